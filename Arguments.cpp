@@ -129,6 +129,16 @@ bool ArgumentContainer::parse(int argc, char *argv[]){
 	return false;
 }
 
+bool ArgumentContainer::override(const string& name, const string& value){
+	map<string, ArgumentBase*>::const_iterator it = _options.find(name);
+	if (it == _options.end()){
+		cerr << "Invalid option " << name << endl;
+		return true;
+	}
+	it->second->parseValue(value);
+	return false;
+}
+
 void ArgumentContainer::usage(ostream& out) const{
 	out << "Usage: " << _progName << " [OPTIONS]";
 	for (map<int, ArgumentBase*>::const_iterator it = _args.begin(); it != _args.end(); it++){
@@ -121,7 +121,12 @@ Bank::Bank(
 	uint64 openLatencyArg,
 	uint64 closeLatencyArg,
 	uint64 accessLatencyArg,
-	bool longCloseLatencyArg) :
+	bool longCloseLatencyArg,
+	unsigned writeHighWatermarkArg,
+	unsigned writeLowWatermarkArg,
+	bool writePausingArg,
+	bool writeCancellationArg,
+	unsigned writeCancelThresholdArg) :
 		name(nameArg),
 		desc(descArg),
 		engine(engineArg),
@@ -142,10 +147,25 @@ Bank::Bank(
 		closeLatency(closeLatencyArg),
 		accessLatency(accessLatencyArg),
 		longCloseLatency(longCloseLatencyArg),
+		writeHighWatermark(writeHighWatermarkArg),
+		writeLowWatermark(writeLowWatermarkArg),
+		writePausing(writePausingArg),
+		writeCancellation(writeCancellationArg),
+		writeCancelThreshold(writeCancelThresholdArg),
 		state(CLOSED),
 		row(0),
 		currentRequestValid(false),
 		nextPipelineEvent(0),
+		writeQueueSize(0),
+		draining(false),
+		drainStartTimestamp(0),
+		writeBackColumns(0),
+		writeBackColumnsDone(0),
+		writeBackPreemptible(false),
+		writeBackStartTimestamp(0),
+		writeBackEventTimestamp(0),
+		pausedColumns(0),
+		pauseStartTimestamp(0),
 		queueTime(statCont, nameArg + "_queue_time", "Number of cycles requests for " + descArg + " spend in the queue", 0),
 		openTime(statCont, nameArg + "_open_time", "Number of cycles " + descArg + " spends opening rows for requests", 0),
 		accessTime(statCont, nameArg + "_access_time", "Number of cycles " + descArg + " spends accessing rows for requests", 0),
@@ -170,7 +190,22 @@ Bank::Bank(
 
 		waitLowerPriorityTime(statCont, nameArg + "_wait_lower_priority_time", "Number of cycles " + descArg + " requests wait for lower priority requests", 0),
 		waitSamePriorityTime(statCont, nameArg + "_wait_same_priority_time", "Number of cycles " + descArg + " requests wait for same priority requests", 0),
-		waitHigherPriorityTime(statCont, nameArg + "_wait_higher_priority_time", "Number of cycles " + descArg + " requests wait for higher priority requests", 0){
+		waitHigherPriorityTime(statCont, nameArg + "_wait_higher_priority_time", "Number of cycles " + descArg + " requests wait for higher priority requests", 0),
+
+		readWaitWriteTime(statCont, nameArg + "_read_wait_write_time", "Number of cycles " + descArg + " read requests wait for write requests", 0),
+		numWriteDrains(statCont, nameArg + "_num_write_drains", "Number of " + descArg + " write queue drains", 0),
+		writeDrainTime(statCont, nameArg + "_write_drain_time", "Number of cycles " + descArg + " spends draining the write queue", 0),
+		numWriteForwards(statCont, nameArg + "_num_write_forwards", "Number of " + descArg + " read requests forwarded from the write queue", 0),
+
+		numWritePauses(statCont, nameArg + "_num_write_pauses", "Number of " + descArg + " write backs paused by reads", 0),
+		numWriteCancellations(statCont, nameArg + "_num_write_cancellations", "Number of " + descArg + " write backs cancelled by reads", 0),
+		numWriteDeferrals(statCont, nameArg + "_num_write_deferrals", "Number of " + descArg + " write backs deferred by reads before writing any column", 0),
+		writePausedTime(statCont, nameArg + "_write_paused_time", "Number of cycles " + descArg + " write backs spend paused or cancelled", 0),
+		writeCancelledTime(statCont, nameArg + "_write_cancelled_time", "Number of cycles of " + descArg + " write backs lost to cancellations", 0){
+
+	if (writeHighWatermark != 0 && writeLowWatermark >= writeHighWatermark){
+		error("Write low watermark (%u) must be smaller than write high watermark (%u)", writeLowWatermark, writeHighWatermark);
+	}
 
 	//debugStart = 120000000;
 	//debugStart = 0;
@@ -182,7 +217,21 @@ bool Bank::access(MemoryRequest *request, IMemoryCallback *caller){
 	debug("(%p, %lu, %u, %s, %s, %d, %s)", request, request->addr, request->size, request->read?"read":"write", request->instr?"instr":"data", request->priority, caller->getName());
 
 	bool found = false;
-	for (Queue::iterator it = queue.begin(); it != queue.end(); it++){
+	if (request->read && writeHighWatermark != 0){
+		//forward from the write queue (latest write to the same block wins)
+		for (Queue::iterator it = writeQueue.begin(); it != writeQueue.end() && !found; it++){
+			for (RequestList::iterator itReq = it->second.begin(); itReq != it->second.end(); itReq++){
+				if (request->addr == itReq->request->addr){
+					numRAWs++;
+					numWriteForwards++;
+					notify(request);
+					found = true;
+					break;
+				}
+			}
+		}
+	}
+	for (Queue::iterator it = queue.begin(); it != queue.end() && !found; it++){
 		for (RequestList::iterator itReq = it->second.begin(); itReq != it->second.end(); itReq++){
 			if (request->addr == itReq->request->addr){
 				if (request->read && itReq->request->read){
@@ -201,12 +250,18 @@ bool Bank::access(MemoryRequest *request, IMemoryCallback *caller){
 				}
 			}
 		}
-		if (found){
-			break;
+	}
+	if (!request->read && writeHighWatermark != 0){
+		for (Queue::iterator it = writeQueue.begin(); it != writeQueue.end(); it++){
+			for (RequestList::iterator itReq = it->second.begin(); itReq != it->second.end(); itReq++){
+				if (request->addr == itReq->request->addr){
+					numWAWs++;
+				}
+			}
 		}
 	}
 	if (!found){
-		if ((state == CLOSED || state == OPEN_CLEAN || state == OPEN_DIRTY) && !currentRequestValid && queue.empty()){
+		if ((state == CLOSED || state == OPEN_CLEAN || state == OPEN_DIRTY) && !currentRequestValid && queuesEmpty()){
 			addEvent(0, BANK);
 
 		}
@@ -219,6 +274,9 @@ bool Bank::access(MemoryRequest *request, IMemoryCallback *caller){
 			} else {
 				reqTime.waitingOnSamePriority = true;
 			}
+			if (request->read && !currentRequest.request->read){
+				reqTime.waitingOnWrite = true;
+			}
 		}
 		if ((state == OPEN_CLEAN || state == OPEN_DIRTY) && currentRequestValid && row == mapping->getRowIndex(request->addr) && nextPipelineEvent < timestamp){
 			nextPipelineEvent = timestamp;
@@ -226,12 +284,20 @@ bool Bank::access(MemoryRequest *request, IMemoryCallback *caller){
 			debug(": \tadded PIPELINE event for %lu", nextPipelineEvent);
 
 		}
-		if (state == CLOSING && !currentRequestValid && queue.empty()){
+		if (state == CLOSING && !currentRequestValid && queuesEmpty()){
 			request->counters[closeCounterIndex] = timestamp;
 		}
-		queue[request->priority].emplace_back(reqTime);
+		if (!request->read && writeHighWatermark != 0){
+			writeQueue[request->priority].emplace_back(reqTime);
+			writeQueueSize++;
+		} else {
+			queue[request->priority].emplace_back(reqTime);
+		}
 		request->counters[queueCounterIndex] = timestamp;
 
+		if (request->read && state == CLOSING && writeBackColumns != 0 && writeBackPreemptible && writeCancellation && writeBackColumnsDone * 100 < writeCancelThreshold * writeBackColumns && isReadPending()){
+			cancelWriteBack();
+		}
 	}
 	return true;
 }
@@ -371,15 +437,9 @@ void Bank::changeState(){
 					numAccesses++;
 				} else {
 					state = CLOSING;
-					uint64 latency;
-					if (longCloseLatency){
-						latency = closeLatency * dirtyColumns.count();
-					} else {
-						latency = closeLatency;
-					}
+					uint64 latency = startWriteBack(dirtyColumns.count());
 					debug(": close latency: %lu", latency);
 					dirtyColumns.reset();
-					addEvent(latency, BANK);
 					closeTime += latency;
 					numCloses++;
 					currentRequest.request->counters[closeCounterIndex] = timestamp;
@@ -389,15 +449,9 @@ void Bank::changeState(){
 
 				} else if (policy == CLOSED_PAGE){
 					state = CLOSING;
-					uint64 latency;
-					if (longCloseLatency){
-						latency = closeLatency * dirtyColumns.count();
-					} else {
-						latency = closeLatency;
-					}
+					uint64 latency = startWriteBack(dirtyColumns.count());
 					dirtyColumns.reset();
 					debug(": close latency: %lu", latency);
-					addEvent(latency, BANK);
 					numCloses++;
 				} else {
 					error("Invalid row buffer policy");
@@ -448,6 +502,18 @@ void Bank::changeState(){
 	} else {
 		error("Wrong bank state");
 	}
+
+	if (pausedColumns != 0 && !currentRequestValid && pipelineRequests.empty() && (state == CLOSED || state == OPEN_CLEAN)){
+		//bank is idle: resume the paused write back
+		debug(": resuming write back of %u columns", pausedColumns);
+		state = CLOSING;
+		closeTime += startWriteBack(0);
+	}
+}
+
+const char* Bank::getEventName(const Event *event) const {
+	static const char *names[] = {"QUEUE", "BANK", "PIPELINE"};
+	return names[event->getData()];
 }
 
 void Bank::process(const Event *event) {
@@ -455,6 +521,17 @@ void Bank::process(const Event *event) {
 	EventType eventType = static_cast<EventType>(event->getData());
 	debug("(%d): state: %d", eventType, state);
 	if (eventType == BANK){
+		multiset<uint64>::iterator itCancelled = cancelledEvents.find(timestamp);
+		if (itCancelled != cancelledEvents.end()){
+			//event of a cancelled write back
+			cancelledEvents.erase(itCancelled);
+			return;
+		}
+		if (state == CLOSING && writeBackColumns != 0){
+			if (!continueWriteBack()){
+				return;
+			}
+		}
 		if (state == CLOSED || state == CLOSING){
 			changeState();
 		} else if (state == OPENING) {
@@ -490,8 +567,9 @@ void Bank::process(const Event *event) {
 			} else {
 				prevRequest = pipelineRequests.back();
 			}
-			Queue::iterator itQueue = queue.lower_bound(0);
-			if (itQueue != queue.end()){
+			Queue *q = selectQueue();
+			Queue::iterator itQueue = q->lower_bound(0);
+			if (itQueue != q->end()){
 				for (list<RequestAndTime>::iterator it = itQueue->second.begin(); it != itQueue->second.end(); it++){
 					if (mapping->getRowIndex(it->request->addr) == row){
 						if (prevRequest.request->read == it->request->read){
@@ -499,7 +577,7 @@ void Bank::process(const Event *event) {
 							pipelineRequests.emplace_back(*it);
 							itQueue->second.erase(it);
 							if (itQueue->second.empty()){
-								queue.erase(itQueue);
+								q->erase(itQueue);
 							}
 							found = true;
 							rowBufferHits++;
@@ -517,7 +595,7 @@ void Bank::process(const Event *event) {
 				}
 				if (!found){
 					if (firstReadyAcrossPriorities){
-						for (Queue::iterator itQueueAll = queue.begin(); itQueueAll != queue.end(); itQueueAll++){
+						for (Queue::iterator itQueueAll = q->begin(); itQueueAll != q->end(); itQueueAll++){
 							if (itQueueAll != itQueue){
 								for (list<RequestAndTime>::iterator it = itQueueAll->second.begin(); it != itQueueAll->second.end(); it++){
 									if (mapping->getRowIndex(it->request->addr) == row){
@@ -525,7 +603,7 @@ void Bank::process(const Event *event) {
 											pipelineRequests.emplace_back(*it);
 											itQueueAll->second.erase(it);
 											if (itQueueAll->second.empty()){
-												queue.erase(itQueueAll);
+												q->erase(itQueueAll);
 											}
 											found = true;
 											rowBufferHits++;
@@ -546,6 +624,9 @@ void Bank::process(const Event *event) {
 				}
 				if (found){
 					myassert(row ==  mapping->getRowIndex(pipelineRequests.back().request->addr));
+					if (q == &writeQueue){
+						writeQueueSize--;
+					}
 					if (pipelineRequests.back().request->read){
 							uint64 actualBusDelay = bus->schedule(accessLatency, this);
 							nextPipelineEvent = timestamp + actualBusDelay - accessLatency + bus->getLatency();
@@ -593,6 +674,23 @@ void Bank::transferCompleted(){
 	}
 }
 
+/*
+ * Only the row buffer is saved. A row that is being opened or closed is saved as closed, since the
+ * requests waiting for it are not part of the checkpoint.
+ */
+void Bank::saveCheckpoint(CheckpointWriter *writer) const {
+	bool open = state == OPEN_CLEAN || state == OPEN_DIRTY;
+	writer->write(open ? state : CLOSED);
+	writer->write(row);
+	writer->write(open ? dirtyColumns.to_ullong() : 0ULL);
+}
+
+void Bank::restoreCheckpoint(CheckpointReader *reader){
+	reader->read(&state);
+	reader->read(&row);
+	dirtyColumns = bitset<64>(reader->read<unsigned long long>());
+}
+
 /*
  * Assumes current request is not valid
  */
@@ -600,24 +698,31 @@ void Bank::selectNextRequest(){
 	uint64 timestamp = engine->getTimestamp();
 	debug("()");
 	myassert (!currentRequestValid);
-	for (Queue::iterator itQueue = queue.begin(); itQueue != queue.end(); itQueue++){
-		for (list<RequestAndTime>::iterator it = itQueue->second.begin(); it != itQueue->second.end(); it++){
-			if (it->waitingOnLowerPriority){
-				waitLowerPriorityTime += timestamp - it->startWaitingTimestamp;
-			}
-			if (it->waitingOnSamePriority){
-				waitSamePriorityTime += timestamp - it->startWaitingTimestamp;
-			}
-			if (it->waitingOnHigherPriority){
-				waitHigherPriorityTime += timestamp - it->startWaitingTimestamp;
+	Queue *queues[] = {&queue, &writeQueue};
+	for (Queue *qAll : queues){
+		for (Queue::iterator itQueue = qAll->begin(); itQueue != qAll->end(); itQueue++){
+			for (list<RequestAndTime>::iterator it = itQueue->second.begin(); it != itQueue->second.end(); it++){
+				if (it->waitingOnLowerPriority){
+					waitLowerPriorityTime += timestamp - it->startWaitingTimestamp;
+				}
+				if (it->waitingOnSamePriority){
+					waitSamePriorityTime += timestamp - it->startWaitingTimestamp;
+				}
+				if (it->waitingOnHigherPriority){
+					waitHigherPriorityTime += timestamp - it->startWaitingTimestamp;
+				}
+				if (it->waitingOnWrite){
+					readWaitWriteTime += timestamp - it->startWaitingTimestamp;
+				}
+				it->waitingOnSamePriority = it->waitingOnHigherPriority = it->waitingOnLowerPriority = it->waitingOnWrite = false;
 			}
-			it->waitingOnSamePriority = it->waitingOnHigherPriority = it->waitingOnLowerPriority = false;
 		}
 	}
 
-	if(!queue.empty()) {
-		Queue::iterator itQueue = queue.lower_bound(0);
-		myassert(itQueue != queue.end());
+	Queue *q = selectQueue();
+	if(!q->empty()) {
+		Queue::iterator itQueue = q->lower_bound(0);
+		myassert(itQueue != q->end());
 		if (state == CLOSED || state == CLOSING){
 			currentRequest = itQueue->second.front();
 			itQueue->second.pop_front();
@@ -637,14 +742,14 @@ void Bank::selectNextRequest(){
 			}
 			if (!found){
 				if (firstReadyAcrossPriorities){
-					for (Queue::iterator itQueueAll = queue.begin(); itQueueAll != queue.end(); itQueueAll++){
+					for (Queue::iterator itQueueAll = q->begin(); itQueueAll != q->end(); itQueueAll++){
 						if (itQueueAll != itQueue){
 							for (list<RequestAndTime>::iterator it = itQueueAll->second.begin(); it != itQueueAll->second.end(); it++){
 								if (mapping->getRowIndex(it->request->addr) == row){
 									currentRequest = *it;
 									itQueueAll->second.erase(it);
 									if (itQueueAll->second.empty()){
-										queue.erase(itQueueAll);
+										q->erase(itQueueAll);
 									}
 									found = true;
 									rowBufferHits++;
@@ -665,19 +770,27 @@ void Bank::selectNextRequest(){
 			error("Invalid bank state");
 		}
 		if (itQueue->second.empty()){
-			queue.erase(itQueue);
+			q->erase(itQueue);
+		}
+		if (q == &writeQueue){
+			writeQueueSize--;
 		}
 
-		for (Queue::iterator itQueueAll = queue.begin(); itQueueAll != queue.end(); itQueueAll++){
-			for (list<RequestAndTime>::iterator it = itQueueAll->second.begin(); it != itQueueAll->second.end(); it++){
-				if (currentRequest.request->priority < it->request->priority){
-					it->waitingOnHigherPriority = true;
-				} else if (currentRequest.request->priority > it->request->priority){
-					it->waitingOnLowerPriority = true;
-				} else {
-					it->waitingOnSamePriority = true;
+		for (Queue *qAll : queues){
+			for (Queue::iterator itQueueAll = qAll->begin(); itQueueAll != qAll->end(); itQueueAll++){
+				for (list<RequestAndTime>::iterator it = itQueueAll->second.begin(); it != itQueueAll->second.end(); it++){
+					if (currentRequest.request->priority < it->request->priority){
+						it->waitingOnHigherPriority = true;
+					} else if (currentRequest.request->priority > it->request->priority){
+						it->waitingOnLowerPriority = true;
+					} else {
+						it->waitingOnSamePriority = true;
+					}
+					if (it->request->read && !currentRequest.request->read){
+						it->waitingOnWrite = true;
+					}
+					it->startWaitingTimestamp = timestamp;
 				}
-				it->startWaitingTimestamp = timestamp;
 			}
 		}
 
@@ -694,6 +807,143 @@ void Bank::selectNextRequest(){
 	}
 }
 
+/*
+ * Chooses the queue the next request is taken from. Reads have priority over
+ * writes unless the write queue has reached the high watermark, in which case
+ * writes are drained until the low watermark is reached.
+ */
+Bank::Queue* Bank::selectQueue(){
+	uint64 timestamp = engine->getTimestamp();
+	if (writeHighWatermark == 0){
+		return &queue;
+	}
+	bool drain = drainsWrites();
+	if (draining && !drain){
+		writeDrainTime += timestamp - drainStartTimestamp;
+		debug(": stop draining: %u writes", writeQueueSize);
+	} else if (!draining && drain){
+		drainStartTimestamp = timestamp;
+		numWriteDrains++;
+		debug(": start draining: %u writes", writeQueueSize);
+	}
+	draining = drain;
+	if (draining || queue.empty()){
+		return &writeQueue;
+	} else {
+		return &queue;
+	}
+}
+
+/*
+ * Returns whether the write queue is drained when the next request is selected,
+ * without starting or stopping the drain
+ */
+bool Bank::drainsWrites() const {
+	if (draining){
+		return writeQueueSize > writeLowWatermark;
+	} else {
+		return writeQueueSize >= writeHighWatermark;
+	}
+}
+
+/*
+ * Starts writing back numColumns dirty columns of the open row plus the columns
+ * of a paused write back, if any. Returns the latency of the write back.
+ *
+ * With write pausing or cancellation, a write back is performed one column at a
+ * time so that a high priority read can preempt it at column boundaries
+ * (pausing) or at any time before writeCancelThreshold percent of it is done
+ * (cancellation). A preempted write back is resumed when the bank becomes idle
+ * or merged with the next write back, which cannot be preempted again.
+ */
+uint64 Bank::startWriteBack(unsigned numColumns){
+	uint64 timestamp = engine->getTimestamp();
+	if (!longCloseLatency){
+		addEvent(closeLatency, BANK);
+		return closeLatency;
+	}
+	unsigned totalColumns = numColumns + pausedColumns;
+	uint64 latency = closeLatency * totalColumns;
+	writeBackPreemptible = (pausedColumns == 0) && (writePausing || writeCancellation);
+	if (pausedColumns != 0){
+		writePausedTime += timestamp - pauseStartTimestamp;
+		pausedColumns = 0;
+	}
+	if (!writeBackPreemptible){
+		addEvent(latency, BANK);
+		return latency;
+	}
+	if (writeCancellation && isReadPending()){
+		//cancel before any column is written
+		debug(": write back of %u columns deferred", totalColumns);
+		pausedColumns = totalColumns;
+		pauseStartTimestamp = timestamp;
+		numWriteDeferrals++;
+		addEvent(0, BANK);
+		return 0;
+	}
+	writeBackColumns = totalColumns;
+	writeBackColumnsDone = 0;
+	writeBackStartTimestamp = timestamp;
+	writeBackEventTimestamp = timestamp + closeLatency;
+	addEvent(closeLatency, BANK);
+	return latency;
+}
+
+/*
+ * Called when a column write of a preemptible write back finishes. Returns true
+ * if the close operation is done (because the write back finished or was paused).
+ */
+bool Bank::continueWriteBack(){
+	uint64 timestamp = engine->getTimestamp();
+	writeBackColumnsDone++;
+	if (writeBackColumnsDone == writeBackColumns){
+		writeBackColumns = 0;
+		return true;
+	}
+	if (writePausing && isReadPending()){
+		pausedColumns = writeBackColumns - writeBackColumnsDone;
+		pauseStartTimestamp = timestamp;
+		writeBackColumns = 0;
+		numWritePauses++;
+		debug(": write back paused with %u columns left", pausedColumns);
+		return true;
+	}
+	writeBackEventTimestamp = timestamp + closeLatency;
+	addEvent(closeLatency, BANK);
+	return false;
+}
+
+/*
+ * Cancels the ongoing write back. All its columns have to be written again.
+ */
+void Bank::cancelWriteBack(){
+	uint64 timestamp = engine->getTimestamp();
+	myassert(state == CLOSING && writeBackColumns != 0);
+	debug(": write back cancelled after %u of %u columns", writeBackColumnsDone, writeBackColumns);
+	cancelledEvents.insert(writeBackEventTimestamp);
+	writeCancelledTime += timestamp - writeBackStartTimestamp;
+	pausedColumns = writeBackColumns;
+	pauseStartTimestamp = timestamp;
+	writeBackColumns = 0;
+	numWriteCancellations++;
+	addEvent(0, BANK);
+}
+
+/*
+ * Returns whether the next request the bank would serve is a high priority read
+ */
+bool Bank::isReadPending() const {
+	if (currentRequestValid){
+		return currentRequest.request->read && currentRequest.request->priority == HIGH;
+	}
+	const Queue *q = &queue;
+	if (writeHighWatermark != 0 && (drainsWrites() || queue.empty())){
+		q = &writeQueue;
+	}
+	return !q->empty() && q->begin()->first == HIGH && q->begin()->second.front().request->read;
+}
+
 void Bank::notify(MemoryRequest * request) {
 	myassert(request->read);
 	if (notifications.size() == 0){
@@ -103,6 +103,8 @@ OOOCPU::OOOCPU(Engine *engineArg,
 	fetchEntry = new unsigned[issueWidth];
 	numFetchEntries = 0;
 
+	fetchStopped = false;
+
 	eventScheduled[0] = false;
 	eventScheduled[1] = false;
 	resumed[0] = false;
@@ -117,13 +119,30 @@ OOOCPU::OOOCPU(Engine *engineArg,
 }
 
 void OOOCPU::start(){
-	nextEntryValid = readNextEntry();
+	if (!restored){
+		nextEntryValid = readNextEntry();
+	}
 	if (nextEntryValid){
 		currentTraceTimestamp = firstEntry.timestamp;
 		scheduleEvent();
 	}
 }
 
+void OOOCPU::saveCheckpoint(CheckpointWriter *writer){
+	CPU::saveCheckpoint(writer);
+	writer->write(nextEntryValid);
+}
+
+void OOOCPU::restoreCheckpoint(CheckpointReader *checkpoint){
+	CPU::restoreCheckpoint(checkpoint);
+	checkpoint->read(&nextEntryValid);
+}
+
+const char* OOOCPU::getEventName(const Event *event) const {
+	static const char *names[] = {"PROCESS", "DRAIN"};
+	return names[event->getData()];
+}
+
 void OOOCPU::process(const Event * event){
 	uint64 timestamp = engine->getTimestamp();
 	EventType type = static_cast<EventType>(event->getData());
@@ -221,6 +240,56 @@ void OOOCPU::drain(addrint page, IDrainCallback *caller){
 	}
 }
 
+void OOOCPU::stopFetching(){
+	fetchStopped = true;
+}
+
+void OOOCPU::startFetching(){
+	fetchStopped = false;
+	if (nextEntryValid){
+		scheduleEvent();
+	}
+}
+
+bool OOOCPU::isDrained() const {
+	return robHead == robTail && !robFull && instrPausers.empty() && dataPausers.empty() && stalledInstrRequests.empty() && stalledDataRequests.empty() && drainRequests.empty();
+}
+
+bool OOOCPU::isFinished() const {
+	return !nextEntryValid && isDrained();
+}
+
+/*
+ * Executes instructions functionally: the addresses are translated and the caches are warmed, but
+ * no time passes. The pipeline must be drained.
+ */
+uint64 OOOCPU::fastForward(uint64 instructions){
+	myassert(isDrained());
+	if (!nextEntryValid){
+		return 0;
+	}
+	uint64 start = numInstr;
+	while (nextEntryValid && numInstr - start < instructions){
+		addrint physicalAddr;
+		if (manager->access(pid, firstEntry.address, firstEntry.read, firstEntry.instr, &physicalAddr, this)){
+			error("%s accessed a page under migration while fast-forwarding", name.c_str());
+		}
+		if (firstEntry.instr){
+			instrCache->warm(physicalAddr, true, true);
+		} else {
+			dataCache->warm(physicalAddr, firstEntry.read, false);
+		}
+		nextEntryValid = readNextEntry();
+	}
+	if (nextEntryValid){
+		currentTraceTimestamp = firstEntry.timestamp;
+	} else {
+		//the last entry is never committed
+		manager->finish(coreId);
+	}
+	return numInstr - start;
+}
+
 void OOOCPU::resumePrivate(){
 	uint64 timestamp = engine->getTimestamp();
 	myassert(!instrPausers.empty() || !dataPausers.empty());
@@ -273,9 +342,8 @@ void OOOCPU::resumePrivate(){
 						rob[*stallIt].dataReqs[i]->addr = physicalAddr;
 						rob[*stallIt].dataPause[i] = false;
 						if (rob[*stallIt].dataReqs[i]->read){
-							//bool ins = lsq.emplace((rob[*stallIt].dataReqs[i], QueueMapEntry(*stallIt, i)).second;
-							bool ins = lsq.emplace(rob[*stallIt].dataReqs[i], *stallIt).second;
-							myassert(ins);
+							myassert(rob[*stallIt].dataReqs[i]->canPushFrame());
+							rob[*stallIt].dataReqs[i]->pushFrame(this, this, physicalAddr, timestamp, *stallIt, i);
 						}
 						rob[*stallIt].dataReqs[i]->counters[CPU_PAUSE] = timestamp - rob[*stallIt].dataReqs[i]->counters[CPU_PAUSE];
 						debug(":\tcalling 1 dataCache.access(%p, %lu)", rob[*stallIt].dataReqs[i], physicalAddr);
@@ -415,9 +483,8 @@ void OOOCPU::processInstr(uint64 index){
 						req->addr = physicalAddr;
 						robPtr->dataPause[i] = false;
 						if (req->read){
-							//bool ins = lsq.emplace((req, QueueMapEntry(entry, i)).second;
-							bool ins = lsq.emplace(req, entry).second;
-							myassert(ins);
+							myassert(req->canPushFrame());
+							req->pushFrame(this, this, physicalAddr, timestamp, entry, i);
 						}
 						debug(":\tcalling 2 dataCache.access(%p, %lu)", req, physicalAddr);
 						if (!stalledDataRequests.empty() || !dataCache->access(req, this)){
@@ -450,36 +517,20 @@ void OOOCPU::processData(uint64 index){
 	uint64 timestamp = engine->getTimestamp();
 	for (vector<MemoryRequest *>::iterator oit = dataMsg[index].begin(); oit != dataMsg[index].end(); ++oit){
 		debug(":\tdata message: %p", *oit);
-		QueueMap::iterator it = lsq.find(*oit);
-		if (it != lsq.end()){
-			RobEntry *robPtr = &rob[it->second];
-			myassert(robPtr->state == DATA);
-			bool found = false;
-			for (unsigned i = 0; i < robPtr->numData; i++){
-				MemoryRequest *req = robPtr->dataReqs[i];
-				if (*oit == req){
-					found = true;
-					req->counters[TOTAL] = timestamp - 1 - req->counters[TOTAL];
-//					if (!req->checkCounters()){
-//						cout << timestamp << ": " << req << ", " << req->addr << endl;
-//						req->printCounters();
-//
-//					}
-//					myassert(req->checkCounters());
-					countData(req);
-					delete req;
-					robPtr->numDataLeft--;
-					break;
-				}
-			}
-			myassert(found);
-			if (robPtr->numDataLeft == 0){
-				robPtr->state = DONE;
-				debug(":\trob[%u].state = DONE", it->second);
-			}
-			lsq.erase(it);
-		} else {
-			myassert(false);
+		myassert((*oit)->hasFrame(this));
+		CallbackFrame frame = (*oit)->popFrame(this);
+		unsigned entry = frame.data[0];
+		RobEntry *robPtr = &rob[entry];
+		myassert(robPtr->state == DATA);
+		MemoryRequest *req = robPtr->dataReqs[frame.data[1]];
+		myassert(*oit == req);
+		req->counters[TOTAL] = timestamp - 1 - req->counters[TOTAL];
+		countData(req);
+		delete req;
+		robPtr->numDataLeft--;
+		if (robPtr->numDataLeft == 0){
+			robPtr->state = DONE;
+			debug(":\trob[%u].state = DONE", entry);
 		}
 	}
 	dataMsg[index].clear();
@@ -495,7 +546,7 @@ void OOOCPU::fetch(){
 			fetchNext = false;
 		}
 	}
-	if (fetchNext && nextEntryValid && !robFull && instrPausers.empty() && stalledInstrRequests.empty() && stalledDataRequests.empty()){
+	if (fetchNext && nextEntryValid && !fetchStopped && !robFull && instrPausers.empty() && stalledInstrRequests.empty() && stalledDataRequests.empty()){
 		numFetchEntries = 0;
 		nextFetchEntry = 0;
 		while(nextEntryValid && !robFull && numFetchEntries < issueWidth){
@@ -609,7 +660,7 @@ void OOOCPU::commit(){
 //			usedEntries = 0;
 //		}
 //	}
-//	cout << timestamp << ": commit: used rob entries: " << usedEntries << " lsq size: " << lsq.size() << endl;
+//	cout << timestamp << ": commit: used rob entries: " << usedEntries << endl;
 }
 
 void OOOCPU::scheduleEvent(){
@@ -829,6 +880,38 @@ CPU::CPU(Engine *engineArg,
 
 	secondEntryValid = false;
 
+	restored = false;
+}
+
+/*
+ * The position in the trace is the number of entries read from it. Entries that were already
+ * fetched into the pipeline when the checkpoint was taken are not executed after restoring it.
+ */
+void CPU::saveCheckpoint(CheckpointWriter *writer){
+	writer->write(reader->numInstr + reader->numReads + reader->numWrites);
+	writer->write(numInstr);
+	writer->write(firstEntry);
+	writer->write(secondEntry);
+	writer->write(secondEntryValid);
+}
+
+void CPU::restoreCheckpoint(CheckpointReader *checkpoint){
+	uint64 position = checkpoint->read<uint64>();
+	uint64 current = reader->numInstr + reader->numReads + reader->numWrites;
+	if (current > position){
+		error("Trace of %s is already past the checkpoint", name.c_str());
+	}
+	TraceEntry entry;
+	for (; current < position; current++){
+		if (!reader->readEntry(&entry)){
+			error("Trace of %s is shorter than in the checkpoint", name.c_str());
+		}
+	}
+	checkpoint->read(&numInstr);
+	checkpoint->read(&firstEntry);
+	checkpoint->read(&secondEntry);
+	checkpoint->read(&secondEntryValid);
+	restored = true;
 }
 
 bool CPU::readNextEntry(){
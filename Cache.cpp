@@ -56,6 +56,15 @@ int Set::access(addrint tag, uint64 timestamp, bool read){
 	return -1;
 }
 
+bool Set::contains(addrint tag) const {
+	for (unsigned i = 0; i < numBlocks; i++){
+		if (blocks[i].valid && blocks[i].tag == tag){
+			return true;
+		}
+	}
+	return false;
+}
+
 Set::Result Set::allocate(addrint tag, uint64 timestamp, bool read, CacheReplacementPolicy policy, addrint *tagEvicted, int *block){
 	unsigned int i;
 	int victim;
@@ -169,6 +178,37 @@ void Set::makeDirty(addrint tag){
 	warn("Trying to make dirty a block that was not present");
 }
 
+bool Set::getValidTag(unsigned block, addrint *tag) const {
+	*tag = blocks[block].tag;
+	return blocks[block].valid;
+}
+
+void Set::saveCheckpoint(CheckpointWriter *writer) const {
+	writer->write(numBlocks);
+	for (unsigned i = 0; i < numBlocks; i++){
+		writer->write(blocks[i].valid);
+		if (blocks[i].valid){
+			writer->write(blocks[i].tag);
+			writer->write(blocks[i].timestamp);
+			writer->write(blocks[i].clean);
+		}
+	}
+}
+
+void Set::restoreCheckpoint(CheckpointReader *reader){
+	if (reader->read<unsigned>() != numBlocks){
+		error("Checkpoint has a different cache associativity");
+	}
+	for (unsigned i = 0; i < numBlocks; i++){
+		reader->read(&blocks[i].valid);
+		if (blocks[i].valid){
+			reader->read(&blocks[i].tag);
+			reader->read(&blocks[i].timestamp);
+			reader->read(&blocks[i].clean);
+		}
+	}
+}
+
 
 
 CacheModel::CacheModel(const string& nameArg, const string& descArg, StatContainer *statCont, uint64 cacheSizeArg, unsigned blockSizeArg, unsigned setAssocArg, CacheReplacementPolicy policyArg, unsigned pageSizeArg) :
@@ -187,6 +227,9 @@ CacheModel::CacheModel(const string& nameArg, const string& descArg, StatContain
 	instrLoadHits (statCont, nameArg + "_instr_load_hits", "Number of " + descArg + " instruction load hits", 0),
 	instrLoadMisses (statCont, nameArg + "_instr_load_misses", "Number of " + descArg + " instruction load misses", 0),
 
+	prefetchHits (statCont, nameArg + "_prefetch_hits", "Number of " + descArg + " prefetch hits", 0),
+	prefetchMisses (statCont, nameArg + "_prefetch_misses", "Number of " + descArg + " prefetch misses", 0),
+
 	flushesWithoutEviction (statCont, nameArg + "_flushes_without_eviction", "Number of " + descArg + " flushes without eviction", 0),
 	flushesWithEviction (statCont, nameArg + "_flushes_with_eviction", "Number of " + descArg + " flushes with eviction", 0),
 	flushesWithWriteback (statCont, nameArg + "_flushes_with_writeback", "Number of " + descArg + " flushes with writeback", 0),
@@ -249,6 +292,11 @@ CacheModel::CacheModel(const string& nameArg, const string& descArg, StatContain
 		pageIndexMask |= (addrint)1U << i;
 	}
 
+	if (pageSize < blockSize){
+		error("The page size (%u bytes) cannot be smaller than the block size (%u bytes)", pageSize, blockSize);
+	}
+	residencyWords = (pageSize / blockSize + 63) / 64;
+
 	timestamp = 0;
 }
 
@@ -256,7 +304,7 @@ CacheModel::~CacheModel(){
 	delete [] sets;
 }
 
-CacheModel::Result CacheModel::access(addrint addr, bool read, bool instr, addrint *evictedAddr, addrint *internalAddr){
+CacheModel::Result CacheModel::access(addrint addr, bool read, bool instr, bool prefetch, addrint *evictedAddr, addrint *internalAddr){
 	//debug2("CacheModel.access(%lu)", addr);
 	assert((addr & msbMask) == 0);
 	addrint actualAddr;
@@ -275,7 +323,9 @@ CacheModel::Result CacheModel::access(addrint addr, bool read, bool instr, addri
 	timestamp++;
 	int block = sets[index].access(tag, timestamp, read);
 	if (block == -1){
-		if (read){
+		if (prefetch){
+			prefetchMisses++;
+		} else if (read){
 			if (instr){
 				instrLoadMisses++;
 			} else {
@@ -289,6 +339,9 @@ CacheModel::Result CacheModel::access(addrint addr, bool read, bool instr, addri
 		if (it != remapTable.end()){
 			it->second.count++;
 		}
+		if (res != Set::INVALID){
+			setResident(addr);
+		}
 		if (res == Set::NO_EVICTION){
 			misses_without_eviction++;
 			ret = MISS_WITHOUT_EVICTION;
@@ -315,6 +368,7 @@ CacheModel::Result CacheModel::access(addrint addr, bool read, bool instr, addri
 //				printf("evictedAddr: %lu\n", *evictedAddr);
 			}
 			assert((*evictedAddr & msbMask) == 0);
+			clearResident(*evictedAddr);
 			if (res == Set::EVICTION){
 				misses_with_eviction++;
 				ret = MISS_WITH_EVICTION;
@@ -330,7 +384,9 @@ CacheModel::Result CacheModel::access(addrint addr, bool read, bool instr, addri
 		}
 	} else {
 		hits++;
-		if (read){
+		if (prefetch){
+			prefetchHits++;
+		} else if (read){
 			if (instr){
 				instrLoadHits++;
 			} else {
@@ -370,8 +426,10 @@ Set::Result CacheModel::flush(addrint addr){
 		flushesWithoutEviction++;
 	} else if (res == Set::EVICTION){
 		flushesWithEviction++;
+		clearResident(addr);
 	} else if (res == Set::WRITEBACK){
 		flushesWithWriteback++;
+		clearResident(addr);
 	} else {
 		assert(false);
 	}
@@ -379,6 +437,15 @@ Set::Result CacheModel::flush(addrint addr){
 }
 
 bool CacheModel::changeTag(addrint oldAddr, addrint newAddr){
+	bool res = changeTagInSet(oldAddr, newAddr);
+	if (res){
+		clearResident(oldAddr);
+		setResident(newAddr);
+	}
+	return res;
+}
+
+bool CacheModel::changeTagInSet(addrint oldAddr, addrint newAddr){
 	//debug2("CacheModel.changeTag(%lu, %lu)", oldAddr, newAddr);
 	addrint oldIndex = getIndex(oldAddr);
 	addrint newIndex = getIndex(newAddr);
@@ -413,7 +480,7 @@ bool CacheModel::remap(addrint oldPage, addrint newPage, AddrList *present, Addr
 		if (oldIndex == newIndex){
 			for (addrint offset = 0; offset < pageSize; offset += blockSize){
 				addrint oldAddr = getPageAddress(oldPage, offset);
-				if (changeTag(oldAddr, getPageAddress(newPage, offset))){
+				if (changeTagInSet(oldAddr, getPageAddress(newPage, offset))){
 					present->push_back(oldAddr);
 				}
 			}
@@ -423,7 +490,7 @@ bool CacheModel::remap(addrint oldPage, addrint newPage, AddrList *present, Addr
 			//printf("oldPageAndBit: %lu\n", oldPageAndBit);
 			for (addrint offset = 0; offset < pageSize; offset += blockSize){
 				addrint oldAddr = getPageAddress(oldPage, offset);
-				if (changeTag(oldAddr, getPageAddress(oldPageAndBit, offset))){
+				if (changeTagInSet(oldAddr, getPageAddress(oldPageAndBit, offset))){
 					present->push_back(oldAddr);
 				}
 			}
@@ -442,7 +509,7 @@ bool CacheModel::remap(addrint oldPage, addrint newPage, AddrList *present, Addr
 		if (prevIndex == newIndex){
 			for (addrint offset = 0; offset < pageSize; offset += blockSize){
 				addrint oldAddr = getPageAddress(it->second.addr, offset);
-				if (changeTag(oldAddr, getPageAddress(newPage, offset))){
+				if (changeTagInSet(oldAddr, getPageAddress(newPage, offset))){
 					present->push_back(oldAddr);
 				}
 			}
@@ -455,7 +522,7 @@ bool CacheModel::remap(addrint oldPage, addrint newPage, AddrList *present, Addr
 			assert((it->second.addr & getPageIndex(msbMask)) != 0);
 			for (addrint offset = 0; offset < pageSize; offset += blockSize){
 				addrint oldAddr = getPageAddress(it->second.addr, offset);
-				if (changeTag(oldAddr, oldAddr)){
+				if (changeTagInSet(oldAddr, oldAddr)){
 					present->push_back(oldAddr);
 				}
 			}
@@ -468,9 +535,117 @@ bool CacheModel::remap(addrint oldPage, addrint newPage, AddrList *present, Addr
 			itInv->second.countPtr = &it->second.count;
 		}
 	}
+	//the blocks now belong to the new page
+	auto rit = residency.find(oldPage);
+	if (rit != residency.end()){
+		assert(residency.count(newPage) == 0);
+		residency.emplace(newPage, rit->second);
+		residency.erase(rit);
+	}
 	return false;
 }
 
+/*
+ * Saves the contents of the cache and the remap table. The inverse remap table is rebuilt from it on restore.
+ */
+void CacheModel::saveCheckpoint(CheckpointWriter *writer) const {
+	writer->write(numSets);
+	writer->write(timestamp);
+	for (uint64 i = 0; i < numSets; i++){
+		sets[i].saveCheckpoint(writer);
+	}
+	writer->write(static_cast<uint64>(remapTable.size()));
+	for (auto it = remapTable.begin(); it != remapTable.end(); ++it){
+		writer->write(it->first);
+		writer->write(it->second.addr);
+		writer->write(it->second.count);
+	}
+}
+
+void CacheModel::restoreCheckpoint(CheckpointReader *reader){
+	if (reader->read<uint64>() != numSets){
+		error("Checkpoint has a different number of cache sets");
+	}
+	reader->read(&timestamp);
+	for (uint64 i = 0; i < numSets; i++){
+		sets[i].restoreCheckpoint(reader);
+	}
+	remapTable.clear();
+	invRemapTable.clear();
+	uint64 remapEntries = reader->read<uint64>();
+	for (uint64 i = 0; i < remapEntries; i++){
+		addrint newPage = reader->read<addrint>();
+		addrint oldPageAndBit = reader->read<addrint>();
+		unsigned count = reader->read<unsigned>();
+		auto it = remapTable.emplace(newPage, RemapTableEntry(oldPageAndBit, count)).first;
+		invRemapTable.emplace(oldPageAndBit, InvRemapTableEntry(newPage, &it->second.count));
+	}
+	rebuildResidency();
+}
+
+void CacheModel::getResidentBlocks(addrint page, AddrList *blocks) const {
+	blocks->clear();
+	auto it = residency.find(page);
+	if (it == residency.end()){
+		return;
+	}
+	for (unsigned w = 0; w < residencyWords; w++){
+		uint64 bits = it->second.blocks[w];
+		while (bits != 0){
+			unsigned bit = __builtin_ctzll(bits);
+			bits &= bits - 1;
+			blocks->push_back(getPageAddress(page, static_cast<addrint>(w * 64 + bit) << offsetWidth));
+		}
+	}
+}
+
+void CacheModel::setResident(addrint addr){
+	PageResidency& page = residency[getPageIndex(addr)];
+	if (page.blocks.empty()){
+		page.blocks.resize(residencyWords, 0);
+		page.count = 0;
+	}
+	addrint block = getPageOffset(addr) >> offsetWidth;
+	uint64 mask = static_cast<uint64>(1) << (block % 64);
+	if ((page.blocks[block / 64] & mask) == 0){
+		page.blocks[block / 64] |= mask;
+		page.count++;
+	}
+}
+
+void CacheModel::clearResident(addrint addr){
+	auto it = residency.find(getPageIndex(addr));
+	if (it == residency.end()){
+		return;
+	}
+	addrint block = getPageOffset(addr) >> offsetWidth;
+	uint64 mask = static_cast<uint64>(1) << (block % 64);
+	if ((it->second.blocks[block / 64] & mask) != 0){
+		it->second.blocks[block / 64] &= ~mask;
+		it->second.count--;
+		if (it->second.count == 0){
+			residency.erase(it);
+		}
+	}
+}
+
+void CacheModel::rebuildResidency(){
+	residency.clear();
+	for (uint64 index = 0; index < numSets; index++){
+		for (unsigned block = 0; block < setAssoc; block++){
+			addrint tag;
+			if (sets[index].getValidTag(block, &tag)){
+				setResident(getInvActualAddress((tag << (indexWidth + offsetWidth)) | (index << offsetWidth)));
+			}
+		}
+	}
+}
+
+bool CacheModel::contains(addrint addr) const {
+	addrint actualAddr = getActualAddress(addr);
+	return sets[getIndex(actualAddr)].contains(getTag(actualAddr));
+}
+
 addrint CacheModel::getActualAddress(addrint addr) const {
 	assert((addr & msbMask) == 0);
 	auto it = remapTable.find(getPageIndex(addr));
@@ -483,6 +658,15 @@ addrint CacheModel::getActualAddress(addrint addr) const {
 	}
 }
 
+addrint CacheModel::getInvActualAddress(addrint addr) const {
+	auto it = invRemapTable.find(getPageIndex(addr));
+	if (it == invRemapTable.end()){
+		return addr;
+	} else {
+		return getPageAddress(it->second.addr, getPageOffset(addr));
+	}
+}
+
 
 Cache::Cache(
 	const string& nameArg,
@@ -514,11 +698,23 @@ Cache::Cache(
 		penalty(penaltyArg),
 		maxQueueSize(maxQueueSizeArg),
 		realRemap(realRemapArg),
+		requests(engineArg, maxQueueSizeArg),
 		queueSize(0),
 		nextStalledCaller(0),
+		lastMshrUpdate(0),
+		prefetcher(0),
 		readAccessTime(statCont, nameArg + "_read_access_time", "Number of cycles of " + descArg + " read requests", 0),
+		mshrAllocations(statCont, nameArg + "_mshr_allocations", "Number of MSHRs allocated by the " + descArg, 0),
+		mshrMerges(statCont, nameArg + "_mshr_merges", "Number of " + descArg + " requests merged into an allocated MSHR", 0),
+		mshrFullStalls(statCont, nameArg + "_mshr_full_stalls", "Number of " + descArg + " requests stalled because the queue was full", 0),
+		mshrPeakOccupancy(statCont, nameArg + "_mshr_peak_occupancy", "Maximum number of MSHRs allocated at the same time in the " + descArg, 0),
+		mshrOccupancyTime(statCont, nameArg + "_mshr_occupancy_time", "Sum over cycles of the number of MSHRs allocated in the " + descArg, 0),
+		mshrBusyTime(statCont, nameArg + "_mshr_busy_time", "Number of cycles with at least one MSHR allocated in the " + descArg, 0),
+		averageMshrOccupancy(statCont, nameArg + "_average_mshr_occupancy", "Average number of MSHRs allocated in the " + descArg + " while busy", &mshrOccupancyTime, &mshrBusyTime),
 		missesFromFlush(statCont, nameArg + "_misses_from_flush", "Number of " + descArg + " misses from flush", 0),
-		writebacksFromFlush(statCont, nameArg + "_writebacks_from_flush", "Number of " + descArg + " writebacks from flush", 0) {
+		writebacksFromFlush(statCont, nameArg + "_writebacks_from_flush", "Number of " + descArg + " writebacks from flush", 0),
+		pageFlushes(statCont, nameArg + "_page_flushes", "Number of " + descArg + " page flushes", 0),
+		pageFlushBlocks(statCont, nameArg + "_page_flush_blocks", "Number of blocks present in the hierarchy flushed by " + descArg + " page flushes", 0) {
 
 	accessTypeMask = 63;
 	myassert(accessTypeMask < cacheModel.getBlockSize());
@@ -530,8 +726,11 @@ bool Cache::access(MemoryRequest *request, IMemoryCallback *caller){
 	debug("(%p, %lu, %u, %s, %s, %d, %s)", request, request->addr, request->size, request->read?"read":"write", request->instr?"instr":"data", request->priority, caller->getName());
 
 	if (DEBUG){
-		for (auto it = requests.begin(); it != requests.end(); ++it){
-			debug(": timestamp: %lu,  it->first: %lu, request: %p, request->addr: %lu, waitingForFlush: %s", it->second.timestamp, it->first, it->second.request, it->second.request->addr, it->second.waitingForFlush?"true":"false");
+		for (unsigned i = 0; i < requests.getNumEntries(); i++){
+			Request *it = requests.getEntry(i);
+			if (it != 0){
+				debug(": timestamp: %lu,  blockAddr: %lu, request: %p, request->addr: %lu, waitingForFlush: %s", it->timestamp, requests.getKey(it), it->request, it->request->addr, it->waitingForFlush?"true":"false");
+			}
 		}
 	}
 
@@ -544,6 +743,7 @@ bool Cache::access(MemoryRequest *request, IMemoryCallback *caller){
 //			stalledCallers.push_back(caller);
 //		}
 		stalledCallers.insert(caller);
+		mshrFullStalls++;
 		debug(": queue full (queueSize == %lu)", queueSize);
 		return false;
 	}
@@ -584,70 +784,114 @@ bool Cache::access(MemoryRequest *request, IMemoryCallback *caller){
 //		} else {
 //			myassert(false);
 //		}
+	} else if (!pageFlushRequests.empty()){
+		//a block that was not in the hierarchy when its page flush started is flushed again after this access brings it in
+		PageFlushRequestMap::iterator pit = pageFlushRequests.find(cacheModel.getPageIndex(blockAddr));
+		if (pit != pageFlushRequests.end()){
+			fit = startFlush(blockAddr, true, 0);
+			fit->second.page = true;
+			fit->second.repeat = true;
+			pit->second.blocksLeft++;
+			pit->second.flushedBlocks++;
+			pageFlushBlocks++;
+		}
 	}
 
-	RequestMap::iterator it = requests.find(blockAddr);
-	auto res = requests.emplace(blockAddr, Request(request));
-	if (res.second){
-		res.first->second.result = cacheModel.access(blockAddr, request->read, request->instr, &res.first->second.evictedAddr, 0);
+	bool miss = false;
+	bool inFlight = false;
+	Request *req = requests.find(blockAddr);
+	if (req == 0){
+		updateMshrOccupancy(timestamp);
+		req = requests.allocate(blockAddr);
+		*req = Request(request);
+		mshrAllocations++;
+		if (requests.size() > mshrPeakOccupancy){
+			mshrPeakOccupancy = requests.size();
+		}
+		req->result = cacheModel.access(blockAddr, request->read, request->instr, request->priority == LOW, &req->evictedAddr, 0);
 		addEvent(penalty, blockAddr, ACCESS);
 		if (!request->read){
-			res.first->second.request->counters[TOTAL] = timestamp - res.first->second.request->counters[TOTAL];
-//			if(!res.first->second.request->checkCounters()){
-//				cout << timestamp << ": " << res.first->second.request << ", " << res.first->second.request->addr << endl;
-//				res.first->second.request->printCounters();
+			req->request->counters[TOTAL] = timestamp - req->request->counters[TOTAL];
+//			if(!req->request->checkCounters()){
+//				cout << timestamp << ": " << req->request << ", " << req->request->addr << endl;
+//				req->request->printCounters();
 //			}
-			//assert(res.first->second.->request->checkCounters());
-			res.first->second.request->resetCounters();
-			res.first->second.request->counters[TOTAL] = timestamp;
+			//assert(req->request->checkCounters());
+			req->request->resetCounters();
+			req->request->counters[TOTAL] = timestamp;
 		}
 		request->counters[tagCounterIndex] = timestamp;
-		debug(": %s, evictedAddr: %lu", res.first->second.result == CacheModel::HIT ? "hit" : (res.first->second.result == CacheModel::MISS_WITHOUT_EVICTION ? "miss without eviction" : (res.first->second.result == CacheModel::MISS_WITH_EVICTION ? "miss with eviction" : (res.first->second.result == CacheModel::MISS_WITH_WRITEBACK ? "miss with writeback" : ("")))), res.first->second.evictedAddr);
+		miss = req->result != CacheModel::HIT;
+		if (prefetcher != 0 && (req->result == CacheModel::MISS_WITH_EVICTION || req->result == CacheModel::MISS_WITH_WRITEBACK)){
+			if (prefetchedBlocks.erase(req->evictedAddr) > 0){
+				prefetcher->prefetchEvicted();
+			}
+		}
+		debug(": %s, evictedAddr: %lu", req->result == CacheModel::HIT ? "hit" : (req->result == CacheModel::MISS_WITHOUT_EVICTION ? "miss without eviction" : (req->result == CacheModel::MISS_WITH_EVICTION ? "miss with eviction" : (req->result == CacheModel::MISS_WITH_WRITEBACK ? "miss with writeback" : ("")))), req->evictedAddr);
 	} else {
-		if (res.first->second.callers.empty()){
-			myassert(!res.first->second.waitingForRead);
-			res.first->second.result = CacheModel::HIT;
+		if (req->callers.empty()){
+			myassert(!req->waitingForRead);
+			req->result = CacheModel::HIT;
 			addEvent(0, blockAddr, ACCESS);
 			debug(": ongoing access after next level access");
-			debug(": waitingForFlush: %s", res.first->second.waitingForFlush?"true":"false");
+			debug(": waitingForFlush: %s", req->waitingForFlush?"true":"false");
 		} else {
+			miss = true;
+			inFlight = true;
 			debug(": ongoing access before next level access");
-			debug(": numCallers: %lu", res.first->second.numCallers);
+			debug(": numCallers: %lu", req->numCallers);
 			if (DEBUG){
-				for (auto i = res.first->second.callers.begin(); i != res.first->second.callers.end(); ++i){
+				for (auto i = req->callers.begin(); i != req->callers.end(); ++i){
 					debug(": caller: %p", i->request);
 				}
 			}
 		}
 		request->counters[waitCounterIndex] = timestamp;
+		mshrMerges++;
 	}
-	res.first->second.numCallers++;
+	req->numCallers++;
 	debug(": emplaced request: %p", request);
-	res.first->second.callers.emplace_back(request->read, request, caller);
+	req->callers.emplace_back(request->read, request, caller);
+
+	if (prefetcher != 0 && caller != this){
+		bool prefetchHit = prefetchedBlocks.erase(blockAddr) > 0;
+		if (prefetchHit){
+			prefetcher->prefetchUsed(inFlight);
+		}
+		if (request->read && request->priority == HIGH){
+			trainPrefetcher(blockAddr, miss, prefetchHit);
+		}
+	}
 	return true;
 }
 
 void Cache::accessCompleted(MemoryRequest *request, IMemory *caller){
 	uint64 timestamp = engine->getTimestamp();
 	debug("(%p, %lu, %s)", request, request->addr, caller->getName());
+	if (caller == this){
+		//prefetch issued by this cache
+		delete request;
+		return;
+	}
 	myassert(caller == nextLevel);
 
 	addrint blockAddr = request->addr;
 
-	RequestMap::iterator it = requests.find(request->addr);
-	myassert(it != requests.end());
+	Request *it = requests.find(request->addr);
+	myassert(it != 0);
 
-	readAccessTime += (timestamp - it->second.timestamp);
+	readAccessTime += (timestamp - it->timestamp);
 
-	it->second.waitingForRead = false;
-	for (CallerList::iterator callerIt = it->second.callers.begin(); callerIt != it->second.callers.end(); callerIt++){
-		if (callerIt->request != it->second.request){
+	it->waitingForRead = false;
+	for (unsigned c = 0; c < it->callers.size(); c++){
+		Caller *callerIt = &it->callers[c];
+		if (callerIt->request != it->request){
 			uint64 waitTime = timestamp - callerIt->request->counters[waitCounterIndex];
 			callerIt->request->counters[waitCounterIndex] = waitTime;
 //			for (int i = COUNTER_INDEX_SIZE - 1; i >= tagCounterIndex; i--){
-//				if (waitTime >= it->second.request->counters[i]){
-//					callerIt->request->counters[i] += it->second.request->counters[i];
-//					waitTime -= it->second.request->counters[i];
+//				if (waitTime >= it->request->counters[i]){
+//					callerIt->request->counters[i] += it->request->counters[i];
+//					waitTime -= it->request->counters[i];
 //				} else {
 //					callerIt->request->counters[i] += waitTime;
 //					break;
@@ -656,7 +900,8 @@ void Cache::accessCompleted(MemoryRequest *request, IMemory *caller){
 //			}
 		}
 	}
-	for (CallerList::iterator callerIt = it->second.callers.begin(); callerIt != it->second.callers.end(); callerIt++){
+	for (unsigned c = 0; c < it->callers.size(); c++){
+		Caller *callerIt = &it->callers[c];
 		if (callerIt->read){
 			callerIt->callback->accessCompleted(callerIt->request, this);
 		} else {
@@ -669,10 +914,10 @@ void Cache::accessCompleted(MemoryRequest *request, IMemory *caller){
 			delete callerIt->request;
 		}
 	}
-	it->second.callers.clear();
+	it->callers.clear();
 
-	if (!it->second.waitingForFlush){
-		if (it->second.repeatFlush){
+	if (!it->waitingForFlush){
+		if (it->repeatFlush){
 			FlushRequestMap::iterator fit = flushRequests.find(blockAddr);
 			myassert(fit != flushRequests.end());
 			myassert(fit->second.repeat);
@@ -703,9 +948,9 @@ void Cache::accessCompleted(MemoryRequest *request, IMemory *caller){
 //				stalledCallers.pop_front();
 //			}
 		}
-		myassert(queueSize >= it->second.numCallers);
-		queueSize -= it->second.numCallers;
-		requests.erase(it);
+		myassert(queueSize >= it->numCallers);
+		queueSize -= it->numCallers;
+		releaseRequest(it);
 	}
 }
 
@@ -715,6 +960,11 @@ void Cache::unstall(IMemory *caller){
 	addEvent(1, 0, UNSTALL);
 }
 
+const char* Cache::getEventName(const Event *event) const {
+	static const char *names[] = {"ACCESS", "FLUSH", "REMAP", "TAG_CHANGE", "UNSTALL", "PAGE_FLUSH"};
+	return names[event->getData() & accessTypeMask];
+}
+
 void Cache::process(const Event *event){
 	uint64 timestamp = engine->getTimestamp();
 	addrint data = event->getData();
@@ -722,79 +972,74 @@ void Cache::process(const Event *event){
 	addrint blockAddr = data & ~accessTypeMask;
 	debug("(): %lu, %d", blockAddr, type);
 	if (type == ACCESS){
-		RequestMap::iterator it = requests.find(blockAddr);
-		RequestMap::iterator it2;
-//		for(it2 = requests.begin(); it2 != requests.end(); it2++)
-//				cout<<it2->first << " : "<< it2->second.request->addr<<endl;
-//		cout << "****";
-//			if(it2->second.request->addr == 0)
-		myassert(it != requests.end());
-		it->second.request->counters[tagCounterIndex] = timestamp - it->second.request->counters[tagCounterIndex];
-		it->second.waitingForTag = false;
-		if (it->second.result == CacheModel::HIT){
-
-		} else if (it->second.result == CacheModel::MISS_WITHOUT_EVICTION){
+		Request *it = requests.find(blockAddr);
+		myassert(it != 0);
+		it->request->counters[tagCounterIndex] = timestamp - it->request->counters[tagCounterIndex];
+		it->waitingForTag = false;
+		if (it->result == CacheModel::HIT){
+
+		} else if (it->result == CacheModel::MISS_WITHOUT_EVICTION){
 			if (outgoingFlushRequests.count(blockAddr) > 0){
 				missesFromFlush++;
 			} else {
-				it->second.timestamp = timestamp;
-				it->second.waitingForRead = true;
-				it->second.request->read = true;
-				if (!stalledRequests.empty() || !nextLevel->access(it->second.request, this)){
-					debug(": next level is stalled: %p, %lu", it->second.request, it->second.request->addr);
-					stalledRequests.emplace_back(it->second.request);
-					it->second.request->counters[stallCounterIndex] = timestamp;
+				it->timestamp = timestamp;
+				it->waitingForRead = true;
+				it->request->read = true;
+				if (!stalledRequests.empty() || !nextLevel->access(it->request, this)){
+					debug(": next level is stalled: %p, %lu", it->request, it->request->addr);
+					stalledRequests.emplace_back(it->request);
+					it->request->counters[stallCounterIndex] = timestamp;
 				}
 			}
-		} else if (it->second.result == CacheModel::MISS_WITH_EVICTION){
+		} else if (it->result == CacheModel::MISS_WITH_EVICTION){
 			if (outgoingFlushRequests.count(blockAddr) > 0){
 				missesFromFlush++;
 			} else {
-				it->second.timestamp = timestamp;
-				it->second.waitingForRead = true;
-				it->second.request->read = true;
-				if (!stalledRequests.empty() || !nextLevel->access(it->second.request, this)){
-					debug(": next level is stalled: %p, %lu", it->second.request, it->second.request->addr);
-					stalledRequests.emplace_back(it->second.request);
-					it->second.request->counters[stallCounterIndex] = timestamp;
+				it->timestamp = timestamp;
+				it->waitingForRead = true;
+				it->request->read = true;
+				if (!stalledRequests.empty() || !nextLevel->access(it->request, this)){
+					debug(": next level is stalled: %p, %lu", it->request, it->request->addr);
+					stalledRequests.emplace_back(it->request);
+					it->request->counters[stallCounterIndex] = timestamp;
 				}
 			}
 			if (prevLevels.size() > 0){
-				it->second.waitingForFlush = true;
-				auto p = outgoingFlushRequests.emplace(it->second.evictedAddr, OutgoingFlushRequest(ACCESS, blockAddr, prevLevels.size(), false, false));
+				it->waitingForFlush = true;
+				auto p = outgoingFlushRequests.emplace(it->evictedAddr, OutgoingFlushRequest(ACCESS, blockAddr, prevLevels.size(), false, false));
 				if(p.second){
 					for (CacheList::iterator itCache = prevLevels.begin(); itCache != prevLevels.end(); itCache++){
-						(*itCache)->flush(it->second.evictedAddr, cacheModel.getBlockSize(), false, this);
+						(*itCache)->flush(it->evictedAddr, cacheModel.getBlockSize(), false, this);
 					}
 				} else {
 					p.first->second.requests.emplace_back(ACCESS, blockAddr);
 				}
 			}
-		} else if (it->second.result == CacheModel::MISS_WITH_WRITEBACK){
+		} else if (it->result == CacheModel::MISS_WITH_WRITEBACK){
 			if (outgoingFlushRequests.count(blockAddr) > 0){
 				missesFromFlush++;
 			} else {
-				it->second.timestamp = timestamp;
-				it->second.waitingForRead = true;
-				it->second.request->read = true;
-				if (!stalledRequests.empty() || !nextLevel->access(it->second.request, this)){
-					debug(": next level is stalled: %p, %lu", it->second.request, it->second.request->addr);
-					stalledRequests.emplace_back(it->second.request);
-					it->second.request->counters[stallCounterIndex] = timestamp;
+				it->timestamp = timestamp;
+				it->waitingForRead = true;
+				it->request->read = true;
+				if (!stalledRequests.empty() || !nextLevel->access(it->request, this)){
+					debug(": next level is stalled: %p, %lu", it->request, it->request->addr);
+					stalledRequests.emplace_back(it->request);
+					it->request->counters[stallCounterIndex] = timestamp;
 				}
 			}
 			if (prevLevels.size() > 0){
-				it->second.waitingForFlush = true;
-				auto p = outgoingFlushRequests.emplace(it->second.evictedAddr, OutgoingFlushRequest(ACCESS, blockAddr, prevLevels.size(), true, true));
+				it->waitingForFlush = true;
+				auto p = outgoingFlushRequests.emplace(it->evictedAddr, OutgoingFlushRequest(ACCESS, blockAddr, prevLevels.size(), true, true));
 				if(p.second){
 					for (CacheList::iterator itCache = prevLevels.begin(); itCache != prevLevels.end(); itCache++){
-						(*itCache)->flush(it->second.evictedAddr, cacheModel.getBlockSize(), false, this);
+						(*itCache)->flush(it->evictedAddr, cacheModel.getBlockSize(), false, this);
 					}
 				} else {
 					p.first->second.requests.emplace_back(ACCESS, blockAddr);
 				}
 			} else {
-				MemoryRequest *wbRequest = new MemoryRequest(it->second.evictedAddr, cacheModel.getBlockSize(), false, false, HIGH);
+				MemoryRequest *wbRequest = new MemoryRequest(it->evictedAddr, cacheModel.getBlockSize(), false, false, HIGH);
 				wbRequest->counters[TOTAL] = timestamp;
 				if (!stalledRequests.empty() || !nextLevel->access(wbRequest, this)){
 					debug(": next level is stalled: %p, %lu", wbRequest, wbRequest->addr);
@@ -807,22 +1052,23 @@ void Cache::process(const Event *event){
 					wbRequest->counters[stallCounterIndex] = timestamp;
 				}
 			}
-		} else if (it->second.result == CacheModel::MISS_WITHOUT_FREE_BLOCK){
+		} else if (it->result == CacheModel::MISS_WITHOUT_FREE_BLOCK){
 			error("CacheModel::access() returned MISS_WITHOUT_FREE_BLOCK");
 		} else {
 			myassert(false);
 		}
 
-		if (!it->second.waitingForRead){
-			for (CallerList::iterator callerIt = it->second.callers.begin(); callerIt != it->second.callers.end(); callerIt++){
+		if (!it->waitingForRead){
+			for (unsigned c = 0; c < it->callers.size(); c++){
+				Caller *callerIt = &it->callers[c];
 				debug(": callerIt->request: %p", callerIt->request);
-				if (callerIt->request != it->second.request){
+				if (callerIt->request != it->request){
 //					uint64 waitTime = timestamp - callerIt->request->counters[waitCounterIndex];
 //					callerIt->request->counters[waitCounterIndex] = waitTime;
 //					for (int i = COUNTER_INDEX_SIZE - 1; i >= tagCounterIndex; i--){
-//						if (waitTime >= it->second.request->counters[i]){
-//							callerIt->request->counters[i] += it->second.request->counters[i];
-//							waitTime -= it->second.request->counters[i];
+//						if (waitTime >= it->request->counters[i]){
+//							callerIt->request->counters[i] += it->request->counters[i];
+//							waitTime -= it->request->counters[i];
 //						} else {
 //							callerIt->request->counters[i] += waitTime;
 //							break;
@@ -831,7 +1077,8 @@ void Cache::process(const Event *event){
 //					}
 				}
 			}
-			for (CallerList::iterator callerIt = it->second.callers.begin(); callerIt != it->second.callers.end(); callerIt++){
+			for (unsigned c = 0; c < it->callers.size(); c++){
+				Caller *callerIt = &it->callers[c];
 				if (callerIt->read){
 					callerIt->callback->accessCompleted(callerIt->request, this);
 				} else {
@@ -844,16 +1091,17 @@ void Cache::process(const Event *event){
 					delete callerIt->request;
 				}
 			}
-			it->second.callers.clear();
+			it->callers.clear();
 		}
-		if (!it->second.waitingForFlush && !it->second.pinners.empty()){
-			for (PinnerList::iterator pinnerIt = it->second.pinners.begin(); pinnerIt != it->second.pinners.end(); pinnerIt++){
+		if (!it->waitingForFlush && !it->pinners.empty()){
+			for (unsigned j = 0; j < it->pinners.size(); j++){
+				Pinner *pinnerIt = &it->pinners[j];
 				pinnerIt->callback->pinCompleted(pinnerIt->addr, this);
 			}
-			it->second.pinners.clear();
+			it->pinners.clear();
 		}
-		if (!it->second.waitingForRead && !it->second.waitingForFlush){
-			if (it->second.repeatFlush){
+		if (!it->waitingForRead && !it->waitingForFlush){
+			if (it->repeatFlush){
 				FlushRequestMap::iterator fit = flushRequests.find(blockAddr);
 				myassert(fit != flushRequests.end());
 				myassert(fit->second.repeat);
@@ -880,9 +1128,9 @@ void Cache::process(const Event *event){
 				stalledCallers.clear();
 				nextStalledCaller++;
 			}
-			myassert(queueSize >= it->second.numCallers);
-			queueSize -= it->second.numCallers;
-			requests.erase(it);
+			myassert(queueSize >= it->numCallers);
+			queueSize -= it->numCallers;
+			releaseRequest(it);
 		}
 	} else if (type == FLUSH){
 //		if (DEBUG){
@@ -914,31 +1162,25 @@ void Cache::process(const Event *event){
 					}
 				} else {
 					if (it->second.repeat){
-						auto rit = requests.find(blockAddr);
-						if (rit == requests.end()){
+						Request *rit = requests.find(blockAddr);
+						if (rit == 0){
 							it->second.result = cacheModel.flush(blockAddr);
 							it->second.repeat = false;
 							addEvent(penalty, blockAddr, FLUSH);
 						} else {
-							rit->second.repeatFlush = true;
+							rit->repeatFlush = true;
 						}
 					} else {
 						it->second.done = true;
 						if (it->second.stalledRequestsLeft == 0){
-							IFlushCallback *caller = it->second.caller;
-							bool dirty = it->second.dirty;
-							flushRequests.erase(it);
-							caller->flushCompleted(blockAddr, dirty, this);
+							completeFlush(blockAddr, it);
 						}
 					}
 				}
 			} else {
 				it->second.done = true;
 				if (it->second.stalledRequestsLeft == 0){
-					IFlushCallback *caller = it->second.caller;
-					bool dirty = it->second.dirty;
-					flushRequests.erase(it);
-					caller->flushCompleted(blockAddr, dirty, this);
+					completeFlush(blockAddr, it);
 				}
 			}
 		} else if (it->second.result == Set::EVICTION || it->second.result == Set::WRITEBACK){
@@ -963,21 +1205,18 @@ void Cache::process(const Event *event){
 				}
 			} else {
 				if (it->second.guarantee && it->second.repeat){
-					auto rit = requests.find(blockAddr);
-					if (rit == requests.end()){
+					Request *rit = requests.find(blockAddr);
+					if (rit == 0){
 						it->second.result = cacheModel.flush(blockAddr);
 						it->second.repeat = false;
 						addEvent(penalty, blockAddr, FLUSH);
 					} else {
-						rit->second.repeatFlush = true;
+						rit->repeatFlush = true;
 					}
 				} else {
 					it->second.done = true;
 					if (it->second.stalledRequestsLeft == 0){
-						IFlushCallback *caller = it->second.caller;
-						bool dirty = it->second.dirty;
-						flushRequests.erase(it);
-						caller->flushCompleted(blockAddr, dirty, this);
+						completeFlush(blockAddr, it);
 					}
 				}
 			}
@@ -1072,13 +1311,11 @@ void Cache::process(const Event *event){
 				myassert(fit != flushRequests.end());
 				fit->second.stalledRequestsLeft--;
 				if (fit->second.stalledRequestsLeft == 0 && fit->second.done){
-					IFlushCallback *caller = fit->second.caller;
-					bool dirty = fit->second.dirty;
-					flushRequests.erase(fit);
-					caller->flushCompleted(reqAddr, dirty, this);
+					completeFlush(reqAddr, fit);
 				}
 			}
-			for (PinnerList::iterator pinnerIt = it->pinners.begin(); pinnerIt != it->pinners.end(); ++pinnerIt){
+			for (unsigned j = 0; j < it->pinners.size(); j++){
+				Pinner *pinnerIt = &it->pinners[j];
 				pinnerIt->callback->pinCompleted(pinnerIt->addr, this);
 			}
 			it = stalledRequests.erase(it);
@@ -1088,6 +1325,13 @@ void Cache::process(const Event *event){
 		} else {
 			it->request->counters[stallCounterIndex] = origStallTimestamp;
 		}
+	} else if (type == PAGE_FLUSH){
+		PageFlushRequestMap::iterator it = pageFlushRequests.find(cacheModel.getPageIndex(blockAddr));
+		myassert(it != pageFlushRequests.end());
+		//otherwise, a block brought in by an access joined the flush and completes it
+		if (it->second.blocksLeft == 0){
+			completePageFlush(it);
+		}
 	} else {
 		myassert(false);
 	}
@@ -1098,6 +1342,74 @@ void Cache::flush(addrint blockAddr, uint8 size, bool guarantee, IFlushCallback
 	debug("(%lu, %u, %s, %s)", blockAddr, size, guarantee?"true":"false", caller->getName());
 	myassert(size == cacheModel.getBlockSize());
 	myassert(blockAddr == cacheModel.getBlockAddress(blockAddr));
+	startFlush(blockAddr, guarantee, caller);
+}
+
+/*
+ * Flushes only the blocks of the page that are in the hierarchy. The caller is notified once, after all
+ * of them have been flushed.
+ */
+void Cache::flushPage(addrint page, IPageFlushCallback *caller){
+	uint64 timestamp = engine->getTimestamp();
+	debug("(%lu, %s)", page, caller->getName());
+	auto p = pageFlushRequests.emplace(page, PageFlushRequest());
+	myassert(p.second);
+	CacheModel::AddrList blocks;
+	getPageBlocks(page, &blocks);
+	blocks.sort();
+	blocks.unique();
+	p.first->second.caller = caller;
+	p.first->second.blocksLeft = blocks.size();
+	p.first->second.flushedBlocks = blocks.size();
+	pageFlushes++;
+	pageFlushBlocks += blocks.size();
+	debug(": %lu blocks", blocks.size());
+	if (blocks.empty()){
+		addEvent(penalty, cacheModel.getPageAddress(page, 0), PAGE_FLUSH);
+	} else {
+		for (auto it = blocks.begin(); it != blocks.end(); ++it){
+			FlushRequestMap::iterator fit = startFlush(*it, true, 0);
+			myassert(fit->second.caller == 0);
+			fit->second.page = true;
+		}
+	}
+}
+
+/*
+ * Appends the blocks of the page present in this cache or in the previous levels, including the ones
+ * still being evicted or written back and the ones with outstanding misses. Blocks of previous levels
+ * might not be here yet when their misses are stalled.
+ */
+void Cache::getPageBlocks(addrint page, CacheModel::AddrList *blocks) const {
+	CacheModel::AddrList resident;
+	cacheModel.getResidentBlocks(page, &resident);
+	blocks->splice(blocks->end(), resident);
+	for (auto it = outgoingFlushRequests.begin(); it != outgoingFlushRequests.end(); ++it){
+		if (cacheModel.getPageIndex(it->first) == page){
+			blocks->push_back(it->first);
+		}
+	}
+	for (auto it = stalledRequests.begin(); it != stalledRequests.end(); ++it){
+		if (!it->request->read && cacheModel.getPageIndex(it->request->addr) == page){
+			blocks->push_back(it->request->addr);
+		}
+	}
+	for (unsigned i = 0; i < requests.getNumEntries(); i++){
+		const Request *rit = requests.getEntry(i);
+		if (rit != 0 && cacheModel.getPageIndex(requests.getKey(rit)) == page){
+			blocks->push_back(requests.getKey(rit));
+		}
+	}
+	for (auto it = prevLevels.begin(); it != prevLevels.end(); ++it){
+		(*it)->getPageBlocks(page, blocks);
+	}
+}
+
+Cache::FlushRequestMap::iterator Cache::startFlush(addrint blockAddr, bool guarantee, IFlushCallback *caller){
+	uint64 timestamp = engine->getTimestamp();
+	if (prefetcher != 0){
+		prefetchedBlocks.erase(blockAddr);
+	}
 	auto res = flushRequests.emplace(blockAddr, FlushRequest(guarantee));
 	if (res.second){
 		res.first->second.result = cacheModel.flush(blockAddr);
@@ -1109,6 +1421,10 @@ void Cache::flush(addrint blockAddr, uint8 size, bool guarantee, IFlushCallback
 			res.first->second.guarantee = true;
 		}
 	}
+	if (guarantee && requests.find(blockAddr) != 0){
+		//the block arrives after the outstanding miss completes, so it is flushed again then
+		res.first->second.repeat = true;
+	}
 	for (auto sit = stalledRequests.begin(); sit != stalledRequests.end(); ++sit){
 		if (sit->request->addr == blockAddr){
 			sit->flushing = true;
@@ -1116,6 +1432,7 @@ void Cache::flush(addrint blockAddr, uint8 size, bool guarantee, IFlushCallback
 		}
 	}
 	debug(": stalledRequestsLeft: %u", res.first->second.stalledRequestsLeft);
+	return res.first;
 }
 
 void Cache::flushCompleted(addrint blockAddr, bool dirty, IMemory *caller){
@@ -1134,29 +1451,31 @@ void Cache::flushCompleted(addrint blockAddr, bool dirty, IMemory *caller){
 		for (auto lit = outIt->second.requests.begin(); lit != outIt->second.requests.end(); ++lit){
 			debug(": %d", lit->type);
 			if (lit->type == ACCESS){
-				RequestMap::iterator it = requests.find(lit->origAddr);
-				myassert(it != requests.end());
-				it->second.waitingForFlush = false;
+				Request *it = requests.find(lit->origAddr);
+				myassert(it != 0);
+				it->waitingForFlush = false;
 				if (outIt->second.dirty){
-					MemoryRequest *wbRequest = new MemoryRequest(it->second.evictedAddr, cacheModel.getBlockSize(), false, false, HIGH);
+					MemoryRequest *wbRequest = new MemoryRequest(it->evictedAddr, cacheModel.getBlockSize(), false, false, HIGH);
 					wbRequest->counters[TOTAL] = timestamp;
 					if (!stalledRequests.empty() || !nextLevel->access(wbRequest, this)){
-						stalledRequests.emplace_back(wbRequest, it->second.pinners);
-						it->second.pinners.clear();
+						stalledRequests.emplace_back(wbRequest, it->pinners);
+						it->pinners.clear();
 						wbRequest->counters[stallCounterIndex] = timestamp;
 					} else {
-						for (PinnerList::iterator pinnerIt = it->second.pinners.begin(); pinnerIt != it->second.pinners.end(); pinnerIt++){
+						for (unsigned j = 0; j < it->pinners.size(); j++){
+							Pinner *pinnerIt = &it->pinners[j];
 							pinnerIt->callback->pinCompleted(pinnerIt->addr, this);
 						}
 					}
 				} else {
-					for (PinnerList::iterator pinnerIt = it->second.pinners.begin(); pinnerIt != it->second.pinners.end(); pinnerIt++){
+					for (unsigned j = 0; j < it->pinners.size(); j++){
+						Pinner *pinnerIt = &it->pinners[j];
 						pinnerIt->callback->pinCompleted(pinnerIt->addr, this);
 					}
 				}
-				it->second.pinners.clear();
-				if (!it->second.waitingForRead){
-					if (it->second.repeatFlush){
+				it->pinners.clear();
+				if (!it->waitingForRead){
+					if (it->repeatFlush){
 						FlushRequestMap::iterator fit = flushRequests.find(lit->origAddr);
 						myassert(fit != flushRequests.end());
 						myassert(fit->second.repeat);
@@ -1183,9 +1502,9 @@ void Cache::flushCompleted(addrint blockAddr, bool dirty, IMemory *caller){
 						stalledCallers.clear();
 						nextStalledCaller++;
 					}
-					myassert(queueSize >= it->second.numCallers);
-					queueSize -= it->second.numCallers;
-					requests.erase(it);
+					myassert(queueSize >= it->numCallers);
+					queueSize -= it->numCallers;
+					releaseRequest(it);
 				}
 			} else if (lit->type == FLUSH){
 				FlushRequestMap::iterator it = flushRequests.find(blockAddr);
@@ -1195,22 +1514,19 @@ void Cache::flushCompleted(addrint blockAddr, bool dirty, IMemory *caller){
 				}
 				debug(": guarantee: %s, repeat: %s", it->second.guarantee?"true":"false", it->second.repeat?"true":"false");
 				if (it->second.guarantee && it->second.repeat){
-					auto rit = requests.find(blockAddr);
-					if (rit == requests.end()){
+					Request *rit = requests.find(blockAddr);
+					if (rit == 0){
 						it->second.result = cacheModel.flush(blockAddr);
 						it->second.repeat = false;
 						addEvent(penalty, blockAddr, FLUSH);
 					} else {
-						rit->second.repeatFlush = true;
+						rit->repeatFlush = true;
 					}
 				} else {
 					it->second.done = true;
 					debug(": stalledRequestsLeft: %u", it->second.stalledRequestsLeft);
 					if (it->second.stalledRequestsLeft == 0){
-						IFlushCallback *caller = it->second.caller;
-						bool d = it->second.dirty;
-						flushRequests.erase(it);
-						caller->flushCompleted(blockAddr, d, this);
+						completeFlush(blockAddr, it);
 					}
 				}
 			} else if (lit->type == REMAP){
@@ -1232,7 +1548,17 @@ void Cache::flushCompleted(addrint blockAddr, bool dirty, IMemory *caller){
 				TagChangeRequestMap::iterator it = tagChangeRequests.find(blockAddr);
 				myassert(it != tagChangeRequests.end());
 				if (outIt->second.dirty){
-					cacheModel.makeDirty(it->second.newAddr);
+					if (cacheModel.contains(it->second.newAddr)){
+						cacheModel.makeDirty(it->second.newAddr);
+					} else {
+						//the block was evicted after its tag changed, so the data of the previous levels is written back
+						MemoryRequest *wbRequest = new MemoryRequest(it->second.newAddr, cacheModel.getBlockSize(), false, false, HIGH);
+						wbRequest->counters[TOTAL] = timestamp;
+						if (!stalledRequests.empty() || !nextLevel->access(wbRequest, this)){
+							stalledRequests.emplace_back(wbRequest);
+							wbRequest->counters[stallCounterIndex] = timestamp;
+						}
+					}
 				}
 				ITagChangeCallback *caller = it->second.caller;
 				tagChangeRequests.erase(it);
@@ -1247,6 +1573,37 @@ void Cache::flushCompleted(addrint blockAddr, bool dirty, IMemory *caller){
 
 }
 
+void Cache::completeFlush(addrint blockAddr, FlushRequestMap::iterator it){
+	IFlushCallback *caller = it->second.caller;
+	bool dirty = it->second.dirty;
+	bool page = it->second.page;
+	flushRequests.erase(it);
+	if (page){
+		PageFlushRequestMap::iterator pit = pageFlushRequests.find(cacheModel.getPageIndex(blockAddr));
+		myassert(pit != pageFlushRequests.end());
+		if (dirty){
+			pit->second.dirtyBlocks.emplace_back(blockAddr);
+		}
+		myassert(pit->second.blocksLeft > 0);
+		pit->second.blocksLeft--;
+		if (pit->second.blocksLeft == 0){
+			completePageFlush(pit);
+		}
+	} else {
+		caller->flushCompleted(blockAddr, dirty, this);
+	}
+}
+
+void Cache::completePageFlush(PageFlushRequestMap::iterator it){
+	addrint page = it->first;
+	IPageFlushCallback *caller = it->second.caller;
+	unsigned flushedBlocks = it->second.flushedBlocks;
+	vector<addrint> dirtyBlocks;
+	dirtyBlocks.swap(it->second.dirtyBlocks);
+	pageFlushRequests.erase(it);
+	caller->pageFlushCompleted(page, dirtyBlocks, flushedBlocks, this);
+}
+
 void Cache::remap(addrint oldPage, addrint newPage, IRemapCallback *caller){
 	uint64 timestamp = engine->getTimestamp();
 	debug("(%lu, %lu, %s)", oldPage, newPage, caller->getName());
@@ -1289,9 +1646,10 @@ unsigned Cache::pin(addrint addr, IPinCallback *caller){
 	uint64 timestamp = engine->getTimestamp();
 	myassert(addr == cacheModel.getBlockAddress(addr));
 	unsigned count = 0;
-	for (RequestMap::iterator it = requests.begin(); it != requests.end(); it++){
-		if (it->second.result != CacheModel::HIT && it->second.evictedAddr == addr && (it->second.waitingForTag || it->second.waitingForFlush)){
-			it->second.pinners.emplace_back(Pinner(addr, caller));
+	for (unsigned i = 0; i < requests.getNumEntries(); i++){
+		Request *it = requests.getEntry(i);
+		if (it != 0 && it->result != CacheModel::HIT && it->evictedAddr == addr && (it->waitingForTag || it->waitingForFlush)){
+			it->pinners.emplace_back(Pinner(addr, caller));
 			count++;
 		}
 	}
@@ -1299,3 +1657,90 @@ unsigned Cache::pin(addrint addr, IPinCallback *caller){
 	debug(": %lu, %s", addr, caller->getName());
 	return count;
 }
+
+void Cache::updateMshrOccupancy(uint64 timestamp){
+	if (requests.size() > 0){
+		mshrOccupancyTime += requests.size() * (timestamp - lastMshrUpdate);
+		mshrBusyTime += timestamp - lastMshrUpdate;
+	}
+	lastMshrUpdate = timestamp;
+}
+
+/*
+ * Flushes, remaps and tag changes belong to page migrations, which cannot be checkpointed halfway.
+ * Outstanding misses are fine: their blocks are already allocated in the cache model.
+ */
+void Cache::warm(addrint addr, bool read, bool instr){
+	addrint blockAddr = cacheModel.getBlockAddress(addr);
+	addrint evictedAddr, internalAddr;
+	CacheModel::Result result = cacheModel.access(blockAddr, read, instr, false, &evictedAddr, &internalAddr);
+	if (result == CacheModel::MISS_WITH_EVICTION || result == CacheModel::MISS_WITH_WRITEBACK){
+		//keep the previous levels inclusive, as the flushes sent on evictions do
+		bool dirty = result == CacheModel::MISS_WITH_WRITEBACK;
+		for (CacheList::iterator it = prevLevels.begin(); it != prevLevels.end(); ++it){
+			if ((*it)->cacheModel.flush(evictedAddr) == Set::WRITEBACK){
+				dirty = true;
+			}
+		}
+		if (dirty){
+			nextLevel->warm(evictedAddr, false, false);
+		}
+	}
+	if (result != CacheModel::HIT){
+		nextLevel->warm(blockAddr, true, instr);
+	}
+}
+
+//whether there are no requests in flight, so that the contents can be warmed functionally
+bool Cache::isPageBusy(addrint addr) const {
+	return pageFlushRequests.count(cacheModel.getPageIndex(addr)) > 0 || nextLevel->isPageBusy(addr);
+}
+
+bool Cache::isIdle() const {
+	return requests.size() == 0 && stalledRequests.empty() && queueSize == 0 && isQuiescent();
+}
+
+bool Cache::isQuiescent() const {
+	return flushRequests.empty() && pageFlushRequests.empty() && remapRequests.empty() && tagChangeRequests.empty() && outgoingFlushRequests.empty() && outgoingRemapRequests.empty();
+}
+
+void Cache::saveCheckpoint(CheckpointWriter *writer){
+	cacheModel.saveCheckpoint(writer);
+}
+
+void Cache::restoreCheckpoint(CheckpointReader *reader){
+	cacheModel.restoreCheckpoint(reader);
+}
+
+void Cache::releaseRequest(Request *request){
+	updateMshrOccupancy(engine->getTimestamp());
+	requests.release(request);
+}
+
+void Cache::trainPrefetcher(addrint blockAddr, bool miss, bool prefetchHit){
+	uint64 timestamp = engine->getTimestamp();
+	prefetchCandidates.clear();
+	prefetcher->train(blockAddr, miss, prefetchHit, &prefetchCandidates);
+	//prefetches into a page that is being flushed or migrated could reach its frame after it is freed
+	bool pageBusy = !prefetchCandidates.empty() && isPageBusy(blockAddr);
+	for (auto it = prefetchCandidates.begin(); it != prefetchCandidates.end(); ++it){
+		addrint addr = cacheModel.getBlockAddress(*it);
+		//stay inside the physical page of the demand access: the next page may not belong to the same process
+		if (pageBusy || addr == blockAddr || cacheModel.getPageIndex(addr) != cacheModel.getPageIndex(blockAddr)){
+			prefetcher->prefetchDropped();
+			continue;
+		}
+		//leave at least one entry free for demand requests
+		if (queueSize + 1 >= maxQueueSize || cacheModel.contains(addr) || requests.find(addr) != 0 || flushRequests.count(addr) > 0 || outgoingFlushRequests.count(addr) > 0){
+			prefetcher->prefetchDropped();
+			continue;
+		}
+		debug(": prefetch %lu", addr);
+		MemoryRequest *prefetchRequest = new MemoryRequest(addr, cacheModel.getBlockSize(), true, false, LOW);
+		prefetchRequest->counters[TOTAL] = timestamp;
+		bool issued = access(prefetchRequest, this);
+		myassert(issued);
+		prefetchedBlocks.insert(addr);
+		prefetcher->prefetchIssued();
+	}
+}
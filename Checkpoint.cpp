@@ -0,0 +1,195 @@
+/*
+ * Copyright (c) 2015 Santiago Bock
+ *
+ * See the file LICENSE.txt for copying permission.
+ */
+
+#include "Checkpoint.H"
+
+#include <cstring>
+
+static const char CHECKPOINT_MAGIC[8] = {'H', 'M', 'M', 'C', 'K', 'P', 'T', '\0'};
+static const uint32 CHECKPOINT_VERSION = 2;
+static const uint32 SECTION_END = 0x5ec7e4d5;
+
+CheckpointWriter::CheckpointWriter(const string& filenameArg) : filename(filenameArg) {
+	out.open(filename.c_str(), ios::out | ios::binary | ios::trunc);
+	if (!out.is_open()){
+		error("Could not open checkpoint file '%s'", filename.c_str());
+	}
+	out.write(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+	write(CHECKPOINT_VERSION);
+}
+
+CheckpointWriter::~CheckpointWriter(){
+	out.close();
+	if (!out){
+		error("Could not write checkpoint file '%s'", filename.c_str());
+	}
+}
+
+void CheckpointWriter::beginSection(const string& name){
+	writeString(name);
+}
+
+void CheckpointWriter::endSection(){
+	write(SECTION_END);
+}
+
+void CheckpointWriter::writeString(const string& str){
+	write(static_cast<uint32>(str.size()));
+	out.write(str.data(), str.size());
+}
+
+CheckpointReader::CheckpointReader(const string& filenameArg) : filename(filenameArg) {
+	in.open(filename.c_str(), ios::in | ios::binary);
+	if (!in.is_open()){
+		error("Could not open checkpoint file '%s'", filename.c_str());
+	}
+	char magic[sizeof(CHECKPOINT_MAGIC)];
+	in.read(magic, sizeof(magic));
+	if (!in || memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) != 0){
+		error("File '%s' is not a checkpoint", filename.c_str());
+	}
+	uint32 version = read<uint32>();
+	if (version != CHECKPOINT_VERSION){
+		error("Checkpoint file '%s' has version %u (expected %u)", filename.c_str(), version, CHECKPOINT_VERSION);
+	}
+}
+
+void CheckpointReader::beginSection(const string& name){
+	string found = readString();
+	if (found != name){
+		error("Checkpoint file '%s' has section '%s' where '%s' was expected (was it created with a different configuration?)", filename.c_str(), found.c_str(), name.c_str());
+	}
+}
+
+void CheckpointReader::endSection(){
+	if (read<uint32>() != SECTION_END){
+		error("Checkpoint file '%s' is corrupted (section does not end where expected)", filename.c_str());
+	}
+}
+
+string CheckpointReader::readString(){
+	uint32 size = read<uint32>();
+	string str(size, '\0');
+	in.read(&str[0], size);
+	if (!in){
+		error("Checkpoint file '%s' is truncated", filename.c_str());
+	}
+	return str;
+}
+
+void CheckpointReader::skip(uint64 bytes){
+	in.ignore(bytes);
+	if (!in){
+		error("Checkpoint file '%s' is truncated", filename.c_str());
+	}
+}
+
+Checkpointer::Checkpointer(Engine *engineArg, StatContainer *statsArg) : engine(engineArg), stats(statsArg), exitAfterSave(false), scheduledTimestamp(0), attempts(0), quiescing(false) {
+
+}
+
+void Checkpointer::add(const string& name, ICheckpointable *component){
+	components.emplace_back(name, component);
+}
+
+void Checkpointer::schedule(uint64 timestamp, const string& filenameArg, bool exitAfterSaveArg){
+	if (timestamp < engine->getTimestamp()){
+		error("Checkpoint timestamp (%lu) is earlier than the current timestamp (%lu)", timestamp, engine->getTimestamp());
+	}
+	filename = filenameArg;
+	exitAfterSave = exitAfterSaveArg;
+	scheduledTimestamp = timestamp;
+	attempts = 0;
+	engine->addEvent(timestamp - engine->getTimestamp(), this);
+}
+
+void Checkpointer::save(const string& filenameArg){
+	CheckpointWriter writer(filenameArg);
+	writer.beginSection("engine");
+	writer.write(engine->getTimestamp());
+	writer.endSection();
+	for (auto it = components.begin(); it != components.end(); ++it){
+		writer.beginSection(it->first);
+		it->second->saveCheckpoint(&writer);
+		writer.endSection();
+	}
+	writer.beginSection("statistics");
+	stats->saveCheckpoint(writer.getStream());
+	writer.endSection();
+}
+
+void Checkpointer::restore(const string& filenameArg, bool restoreStats){
+	CheckpointReader reader(filenameArg);
+	reader.beginSection("engine");
+	engine->restoreTimestamp(reader.read<uint64>());
+	reader.endSection();
+	for (auto it = components.begin(); it != components.end(); ++it){
+		reader.beginSection(it->first);
+		it->second->restoreCheckpoint(&reader);
+		reader.endSection();
+	}
+	reader.beginSection("statistics");
+	if (restoreStats){
+		stats->restoreCheckpoint(reader.getStream());
+	} else {
+		uint64 count = reader.read<uint64>();
+		for (uint64 i = 0; i < count; i++){
+			reader.skip(reader.read<uint32>()); //name
+			reader.skip(reader.read<uint32>()); //state
+		}
+	}
+	reader.endSection();
+}
+
+void Checkpointer::process(const Event *event){
+	if (isQuiescent()){
+		uint64 timestamp = engine->getTimestamp();
+		save(filename);
+		cout << timestamp << ": saved checkpoint to '" << filename << "'";
+		if (timestamp != scheduledTimestamp){
+			cout << " (requested at " << scheduledTimestamp << ")";
+		}
+		cout << endl;
+		if (exitAfterSave){
+			engine->quit();
+		} else {
+			endQuiesce();
+		}
+	} else if (++attempts < MAX_ATTEMPTS){
+		quiesce();
+		engine->addEvent(RETRY_PERIOD, this);
+	} else if (exitAfterSave){
+		error("Could not save checkpoint to '%s': the memory hierarchy was not quiescent within %lu cycles of %lu", filename.c_str(), MAX_ATTEMPTS * RETRY_PERIOD, scheduledTimestamp);
+	} else {
+		warn("Could not save checkpoint to '%s': the memory hierarchy was not quiescent within %lu cycles of %lu", filename.c_str(), MAX_ATTEMPTS * RETRY_PERIOD, scheduledTimestamp);
+		endQuiesce();
+	}
+}
+
+bool Checkpointer::isQuiescent() const {
+	for (auto it = components.begin(); it != components.end(); ++it){
+		if (!it->second->isQuiescent()){
+			return false;
+		}
+	}
+	return true;
+}
+
+void Checkpointer::quiesce(){
+	quiescing = true;
+	for (auto it = components.begin(); it != components.end(); ++it){
+		it->second->quiesce();
+	}
+}
+
+void Checkpointer::endQuiesce(){
+	if (quiescing){
+		quiescing = false;
+		for (auto it = components.begin(); it != components.end(); ++it){
+			it->second->endQuiesce();
+		}
+	}
+}
@@ -0,0 +1,299 @@
+/*
+ * Copyright (c) 2015 Santiago Bock
+ *
+ * See the file LICENSE.txt for copying permission.
+ */
+
+#include "DebugTrace.H"
+#include "Error.H"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+static const char DEBUG_MAGIC[8] = {'H', 'M', 'M', 'D', 'B', 'G', '1', '\0'};
+
+struct DebugHeader {
+	char magic[8];
+	uint64 numFormats;
+	uint64 numComponents;
+	uint64 numStrings;
+	uint64 numRecords;
+};
+
+vector<DebugTrace::Format> DebugTrace::formats;
+vector<string> DebugTrace::components;
+vector<DebugTrace::Ring *> DebugTrace::rings;
+unordered_map<const string *, DebugTrace::Ring *> DebugTrace::ringMap;
+const string *DebugTrace::lastName = 0;
+DebugTrace::Ring *DebugTrace::lastRing = 0;
+uint64 DebugTrace::sequence = 0;
+uint64 DebugTrace::capacity = 65536;
+string DebugTrace::filename = "debug.trace";
+pid_t DebugTrace::pid = 0;
+volatile sig_atomic_t DebugTrace::dumpRequested = 0;
+
+//returns the index of the next conversion of the format string at or after pos, and its length
+static size_t findConversion(const string& format, size_t pos, size_t *length){
+	while ((pos = format.find('%', pos)) != string::npos){
+		if (pos + 1 < format.size() && format[pos + 1] == '%'){
+			pos += 2;
+			continue;
+		}
+		size_t end = format.find_first_of("diouxXcspfeEgG", pos + 1);
+		if (end == string::npos){
+			return string::npos;
+		}
+		*length = end + 1 - pos;
+		return pos;
+	}
+	return string::npos;
+}
+
+void DebugTrace::init(const string& filenameArg, uint64 capacityArg){
+	if (capacityArg == 0){
+		error("Debug trace must hold at least one record per component");
+	}
+	capacity = 1;
+	while (capacity < capacityArg){
+		capacity <<= 1;
+	}
+	filename = filenameArg;
+	pid = getpid();
+	signal(SIGUSR1, requestDump);
+}
+
+uint32 DebugTrace::registerFormat(const char *function, const char *format){
+	Format f;
+	f.function = function;
+	f.format = format;
+	f.stringArgs = 0;
+	size_t length;
+	size_t pos = 0;
+	for (unsigned i = 0; (pos = findConversion(f.format, pos, &length)) != string::npos; i++){
+		if (f.format[pos + length - 1] == 's'){
+			f.stringArgs |= 1 << i;
+		}
+		pos += length;
+	}
+	formats.emplace_back(f);
+	return formats.size() - 1;
+}
+
+DebugTrace::Ring *DebugTrace::getRing(const string& name){
+	auto it = ringMap.find(&name);
+	if (it == ringMap.end()){
+		if (rings.empty()){
+			//the first record arms the dumps
+			if (pid == 0){
+				pid = getpid();
+			}
+			atexit(dump);
+			set_failure_handler(dump);
+		}
+		Ring *ring = new Ring;
+		ring->records.resize(capacity);
+		ring->head = 0;
+		ring->component = components.size();
+		components.emplace_back(name);
+		rings.emplace_back(ring);
+		it = ringMap.emplace(&name, ring).first;
+	}
+	lastName = &name;
+	lastRing = it->second;
+	return lastRing;
+}
+
+void DebugTrace::requestDump(int signum){
+	dumpRequested = 1;
+}
+
+void DebugTrace::dump(){
+	static bool dumping = false;
+	if (dumping || rings.empty()){
+		return;
+	}
+	dumping = true;
+	vector<DebugRecord> records;
+	for (auto it = rings.begin(); it != rings.end(); ++it){
+		uint64 first = (*it)->head > capacity ? (*it)->head - capacity : 0;
+		for (uint64 i = first; i < (*it)->head; i++){
+			records.emplace_back((*it)->records[i & (capacity - 1)]);
+		}
+	}
+	sort(records.begin(), records.end(), [](const DebugRecord& a, const DebugRecord& b) {return a.sequence < b.sequence;});
+
+	//the pointers of the string arguments are replaced by indices into a table of their contents
+	vector<string> strings;
+	unordered_map<uint64, uint64> stringMap;
+	for (auto it = records.begin(); it != records.end(); ++it){
+		uint32 stringArgs = formats[it->format].stringArgs;
+		for (unsigned i = 0; i < it->numArgs; i++){
+			if (stringArgs & (1 << i)){
+				auto sit = stringMap.find(it->args[i]);
+				if (sit == stringMap.end()){
+					const char *str = reinterpret_cast<const char *>(it->args[i]);
+					sit = stringMap.emplace(it->args[i], strings.size()).first;
+					strings.emplace_back(str == 0 ? "(null)" : str);
+				}
+				it->args[i] = sit->second;
+			}
+		}
+	}
+
+	string name(filename);
+	if (getpid() != pid){
+		//forked simulations (sweeps) do not overwrite the dump of their parent
+		ostringstream oss;
+		oss << filename << "." << getpid();
+		name = oss.str();
+	}
+	FILE *file = fopen(name.c_str(), "w");
+	if (file == 0){
+		warn("Could not open debug trace file '%s'", name.c_str());
+		errno = 0;
+		dumping = false;
+		return;
+	}
+	auto writeString = [file](const string& str) {
+		uint32 length = str.size();
+		fwrite(&length, sizeof(length), 1, file);
+		fwrite(str.data(), 1, length, file);
+	};
+	DebugHeader header;
+	memcpy(header.magic, DEBUG_MAGIC, sizeof(DEBUG_MAGIC));
+	header.numFormats = formats.size();
+	header.numComponents = components.size();
+	header.numStrings = strings.size();
+	header.numRecords = records.size();
+	fwrite(&header, sizeof(header), 1, file);
+	for (auto it = formats.begin(); it != formats.end(); ++it){
+		writeString(it->function);
+		writeString(it->format);
+		fwrite(&it->stringArgs, sizeof(it->stringArgs), 1, file);
+	}
+	for (auto it = components.begin(); it != components.end(); ++it){
+		writeString(*it);
+	}
+	for (auto it = strings.begin(); it != strings.end(); ++it){
+		writeString(*it);
+	}
+	if (!records.empty()){
+		fwrite(records.data(), sizeof(DebugRecord), records.size(), file);
+	}
+	if (ferror(file) || fclose(file) != 0){
+		warn("Could not write debug trace file '%s'", name.c_str());
+		errno = 0;
+	} else {
+		cerr << "debug trace with " << records.size() << " records written to '" << name << "'" << endl;
+	}
+	dumping = false;
+}
+
+DebugTraceReader::DebugTraceReader(const string& filename) : currentRecord(0) {
+	file = fopen(filename.c_str(), "r");
+	if (file == 0){
+		error("Could not open debug trace file '%s'", filename.c_str());
+	}
+	auto readString = [this, &filename]() {
+		uint32 length;
+		if (fread(&length, sizeof(length), 1, file) != 1){
+			error("Debug trace file '%s' is truncated", filename.c_str());
+		}
+		string str(length, '\0');
+		if (length != 0 && fread(&str[0], 1, length, file) != length){
+			error("Debug trace file '%s' is truncated", filename.c_str());
+		}
+		return str;
+	};
+	DebugHeader header;
+	if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, DEBUG_MAGIC, sizeof(DEBUG_MAGIC)) != 0){
+		error("File '%s' is not a debug trace", filename.c_str());
+	}
+	for (uint64 i = 0; i < header.numFormats; i++){
+		DebugTrace::Format f;
+		f.function = readString();
+		f.format = readString();
+		if (fread(&f.stringArgs, sizeof(f.stringArgs), 1, file) != 1){
+			error("Debug trace file '%s' is truncated", filename.c_str());
+		}
+		formats.emplace_back(f);
+	}
+	for (uint64 i = 0; i < header.numComponents; i++){
+		components.emplace_back(readString());
+	}
+	for (uint64 i = 0; i < header.numStrings; i++){
+		strings.emplace_back(readString());
+	}
+	numRecords = header.numRecords;
+}
+
+DebugTraceReader::~DebugTraceReader(){
+	fclose(file);
+}
+
+bool DebugTraceReader::readRecord(DebugRecord *record){
+	if (currentRecord == numRecords){
+		return false;
+	}
+	if (fread(record, sizeof(DebugRecord), 1, file) != 1){
+		error("Debug trace file is truncated");
+	}
+	currentRecord++;
+	return true;
+}
+
+string DebugTraceReader::format(const DebugRecord& record) const {
+	const DebugTrace::Format& f = formats[record.format];
+	auto literal = [](string text) {
+		for (size_t p = 0; (p = text.find("%%", p)) != string::npos; p++){
+			text.erase(p, 1);
+		}
+		return text;
+	};
+	ostringstream oss;
+	oss << f.function;
+	char buf[1024];
+	size_t length;
+	size_t prev = 0;
+	size_t pos = 0;
+	for (unsigned i = 0; (pos = findConversion(f.format, pos, &length)) != string::npos; i++){
+		oss << literal(f.format.substr(prev, pos - prev));
+		string spec = f.format.substr(pos, length);
+		uint64 arg = i < record.numArgs ? record.args[i] : 0;
+		char conv = spec[spec.size() - 1];
+		bool isLong = spec.find('l') != string::npos;
+		if (conv == 's'){
+			snprintf(buf, sizeof(buf), spec.c_str(), strings[arg].c_str());
+		} else if (conv == 'p'){
+			snprintf(buf, sizeof(buf), spec.c_str(), reinterpret_cast<void *>(arg));
+		} else if (conv == 'd' || conv == 'i'){
+			if (isLong){
+				snprintf(buf, sizeof(buf), spec.c_str(), static_cast<long>(arg));
+			} else {
+				snprintf(buf, sizeof(buf), spec.c_str(), static_cast<int>(arg));
+			}
+		} else if (conv == 'c'){
+			snprintf(buf, sizeof(buf), spec.c_str(), static_cast<int>(arg));
+		} else if (conv == 'o' || conv == 'u' || conv == 'x' || conv == 'X'){
+			if (isLong){
+				snprintf(buf, sizeof(buf), spec.c_str(), static_cast<unsigned long>(arg));
+			} else {
+				snprintf(buf, sizeof(buf), spec.c_str(), static_cast<unsigned>(arg));
+			}
+		} else {
+			//floating point arguments are not recorded
+			snprintf(buf, sizeof(buf), "%s", spec.c_str());
+		}
+		oss << buf;
+		pos += length;
+		prev = pos;
+	}
+	oss << literal(f.format.substr(prev));
+	return oss.str();
+}
@@ -5,21 +5,24 @@
  */
 
 #include "Engine.H"
+#include "EventProfiler.H"
 
 #include <cassert>
 
-Engine::Engine(StatContainer *statsArg, uint64 statsPeriodArg, const string& statsFilename, uint64 progressPeriodArg) :
+Engine::Engine(StatContainer *statsArg, uint64 statsPeriodArg, const string& statsFilename, IntervalStatsFormat statsFormat, uint64 progressPeriodArg) :
 		stats(statsArg),
 		statsPeriod(statsPeriodArg),
 		progressPeriod(progressPeriodArg),
 		currentInterval(0),
 		statsNextEvent(statsPeriodArg),
 		progressNextEvent(progressPeriodArg),
+		statsWriter(0),
 		done(false),
 		timestamp(0),
 		lastTimestamp(0),
 		numEvents(0),
 		lastNumEvents(0),
+		profiler(0),
 		finalTimestamp(stats, "final_timestamp", "Final timestamp", this, &Engine::getFinalTimestamp),
 		totalEvents(stats, "total_events", "Total number of events", 0),
 		executionTime(stats, "execution_time", "Execution time in seconds", 0),
@@ -38,12 +41,16 @@ Engine::Engine(StatContainer *statsArg, uint64 statsPeriodArg, const string& sta
 			addEvent(progressNextEvent - timestamp, this);
 		}
 	} else {
-		statsOut.open(statsFilename.c_str());
-		if (!statsOut.is_open()){
-			error("Could not open statistics file '%s'", statsFilename.c_str());
+		if (statsFormat == TEXT_INTERVAL_STATS){
+			statsOut.open(statsFilename.c_str());
+			if (!statsOut.is_open()){
+				error("Could not open statistics file '%s'", statsFilename.c_str());
+			}
+			statsOut.setf(std::ios::fixed);
+			statsOut.precision(2);
+		} else {
+			statsWriter = new IntervalStatsWriter(statsFilename, statsFormat == GZIP_INTERVAL_STATS);
 		}
-		statsOut.setf(std::ios::fixed);
-		statsOut.precision(2);
 		if (progressNextEvent == 0){
 			addEvent(statsNextEvent -timestamp, this);
 		} else {
@@ -59,10 +66,19 @@ Engine::Engine(StatContainer *statsArg, uint64 statsPeriodArg, const string& sta
 	last = start;
 }
 
+Engine::~Engine(){
+	delete statsWriter;
+	delete profiler;
+}
+
 void Engine::run(){
 	if (statsNextEvent != 0){
-		stats->printNames(statsOut);
-		statsOut << endl;
+		if (statsWriter == 0){
+			stats->printNames(statsOut);
+			statsOut << endl;
+		} else {
+			stats->printNames(statsWriter);
+		}
 	}
 	bool empty = currentEventsEmpty();
 	while (!done && !(empty && events.empty()) ){
@@ -99,7 +115,23 @@ void Engine::run(){
 	//	cout<<timestamp<<endl;
 
  		numEvents++;
+#if PROFILE_EVENTS
+		if (profiler != 0){
+			EventProfiler::Entry *entry = profiler->count(event);
+			if (profiler->sample()){
+				uint64 depth = getNumPendingEvents();
+				uint64 startTicks = EventProfiler::readTicks();
+				event.execute();
+				profiler->addSample(entry, EventProfiler::readTicks() - startTicks, depth);
+			} else {
+				event.execute();
+			}
+		} else {
+			event.execute();
+		}
+#else
 		event.execute();
+#endif
 
 		empty = currentEventsEmpty();
 
@@ -111,7 +143,14 @@ void Engine::run(){
 	}
 	updateStats();
 	if (statsNextEvent != 0){
-		statsOut.close();
+		if (statsWriter == 0){
+			statsOut.close();
+		} else {
+			statsWriter->close();
+		}
+	}
+	if (profiler != 0){
+		profiler->printReport(timestamp);
 	}
 }
 
@@ -119,6 +158,20 @@ void Engine::quit(){
 	done = true;
 }
 
+/*
+ * Attributes the events executed from now on to their handlers and prints the profile at the end of
+ * the run (and after each statistics interval if intervals is true). The event loop only calls the
+ * profiler when the simulator is compiled with PROFILE_EVENTS.
+ */
+void Engine::enableProfiling(const string& filename, bool intervals){
+#if PROFILE_EVENTS
+	delete profiler;
+	profiler = new EventProfiler(filename, intervals);
+#else
+	warn("Event profiling is disabled: compile with PROFILE_EVENTS=1 (see the makefile)");
+#endif
+}
+
 void Engine::addEvent(uint64 delay, IEventHandler *handler, uint64 data){
 //	if (timestamp+delay == 6338739) {
 //		cout << "Hello from add" << endl;
@@ -131,6 +184,38 @@ void Engine::addEvent(uint64 delay, IEventHandler *handler, uint64 data){
 	}
 }
 
+/*
+ * Moves the engine forward to the timestamp of a checkpoint before the simulation starts. Events that
+ * are already scheduled keep their delay relative to the current timestamp.
+ */
+void Engine::restoreTimestamp(uint64 timestampArg){
+	if (timestampArg < timestamp){
+		error("Cannot restore timestamp %lu (current timestamp is %lu)", timestampArg, timestamp);
+	}
+	uint64 delta = timestampArg - timestamp;
+	vector<Event> pending;
+	for (unsigned i = 0; i < currentSize; i++){
+		deque<Event>& bucket = currentEvents[(timestamp + i) % currentSize];
+		pending.insert(pending.end(), bucket.begin(), bucket.end());
+		bucket.clear();
+	}
+	while (!events.empty()){
+		pending.emplace_back(events.top());
+		events.pop();
+	}
+	uint64 oldTimestamp = timestamp;
+	timestamp = lastTimestamp = timestampArg;
+	for (auto it = pending.begin(); it != pending.end(); ++it){
+		addEvent(it->getTimestamp() - oldTimestamp, it->getHandler(), it->getData());
+	}
+	if (statsNextEvent != 0){
+		statsNextEvent += delta;
+	}
+	if (progressNextEvent != 0){
+		progressNextEvent += delta;
+	}
+}
+
 bool Engine::currentEventsEmpty(){
 	for (unsigned i = 0; i < currentSize; i++){
 		if (!currentEvents[(timestamp + i) % currentSize].empty()){
@@ -144,10 +229,17 @@ void Engine::process(const Event * event){
 	if (timestamp == statsNextEvent){
 		updateStats();
 		statsNextEvent += statsPeriod;
-		stats->printInterval(statsOut);
-		statsOut << endl;
+		if (statsWriter == 0){
+			stats->printInterval(statsOut);
+			statsOut << endl;
+		} else {
+			stats->printInterval(statsWriter);
+		}
 		currentInterval++;
 		stats->startInterval();
+		if (profiler != 0){
+			profiler->printInterval(timestamp);
+		}
 	}
 	if (timestamp == progressNextEvent){
 		progressNextEvent += progressPeriod;
@@ -182,6 +274,14 @@ void Engine::process(const Event * event){
 	}
 }
 
+uint64 Engine::getNumPendingEvents() const {
+	uint64 num = events.size();
+	for (unsigned i = 0; i < currentSize; i++){
+		num += currentEvents[i].size();
+	}
+	return num;
+}
+
 void Engine::updateStats(){
 	gettimeofday(&end, NULL);
 	totalEvents = numEvents;
@@ -15,6 +15,8 @@
 char msg_buffer[MAX_MSG_SIZE];
 uint64 debug2_timestamp = std::numeric_limits<uint64>::max();
 
+static void (*failure_handler)() = 0;
+
 
 void print_error(char *msg){
 	print_warn(msg);
@@ -29,7 +31,16 @@ void print_warn(char *msg){
 	}
 }
 
+void set_failure_handler(void (*handler)()){
+	failure_handler = handler;
+}
+
 void print_assert(uint64 timestamp, const char *assertion, const char *file, unsigned line, const char *function){
 	fprintf(stderr, "%lu: %s:%u: %s: Assertion '%s' failed.\n", timestamp, file, line, function, assertion);
+	if (failure_handler != 0){
+		void (*handler)() = failure_handler;
+		failure_handler = 0;
+		handler();
+	}
 	abort();
 }
@@ -0,0 +1,243 @@
+/*
+ * Copyright (c) 2015 Santiago Bock
+ *
+ * See the file LICENSE.txt for copying permission.
+ */
+
+#include "EventProfiler.H"
+#include "Error.H"
+#include "MemoryHierarchy.H"
+
+#include <cxxabi.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <typeinfo>
+
+EventProfiler::Entry::Entry() : events(0), sampledEvents(0), sampledTicks(0) {
+	memset(depths, 0, sizeof(depths));
+}
+
+void EventProfiler::Entry::add(const Entry& entry){
+	events += entry.events;
+	sampledEvents += entry.sampledEvents;
+	sampledTicks += entry.sampledTicks;
+	for (unsigned i = 0; i < DEPTH_BUCKETS; i++){
+		depths[i] += entry.depths[i];
+	}
+}
+
+void EventProfiler::Entry::subtract(const Entry& entry){
+	events -= entry.events;
+	sampledEvents -= entry.sampledEvents;
+	sampledTicks -= entry.sampledTicks;
+	for (unsigned i = 0; i < DEPTH_BUCKETS; i++){
+		depths[i] -= entry.depths[i];
+	}
+}
+
+EventProfiler::EventProfiler(const string& filename, bool intervalsArg) : numEvents(0), intervals(intervalsArg) {
+	if (filename.empty()){
+		out = &cout;
+	} else {
+		file.open(filename.c_str());
+		if (!file.is_open()){
+			error("Could not open event profile file '%s'", filename.c_str());
+		}
+		out = &file;
+	}
+}
+
+EventProfiler::Entry *EventProfiler::count(const Event& event){
+	numEvents++;
+	IEventHandler *handler = event.getHandler();
+	Handler& h = getHandler(handler);
+	const char *type = handler->getEventName(&event);
+	auto it = h.types.begin();
+	while (it != h.types.end() && it->first != type && (it->first == 0 || type == 0 || strcmp(it->first, type) != 0)){
+		++it;
+	}
+	if (it == h.types.end()){
+		h.types.emplace_back(type, Entry());
+		it = h.types.end() - 1;
+	}
+	it->second.events++;
+	return &it->second;
+}
+
+void EventProfiler::addSample(Entry *entry, uint64 ticks, uint64 depth){
+	entry->sampledEvents++;
+	entry->sampledTicks += ticks;
+	entry->depths[getBucket(depth)]++;
+}
+
+void EventProfiler::printInterval(uint64 timestamp){
+	if (!intervals){
+		return;
+	}
+	ostringstream oss;
+	oss << "Event profile of the interval ending at timestamp " << timestamp;
+	print(handlers, &lastInterval, oss.str());
+	lastInterval = handlers;
+}
+
+void EventProfiler::printReport(uint64 timestamp){
+	ostringstream oss;
+	oss << "Event profile at timestamp " << timestamp;
+	print(handlers, 0, oss.str());
+	out->flush();
+}
+
+uint64 EventProfiler::readTicks(){
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+//the names are looked up when the handler is first seen, while it is known to exist
+EventProfiler::Handler& EventProfiler::getHandler(IEventHandler *handler){
+	auto it = handlers.find(handler);
+	if (it != handlers.end()){
+		return it->second;
+	}
+	Handler& h = handlers[handler];
+	int status;
+	char *demangled = abi::__cxa_demangle(typeid(*handler).name(), 0, 0, &status);
+	h.className = status == 0 ? demangled : typeid(*handler).name();
+	free(demangled);
+	IMemory *memory = dynamic_cast<IMemory *>(handler);
+	IMemoryCallback *callback = dynamic_cast<IMemoryCallback *>(handler);
+	if (memory != 0){
+		h.name = memory->getName();
+	} else if (callback != 0){
+		h.name = callback->getName();
+	} else {
+		//components without a name are numbered in the order in which they first get an event
+		ostringstream oss;
+		oss << h.className << "_" << classCount[h.className]++;
+		h.name = oss.str();
+	}
+	return h;
+}
+
+void EventProfiler::print(const HandlerMap& current, const HandlerMap *base, const string& title){
+	struct Row {
+		string name;
+		string className;
+		Entry total;
+		vector<pair<string, Entry> > types;
+	};
+	vector<Row> rows;
+	map<string, Entry> classes;
+	Entry total;
+	for (auto it = current.begin(); it != current.end(); ++it){
+		Row row;
+		row.name = it->second.name;
+		row.className = it->second.className;
+		const Handler *prev = 0;
+		if (base != 0){
+			auto bit = base->find(it->first);
+			if (bit != base->end()){
+				prev = &bit->second;
+			}
+		}
+		for (unsigned i = 0; i < it->second.types.size(); i++){
+			Entry entry(it->second.types[i].second);
+			if (prev != 0 && i < prev->types.size()){
+				entry.subtract(prev->types[i].second);
+			}
+			row.types.emplace_back(it->second.types[i].first == 0 ? "" : it->second.types[i].first, entry);
+			row.total.add(entry);
+		}
+		if (row.total.events == 0){
+			continue;
+		}
+		classes[row.className].add(row.total);
+		total.add(row.total);
+		rows.emplace_back(row);
+	}
+	auto byTicks = [](const pair<string, Entry>& a, const pair<string, Entry>& b) {return a.second.getTicks() > b.second.getTicks();};
+	sort(rows.begin(), rows.end(), [](const Row& a, const Row& b) {return a.total.getTicks() > b.total.getTicks();});
+	for (auto it = rows.begin(); it != rows.end(); ++it){
+		sort(it->types.begin(), it->types.end(), byTicks);
+	}
+	vector<pair<string, Entry> > classRows(classes.begin(), classes.end());
+	sort(classRows.begin(), classRows.end(), byTicks);
+
+	double totalTicks = total.getTicks();
+	ostream& os = *out;
+	auto printEntry = [&](const string& name, const string& className, const Entry& entry) {
+		os << "  " << left << setw(32) << name << setw(24) << className << right;
+		os << setw(14) << entry.events << setw(8) << fixed << setprecision(2) << (total.events == 0 ? 0 : 100.0 * entry.events / total.events);
+		os << setw(16) << static_cast<uint64>(entry.getTicks()) << setw(8) << (totalTicks == 0 ? 0 : 100 * entry.getTicks() / totalTicks);
+		os << setw(12) << (entry.sampledEvents == 0 ? 0 : static_cast<double>(entry.sampledTicks) / entry.sampledEvents);
+		os << setw(8) << getPercentile(entry, 0.5) << setw(8) << getPercentile(entry, 0.9) << setw(9) << getPercentile(entry, 1) << endl;
+	};
+	auto printHeader = [&](const string& name, const string& className) {
+		os << "  " << left << setw(32) << name << setw(24) << className << right;
+		os << setw(14) << "events" << setw(8) << "%" << setw(16) << "ticks" << setw(8) << "%" << setw(12) << "ticks/event";
+		os << setw(8) << "depth50" << setw(8) << "depth90" << setw(9) << "depthmax" << endl;
+	};
+
+	os << title << ": " << total.events << " events, " << static_cast<uint64>(totalTicks) << " host ticks (one in " << SAMPLE_PERIOD << " events timed)" << endl;
+	os << "Depths are upper bounds of the number of pending events in the engine when the events were executed" << endl;
+	printHeader("component/event", "class");
+	for (auto it = rows.begin(); it != rows.end(); ++it){
+		printEntry(it->name, it->className, it->total);
+		if (it->types.size() > 1 || !it->types[0].first.empty()){
+			for (auto tit = it->types.begin(); tit != it->types.end(); ++tit){
+				printEntry("  " + tit->first, "", tit->second);
+			}
+		}
+	}
+	os << "Per class:" << endl;
+	printHeader("class", "");
+	for (auto it = classRows.begin(); it != classRows.end(); ++it){
+		printEntry(it->first, "", it->second);
+	}
+	os << "Queue depth histograms (sampled events per bucket of depths below the given power of 2):" << endl;
+	for (auto it = rows.begin(); it != rows.end(); ++it){
+		os << "  " << it->name << ":";
+		for (unsigned i = 0; i < DEPTH_BUCKETS; i++){
+			if (it->total.depths[i] != 0){
+				os << " " << (1ul << i) << ":" << it->total.depths[i];
+			}
+		}
+		os << endl;
+	}
+	os << endl;
+}
+
+unsigned EventProfiler::getBucket(uint64 depth){
+	unsigned bucket = 0;
+	while (depth != 0 && bucket < DEPTH_BUCKETS - 1){
+		depth >>= 1;
+		bucket++;
+	}
+	return bucket;
+}
+
+//upper bound of the depth below which the given fraction of the sampled events were executed
+uint64 EventProfiler::getPercentile(const Entry& entry, double fraction){
+	uint64 target = static_cast<uint64>(fraction * entry.sampledEvents);
+	uint64 sum = 0;
+	for (unsigned i = 0; i < DEPTH_BUCKETS; i++){
+		sum += entry.depths[i];
+		if (sum != 0 && sum >= target){
+			return i == 0 ? 0 : (1ul << i) - 1;
+		}
+	}
+	return 0;
+}
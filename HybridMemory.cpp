@@ -6,9 +6,19 @@
 
 #include "HybridMemory.H"
 
+#include <algorithm>
 #include <iomanip>
 #include <iostream>
 #include <cmath>
+#include <limits>
+
+static uint64 getSlowestBusLatency(Memory *dram, Memory *pcm, const vector<Memory *>& far){
+	uint64 latency = max(max(dram->getBusLatency(), pcm->getBusLatency()), static_cast<uint64>(1));
+	for (auto it = far.begin(); it != far.end(); ++it){
+		latency = max(latency, (*it)->getBusLatency());
+	}
+	return latency;
+}
 
 HybridMemory::HybridMemory(
 	const string& nameArg,
@@ -28,7 +38,16 @@ HybridMemory::HybridMemory(
 	unsigned completionThresholdArg,
 	bool elideCleanDramBlocksArg,
 	bool fixedPcmMigrationCostArg,
-	uint64 pcmMigrationCostArg) :
+	uint64 pcmMigrationCostArg,
+	bool copyEngineArg,
+	unsigned copyWindowArg,
+	unsigned copyBatchSizeArg,
+	const vector<Memory *>& farArg,
+	uint64 lineCacheSizeArg,
+	unsigned lineCacheAssocArg,
+	unsigned lineCacheMigrationBlocksArg,
+	bool criticalBlockFirstArg,
+	uint64 idleCopyPeriodArg) :
 		name(nameArg),
 		desc(descArg),
 		engine(engineArg),
@@ -48,7 +67,16 @@ HybridMemory::HybridMemory(
 		elideCleanDramBlocks(elideCleanDramBlocksArg),
 		fixedPcmMigrationCost(fixedPcmMigrationCostArg),
 		pcmMigrationCost(pcmMigrationCostArg),
+		copyEngine(copyEngineArg),
+		copyWindow(copyWindowArg),
+		copyBatchSize(copyBatchSizeArg),
+		criticalBlockFirst(criticalBlockFirstArg),
+		idleCopyPeriod(idleCopyPeriodArg),
 		pcmOffset(dramArg->getSize()),
+		nextMigrationId(1),
+		lineCacheSize(lineCacheSizeArg),
+		lineCacheAssoc(lineCacheAssocArg),
+		lineCacheMigrationBlocks(lineCacheMigrationBlocksArg),
 
 		dramReads(statCont, nameArg + "_dram_reads", "Number of DRAM reads seen by the " + descArg, 0),
 		dramWrites(statCont, nameArg + "_dram_writes", "Number of DRAM writes seen by the " + descArg, 0),
@@ -136,6 +164,43 @@ HybridMemory::HybridMemory(
 		dramPageCopyTime(statCont, nameArg + "_dram_page_copy_time", "Number of cycles copying DRAM pages by " + descArg, 0),
 		pcmPageCopyTime(statCont, nameArg + "_pcm_page_copy_time", "Number of cycles copying PCM pages by " + descArg, 0),
 
+		copyBytes(statCont, nameArg + "_copy_bytes", "Number of bytes written to destination pages by the " + descArg, 0),
+		copyBusyTime(statCont, nameArg + "_copy_busy_time", "Number of cycles with page copies in progress in the " + descArg, this, &HybridMemory::getCopyBusyTime),
+		copyRowHits(statCont, nameArg + "_copy_row_hits", "Number of page copy accesses to the same row as the previous page copy access to their bank by the " + descArg, 0),
+		copyPeakBandwidth(statCont, nameArg + "_copy_peak_bandwidth", "Theoretical page copy bandwidth (bytes per cycle) of the " + descArg + ", limited by the slower memory bus", static_cast<double>(blockSizeArg) / getSlowestBusLatency(dramArg, pcmArg, farArg)),
+		copyBandwidth(statCont, nameArg + "_copy_bandwidth", "Page copy bandwidth (bytes per cycle) achieved by the " + descArg + " while copying", &copyBytes, &copyBusyTime),
+
+		tierReads(statCont, 2 + farArg.size(), nameArg + "_tier_reads", "Number of reads seen by the " + descArg + " to tier"),
+		tierWrites(statCont, 2 + farArg.size(), nameArg + "_tier_writes", "Number of writes seen by the " + descArg + " to tier"),
+		tierAccesses(statCont, nameArg + "_tier_accesses", "Number of accesses seen by the " + descArg + " to tier", &tierReads, &tierWrites),
+
+		tierReadTime(statCont, 2 + farArg.size(), nameArg + "_tier_read_time", "Number of cycles servicing reads as seen by the " + descArg + " in tier"),
+		tierWriteTime(statCont, 2 + farArg.size(), nameArg + "_tier_write_time", "Number of cycles servicing writes as seen by the " + descArg + " in tier"),
+		tierAccessTime(statCont, nameArg + "_tier_access_time", "Number of cycles servicing accesses as seen by the " + descArg + " in tier", &tierReadTime, &tierWriteTime),
+
+		avgTierAccessTime(statCont, nameArg + "_avg_tier_access_time", "Average number of cycles servicing accesses as seen by the " + descArg + " in tier", &tierAccessTime, &tierAccesses),
+
+		tierCopyReads(statCont, 2 + farArg.size(), nameArg + "_tier_copy_reads", "Number of reads due to page copies by the " + descArg + " in tier"),
+		tierCopyWrites(statCont, 2 + farArg.size(), nameArg + "_tier_copy_writes", "Number of writes due to page copies by the " + descArg + " in tier"),
+		tierPageCopies(statCont, 2 + farArg.size(), nameArg + "_tier_page_copies", "Number of pages copied by the " + descArg + " to tier"),
+
+		lineCacheStats(lineCacheSizeArg > 0 ? statCont : &unusedLineCacheStats),
+		lineCacheReadHits(lineCacheStats, nameArg + "_line_cache_read_hits", "Number of reads to pages below DRAM served by the line cache of the " + descArg, 0),
+		lineCacheReadMisses(lineCacheStats, nameArg + "_line_cache_read_misses", "Number of reads to pages below DRAM that missed in the line cache of the " + descArg, 0),
+		lineCacheWriteHits(lineCacheStats, nameArg + "_line_cache_write_hits", "Number of writes to pages below DRAM served by the line cache of the " + descArg, 0),
+		lineCacheWriteMisses(lineCacheStats, nameArg + "_line_cache_write_misses", "Number of writes to pages below DRAM that missed in the line cache of the " + descArg, 0),
+		lineCacheHits(lineCacheStats, nameArg + "_line_cache_hits", "Number of accesses to pages below DRAM served by the line cache of the " + descArg, &lineCacheReadHits, &lineCacheWriteHits),
+		lineCacheMisses(lineCacheStats, nameArg + "_line_cache_misses", "Number of accesses to pages below DRAM that missed in the line cache of the " + descArg, &lineCacheReadMisses, &lineCacheWriteMisses),
+		lineCacheAccesses(lineCacheStats, nameArg + "_line_cache_accesses", "Number of accesses to pages below DRAM looked up in the line cache of the " + descArg, &lineCacheHits, &lineCacheMisses),
+		lineCacheHitRate(lineCacheStats, nameArg + "_line_cache_hit_rate", "Fraction of accesses to pages below DRAM served by the line cache of the " + descArg, &lineCacheHits, &lineCacheAccesses),
+		lineCacheFills(lineCacheStats, nameArg + "_line_cache_fills", "Number of blocks written to the line cache of the " + descArg, 0),
+		lineCacheWritebacks(lineCacheStats, nameArg + "_line_cache_writebacks", "Number of dirty blocks written back from the line cache of the " + descArg, 0),
+		lineCacheInvalidations(lineCacheStats, nameArg + "_line_cache_invalidations", "Number of blocks dropped from the line cache of the " + descArg + " because their page was copied", 0),
+		lineCachePcmAccessesSaved(lineCacheStats, nameArg + "_line_cache_pcm_accesses_saved", "Number of accesses to the tiers below DRAM saved by the line cache of the " + descArg + " (hits minus writebacks)", &lineCacheHits, &lineCacheWritebacks),
+
+		criticalBlocks(statCont, nameArg + "_critical_blocks", "Number of blocks of on-demand DRAM migrations read first by the " + descArg + " because the page read them before", 0),
+		idleBlockCopies(statCont, nameArg + "_idle_block_copies", "Number of blocks of on-demand DRAM migrations read by the " + descArg + " while their bank was idle", 0),
+
 		dramReadsPerPid(statCont, numProcesses, nameArg + "_dram_reads_per_pid", "Number of DRAM reads seen by the " + descArg + " from process"),
 		dramWritesPerPid(statCont, numProcesses, nameArg + "_dram_writes_per_pid", "Number of DRAM writes seen by the " + descArg + " from process"),
 		dramAccessesPerPid(statCont, nameArg + "_dram_accesses_per_pid", "Number of DRAM accesses seen by the " + descArg + " from process", &dramReadsPerPid, &dramWritesPerPid),
@@ -180,7 +245,41 @@ HybridMemory::HybridMemory(
 
 		avgAccessTimePerPid(statCont, nameArg + "_avg_access_time_per_pid", "Average number of cycles servicing all accesses as seen by the " + descArg + " from process", &totalAccessTimePerPid, &totalAccessesPerPid)
 {
-
+	if (copyEngine && copyWindow == 0){
+		error("The copy window must allow at least one read in flight");
+	}
+	if (lineCacheSize > 0){
+		if (lineCacheAssoc == 0){
+			error("The line cache must have at least one way");
+		}
+		if (lineCacheSize % pageSize != 0 || lineCacheSize % (static_cast<uint64>(blockSize) * lineCacheAssoc) != 0){
+			error("Line cache size (%lu) must be a multiple of the page size (%u) and of the block size times the associativity (%u)", lineCacheSize, pageSize, blockSize * lineCacheAssoc);
+		}
+		if (lineCacheSize >= dram->getSize()){
+			error("Line cache size (%lu) must be smaller than the DRAM size (%lu)", lineCacheSize, dram->getSize());
+		}
+	}
+	lineCacheOffset = dram->getSize() - lineCacheSize;
+	lineCacheSets = lineCacheSize / blockSize / max(lineCacheAssoc, 1U);
+	lineCache.resize(lineCacheSize / blockSize);
+	lineCacheUses = 0;
+	tiers.emplace_back(dram);
+	tiers.emplace_back(pcm);
+	tiers.insert(tiers.end(), farArg.begin(), farArg.end());
+	addrint end = 0;
+	for (auto it = tiers.begin(); it != tiers.end(); ++it){
+		end += (*it)->getSize();
+		tierEnds.emplace_back(end);
+		copyRows.emplace_back((*it)->getNumBanks(), numeric_limits<addrint>::max());
+	}
+	stalledCallers.resize(tiers.size());
+	stalledOnRead.resize(tiers.size());
+	stalledOnWrite.resize(tiers.size());
+	copyEngineScheduled = false;
+	copyReadsInFlight = 0;
+	copiesInProgress = 0;
+	copyStartTime = 0;
+	copyBusyCycles = 0;
 }
 
 bool HybridMemory::access(MemoryRequest *request, IMemoryCallback *caller){
@@ -192,12 +291,8 @@ bool HybridMemory::access(MemoryRequest *request, IMemoryCallback *caller){
 
 	addrint callbackAddr = request->addr; //addr might get overwritten
 
-	PageType type;
-	if (request->addr < pcmOffset){
-		type = DRAM;
-	} else {
-		type = PCM;
-	}
+	unsigned tier = getTierOfAddress(request->addr);
+	PageType type = tier == 0 ? DRAM : PCM;
 	bool read = request->read;
 	int pid = manager->getPidOfAddress(request->addr);
 
@@ -213,19 +308,15 @@ bool HybridMemory::access(MemoryRequest *request, IMemoryCallback *caller){
 		if (mit->second.blocks[block].state == NOT_READ){
 			myassert(mit->second.blocks[block].request == 0);
 			if(request->read){
+				if (mit->second.rolledBack){
+					//the block is dirty in the old destination and is read from there
+					request->addr = manager->getAddressFromBlock(mit->second.destPage, block);
+				}
 				if(accessNextLevel(request, caller, callbackAddr, true, page)){
 					mit->second.blocks[block].state = READING;
 					mit->second.blocks[block].request = request;
 					mit->second.blocksLeftToRead--;
-					if (mit->second.blocksLeftToRead == completionThreshold && mit->second.blocksLeftToRead > 0){
-						auto bit = mit->second.blocks.begin();
-						while (bit != mit->second.blocks.end() && bit->state != NOT_READ){
-							++bit;
-							mit->second.nextReadBlock++;
-						}
-						myassert(mit->second.nextReadBlock != static_cast<int>(block));
-						addEvent(0, READ, mit->first);
-					}
+					startReadingAtThreshold(mit);
 					if (type == DRAM){
 						readsFromDram++;
 					} else {
@@ -240,23 +331,13 @@ bool HybridMemory::access(MemoryRequest *request, IMemoryCallback *caller){
 				mit->second.blocks[block].dirty = true;
 				mit->second.blocks[block].request = request;
 				mit->second.blocksLeftToRead--;
-				if (mit->second.blocksLeftToRead == completionThreshold && mit->second.blocksLeftToRead > 0){
-					auto bit = mit->second.blocks.begin();
-					while (bit != mit->second.blocks.end() && bit->state != NOT_READ){
-						++bit;
-						mit->second.nextReadBlock++;
-					}
-					myassert(mit->second.nextReadBlock != static_cast<int>(block));
-					addEvent(0, READ, mit->first);
-				}
+				//the block is never read, so no read is left to complete for it
+				mit->second.blockLeftToCompleteRead--;
+				startReadingAtThreshold(mit);
 				if (mit->second.nextWriteBlock == -1){
 					mit->second.nextWriteBlock = block;
 					debug(": adding event 1: blocksLeftToWrite: %u", mit->second.blocksLeftToWrite);
-					if (mit->second.lastWrite + mit->second.writeDelay < timestamp){
-						addEvent(0, WRITE, mit->first);
-					} else {
-						addEvent(mit->second.lastWrite + mit->second.writeDelay - timestamp, WRITE, mit->first);
-					}
+					scheduleWrite(mit);
 				}
 				writesToBuffer++;
 			}
@@ -277,11 +358,7 @@ bool HybridMemory::access(MemoryRequest *request, IMemoryCallback *caller){
 				if (mit->second.nextWriteBlock == -1){
 					mit->second.nextWriteBlock = block;
 					debug(": adding event 2: blocksLeftToWrite: %u", mit->second.blocksLeftToWrite);
-					if (mit->second.lastWrite + mit->second.writeDelay < timestamp){
-						addEvent(0, WRITE, mit->first);
-					} else {
-						addEvent(mit->second.lastWrite + mit->second.writeDelay - timestamp, WRITE, mit->first);
-					}
+					scheduleWrite(mit);
 				}
 				writesToBuffer++;
 			}
@@ -324,12 +401,22 @@ bool HybridMemory::access(MemoryRequest *request, IMemoryCallback *caller){
 		addrint pcmPageOffset = manager->getIndex(pcmOffset);
 		addrint destPage;
 		if(page >= pcmPageOffset && caller != manager && manager->migrateOnDemand(page, &destPage)){
-			myassert(destPage < pcmPageOffset);
-			auto p = migrations.emplace(page, MigrationEntry(destPage, pcm, dram, dramMigrationReadDelay, dramMigrationWriteDelay, blocksPerPage, timestamp));
+			//pages are promoted to the next faster tier; only promotions to DRAM use the DRAM migration delays
+			myassert(getTierOfAddress(manager->getAddressFromBlock(destPage, 0)) == tier - 1);
+			Memory *src = tiers[tier];
+			Memory *dest = tiers[tier - 1];
+			uint64 readDelay = dest == dram ? dramMigrationReadDelay : pcmMigrationReadDelay;
+			uint64 writeDelay = dest == dram ? dramMigrationWriteDelay : pcmMigrationWriteDelay;
+			auto p = migrations.emplace(page, MigrationEntry(destPage, src, dest, readDelay, writeDelay, blocksPerPage, timestamp, nextMigrationId++));
 			myassert(p.second);
 			//cout << "on demand: " << page << ", " << destPage << endl;
-			debug(": %s(%lu) to %s(%lu)", pcm->getName(), manager->getAddressFromBlock(page, 0), dram->getName(), manager->getAddressFromBlock(destPage, 0));
+			debug(": %s(%lu) to %s(%lu)", src->getName(), manager->getAddressFromBlock(page, 0), dest->getName(), manager->getAddressFromBlock(destPage, 0));
+			if (lineCacheSize > 0){
+				invalidateLines(page);
+				invalidateLines(destPage);
+			}
 			pcmPageCopies++;
+			startCopy();
 			p.first->second.blocks.resize(blocksPerPage);
 
 			if (request->read){
@@ -347,19 +434,42 @@ bool HybridMemory::access(MemoryRequest *request, IMemoryCallback *caller){
 				p.first->second.blocks[block].dirty = true;
 				p.first->second.blocks[block].request = request;
 				p.first->second.blocksLeftToRead--;
+				p.first->second.blockLeftToCompleteRead--;
 				p.first->second.nextWriteBlock = block;
 				debug(": adding event: blocksLeftToWrite: %u", p.first->second.blocksLeftToWrite);
-				addEvent(0, WRITE, p.first->first);
+				scheduleWrite(p.first);
 				writesToBuffer++;
 			}
-			if (p.first->second.blocksLeftToRead == completionThreshold){
+			if (dest == dram && criticalBlockFirst){
+				auto hit = blockHistory.find(page);
+				if (hit != blockHistory.end()){
+					for (unsigned i = 0; i < blocksPerPage; i++){
+						if (hit->second[i] && p.first->second.blocks[i].state == NOT_READ){
+							p.first->second.blocks[i].critical = true;
+							criticalBlocks++;
+						}
+					}
+					if (getCriticalBlock(p.first) >= 0){
+						startCriticalReading(p.first);
+					}
+				}
+			}
+			if (dest == dram && idleCopyPeriod > 0){
+				addEvent(idleCopyPeriod, IDLE_COPY, page, p.first->second.id);
+			}
+			//promotions between the tiers below DRAM are never rolled back, so the rest of the page is read right away
+			if (p.first->second.blocksLeftToRead == (dest == dram ? completionThreshold : blocksPerPage - 1)){
 				auto bit = p.first->second.blocks.begin();
 				while (bit != p.first->second.blocks.end() && bit->state != NOT_READ){
 					++bit;
 					p.first->second.nextReadBlock++;
 				}
 				myassert(p.first->second.nextReadBlock != static_cast<int>(block));
-				addEvent(0, READ, p.first->first);
+				startReading(p.first);
+			}
+		} else if (lineCacheSize > 0 && tier != 0){
+			if (!accessLineCache(request, caller, callbackAddr)){
+				return false;
 			}
 		} else {
 			if(accessNextLevel(request, caller, callbackAddr, false, 0)){
@@ -392,6 +502,13 @@ bool HybridMemory::access(MemoryRequest *request, IMemoryCallback *caller){
 		if (read){
 			monit->second.reads++;
 			monit->second.readBlocks[block]++;
+			if (criticalBlockFirst){
+				auto hit = blockHistory.find(page);
+				if (hit == blockHistory.end()){
+					hit = blockHistory.emplace(page, vector<bool>(blocksPerPage)).first;
+				}
+				hit->second[block] = true;
+			}
 		} else {
 			monit->second.writes++;
 			monit->second.writtenBlocks[block]++;
@@ -422,42 +539,56 @@ bool HybridMemory::access(MemoryRequest *request, IMemoryCallback *caller){
 			}
 		}
 	}
+	if (read){
+		tierReads[tier]++;
+	} else {
+		tierWrites[tier]++;
+	}
 	return true;
 }
 
 bool HybridMemory::accessNextLevel(MemoryRequest *request, IMemoryCallback *caller, addrint callbackAddr, bool partOfMigration, addrint srcPage){
 	uint64 timestamp = engine->getTimestamp();
-	if (request->addr < pcmOffset){
-		if (dramStalledCallers.empty() && dram->access(request, this)){
-			if (!request->read){
-				addrint page = manager->getIndex(request->addr);
-				addrint block = manager->getBlock(request->addr);
-				auto dit = dirties.find(page);
-				if (dit != dirties.end()){
-					dit->second[block] = true;
-				}
-			}
-		} else {
-			debug(": stalled due to dram");
-			dramStalledCallers.insert(caller);
-			request->addr = callbackAddr;
-			return false;
+	//the frame goes below the one pushed by the next level, so it is pushed first and popped if the next level is stalled
+	if (request->read){
+		uint64 migrationId = 0;
+		if (partOfMigration){
+			auto mit = migrations.find(srcPage);
+			myassert(mit != migrations.end());
+			migrationId = mit->second.id;
 		}
-	} else {
-		if (!pcmStalledCallers.empty() || !pcm->access(request, this)){
-			debug(": stalled due to pcm");
-			pcmStalledCallers.insert(caller);
-			request->addr = callbackAddr;
-			return false;
+		myassert(request->canPushFrame());
+		request->pushFrame(this, caller, callbackAddr, timestamp, srcPage, migrationId);
+	}
+	unsigned tier = getTierOfAddress(request->addr);
+	//the memory makes the address relative to its offset
+	addrint page = manager->getIndex(request->addr);
+	addrint block = manager->getBlock(request->addr);
+	bool write = !request->read;
+	if (!stalledCallers[tier].empty() || !tiers[tier]->access(request, this)){
+		debug(": stalled due to %s", tiers[tier]->getName());
+		stalledCallers[tier].insert(caller);
+		if (request->read){
+			myassert(request->hasFrame(this));
+			request->popFrame(this);
 		}
+		request->addr = callbackAddr;
+		return false;
 	}
-	if (request->read){
-		bool ins = callbacks.emplace(request, CallbackEntry(caller, callbackAddr, partOfMigration, srcPage, engine->getTimestamp())).second;
-		myassert(ins);
+	if (tier == 0 && write){
+		auto dit = dirties.find(page);
+		if (dit != dirties.end()){
+			dit->second[block] = true;
+		}
 	}
 	return true;
 }
 
+bool HybridMemory::isPageBusy(addrint addr) const {
+	addrint page = manager->getIndex(addr);
+	return migrations.count(page) > 0 || rolledBackMigrations.count(page) > 0;
+}
+
 void HybridMemory::accessCompleted(MemoryRequest *request, IMemory *caller){
 	uint64 timestamp = engine->getTimestamp();
 
@@ -466,11 +597,30 @@ void HybridMemory::accessCompleted(MemoryRequest *request, IMemory *caller){
 	addrint block = manager->getBlock(request->addr);
 	addrint page = manager->getIndex(request->addr);
 	bool calledBack = false;
-	auto it = callbacks.find(request);
-	if (it != callbacks.end()){
+	if (request->hasFrame(this) && request->topFrame()->callback == 0){
+		//read of a page copy: the migration may have been rolled back and finished while the read was in flight
+		CallbackFrame frame = request->popFrame(this);
+		if (copyEngine){
+			myassert(copyReadsInFlight > 0);
+			copyReadsInFlight--;
+			scheduleCopyEngine(0);
+		}
+		addrint migPage = page;
+		auto rit = rolledBackMigrations.find(page);
+		if (rit != rolledBackMigrations.end()){
+			migPage = rit->second;
+		}
+		auto mit = migrations.find(migPage);
+		if (mit == migrations.end() || mit->second.id != frame.data[1]){
+			delete request;
+			return;
+		}
+	} else if (request->hasFrame(this)){
+		CallbackFrame frame = request->popFrame(this);
 		int pid = manager->getPidOfAddress(request->addr);
-		uint64 accessTime = timestamp - it->second.startTime;
-		if (caller == dram){
+		uint64 accessTime = timestamp - frame.timestamp;
+		unsigned tier = getTierOfMemory(caller);
+		if (tier == 0){
 			if (request->read){
 				dramReadTime += accessTime;
 				if (pid >= 0){
@@ -482,7 +632,7 @@ void HybridMemory::accessCompleted(MemoryRequest *request, IMemory *caller){
 					dramWriteTimePerPid[pid] += accessTime;
 				}
 			}
-		} else if (caller == pcm){
+		} else {
 			if (request->read){
 				pcmReadTime += accessTime;
 				if (pid >= 0){
@@ -494,17 +644,31 @@ void HybridMemory::accessCompleted(MemoryRequest *request, IMemory *caller){
 					pcmWriteTimePerPid[pid] += accessTime;
 				}
 			}
+		}
+		if (request->read){
+			tierReadTime[tier] += accessTime;
 		} else {
-			myassert(false);
+			tierWriteTime[tier] += accessTime;
 		}
-		IMemoryCallback *callback = it->second.callback;
-		request->addr = it->second.callbackAddr;
-		partOfMigration = it->second.partOfMigration;
+		request->addr = frame.addr;
+		partOfMigration = frame.data[1] != 0;
 		if (partOfMigration){
-			page = it->second.page;
+			page = frame.data[0];
+			//the migration may have been rolled back and finished while the read was in flight
+			addrint migPage = page;
+			auto rit = rolledBackMigrations.find(page);
+			if (rit != rolledBackMigrations.end()){
+				migPage = rit->second;
+			}
+			auto mit = migrations.find(migPage);
+			if (mit == migrations.end() || mit->second.id != frame.data[1]){
+				partOfMigration = false;
+			}
+		}
+		if (lineCacheSize > 0 && request->read && tier != 0 && !partOfMigration){
+			fillLine(request->addr);
 		}
-		callbacks.erase(it);
-		callback->accessCompleted(request, this);
+		frame.callback->accessCompleted(request, this);
 		calledBack = true;
 	}
 	if (partOfMigration){
@@ -527,11 +691,7 @@ void HybridMemory::accessCompleted(MemoryRequest *request, IMemory *caller){
 			if (mit->second.nextWriteBlock == -1){
 				mit->second.nextWriteBlock = block;
 				debug(": adding event: blocksLeftToWrite: %u", mit->second.blocksLeftToWrite);
-				if (mit->second.lastWrite + mit->second.writeDelay < timestamp){
-					addEvent(0, WRITE, mit->first);
-				} else {
-					addEvent(mit->second.lastWrite + mit->second.writeDelay - timestamp, WRITE, mit->first);
-				}
+				scheduleWrite(mit);
 			}
 			for (auto cit = mit->second.blocks[block].callers.begin(); cit != mit->second.blocks[block].callers.end(); ++cit){
 				cit->callback->accessCompleted(cit->request, this);
@@ -540,12 +700,11 @@ void HybridMemory::accessCompleted(MemoryRequest *request, IMemory *caller){
 			if (mit->second.src == dram){
 				dramCopyReads++;
 				dramCopyReadTime += (timestamp - mit->second.startPageCopyTime);
-			} else if (mit->second.src == pcm){
+			} else {
 				pcmCopyReads++;
 				pcmCopyReadTime += (timestamp - mit->second.startPageCopyTime);
-			} else {
-				myassert(false);
 			}
+			tierCopyReads[getTierOfMemory(mit->second.src)]++;
 		} else if(mit->second.blocks[block].state == BUFFERED){
 			//block became buffered because of a write to it since the read request was sent, ignore it
 			myassert(mit->second.blocks[block].request != request); //check request is different from
@@ -572,17 +731,7 @@ void HybridMemory::accessCompleted(MemoryRequest *request, IMemory *caller){
 		}
 		mit->second.blockLeftToCompleteRead--;
 		if (mit->second.blockLeftToCompleteRead == 0 && mit->second.blocksLeftToWrite == 0){
-			debug(": finish copy, src: %s, dest: %s", mit->second.src->getName(), mit->second.dest->getName());
-
-			if (mit->second.dest == dram){
-				dramPageCopyTime += (timestamp - mit->second.startPageCopyTime);
-			} else if ( mit->second.dest == pcm){
-				pcmPageCopyTime += (timestamp - mit->second.startPageCopyTime);
-			} else {
-				myassert(false);
-			}
-
-			manager->copyCompleted(mit->first);
+			finishCopy(mit);
 		}
 	}
 }
@@ -591,48 +740,52 @@ void HybridMemory::copyPage(addrint srcPage, addrint destPage){
 	uint64 timestamp = engine->getTimestamp();
 	debug("(%lu, %lu)", srcPage, destPage);
 	//cout << "copyPage: " << srcPage << ", " << destPage << endl;
-	addrint pcmPageOffset = manager->getIndex(pcmOffset);
-	if (srcPage < pcmPageOffset){
-		if (destPage < pcmPageOffset){
+	unsigned srcTier = getTierOfAddress(manager->getAddressFromBlock(srcPage, 0));
+	unsigned destTier = getTierOfAddress(manager->getAddressFromBlock(destPage, 0));
+	if (destTier == 0){
+		if (srcTier == 0){
 			error("Source and destination pages are both in DRAM")
 		} else {
-			auto p = migrations.emplace(srcPage, MigrationEntry(destPage, dram, pcm, pcmMigrationReadDelay, pcmMigrationWriteDelay, blocksPerPage, timestamp));
-			myassert(p.second);
-			debug(": %s(%lu) to %s(%lu)", dram->getName(), manager->getAddressFromBlock(srcPage, 0), pcm->getName(), manager->getAddressFromBlock(destPage, 0));
+			error("Destination is in DRAM");
+		}
+	} else if (srcTier == destTier){
+		error("Source and destination pages are both in %s", tiers[srcTier]->getName());
+	} else {
+		auto p = migrations.emplace(srcPage, MigrationEntry(destPage, tiers[srcTier], tiers[destTier], pcmMigrationReadDelay, pcmMigrationWriteDelay, blocksPerPage, timestamp, nextMigrationId++));
+		myassert(p.second);
+		debug(": %s(%lu) to %s(%lu)", tiers[srcTier]->getName(), manager->getAddressFromBlock(srcPage, 0), tiers[destTier]->getName(), manager->getAddressFromBlock(destPage, 0));
+		if (lineCacheSize > 0){
+			invalidateLines(srcPage);
+			invalidateLines(destPage);
+		}
+		startCopy();
 
-			if (fixedPcmMigrationCost){
-				addEvent(pcmMigrationCost, COPY, srcPage);
-			} else {
-				p.first->second.blocks.resize(blocksPerPage);
-				auto dit = dirties.find(srcPage);
-				if (dit != dirties.end()){
-					if(elideCleanDramBlocks){
-						int firstBlock = -1;
-						for (unsigned i = 0; i < blocksPerPage; i++){
-							if (dit->second[i]){
-								p.first->second.blocks[i].state = WRITTEN;
-								p.first->second.blocksLeftToWrite--;
-							} else {
-								if (firstBlock < 0){
-									firstBlock = i;
-								}
+		if (fixedPcmMigrationCost && srcTier == 0){
+			addEvent(pcmMigrationCost, COPY, srcPage);
+		} else {
+			p.first->second.blocks.resize(blocksPerPage);
+			auto dit = dirties.find(srcPage);
+			if (dit != dirties.end()){
+				if(elideCleanDramBlocks){
+					int firstBlock = -1;
+					for (unsigned i = 0; i < blocksPerPage; i++){
+						if (dit->second[i]){
+							p.first->second.blocks[i].state = WRITTEN;
+							p.first->second.blocksLeftToWrite--;
+						} else {
+							if (firstBlock < 0){
+								firstBlock = i;
 							}
 						}
-						p.first->second.nextReadBlock = firstBlock;
 					}
-					dirties.erase(dit);
+					p.first->second.nextReadBlock = firstBlock;
 				}
-				addEvent(0, READ, srcPage);
+				dirties.erase(dit);
 			}
-
-			pcmPageCopies++;
-		}
-	} else {
-		if (destPage < pcmPageOffset){
-			error("Destination is in DRAM");
-		} else {
-			error("Source and destination pages are both in PCM")
+			startReading(p.first);
 		}
+
+		pcmPageCopies++;
 	}
 }
 
@@ -645,11 +798,6 @@ void HybridMemory::finishMigration(addrint page){
 		auto rit = rolledBackMigrations.find(mit->second.destPage);
 		myassert(rit != rolledBackMigrations.end());
 		rolledBackMigrations.erase(rit);
-		for (auto cit = callbacks.begin(); cit != callbacks.end(); ++cit){
-			if (cit->second.partOfMigration && cit->second.page == page){
-				cit->second.partOfMigration = false;
-			}
-		}
 	} else {
 		if (mit->second.dest == dram){
 			auto dit = dirties.emplace(mit->second.destPage, vector<bool>(blocksPerPage));
@@ -661,16 +809,59 @@ void HybridMemory::finishMigration(addrint page){
 		auto monit = monitors.find(page);
 		if (monit != monitors.end()){
 			monit->second.page = mit->second.destPage;
-			bool ins = monitors.emplace(mit->second.destPage, monit->second).second;
-			myassert(ins);
+			auto p = monitors.emplace(mit->second.destPage, monit->second);
+			if (!p.second){
+				//with changed tags, the caches write back to the destination before the migration finishes
+				p.first->second.reads += monit->second.reads;
+				p.first->second.writes += monit->second.writes;
+				for (unsigned i = 0; i < blocksPerPage; i++){
+					p.first->second.readBlocks[i] += monit->second.readBlocks[i];
+					p.first->second.writtenBlocks[i] += monit->second.writtenBlocks[i];
+				}
+			}
 			monitors.erase(monit);
 		}
+		if (criticalBlockFirst){
+			//the destination frame might hold the history of the page that used it before
+			vector<bool> history;
+			auto hit = blockHistory.find(page);
+			if (hit != blockHistory.end()){
+				history.swap(hit->second);
+				blockHistory.erase(hit);
+			}
+			if (history.empty()){
+				blockHistory.erase(mit->second.destPage);
+			} else {
+				blockHistory[mit->second.destPage].swap(history);
+			}
+		}
+	}
+	//the copy can complete through demand reads while it is stalled
+	for (unsigned i = 0; i < tiers.size(); i++){
+		stalledOnRead[i].remove(page);
+		stalledOnWrite[i].remove(page);
 	}
 	migrations.erase(mit);
 }
 
+/*
+ * Starts reading the rest of an on-demand migration to DRAM without waiting for more accesses
+ */
 void HybridMemory::complete(addrint srcPage){
-
+	auto mit = migrations.find(srcPage);
+	myassert(mit != migrations.end());
+	if (mit->second.dest != dram || mit->second.readStarted || mit->second.blocksLeftToRead == 0){
+		return;
+	}
+	int block = 0;
+	auto bit = mit->second.blocks.begin();
+	while (bit != mit->second.blocks.end() && bit->state != NOT_READ){
+		++bit;
+		block++;
+	}
+	myassert(bit != mit->second.blocks.end());
+	mit->second.nextReadBlock = block;
+	startReading(mit);
 }
 
 void HybridMemory::rollback(addrint srcPage){
@@ -680,8 +871,18 @@ void HybridMemory::rollback(addrint srcPage){
 	myassert(mit != migrations.end());
 	myassert(mit->second.dest == dram);
 
-	mit->second.src = dram;
-	mit->second.dest = pcm;
+	//the copy changes direction, so it no longer waits for the tiers it stalled on
+	bool stalledOnWriting = false;
+	for (unsigned i = 0; i < tiers.size(); i++){
+		stalledOnRead[i].remove(srcPage);
+		auto sit = find(stalledOnWrite[i].begin(), stalledOnWrite[i].end(), srcPage);
+		if (sit != stalledOnWrite[i].end()){
+			stalledOnWrite[i].erase(sit);
+			stalledOnWriting = true;
+		}
+	}
+
+	swap(mit->second.src, mit->second.dest);
 	mit->second.blocksLeftToRead = 0;
 	mit->second.blockLeftToCompleteRead = 0;
 	mit->second.blocksLeftToWrite = 0;
@@ -692,7 +893,8 @@ void HybridMemory::rollback(addrint srcPage){
 		} else if (bit->state == READING){
 			bit->state = WRITTEN;
 			bit->request = 0;
-			//must ignore read when it comes back (don't send to DRAM)
+			//must ignore read when it comes back (don't send to DRAM), but its callers are answered then
+			mit->second.blockLeftToCompleteRead++;
 		} else if (bit->state == BUFFERED){
 			if (bit->dirty){
 				bit->state = BUFFERED;
@@ -718,7 +920,7 @@ void HybridMemory::rollback(addrint srcPage){
 		}
 	}
 	debug(": blocksLeftToRead: %u, blocksLeftToWrite: %u", mit->second.blocksLeftToRead, mit->second.blocksLeftToWrite);
-	if (mit->second.blocksLeftToRead == 0 && mit->second.blocksLeftToWrite == 0){
+	if (mit->second.blockLeftToCompleteRead == 0 && mit->second.blocksLeftToWrite == 0){
 		addEvent(1, COPY, mit->first);
 	} else {
 		if (mit->second.blocksLeftToRead > 0){
@@ -731,7 +933,7 @@ void HybridMemory::rollback(addrint srcPage){
 			}
 			myassert(bit != mit->second.blocks.end());
 			mit->second.nextReadBlock = block;
-			addEvent(0, READ, mit->first);
+			startReading(mit);
 		}
 		if (mit->second.blocksLeftToWrite > 0){
 			int block = 0;
@@ -742,9 +944,9 @@ void HybridMemory::rollback(addrint srcPage){
 				block++;
 			}
 			if (it != mit->second.blocks.end()){
-				if (mit->second.nextWriteBlock == -1){
+				if (mit->second.nextWriteBlock == -1 || stalledOnWriting){
 					debug(": adding event: blocksLeftToWrite: %u", mit->second.blocksLeftToWrite);
-					addEvent(0, WRITE, mit->first);
+					scheduleWrite(mit);
 				}
 				mit->second.nextWriteBlock = block;
 			} else {
@@ -756,19 +958,46 @@ void HybridMemory::rollback(addrint srcPage){
 	myassert(ins);
 }
 
+const char* HybridMemory::getEventName(const Event *event) const {
+	static const char *names[] = {"COPY", "READ", "WRITE", "NOTIFY", "COPY_ENGINE", "IDLE_COPY"};
+	return names[reinterpret_cast<EventData *>(event->getData())->type];
+}
+
 void HybridMemory::process(const Event *event){
 	uint64 timestamp = engine->getTimestamp();
 	EventData *data = reinterpret_cast<EventData *>(event->getData());
 	debug("(): type: %d, page %lu", data->type, data->page);
+	if (data->type == READ || data->type == WRITE){
+		//a copy can finish through demand reads while it still has events scheduled
+		auto mit = migrations.find(data->page);
+		if (mit == migrations.end() || mit->second.id != data->id){
+			delete data;
+			return;
+		}
+	}
 	if (data->type == COPY){
 		auto mit = migrations.find(data->page);
 		myassert(mit != migrations.end());
-		pcmPageCopyTime += (timestamp - mit->second.startPageCopyTime);
-		manager->copyCompleted(mit->first);
+		myassert(mit->second.dest != dram);
+		finishCopy(mit);
 	} else if (data->type == READ){
 		auto mit = migrations.find(data->page);
 		myassert(mit != migrations.end());
-		if (mit->second.blocksLeftToRead > 0){
+		if (!mit->second.readStarted){
+			//only the critical blocks are read until the rest of the page starts being read
+			int block = getCriticalBlock(mit);
+			if (block >= 0){
+				unsigned srcTier = getTierOfMemory(mit->second.src);
+				if (stalledOnRead[srcTier].empty() && readBlock(mit, block)){
+					//the read might have left only completionThreshold blocks, and then the rest of the page is being read
+					if (!mit->second.readStarted && getCriticalBlock(mit) >= 0){
+						addEvent(mit->second.readDelay, READ, data->page, data->id);
+					}
+				} else {
+					stalledOnRead[srcTier].emplace_back(mit->first);
+				}
+			}
+		} else if (mit->second.blocksLeftToRead > 0){
 			auto it = mit->second.blocks.begin();
 			it += mit->second.nextReadBlock;
 			myassert(it != mit->second.blocks.end());
@@ -780,24 +1009,9 @@ void HybridMemory::process(const Event *event){
 				}
 			}
 			if (it != mit->second.blocks.end()){
-				bool created = false;
-				if (it->request == 0){
-					created = true;
-					addrint srcPage;
-					if (mit->second.rolledBack){
-						srcPage = mit->second.destPage;
-					} else {
-						srcPage = mit->first;
-					}
-					it->request = new MemoryRequest(manager->getAddressFromBlock(srcPage, mit->second.nextReadBlock), blockSize, true, false, LOW);
-					debug(": new memoryRequest: %p", it->request);
-				}
 				debug(": blocksLeftToWrite: %u", mit->second.blocksLeftToWrite);
-				debug(": %s.access(%p, %lu, %u, %s, %s, %d)", mit->second.src->getName(), it->request, it->request->addr, it->request->size, it->request->read?"read":"write", it->request->instr?"instr":"data", it->request->priority);
-				if (stalledOnRead.empty() && mit->second.src->access(it->request, this)){
-					it->state = READING;
-					it->startTime = timestamp;
-					mit->second.blocksLeftToRead--;
+				unsigned srcTier = getTierOfMemory(mit->second.src);
+				if (stalledOnRead[srcTier].empty() && readBlock(mit, mit->second.nextReadBlock)){
 					auto bit = mit->second.blocks.begin();
 					int block = 0;
 					while (bit != mit->second.blocks.end() && bit->state != NOT_READ){
@@ -806,22 +1020,18 @@ void HybridMemory::process(const Event *event){
 					}
 					if (bit != mit->second.blocks.end()){
 						mit->second.nextReadBlock = block;
-						addEvent(mit->second.readDelay, READ, data->page);
+						addEvent(mit->second.readDelay, READ, data->page, data->id);
 					}
 				} else{
-					if (created){
-						delete(it->request);
-						it->request = 0;
-					}
-					stalledOnRead.emplace_back(mit->first);
+					stalledOnRead[srcTier].emplace_back(mit->first);
 				}
 			}
 		}
 	} else if (data->type == WRITE){
 		auto mit = migrations.find(data->page);
 		myassert(mit != migrations.end());
-		if (mit->second.blocksLeftToWrite > 0){
-			myassert(mit->second.nextWriteBlock != -1);
+		//a copy that was rolled back might have no block to write until its reads complete
+		if (mit->second.blocksLeftToWrite > 0 && mit->second.nextWriteBlock != -1){
 			auto it = mit->second.blocks.begin();
 			it += mit->second.nextWriteBlock;
 			debug(": nextWriteBlock: %d", mit->second.nextWriteBlock);
@@ -834,66 +1044,19 @@ void HybridMemory::process(const Event *event){
 				}
 			}
 			myassert(it->state == BUFFERED);
-			addrint destPage;
-			if (mit->second.rolledBack){
-				destPage = mit->first;
-			} else {
-				destPage = mit->second.destPage;
-			}
-			if(it->request == 0){
-				it->request = new MemoryRequest(manager->getAddressFromBlock(destPage, mit->second.nextWriteBlock), blockSize, false, false, LOW);
-			} else {
-				it->request->addr = manager->getAddressFromBlock(destPage, mit->second.nextWriteBlock);
-				it->request->read = false;
-			}
-			debug(": %s.access(%p, %lu, %u, %s, %s, %d", mit->second.dest->getName(), it->request, it->request->addr, it->request->size, it->request->read?"read":"write", it->request->instr?"instr":"data", it->request->priority);
-			if (stalledOnWrite.empty() && mit->second.dest->access(it->request, this)){
+			unsigned destTier = getTierOfMemory(mit->second.dest);
+			if (stalledOnWrite[destTier].empty() && writeBlock(mit, mit->second.nextWriteBlock)){
 				debug(": not stalled");
-				if (mit->second.dest == dram){
-					dramCopyWrites++;
-				} else if (mit->second.dest == pcm){
-					pcmCopyWrites++;
-				} else {
-					myassert(false);
-				}
-				it->state = WRITTEN;
-				it->startTime = timestamp;
-				mit->second.lastWrite = timestamp;
-
-				mit->second.blocksLeftToWrite--;
-				debug(": blocksLeftToWrite: %u", mit->second.blocksLeftToWrite);
-				if (mit->second.blocksLeftToWrite > 0){
-					int block = 0;
-					//find first block in BUFFERED state
-					auto it = mit->second.blocks.begin();
-					while (it != mit->second.blocks.end() && it->state != BUFFERED){
-						++it;
-						block++;
-					}
+				if (mit->second.nextWriteBlock != -1){
 					debug(": adding event: blocksLeftToWrite: %u", mit->second.blocksLeftToWrite);
-					if (it != mit->second.blocks.end()){
-						mit->second.nextWriteBlock = block;
-						addEvent(mit->second.writeDelay, WRITE, data->page);
-					} else {
-						mit->second.nextWriteBlock = -1;
-					}
+					addEvent(mit->second.writeDelay, WRITE, data->page, data->id);
 				}
 				if (mit->second.blocksLeftToWrite == 0 && mit->second.blockLeftToCompleteRead == 0){
-					debug(": finish copy, src: %s, dest: %s", mit->second.src->getName(), mit->second.dest->getName());
-
-					if (mit->second.dest == dram){
-						dramPageCopyTime += (timestamp - mit->second.startPageCopyTime);
-					} else if ( mit->second.dest == pcm){
-						pcmPageCopyTime += (timestamp - mit->second.startPageCopyTime);
-					} else {
-						myassert(false);
-					}
-
-					manager->copyCompleted(mit->first);
+					finishCopy(mit);
 				}
 			} else {
 				debug(": stalled");
-				stalledOnWrite.emplace_back(mit->first);
+				stalledOnWrite[destTier].emplace_back(mit->first);
 			}
 		}
 
@@ -903,6 +1066,17 @@ void HybridMemory::process(const Event *event){
 			it->callback->accessCompleted(it->request, this);
 		}
 		notifications.clear();
+	} else if (data->type == COPY_ENGINE){
+		runCopyEngine();
+	} else if (data->type == IDLE_COPY){
+		auto mit = migrations.find(data->page);
+		//stops when the copy finishes, is rolled back or starts reading the rest of the page
+		if (mit != migrations.end() && mit->second.id == data->id && !mit->second.rolledBack && !mit->second.readStarted && mit->second.blocksLeftToRead > 0){
+			copyIdleBlock(mit);
+			if (mit->second.blocksLeftToRead > 0){
+				addEvent(idleCopyPeriod, IDLE_COPY, data->page, data->id);
+			}
+		}
 	} else {
 		myassert(false);
 	}
@@ -912,46 +1086,51 @@ void HybridMemory::process(const Event *event){
 void HybridMemory::unstall(IMemory *caller){
 	uint64 timestamp = engine->getTimestamp();
 	debug("(%s)", caller->getName());
-	if (caller == dram){
-		if (!dramStalledCallers.empty()){
-			for (auto it = dramStalledCallers.begin(); it != dramStalledCallers.end(); ++it){
-				(*it)->unstall(this);
-			}
-			dramStalledCallers.clear();
+	unsigned tier = getTierOfMemory(caller);
+	if (!stalledCallers[tier].empty()){
+		for (auto it = stalledCallers[tier].begin(); it != stalledCallers[tier].end(); ++it){
+			(*it)->unstall(this);
 		}
-	} else if (caller == pcm){
-		if (!pcmStalledCallers.empty()){
-			for (auto it = pcmStalledCallers.begin(); it != pcmStalledCallers.end(); ++it){
-				(*it)->unstall(this);
-			}
-			pcmStalledCallers.clear();
-		}
-	} else {
-		myassert(false);
+		stalledCallers[tier].clear();
 	}
 
-	for (auto it = stalledOnRead.begin(); it != stalledOnRead.end(); ++it){
+	//copies that stalled on other tiers wait for those tiers to unstall
+	for (auto it = stalledOnRead[tier].begin(); it != stalledOnRead[tier].end(); ++it){
 		auto mit = migrations.find(*it);
 		myassert(mit != migrations.end());
-		if (mit->second.src == caller){
-			//delay 2 cycles so that regular request have higher priority while unstalling
-			addEvent(2, READ, *it);
-		}
+		//delay 2 cycles so that regular request have higher priority while unstalling
+		addEvent(2, READ, *it, mit->second.id);
 	}
-	stalledOnRead.clear();
-	for (auto it = stalledOnWrite.begin(); it != stalledOnWrite.end(); ++it){
+	stalledOnRead[tier].clear();
+	for (auto it = stalledOnWrite[tier].begin(); it != stalledOnWrite[tier].end(); ++it){
 		auto mit = migrations.find(*it);
 		myassert(mit != migrations.end());
-		if (mit->second.dest == caller){
-			//delay 2 cycles so that regular request have higher priority while unstalling
-			addEvent(2, WRITE, *it);
-		}
+		//delay 2 cycles so that regular request have higher priority while unstalling
+		addEvent(2, WRITE, *it, mit->second.id);
+	}
+	stalledOnWrite[tier].clear();
+	auto cit = copyEngineStalled.find(tiers[tier]);
+	if (cit != copyEngineStalled.end()){
+		copyEngineStalled.erase(cit);
+		//delay 2 cycles so that regular request have higher priority while unstalling
+		scheduleCopyEngine(2);
 	}
-	stalledOnWrite.clear();
 }
 
 void HybridMemory::readCountsAndProgress(vector<CountEntry> *monitor, vector<ProgressEntry> *progress){
 	for (auto monit = monitors.begin(); monit != monitors.end(); ++monit){
+		if (lineCacheMigrationBlocks > 0 && getTierOfAddress(manager->getAddressFromBlock(monit->first, 0)) != 0){
+			//pages below DRAM with few accessed blocks are left to the line cache instead of the migration policies
+			unsigned accessedBlocks = 0;
+			for (unsigned i = 0; i < blocksPerPage; i++){
+				if (monit->second.readBlocks[i] != 0 || monit->second.writtenBlocks[i] != 0){
+					accessedBlocks++;
+				}
+			}
+			if (accessedBlocks < lineCacheMigrationBlocks){
+				continue;
+			}
+		}
 		monitor->emplace_back(monit->second);
 	}
 	monitors.clear();
@@ -965,18 +1144,475 @@ void HybridMemory::setManager(HybridMemoryManager *managerArg) {
 }
 
 uint64 HybridMemory::getDramSize() {
-	return dram->getSize();
+	return dram->getSize() - lineCacheSize;
 }
 
 uint64 HybridMemory::getPcmSize() {
 	return pcm->getSize();
 }
 
-void HybridMemory::addEvent(uint64 delay, EventType type, addrint page){
-	EventData *data = new EventData(type, page);
+uint64 HybridMemory::getTierSize(unsigned tier) {
+	return tiers[tier]->getSize();
+}
+
+uint64 HybridMemory::getQueueStallTime() const {
+	uint64 time = 0;
+	for (auto it = tiers.begin(); it != tiers.end(); ++it){
+		time += (*it)->getQueueStallTime();
+	}
+	return time;
+}
+
+void HybridMemory::startCopy(){
+	if (copiesInProgress == 0){
+		copyStartTime = engine->getTimestamp();
+	}
+	copiesInProgress++;
+}
+
+void HybridMemory::startReading(MigrationTable::iterator mit){
+	mit->second.readStarted = true;
+	if (copyEngine){
+		copyQueue.emplace(mit->second.id, mit->first);
+		scheduleCopyEngine(0);
+	} else {
+		addEvent(0, READ, mit->first, mit->second.id);
+	}
+}
+
+void HybridMemory::startCriticalReading(MigrationTable::iterator mit){
+	if (copyEngine){
+		copyQueue.emplace(mit->second.id, mit->first);
+		scheduleCopyEngine(0);
+	} else {
+		addEvent(0, READ, mit->first, mit->second.id);
+	}
+}
+
+/*
+ * Starts reading the rest of an on-demand migration to DRAM once only completionThreshold blocks are left.
+ * Critical and idle block reads also count, so the threshold can be reached from any of them.
+ */
+void HybridMemory::startReadingAtThreshold(MigrationTable::iterator mit){
+	if (mit->second.blocksLeftToRead <= completionThreshold){
+		complete(mit->first);
+	}
+}
+
+int HybridMemory::getCriticalBlock(MigrationTable::iterator mit){
+	for (unsigned i = 0; i < mit->second.blocks.size(); i++){
+		if (mit->second.blocks[i].critical && mit->second.blocks[i].state == NOT_READ){
+			return i;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Reads the first block of the page that is not critical and whose bank in the source memory has no
+ * queued requests. Blocks that are never read this way are read on demand or when the page completes.
+ */
+void HybridMemory::copyIdleBlock(MigrationTable::iterator mit){
+	unsigned srcTier = getTierOfMemory(mit->second.src);
+	if (!stalledOnRead[srcTier].empty()){
+		return;
+	}
+	for (unsigned i = 0; i < blocksPerPage; i++){
+		if (mit->second.blocks[i].state == NOT_READ && !mit->second.blocks[i].critical && mit->second.src->isBankIdle(manager->getAddressFromBlock(mit->first, i))){
+			if (readBlock(mit, i)){
+				idleBlockCopies++;
+			}
+			return;
+		}
+	}
+}
+
+void HybridMemory::scheduleWrite(MigrationTable::iterator mit){
+	uint64 timestamp = engine->getTimestamp();
+	if (copyEngine){
+		copyQueue.emplace(mit->second.id, mit->first);
+		scheduleCopyEngine(0);
+	} else if (mit->second.lastWrite + mit->second.writeDelay < timestamp){
+		addEvent(0, WRITE, mit->first, mit->second.id);
+	} else {
+		addEvent(mit->second.lastWrite + mit->second.writeDelay - timestamp, WRITE, mit->first, mit->second.id);
+	}
+}
+
+bool HybridMemory::readBlock(MigrationTable::iterator mit, unsigned block){
+	uint64 timestamp = engine->getTimestamp();
+	auto it = mit->second.blocks.begin() + block;
+	myassert(it->state == NOT_READ);
+	bool created = false;
+	if (it->request == 0){
+		created = true;
+		addrint srcPage;
+		if (mit->second.rolledBack){
+			srcPage = mit->second.destPage;
+		} else {
+			srcPage = mit->first;
+		}
+		it->request = new MemoryRequest(manager->getAddressFromBlock(srcPage, block), blockSize, true, false, LOW);
+		debug(": new memoryRequest: %p", it->request);
+	}
+	//the memory makes the address relative to its offset
+	addrint addr = it->request->addr;
+	debug(": %s.access(%p, %lu, %u, %s, %s, %d)", mit->second.src->getName(), it->request, it->request->addr, it->request->size, it->request->read?"read":"write", it->request->instr?"instr":"data", it->request->priority);
+	//the frame has no callback: it only identifies the migration when the read returns
+	myassert(it->request->canPushFrame());
+	it->request->pushFrame(this, 0, addr, timestamp, 0, mit->second.id);
+	if (mit->second.src->access(it->request, this)){
+		it->state = READING;
+		it->startTime = timestamp;
+		mit->second.blocksLeftToRead--;
+		countCopyRow(mit->second.src, addr);
+		if (copyEngine){
+			copyReadsInFlight++;
+		}
+		startReadingAtThreshold(mit);
+		return true;
+	} else {
+		myassert(it->request->hasFrame(this));
+		it->request->popFrame(this);
+		if (created){
+			delete it->request;
+			it->request = 0;
+		}
+		return false;
+	}
+}
+
+bool HybridMemory::writeBlock(MigrationTable::iterator mit, unsigned block){
+	uint64 timestamp = engine->getTimestamp();
+	auto it = mit->second.blocks.begin() + block;
+	myassert(it->state == BUFFERED);
+	addrint destPage;
+	if (mit->second.rolledBack){
+		destPage = mit->first;
+	} else {
+		destPage = mit->second.destPage;
+	}
+	if(it->request == 0){
+		it->request = new MemoryRequest(manager->getAddressFromBlock(destPage, block), blockSize, false, false, LOW);
+	} else {
+		it->request->addr = manager->getAddressFromBlock(destPage, block);
+		it->request->read = false;
+	}
+	addrint addr = it->request->addr;
+	debug(": %s.access(%p, %lu, %u, %s, %s, %d", mit->second.dest->getName(), it->request, it->request->addr, it->request->size, it->request->read?"read":"write", it->request->instr?"instr":"data", it->request->priority);
+	if (!mit->second.dest->access(it->request, this)){
+		return false;
+	}
+	if (mit->second.dest == dram){
+		dramCopyWrites++;
+	} else {
+		pcmCopyWrites++;
+	}
+	tierCopyWrites[getTierOfMemory(mit->second.dest)]++;
+	countCopyRow(mit->second.dest, addr);
+	copyBytes += blockSize;
+	it->state = WRITTEN;
+	it->startTime = timestamp;
+	mit->second.lastWrite = timestamp;
+
+	mit->second.blocksLeftToWrite--;
+	debug(": blocksLeftToWrite: %u", mit->second.blocksLeftToWrite);
+	//find first block in BUFFERED state
+	int next = 0;
+	auto bit = mit->second.blocks.begin();
+	while (bit != mit->second.blocks.end() && bit->state != BUFFERED){
+		++bit;
+		next++;
+	}
+	if (bit != mit->second.blocks.end()){
+		mit->second.nextWriteBlock = next;
+	} else {
+		mit->second.nextWriteBlock = -1;
+	}
+	return true;
+}
+
+void HybridMemory::finishCopy(MigrationTable::iterator mit){
+	uint64 timestamp = engine->getTimestamp();
+	debug(": finish copy, src: %s, dest: %s", mit->second.src->getName(), mit->second.dest->getName());
+	if (mit->second.dest == dram){
+		dramPageCopyTime += (timestamp - mit->second.startPageCopyTime);
+	} else {
+		pcmPageCopyTime += (timestamp - mit->second.startPageCopyTime);
+	}
+	tierPageCopies[getTierOfMemory(mit->second.dest)]++;
+	myassert(copiesInProgress > 0);
+	copiesInProgress--;
+	if (copiesInProgress == 0){
+		copyBusyCycles += timestamp - copyStartTime;
+	}
+	//the manager might finish the migration right away, which invalidates mit
+	manager->copyCompleted(mit->first);
+}
+
+void HybridMemory::countCopyRow(Memory *memory, addrint addr){
+	vector<addrint>& rows = copyRows[getTierOfMemory(memory)];
+	unsigned bank = memory->getBankId(addr);
+	addrint row = memory->getRowIndex(addr);
+	if (rows[bank] == row){
+		copyRowHits++;
+	} else {
+		rows[bank] = row;
+	}
+}
+
+uint64 HybridMemory::getCopyBusyTime(){
+	if (copiesInProgress == 0){
+		return copyBusyCycles;
+	} else {
+		return copyBusyCycles + engine->getTimestamp() - copyStartTime;
+	}
+}
+
+void HybridMemory::scheduleCopyEngine(uint64 delay){
+	if (!copyEngineScheduled){
+		copyEngineScheduled = true;
+		addEvent(delay, COPY_ENGINE);
+	}
+}
+
+void HybridMemory::runCopyEngine(){
+	copyEngineScheduled = false;
+	//select the oldest migrations with blocks ready to be read or written
+	vector<MigrationTable::iterator> batch;
+	auto qit = copyQueue.begin();
+	while (qit != copyQueue.end() && batch.size() < copyBatchSize){
+		auto mit = migrations.find(qit->second);
+		bool ready = false;
+		if (mit != migrations.end() && mit->second.id == qit->first){
+			ready = mit->second.blocksLeftToRead > 0 && (mit->second.readStarted || getCriticalBlock(mit) >= 0);
+			for (auto bit = mit->second.blocks.begin(); !ready && bit != mit->second.blocks.end(); ++bit){
+				ready = bit->state == BUFFERED;
+			}
+		}
+		if (ready){
+			batch.emplace_back(mit);
+			++qit;
+		} else {
+			//migrations are added back when they have blocks to copy again
+			qit = copyQueue.erase(qit);
+		}
+	}
+
+	vector<CopyBlock> reads, writes;
+	for (auto it = batch.begin(); it != batch.end(); ++it){
+		auto mit = *it;
+		addrint srcPage, destPage;
+		if (mit->second.rolledBack){
+			srcPage = mit->second.destPage;
+			destPage = mit->first;
+		} else {
+			srcPage = mit->first;
+			destPage = mit->second.destPage;
+		}
+		for (unsigned i = 0; i < mit->second.blocks.size(); i++){
+			if (mit->second.blocks[i].state == BUFFERED){
+				addrint addr = manager->getAddressFromBlock(destPage, i);
+				writes.emplace_back(mit->second.id, mit->first, i, mit->second.dest, mit->second.dest->getBankId(addr), mit->second.dest->getRowIndex(addr));
+			} else if (mit->second.blocks[i].state == NOT_READ && (mit->second.readStarted || mit->second.blocks[i].critical)){
+				addrint addr = manager->getAddressFromBlock(srcPage, i);
+				reads.emplace_back(mit->second.id, mit->first, i, mit->second.src, mit->second.src->getBankId(addr), mit->second.src->getRowIndex(addr));
+			}
+		}
+	}
+	//writes first, since they free buffer space and do not count against the window
+	issueCopyBlocks(&writes, false);
+	issueCopyBlocks(&reads, true);
+}
+
+void HybridMemory::issueCopyBlocks(vector<CopyBlock> *blocks, bool read){
+	while (!blocks->empty() && (!read || copyReadsInFlight < copyWindow)){
+		//prefer a block in the row that was last accessed in its bank
+		auto bit = blocks->begin();
+		for (auto it = blocks->begin(); it != blocks->end(); ++it){
+			vector<addrint>& rows = copyRows[getTierOfMemory(it->memory)];
+			if (rows[it->bank] == it->row){
+				bit = it;
+				break;
+			}
+		}
+		CopyBlock copyBlock = *bit;
+		blocks->erase(bit);
+		if (copyEngineStalled.find(copyBlock.memory) != copyEngineStalled.end()){
+			continue;
+		}
+		//a previous block might have completed the copy or the migration might have been rolled back
+		auto mit = migrations.find(copyBlock.srcPage);
+		if (mit == migrations.end() || mit->second.id != copyBlock.id){
+			continue;
+		}
+		if (read){
+			if (mit->second.blocks[copyBlock.block].state != NOT_READ || mit->second.src != copyBlock.memory){
+				continue;
+			}
+			if (!readBlock(mit, copyBlock.block)){
+				copyEngineStalled.insert(copyBlock.memory);
+			}
+		} else {
+			if (mit->second.blocks[copyBlock.block].state != BUFFERED || mit->second.dest != copyBlock.memory){
+				continue;
+			}
+			if (writeBlock(mit, copyBlock.block)){
+				if (mit->second.blocksLeftToWrite == 0 && mit->second.blockLeftToCompleteRead == 0){
+					finishCopy(mit);
+				}
+			} else {
+				copyEngineStalled.insert(copyBlock.memory);
+			}
+		}
+	}
+}
+
+void HybridMemory::addEvent(uint64 delay, EventType type, addrint page, uint64 id){
+	EventData *data = new EventData(type, page, id);
 	engine->addEvent(delay, this, reinterpret_cast<uintptr_t>(data));
 }
 
+unsigned HybridMemory::getTierOfAddress(addrint addr) const {
+	unsigned tier = 0;
+	while (addr >= tierEnds[tier]){
+		tier++;
+		myassert(tier < tierEnds.size());
+	}
+	return tier;
+}
+
+unsigned HybridMemory::getTierOfMemory(const IMemory *memory) const {
+	for (unsigned i = 0; i < tiers.size(); i++){
+		if (tiers[i] == memory){
+			return i;
+		}
+	}
+	myassert(false);
+	return 0;
+}
+
+HybridMemory::LineEntry *HybridMemory::findLine(addrint addr){
+	addrint tag = addr / blockSize;
+	auto first = lineCache.begin() + (tag % lineCacheSets) * lineCacheAssoc;
+	for (auto it = first; it != first + lineCacheAssoc; ++it){
+		if (it->state != INVALID && it->tag == tag){
+			return &*it;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Sends an access to a page below DRAM to the line cache if the block is there, or to the tier of the page
+ * otherwise. Writes that miss are not allocated. Returns false if the memory that has to serve the access is stalled.
+ */
+bool HybridMemory::accessLineCache(MemoryRequest *request, IMemoryCallback *caller, addrint callbackAddr){
+	uint64 timestamp = engine->getTimestamp();
+	addrint addr = request->addr;
+	bool read = request->read;
+	LineEntry *line = findLine(addr);
+	if (line != 0 && (line->state == VALID || !read)){
+		request->addr = getLineAddress(line) + addr % blockSize;
+		debug(": line cache hit: %lu", request->addr);
+		if (!accessNextLevel(request, caller, callbackAddr, false, 0)){
+			return false;
+		}
+		line->lastUse = lineCacheUses++;
+		if (read){
+			lineCacheReadHits++;
+			readsFromDram++;
+		} else {
+			//a fill that is still in flight is dropped when it returns
+			line->state = VALID;
+			line->dirty = true;
+			lineCacheWriteHits++;
+			writesToDram++;
+		}
+	} else {
+		if (!accessNextLevel(request, caller, callbackAddr, false, 0)){
+			return false;
+		}
+		if (read){
+			lineCacheReadMisses++;
+			readsFromPcm++;
+			if (line == 0){
+				allocateLine(addr);
+			}
+		} else {
+			lineCacheWriteMisses++;
+			writesToPcm++;
+		}
+	}
+	return true;
+}
+
+/*
+ * Replaces the least recently used line of the set. A dirty victim is written back to its tier; the read of
+ * the victim from DRAM is not modeled. The line is not allocated if the tier of the victim is stalled.
+ */
+void HybridMemory::allocateLine(addrint addr){
+	addrint tag = addr / blockSize;
+	auto first = lineCache.begin() + (tag % lineCacheSets) * lineCacheAssoc;
+	auto victim = first;
+	for (auto it = first; it != first + lineCacheAssoc; ++it){
+		if (it->state == INVALID){
+			victim = it;
+			break;
+		}
+		if (it->lastUse < victim->lastUse){
+			victim = it;
+		}
+	}
+	if (victim->state != INVALID && victim->dirty){
+		addrint victimAddr = victim->tag * blockSize;
+		unsigned victimTier = getTierOfAddress(victimAddr);
+		MemoryRequest *writeback = new MemoryRequest(victimAddr, blockSize, false, false, LOW);
+		if (!stalledCallers[victimTier].empty() || !tiers[victimTier]->access(writeback, this)){
+			delete writeback;
+			return;
+		}
+		lineCacheWritebacks++;
+	}
+	victim->state = FILLING;
+	victim->dirty = false;
+	victim->tag = tag;
+	victim->lastUse = lineCacheUses++;
+}
+
+void HybridMemory::fillLine(addrint addr){
+	LineEntry *line = findLine(addr);
+	if (line != 0 && line->state == FILLING){
+		MemoryRequest *fill = new MemoryRequest(getLineAddress(line), blockSize, false, false, LOW);
+		if (stalledCallers[0].empty() && dram->access(fill, this)){
+			line->state = VALID;
+			lineCacheFills++;
+		} else {
+			delete fill;
+			line->state = INVALID;
+		}
+	}
+}
+
+/*
+ * Called when a page starts being copied. Dirty lines are dropped as well: the copy is assumed to read
+ * them from the line cache instead of from the source page.
+ */
+void HybridMemory::invalidateLines(addrint page){
+	for (unsigned i = 0; i < blocksPerPage; i++){
+		LineEntry *line = findLine(manager->getAddressFromBlock(page, i));
+		if (line != 0){
+			line->state = INVALID;
+			line->dirty = false;
+			lineCacheInvalidations++;
+		}
+	}
+}
+
+addrint HybridMemory::getLineAddress(const LineEntry *line) const {
+	return lineCacheOffset + (line - &lineCache[0]) * blockSize;
+}
+
 
 
 //Old Hybrid Memory:
@@ -1256,6 +1892,11 @@ bool OldHybridMemory::access(MemoryRequest *request, IMemoryCallback *caller){
 		}
 	}
 
+	//the frame goes below the one pushed by the next level, so it is pushed first and popped if the next level is stalled
+	if (request->read){
+		myassert(request->canPushFrame());
+		request->pushFrame(this, caller, callbackAddr, timestamp);
+	}
 	int pid = manager->getPidOfAddress(request->addr);
 	if (request->addr < pcmOffset){
 		if (dramStalledCallers.empty() && dram->access(request, this)){
@@ -1274,6 +1915,10 @@ bool OldHybridMemory::access(MemoryRequest *request, IMemoryCallback *caller){
 			}
 		} else {
 			dramStalledCallers.insert(caller);
+			if (request->read){
+				myassert(request->hasFrame(this));
+				request->popFrame(this);
+			}
 			request->addr = callbackAddr;
 			return false;
 		}
@@ -1294,6 +1939,10 @@ bool OldHybridMemory::access(MemoryRequest *request, IMemoryCallback *caller){
 			}
 		} else {
 			pcmStalledCallers.insert(caller);
+			if (request->read){
+				myassert(request->hasFrame(this));
+				request->popFrame(this);
+			}
 			request->addr = callbackAddr;
 			return false;
 		}
@@ -1313,20 +1962,16 @@ bool OldHybridMemory::access(MemoryRequest *request, IMemoryCallback *caller){
 		//Write request completed, so don't do anything (latest write will overwrite migration write)
 	}
 
-	if (request->read){
-		callbacks.emplace(request, CallbackEntry(caller, timestamp));
-	}
 	return true;
 }
 
 void OldHybridMemory::accessCompleted(MemoryRequest *request, IMemory *caller){
 	uint64 timestamp = engine->getTimestamp();
 	debug("(%p, %s, %s)", request, request->read ? "read" : "write", caller->getName());
-	multimap<MemoryRequest *, CallbackEntry>::iterator it = callbacks.find(request);
-	if (it != callbacks.end()){
-
+	if (request->hasFrame(this)){
+		CallbackFrame frame = request->popFrame(this);
 		int pid = manager->getPidOfAddress(request->addr);
-		uint64 accessTime = timestamp - it->second.startTime;
+		uint64 accessTime = timestamp - frame.timestamp;
 		if (caller == dram){
 			if (request->read){
 				dramReadTime += accessTime;
@@ -1358,9 +2003,7 @@ void OldHybridMemory::accessCompleted(MemoryRequest *request, IMemory *caller){
 		} else {
 			myassert(false);
 		}
-		IMemoryCallback *callback = it->second.callback;
-		callbacks.erase(it);
-		callback->accessCompleted(request, this);
+		frame.callback->accessCompleted(request, this);
 	} else {
 		addrint index = manager->getIndex(request->addr);
 		addrint offset = manager->getOffset(request->addr);
@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) 2015 Santiago Bock
+ *
+ * See the file LICENSE.txt for copying permission.
+ */
+
+#include "IntervalStats.H"
+#include "Error.H"
+
+#include <sstream>
+
+static const char INTERVAL_MAGIC[8] = {'H', 'M', 'M', 'I', 'S', 'T', '1', '\0'};
+
+static const unsigned BUFFER_SIZE = 1 << 20;
+
+istream& operator>>(istream& lhs, IntervalStatsFormat& rhs){
+	string s;
+	lhs >> s;
+	if (s == "text"){
+		rhs = TEXT_INTERVAL_STATS;
+	} else if (s == "binary"){
+		rhs = BINARY_INTERVAL_STATS;
+	} else if (s == "gzip"){
+		rhs = GZIP_INTERVAL_STATS;
+	} else {
+		error("Invalid interval statistics format: %s", s.c_str());
+	}
+	return lhs;
+}
+
+ostream& operator<<(ostream& lhs, IntervalStatsFormat rhs){
+	if (rhs == TEXT_INTERVAL_STATS){
+		lhs << "text";
+	} else if (rhs == BINARY_INTERVAL_STATS){
+		lhs << "binary";
+	} else if (rhs == GZIP_INTERVAL_STATS){
+		lhs << "gzip";
+	} else {
+		error("Invalid interval statistics format");
+	}
+	return lhs;
+}
+
+IntervalStatsWriter::IntervalStatsWriter(const string& filenameArg, bool compress) : filename(filenameArg), headerWritten(false) {
+	//"T" writes the file without compression
+	file = gzopen(filename.c_str(), compress ? "wb1" : "wbT");
+	if (file == 0){
+		error("Could not open interval statistics file '%s'", filename.c_str());
+	}
+	gzbuffer(file, BUFFER_SIZE);
+}
+
+IntervalStatsWriter::~IntervalStatsWriter(){
+	close();
+}
+
+void IntervalStatsWriter::addColumn(const string& name, ColumnType type){
+	if (headerWritten){
+		error("Statistic %s was added to interval statistics file '%s' after the first interval", name.c_str(), filename.c_str());
+	}
+	names.emplace_back(name);
+	types.emplace_back(type);
+}
+
+void IntervalStatsWriter::endRow(){
+	if (!headerWritten){
+		writeHeader();
+	}
+	if (row.size() != names.size()){
+		error("Interval statistics row has %lu values instead of %lu", row.size(), names.size());
+	}
+	if (!row.empty()){
+		write(row.data(), row.size() * sizeof(uint64));
+	}
+	row.clear();
+}
+
+void IntervalStatsWriter::close(){
+	if (file != 0){
+		if (!headerWritten){
+			writeHeader();
+		}
+		if (gzclose(file) != Z_OK){
+			error("Could not write interval statistics file '%s'", filename.c_str());
+		}
+		file = 0;
+	}
+}
+
+void IntervalStatsWriter::writeHeader(){
+	write(INTERVAL_MAGIC, sizeof(INTERVAL_MAGIC));
+	uint32 numColumns = names.size();
+	write(&numColumns, sizeof(numColumns));
+	for (unsigned i = 0; i < numColumns; i++){
+		uint8 type = types[i];
+		uint32 length = names[i].size();
+		write(&type, sizeof(type));
+		write(&length, sizeof(length));
+		write(names[i].data(), length);
+	}
+	headerWritten = true;
+}
+
+void IntervalStatsWriter::write(const void *data, unsigned size){
+	if (gzwrite(file, data, size) != static_cast<int>(size)){
+		error("Could not write interval statistics file '%s'", filename.c_str());
+	}
+}
+
+IntervalStatsReader::IntervalStatsReader(const string& filenameArg) : filename(filenameArg) {
+	file = gzopen(filename.c_str(), "rb");
+	if (file == 0){
+		error("Could not open interval statistics file '%s'", filename.c_str());
+	}
+	gzbuffer(file, BUFFER_SIZE);
+	char magic[sizeof(INTERVAL_MAGIC)];
+	read(magic, sizeof(magic));
+	if (memcmp(magic, INTERVAL_MAGIC, sizeof(magic)) != 0){
+		error("File '%s' does not contain binary interval statistics", filename.c_str());
+	}
+	uint32 numColumns;
+	read(&numColumns, sizeof(numColumns));
+	for (unsigned i = 0; i < numColumns; i++){
+		uint8 type;
+		uint32 length;
+		read(&type, sizeof(type));
+		read(&length, sizeof(length));
+		string name(length, '\0');
+		if (length != 0){
+			read(&name[0], length);
+		}
+		names.emplace_back(name);
+		types.emplace_back(static_cast<ColumnType>(type));
+	}
+}
+
+IntervalStatsReader::~IntervalStatsReader(){
+	gzclose(file);
+}
+
+bool IntervalStatsReader::readRow(vector<uint64> *row){
+	row->resize(names.size());
+	if (row->empty()){
+		return false;
+	}
+	int size = row->size() * sizeof(uint64);
+	int count = gzread(file, row->data(), size);
+	if (count == 0){
+		return false;
+	}
+	if (count != size){
+		error("Interval statistics file '%s' is truncated", filename.c_str());
+	}
+	return true;
+}
+
+string IntervalStatsReader::format(unsigned column, uint64 bits) const {
+	ostringstream oss;
+	if (types[column] == DOUBLE_COLUMN){
+		double value;
+		memcpy(&value, &bits, sizeof(value));
+		oss.setf(std::ios::fixed);
+		oss.precision(2);
+		oss << value;
+	} else if (types[column] == SIGNED_COLUMN){
+		oss << static_cast<int64>(bits);
+	} else {
+		oss << bits;
+	}
+	return oss.str();
+}
+
+void IntervalStatsReader::read(void *data, unsigned size){
+	if (gzread(file, data, size) != static_cast<int>(size)){
+		error("Interval statistics file '%s' is truncated", filename.c_str());
+	}
+}
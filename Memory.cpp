@@ -48,6 +48,11 @@ Memory::Memory(
 	uint64 closeLatencyArg,
 	uint64 accessLatencyArg,
 	bool longCloseLatencyArg,
+	unsigned writeHighWatermarkArg,
+	unsigned writeLowWatermarkArg,
+	bool writePausingArg,
+	bool writeCancellationArg,
+	unsigned writeCancelThresholdArg,
 	uint64 busLatencyArg,
 	addrint offsetArg) :
 		name(nameArg),
@@ -82,6 +87,15 @@ Memory::Memory(
 		waitLowerPriorityTime(statCont, nameArg + "_wait_lower_priority_time", "Number of cycles " + descArg + " requests wait for lower priority requests", 0),
 		waitSamePriorityTime(statCont, nameArg + "_wait_same_priority_time", "Number of cycles " + descArg + " requests wait for same priority requests", 0),
 		waitHigherPriorityTime(statCont, nameArg + "_wait_higher_priority_time", "Number of cycles " + descArg + " requests wait for higher priority requests", 0),
+		readWaitWriteTime(statCont, nameArg + "_read_wait_write_time", "Number of cycles " + descArg + " read requests wait for write requests", 0),
+		numWriteDrains(statCont, nameArg + "_num_write_drains", "Number of " + descArg + " write queue drains", 0),
+		writeDrainTime(statCont, nameArg + "_write_drain_time", "Number of cycles " + descArg + " spends draining write queues", 0),
+		numWriteForwards(statCont, nameArg + "_num_write_forwards", "Number of " + descArg + " read requests forwarded from write queues", 0),
+		numWritePauses(statCont, nameArg + "_num_write_pauses", "Number of " + descArg + " write backs paused by reads", 0),
+		numWriteCancellations(statCont, nameArg + "_num_write_cancellations", "Number of " + descArg + " write backs cancelled by reads", 0),
+		numWriteDeferrals(statCont, nameArg + "_num_write_deferrals", "Number of " + descArg + " write backs deferred by reads before writing any column", 0),
+		writePausedTime(statCont, nameArg + "_write_paused_time", "Number of cycles " + descArg + " write backs spend paused or cancelled", 0),
+		writeCancelledTime(statCont, nameArg + "_write_cancelled_time", "Number of cycles of " + descArg + " write backs lost to cancellations", 0),
 		numRequests(statCont, nameArg + "_requests", "Total number of " + descArg + " requests", &numReadRequests, &numWriteRequests),
 		averageQueueStallTime(statCont, nameArg + "_avg_queue_stall_time", "Average number of cycles " + descArg + " queue is stalled", &queueStallTime, &numRequests),
 		totalStallTime(statCont, nameArg + "_total_stall_time", "Total number of cycles " + descArg + " stalls on requests", &readStallTime, &writeStallTime),
@@ -99,7 +113,8 @@ Memory::Memory(
 		averageReadTime(statCont, nameArg + "_avg_read_time", "Average number of cycles of " + descArg + " read requests", &readTotalTime, &numReadRequests),
 		averageWriteTime(statCont, nameArg + "_avg_write_time", "Average number of cycles of " + descArg + " write requests", &writeTotalTime, &numWriteRequests),
 		averageTime(statCont, nameArg + "_avg_time", "Average number of cycles of " + descArg + " requests", &totalTime, &numRequests),
-		rowBufferAccesses(statCont, nameArg + "_row_buffer_accesses", "Number of " + descArg + " row buffer misses", &rowBufferHits, &rowBufferMisses)
+		rowBufferAccesses(statCont, nameArg + "_row_buffer_accesses", "Number of " + descArg + " row buffer misses", &rowBufferHits, &rowBufferMisses),
+		averageReadWaitWriteTime(statCont, nameArg + "_avg_read_wait_write_time", "Average number of cycles " + descArg + " read requests wait for write requests", &readWaitWriteTime, &numReadRequests)
 
 {
 
@@ -115,7 +130,7 @@ Memory::Memory(
 		ssDesc << desc;
 		ssDesc << " bank " << i;
 		Bank *newBank = new Bank(ssName.str(), ssDesc.str(), engineArg, statCont, debugStartArg, queueCounterIndexArg, openCounterIndexArg, accessCounterIndexArg, closeCounterIndexArg, busQueueCounterIndexArg, busCounterIndexArg, policyArg, typeArg, this, bus, openLatencyArg,
-			closeLatencyArg, accessLatencyArg, longCloseLatencyArg);
+			closeLatencyArg, accessLatencyArg, longCloseLatencyArg, writeHighWatermarkArg, writeLowWatermarkArg, writePausingArg, writeCancellationArg, writeCancelThresholdArg);
 		banks.emplace_back(newBank);
 		numReadRequests.addStat(newBank->getStatNumReadRequests());
 		numWriteRequests.addStat(newBank->getStatNumWriteRequests());
@@ -135,6 +150,15 @@ Memory::Memory(
 		waitLowerPriorityTime.addStat(newBank->getStatWaitLowerPriorityTime());
 		waitSamePriorityTime.addStat(newBank->getStatWaitSamePriorityTime());
 		waitHigherPriorityTime.addStat(newBank->getStatWaitHigherPriorityTime());
+		readWaitWriteTime.addStat(newBank->getStatReadWaitWriteTime());
+		numWriteDrains.addStat(newBank->getStatNumWriteDrains());
+		writeDrainTime.addStat(newBank->getStatWriteDrainTime());
+		numWriteForwards.addStat(newBank->getStatNumWriteForwards());
+		numWritePauses.addStat(newBank->getStatNumWritePauses());
+		numWriteCancellations.addStat(newBank->getStatNumWriteCancellations());
+		numWriteDeferrals.addStat(newBank->getStatNumWriteDeferrals());
+		writePausedTime.addStat(newBank->getStatWritePausedTime());
+		writeCancelledTime.addStat(newBank->getStatWriteCancelledTime());
 	}
 	if (globalQueue) {
 		queueSizes = new int[1];
@@ -158,6 +182,31 @@ Memory::~Memory(){
 	delete [] queueSizes;
 }
 
+void Memory::saveCheckpoint(CheckpointWriter *writer){
+	writer->write(mapping.getNumBanks());
+	for (unsigned i = 0; i < mapping.getNumBanks(); i++) {
+		banks[i]->saveCheckpoint(writer);
+	}
+}
+
+void Memory::restoreCheckpoint(CheckpointReader *reader){
+	if (reader->read<unsigned>() != mapping.getNumBanks()){
+		error("Checkpoint has a different number of banks for %s", name.c_str());
+	}
+	for (unsigned i = 0; i < mapping.getNumBanks(); i++) {
+		banks[i]->restoreCheckpoint(reader);
+	}
+}
+
+/*
+ * Operations already under way keep the latencies they were started with
+ */
+void Memory::setLatencies(uint64 openLatency, uint64 closeLatency, uint64 accessLatency){
+	for (unsigned i = 0; i < mapping.getNumBanks(); i++) {
+		banks[i]->setLatencies(openLatency, closeLatency, accessLatency);
+	}
+}
+
 bool Memory::access(MemoryRequest *request, IMemoryCallback *caller){
 	uint64 timestamp = engine->getTimestamp();
 	debug("(%p, %lu, %u, %s, %s, %d, %s)", request, request->addr, request->size, request->read?"read":"write", request->instr?"instr":"data", request->priority, caller->getName());
@@ -187,7 +236,8 @@ bool Memory::access(MemoryRequest *request, IMemoryCallback *caller){
 		queueIndex = bankIndex;
 	}
 
-	requests.emplace(request, caller);
+	myassert(request->canPushFrame());
+	request->pushFrame(this, caller, request->addr + offset, timestamp);
 
 	banks[bankIndex]->access(request, this);
 
@@ -213,13 +263,11 @@ void Memory::accessCompleted(MemoryRequest *request, IMemory *caller) {
 		queueIndex = bankIndex;
 	}
 
-	RequestMap::iterator it = requests.find(request);
-	myassert(it != requests.end());
-	IMemoryCallback * callback = it->second;
-	requests.erase(it);
+	myassert(request->hasFrame(this));
+	CallbackFrame frame = request->popFrame(this);
 	if (request->read){
-		request->addr += offset;
-		callback->accessCompleted(request, this);
+		request->addr = frame.addr;
+		frame.callback->accessCompleted(request, this);
 	} else {
 		delete request;
 	}
@@ -238,6 +286,25 @@ void Memory::accessCompleted(MemoryRequest *request, IMemory *caller) {
 	queueSizes[queueIndex]--;
 }
 
+/*
+ * Includes the current stall, which is only added to the statistic when the queue unstalls
+ */
+uint64 Memory::getQueueStallTime() const {
+	if (stalled){
+		return queueStallTime + (engine->getTimestamp() - stallStartTimestamp);
+	} else {
+		return queueStallTime;
+	}
+}
+
+bool Memory::isBankIdle(addrint addr) {
+	if (globalQueue){
+		return queueSizes[0] == 0;
+	} else {
+		return queueSizes[getBankId(addr)] == 0;
+	}
+}
+
 
 CacheMemory::CacheMemory(
 		const string& nameArg,
@@ -341,7 +408,7 @@ bool CacheMemory::access(MemoryRequest *request, IMemoryCallback *caller){
 		InternalRequestMap::iterator it = internalRequests.find(blockAddr);
 		if (it == internalRequests.end()){
 			it = internalRequests.emplace(blockAddr, InternalRequest(request, caller, START, timestamp)).first;
-			it->second.result = cacheModel.access(blockAddr, request->read, request->instr, &it->second.evictedAddr, &it->second.internalAddr);
+			it->second.result = cacheModel.access(blockAddr, request->read, request->instr, false, &it->second.evictedAddr, &it->second.internalAddr);
 			it->second.smallBlockOffset = cacheModel.getBlockOffset(smallBlockAddr);
 			myassert(smallBlockAddr == (blockAddr | it->second.smallBlockOffset));
 			addEvent(penalty, blockAddr, TAG_ARRAY);
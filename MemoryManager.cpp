@@ -9,11 +9,98 @@
 
 #include <algorithm>
 #include <memory>
+#include <sstream>
 
 #include <cassert>
 #include <cmath>
 
 
+void FreePageList::add(addrint page){
+	numPages++;
+	if (pagesPerFrame == 1){
+		pages.emplace_back(page);
+		return;
+	}
+	addrint frame = page / pagesPerFrame;
+	unsigned freePages = ++freePagesPerFrame[frame];
+	myassert(freePages <= pagesPerFrame);
+	if (freePages == pagesPerFrame){
+		//the frame is entirely free again
+		for (addrint p = frame * pagesPerFrame; p < (frame + 1) * pagesPerFrame; p++){
+			if (p != page){
+				auto pit = positions.find(p);
+				myassert(pit != positions.end());
+				pages.erase(pit->second);
+				positions.erase(pit);
+			}
+		}
+		freeFrames.insert(frame);
+	} else {
+		positions.emplace(page, pages.insert(pages.end(), page));
+	}
+}
+
+addrint FreePageList::take(){
+	myassert(numPages > 0);
+	if (pages.empty()){
+		breakFrame(freeFrames.begin());
+	}
+	addrint page = pages.front();
+	remove(pages.begin());
+	return page;
+}
+
+bool FreePageList::takeFrame(addrint *firstPage){
+	if (freeFrames.empty()){
+		return false;
+	}
+	auto fit = freeFrames.begin();
+	*firstPage = *fit * pagesPerFrame;
+	freePagesPerFrame.erase(*fit);
+	freeFrames.erase(fit);
+	numPages -= pagesPerFrame;
+	return true;
+}
+
+void FreePageList::getPages(vector<addrint> *pagesArg) const {
+	pagesArg->insert(pagesArg->end(), pages.begin(), pages.end());
+	for (auto fit = freeFrames.begin(); fit != freeFrames.end(); ++fit){
+		for (addrint p = *fit * pagesPerFrame; p < (*fit + 1) * pagesPerFrame; p++){
+			pagesArg->emplace_back(p);
+		}
+	}
+}
+
+void FreePageList::clear(){
+	pages.clear();
+	positions.clear();
+	freePagesPerFrame.clear();
+	freeFrames.clear();
+	numPages = 0;
+}
+
+void FreePageList::remove(list<addrint>::iterator it){
+	if (pagesPerFrame > 1){
+		positions.erase(*it);
+		auto cit = freePagesPerFrame.find(*it / pagesPerFrame);
+		myassert(cit != freePagesPerFrame.end());
+		cit->second--;
+		if (cit->second == 0){
+			freePagesPerFrame.erase(cit);
+		}
+	}
+	pages.erase(it);
+	numPages--;
+}
+
+void FreePageList::breakFrame(set<addrint>::iterator fit){
+	addrint frame = *fit;
+	freeFrames.erase(fit);
+	for (addrint p = frame * pagesPerFrame; p < (frame + 1) * pagesPerFrame; p++){
+		positions.emplace(p, pages.insert(pages.end(), p));
+	}
+}
+
 HybridMemoryManager::HybridMemoryManager(
 	Engine *engineArg,
 	StatContainer *statCont,
@@ -33,6 +120,15 @@ HybridMemoryManager::HybridMemoryManager(
 	uint64 partitionPeriodArg,
 	const string& periodTypeArg,
 	unsigned maxMigrationTableSizeArg,
+	double migrationRateArg,
+	unsigned migrationBurstArg,
+	bool adaptiveMigrationRateArg,
+	uint64 migrationRatePeriodArg,
+	unsigned hugePageSizeArg,
+	const string& hugePagePoliciesArg,
+	double thpMinMappedFractionArg,
+	unsigned tierPromotionThresholdArg,
+	unsigned tierFreePagesArg,
 	bool perPageStatsArg,
 	string perPageStatsFilenameArg
 	) :
@@ -52,8 +148,15 @@ HybridMemoryManager::HybridMemoryManager(
 		partitionPeriod(partitionPeriodArg),
 		periodType(periodTypeArg),
 		maxMigrationTableSize(maxMigrationTableSizeArg),
+		migrationRate(migrationRateArg),
+		migrationBurst(migrationBurstArg),
+		adaptiveMigrationRate(adaptiveMigrationRateArg),
+		migrationRatePeriod(migrationRatePeriodArg),
 		perPageStats(perPageStatsArg),
 		perPageStatsFilename(perPageStatsFilenameArg),
+		tierPromotionThreshold(tierPromotionThresholdArg),
+		tierFreePages(tierFreePagesArg),
+		thpMinMappedFraction(thpMinMappedFractionArg),
 
 		dramFullMigrations(statCont, "manager_dram_full_migrations", "Number of full DRAM migrations", 0),
 		dramPartialMigrations(statCont, "manager_dram_partial_migrations", "Number of partial DRAM migrations (rolledback)", 0),
@@ -106,6 +209,19 @@ HybridMemoryManager::HybridMemoryManager(
 		copyTime(statCont, "manager_copy_time", "Number of cycles copying pages during migrations", &dramCopyTime, &pcmCopyTime),
 
 		idleTime(statCont, "manager_idle_time", "Number of cycles the migration policy (demotion) is idle", 0),
+		throttledMigrations(statCont, "manager_throttled_migrations", "Number of times a migration was not attempted because the migration rate was exceeded", 0),
+
+		tierPromotions(statCont, memoryArg->getNumTiers(), "manager_tier_promotions", "Number of pages moved up to tier"),
+		tierDemotions(statCont, memoryArg->getNumTiers(), "manager_tier_demotions", "Number of pages moved down to tier"),
+
+		hugePageReservations(statCont, "manager_huge_page_reservations", "Number of huge page frames reserved", 0),
+		hugePagesMapped(statCont, "manager_huge_pages_mapped", "Number of huge pages that had all their pages mapped to their reserved frame", 0),
+		hugePageSplits(statCont, "manager_huge_page_splits", "Number of huge page reservations split because of a migration or allocation to the other memory", 0),
+		hugePageFallbacks(statCont, "manager_huge_page_fallbacks", "Number of huge pages mapped with single pages because no frame was free", 0),
+		hugePageKeptMigrations(statCont, "manager_huge_page_kept_migrations", "Number of on demand migrations not attempted to keep a huge page whole", 0),
+		translations(statCont, "manager_translations", "Number of address translations", 0),
+		hugePageTranslations(statCont, "manager_huge_page_translations", "Number of address translations of pages in fully mapped huge pages", 0),
+		hugePageTranslationFraction(statCont, "manager_huge_page_translation_fraction", "Fraction of address translations of pages in fully mapped huge pages", &hugePageTranslations, &translations),
 
 		avgDramMigrationTime(statCont, "manager_avg_dram_migration_time", "Average number of cycles per migration to DRAM", &dramMigrationTime, &dramMigrations),
 		avgPcmMigrationTime(statCont, "manager_avg_pcm_migration_time", "Average number of cycles per migration to PCM", &pcmMigrationTime, &pcmMigrations),
@@ -132,6 +248,8 @@ HybridMemoryManager::HybridMemoryManager(
 		dramMemorySizeUsed(statCont, "manager_dram_memory_size_used", "Size of DRAM memory used by the memory manager", this, &HybridMemoryManager::getDramMemorySizeUsed),
 		pcmMemorySize(statCont, "manager_pcm_memory_size", "Size of PCM memory available to the memory manager", this, &HybridMemoryManager::getPcmMemorySize),
 		pcmMemorySizeUsed(statCont, "manager_pcm_memory_size_used", "Size of PCM memory used by the memory manager", this, &HybridMemoryManager::getPcmMemorySizeUsed),
+		tierMemorySize(statCont, memoryArg->getNumTiers(), "manager_tier_memory_size", "Size of the memory available to the memory manager in tier", this, &HybridMemoryManager::getTierMemorySize),
+		tierMemorySizeUsed(statCont, memoryArg->getNumTiers(), "manager_tier_memory_size_used", "Size of the memory used by the memory manager in tier", this, &HybridMemoryManager::getTierMemorySizeUsed),
 
 		dramMemorySizeInitial(statCont, "manager_dram_memory_size_initial", "Size of DRAM memory at start of simulation", 0),
 		pcmMemorySizeInitial(statCont, "manager_pcm_memory_size_initial", "Size of PCM memory at start of simulation", 0),
@@ -154,7 +272,14 @@ HybridMemoryManager::HybridMemoryManager(
 	pageSize = 1 << logPageSize;
 	numDramPages = memory->getDramSize() / pageSize;
 	dramSize = numDramPages * pageSize;
-	numPcmPages = memory->getPcmSize() / pageSize;
+	numTiers = memory->getNumTiers();
+	numPcmPages = 0;
+	for (unsigned i = 1; i < numTiers; i++){
+		if (memory->getTierSize(i) % pageSize != 0){
+			error("Size of memory tier %u (%lu) must be a multiple of the page size (%u)", i, memory->getTierSize(i), pageSize);
+		}
+		numPcmPages += memory->getTierSize(i) / pageSize;
+	}
 	pcmSize = numPcmPages * pageSize;
 
 	offsetWidth = logPageSize;
@@ -173,23 +298,60 @@ HybridMemoryManager::HybridMemoryManager(
 
 	firstDramAddress = 0;
 	onePastLastDramAddress = dramSize;
-	firstPcmAddress = dramSize;
-	onePastLastPcmAddress = dramSize + pcmSize;
+	//the DRAM used by the line cache of the hybrid memory, if any, lies between the last DRAM page and the first PCM page
+	firstPcmAddress = memory->getTierSize(0);
+	onePastLastPcmAddress = firstPcmAddress + pcmSize;
 
 	firstDramPage = getIndex(firstDramAddress);
 	onePastLastDramPage = getIndex(onePastLastDramAddress);
 	firstPcmPage = getIndex(firstPcmAddress);
 	onePastLastPcmPage = getIndex(onePastLastPcmAddress);
 
-	for(addrint page = firstDramPage; page < onePastLastDramPage; page++){
-		dramFreePageList.emplace_back(page);
+	firstTierPages.emplace_back(firstDramPage);
+	firstTierPages.emplace_back(firstPcmPage);
+	numTierPages.emplace_back(numDramPages);
+	for (unsigned i = 1; i < numTiers; i++){
+		firstTierPages.emplace_back(firstTierPages.back() + memory->getTierSize(i) / pageSize);
+		numTierPages.emplace_back(memory->getTierSize(i) / pageSize);
 	}
+	myassert(firstTierPages.back() == onePastLastPcmPage);
 
-	for(addrint page = firstPcmPage; page < onePastLastPcmPage; page++){
-		pcmFreePageList.emplace_back(page);
+	size_t current;
+	size_t next = -1;
+	do {
+		current = next + 1;
+		next = hugePagePoliciesArg.find_first_of("_", current);
+		istringstream iss(hugePagePoliciesArg.substr(current, next - current));
+		HugePagePolicy policy;
+		iss >> policy;
+		hugePagePolicies.emplace_back(policy);
+	} while (next != string::npos);
+	if (hugePagePolicies.size() == 1){
+		hugePagePolicies.resize(numProcesses, hugePagePolicies[0]);
+	} else if (hugePagePolicies.size() != numProcesses){
+		error("Huge page policy string has %lu policies but must have 1 or %u", hugePagePolicies.size(), numProcesses);
+	}
+
+	pagesPerHugePage = 1;
+	for (auto it = hugePagePolicies.begin(); it != hugePagePolicies.end(); ++it){
+		if (*it != NO_HUGE_PAGES){
+			if (hugePageSizeArg <= pageSize || hugePageSizeArg % pageSize != 0){
+				error("Huge page size (%u) must be a multiple of the page size (%u)", hugePageSizeArg, pageSize);
+			}
+			pagesPerHugePage = hugePageSizeArg / pageSize;
+		}
+	}
+	freePageLists.resize(numTiers, FreePageList(engine, pagesPerHugePage));
+	for (unsigned i = 0; i < numTiers; i++){
+		for(addrint page = firstTierPages[i]; page < firstTierPages[i] + numTierPages[i]; page++){
+			freePageLists[i].add(page);
+		}
 	}
+	tierClocks.resize(numTiers);
+	tierDemotionsInFlight.resize(numTiers, 0);
 
 	pages = new PageMap[numProcesses];
+	hugePages = new HugePageMap[numProcesses];
 
 	if (partition->getNumPolicies() == 1){
 		policies.resize(numProcesses, policies[0]);
@@ -211,7 +373,17 @@ HybridMemoryManager::HybridMemoryManager(
 
 	migrationTableSize = 0;
 
-	flushQueueSize = 0;
+	if (migrationBurst == 0){
+		error("Migration burst must be at least one page");
+	}
+	tokens.resize(partition->getNumPolicies(), static_cast<double>(migrationBurst) * pageSize);
+	lastTokenUpdate = 0;
+	migrationRateFactor = 1.0;
+	lastRateUpdate = 0;
+	lastQueueStallTime = 0;
+	lastQueueStallDelta = 0;
+
+	tagChangesInFlight = 0;
 
 	stalledCpus = new StalledCpuMap[numProcesses];
 
@@ -236,18 +408,10 @@ bool HybridMemoryManager::access(int pid, addrint virtualAddr, bool read, bool i
 	PageMap::iterator it = pages[pid].find(virtualPage);
 	if (it == pages[pid].end()){
 		PageType type = policies[pid]->allocate(pid, virtualPage, read, instr);
-		addrint freePage;
+		addrint freePage = allocatePage(pid, virtualPage, type);
 		if (type == DRAM){
-			myassert(!dramFreePageList.empty());
-			freePage = dramFreePageList.front();
-			dramFreePageList.pop_front();
 			dramMemorySizeUsedPerPid[pid] += pageSize;
 		} else if (type == PCM){
-			if (pcmFreePageList.empty()){
-				error("PCM free page list is empty");
-			}
-			freePage = pcmFreePageList.front();
-			pcmFreePageList.pop_front();
 			pcmMemorySizeUsedPerPid[pid] += pageSize;
 		} else {
 			myassert(false);
@@ -255,9 +419,15 @@ bool HybridMemoryManager::access(int pid, addrint virtualAddr, bool read, bool i
 		it = pages[pid].emplace(virtualPage, PageEntry(freePage, type, timestamp)).first;
 		bool ins = physicalPages.emplace(it->second.page, PhysicalPageEntry(pid, virtualPage)).second;
 		myassert(ins);
+		addTierPage(it->second.page);
 	}
 	myassert((isDramPage(it->second.page) && it->second.type == DRAM) || (isPcmPage(it->second.page) && it->second.type == PCM));
 
+	translations++;
+	if (pagesPerHugePage > 1 && isMappedAsHugePage(pid, virtualPage)){
+		hugePageTranslations++;
+	}
+
 	if(it->second.stallOnAccess){
 		stalledCpus[pid][virtualPage].emplace_back(cpu);
 		debug(": stalled on access to %lu", virtualPage);
@@ -271,11 +441,6 @@ bool HybridMemoryManager::access(int pid, addrint virtualAddr, bool read, bool i
 bool HybridMemoryManager::migrateOnDemand(addrint physicalPage, addrint *destPhysicalPage){
 	uint64 timestamp = engine->getTimestamp();
 	debug("(%lu)", physicalPage);
-//	cout << dramFreePageList.size();
-	if (dramFreePageList.empty()){
-		return false;
-	}
-
 	auto pit = physicalPages.find(physicalPage);
 	myassert(pit != physicalPages.end());
 	auto it = pages[pit->second.pid].find(pit->second.virtualPage);
@@ -283,18 +448,38 @@ bool HybridMemoryManager::migrateOnDemand(addrint physicalPage, addrint *destPhy
 	myassert(isPcmPage(it->second.page));
 	myassert(it->second.type == PCM);
 
+	if (getTier(physicalPage) > 1){
+		return promoteTier(it, destPhysicalPage);
+	}
+
+	auto cit = tierClocks[1].entries.find(physicalPage);
+	if (cit != tierClocks[1].entries.end()){
+		cit->second.second = true;
+	}
+
+//	cout << freePageLists[0].size();
+	if (freePageLists[0].empty()){
+		return false;
+	}
+
 	if (it->second.isMigrating){
 		//happens when migration has finished copying blocks but flushing is not done
 		return false;
 	}
 
+	if (keepsHugePage(pit->second.pid, pit->second.virtualPage)){
+		hugePageKeptMigrations++;
+		return false;
+	}
 
-	if(migrationTableSize < maxMigrationTableSize && policies[pit->second.pid]->migrate(pit->second.pid, pit->second.virtualPage)){
+	if(migrationTableSize < maxMigrationTableSize && hasTokens(partition->getNumPolicies() == 1 ? 0 : pit->second.pid) && policies[pit->second.pid]->migrate(pit->second.pid, pit->second.virtualPage)){
+		if (!takeFreePage(&freePageLists[0], it->second.page, destPhysicalPage)){
+			return false;
+		}
+		takeTokens(partition->getNumPolicies() == 1 ? 0 : pit->second.pid);
+		splitHugePage(pit->second.pid, pit->second.virtualPage);
 		it->second.isMigrating = true;
 
-		*destPhysicalPage = dramFreePageList.front();
-		dramFreePageList.pop_front();
-
 		bool ins = migrations.emplace(it->second.page, MigrationEntry(pit->second.pid, pit->second.virtualPage, *destPhysicalPage, DRAM, COPY, timestamp)).second;
 		myassert(ins);
 
@@ -356,14 +541,13 @@ void HybridMemoryManager::allocate(const vector<string>& filenames){
 		while (count < dramPagesPerProcess && *ifs[pid] >> virtualPage){
 			PageType type = policies[pid]->allocate(pid, virtualPage, false, false);
 			myassert(type == DRAM);
-			myassert(!dramFreePageList.empty());
-			addrint freePage = dramFreePageList.front();
-			dramFreePageList.pop_front();
+			addrint freePage = allocatePage(pid, virtualPage, type);
 			dramMemorySizeInitial += pageSize;
 			dramMemorySizeUsedPerPid[pid] += pageSize;
 			PageMap::iterator it = pages[pid].emplace(virtualPage, PageEntry(freePage, type, engine->getTimestamp())).first;
 			bool ins = physicalPages.emplace(it->second.page, PhysicalPageEntry(pid, virtualPage)).second;
 			myassert(ins);
+			addTierPage(it->second.page);
 			count++;
 		}
 	}
@@ -371,19 +555,11 @@ void HybridMemoryManager::allocate(const vector<string>& filenames){
 		addrint virtualPage;
 		while (*ifs[pid] >> virtualPage){
 			PageType type = policies[pid]->allocate(pid, virtualPage, false, false);
-			addrint freePage;
+			addrint freePage = allocatePage(pid, virtualPage, type);
 			if (type == DRAM){
-				myassert(!dramFreePageList.empty());
-				freePage = dramFreePageList.front();
-				dramFreePageList.pop_front();
 				dramMemorySizeInitial += pageSize;
 				dramMemorySizeUsedPerPid[pid] += pageSize;
 			} else if (type == PCM){
-				if (pcmFreePageList.empty()){
-					error("PCM free page list is empty");
-				}
-				freePage = pcmFreePageList.front();
-				pcmFreePageList.pop_front();
 				pcmMemorySizeInitial += pageSize;
 				pcmMemorySizeUsedPerPid[pid] += pageSize;
 			} else {
@@ -392,6 +568,7 @@ void HybridMemoryManager::allocate(const vector<string>& filenames){
 			PageMap::iterator it = pages[pid].emplace(virtualPage, PageEntry(freePage, type, engine->getTimestamp())).first;
 			bool ins = physicalPages.emplace(it->second.page, PhysicalPageEntry(pid, virtualPage)).second;
 			myassert(ins);
+			addTierPage(it->second.page);
 		}
 	}
 
@@ -423,12 +600,18 @@ void HybridMemoryManager::allocate(const vector<string>& filenames){
 //	}
 }
 
+const char* HybridMemoryManager::getEventName(const Event *event) const {
+	static const char *names[] = {"DEMOTE", "COMPLETE", "ROLLBACK", "COPY_PAGE", "UPDATE_PARTITION", "UNSTALL"};
+	return names[event->getData()];
+}
+
 void HybridMemoryManager::process(const Event * event){
 	uint64 timestamp = engine->getTimestamp();
 	EventType type = static_cast<EventType>(event->getData());
 	debug("(%d)", type);
 	if (type == DEMOTE){
 		updateMonitors();
+		demoteTiers();
 		selectPolicyAndDemote();
 	} else if (type == COMPLETE){
 
@@ -494,7 +677,8 @@ bool HybridMemoryManager::startDemotion(int policy){
 	debug("(%d)", policy);
 	int pid;
 	addrint virtualPage;
-	if (migrationTableSize < maxMigrationTableSize && policies[policy]->demote(&pid, &virtualPage)){
+	if (migrationTableSize < maxMigrationTableSize && hasTokens(policy) && policies[policy]->demote(&pid, &virtualPage)){
+		takeTokens(policy);
 		PageMap::iterator it = pages[pid].find(virtualPage);
 		myassert(it != pages[pid].end());
 		if (it->second.isMigrating){
@@ -516,43 +700,22 @@ bool HybridMemoryManager::startDemotion(int policy){
 		} else {
 			myassert(isDramPage(it->second.page));
 			myassert(it->second.type == DRAM);
+			splitHugePage(pid, virtualPage);
 			it->second.isMigrating = true;
-			if (pcmFreePageList.empty()){
-				error("PCM free page list is empty");
-			}
-			addrint destPhysPage = pcmFreePageList.front();
-			pcmFreePageList.pop_front();
-
-			State state;
-			if (flushPolicy == FLUSH_PCM_BEFORE){
-				state = FLUSH_BEFORE;
-				it->second.stallOnAccess = true;
-			} else if (flushPolicy == FLUSH_ONLY_AFTER){
-				state = COPY;
-				memory->copyPage(it->second.page, destPhysPage);
-			} else if (flushPolicy == REMAP){
-				state = COPY;
-				memory->copyPage(it->second.page, destPhysPage);
-			} else if (flushPolicy == CHANGE_TAG){
-				state = COPY;
-				memory->copyPage(it->second.page, destPhysPage);
-			} else {
-				myassert(false);
+			//demoted pages go to the fastest tier below DRAM that has a compatible free page
+			addrint destPhysPage = 0;
+			unsigned tier = 1;
+			while (!takeFreePage(&freePageLists[tier], it->second.page, &destPhysPage)){
+				tier++;
+				if (tier == numTiers){
+					error("PCM free page list has no page compatible with page %lu", it->second.page);
+				}
 			}
 
-			bool ins = migrations.emplace(it->second.page, MigrationEntry(pid, virtualPage, destPhysPage, PCM, state, timestamp)).second;
-			myassert(ins);
-
-			migrationTableSize++;
-
-			if(state == FLUSH_BEFORE){
-				flushPage(it->second.page);
-			}
+			State state = startMigration(pid, virtualPage, it, destPhysPage);
 
 			debug(": demotion: pid: %d, virtualPage: %lu, srcPhysPage: %lu, destPhysPage: %lu, dest: PCM, state: %d", pid, virtualPage, it->second.page, destPhysPage, state);
 
-			migrationEntriesSum += migrations.size();
-			migrationEntriesCount++;
 			pcmMigrationsPerPid[pid]++;
 			pcmMemorySizeUsedPerPid[pid] += pageSize;
 
@@ -575,6 +738,144 @@ bool HybridMemoryManager::startDemotion(int policy){
 	}
 }
 
+/*
+ * Starts moving a page to a slower memory: depending on the flush policy, the page is flushed from
+ * the caches before being copied or it is copied right away
+ */
+HybridMemoryManager::State HybridMemoryManager::startMigration(int pid, addrint virtualPage, PageMap::iterator it, addrint destPhysPage){
+	uint64 timestamp = engine->getTimestamp();
+	State state;
+	if (flushPolicy == FLUSH_PCM_BEFORE){
+		state = FLUSH_BEFORE;
+		it->second.stallOnAccess = true;
+	} else if (flushPolicy == FLUSH_ONLY_AFTER){
+		state = COPY;
+		memory->copyPage(it->second.page, destPhysPage);
+	} else if (flushPolicy == REMAP){
+		state = COPY;
+		memory->copyPage(it->second.page, destPhysPage);
+	} else if (flushPolicy == CHANGE_TAG){
+		state = COPY;
+		memory->copyPage(it->second.page, destPhysPage);
+	} else {
+		myassert(false);
+	}
+
+	bool ins = migrations.emplace(it->second.page, MigrationEntry(pid, virtualPage, destPhysPage, PCM, state, timestamp)).second;
+	myassert(ins);
+
+	migrationTableSize++;
+
+	if(state == FLUSH_BEFORE){
+		flushPage(it->second.page);
+	}
+
+	migrationEntriesSum += migrations.size();
+	migrationEntriesCount++;
+	return state;
+}
+
+/*
+ * Keeps tierFreePages pages free in every tier that has another tier below it by moving the pages
+ * that have not been accessed since the clock hand last went over them one tier down
+ */
+void HybridMemoryManager::demoteTiers(){
+	uint64 timestamp = engine->getTimestamp();
+	for (unsigned tier = 1; tier + 1 < numTiers; tier++){
+		TierClock& clock = tierClocks[tier];
+		//two rounds clear all the referenced bits
+		uint64 pagesLeft = 2 * clock.pages.size();
+		while (freePageLists[tier].size() + tierDemotionsInFlight[tier] < tierFreePages && migrationTableSize < maxMigrationTableSize && pagesLeft > 0){
+			pagesLeft--;
+			addrint page = clock.pages.front();
+			clock.pages.pop_front();
+			clock.pages.emplace_back(page);
+			auto cit = clock.entries.find(page);
+			myassert(cit != clock.entries.end());
+			cit->second.first = prev(clock.pages.end());
+			if (cit->second.second){
+				cit->second.second = false;
+				continue;
+			}
+
+			auto pit = physicalPages.find(page);
+			myassert(pit != physicalPages.end());
+			int pid = pit->second.pid;
+			addrint virtualPage = pit->second.virtualPage;
+			PageMap::iterator it = pages[pid].find(virtualPage);
+			myassert(it != pages[pid].end());
+			if (it->second.isMigrating || keepsHugePage(pid, virtualPage)){
+				continue;
+			}
+			int policy = partition->getNumPolicies() == 1 ? 0 : pid;
+			if (!hasTokens(policy)){
+				continue;
+			}
+			addrint destPhysPage;
+			if (!takeFreePage(&freePageLists[tier + 1], page, &destPhysPage)){
+				break;
+			}
+			takeTokens(policy);
+			splitHugePage(pid, virtualPage);
+			it->second.isMigrating = true;
+
+			State state = startMigration(pid, virtualPage, it, destPhysPage);
+			tierDemotionsInFlight[tier]++;
+
+			debug(": tier demotion: pid: %d, virtualPage: %lu, srcPhysPage: %lu, destPhysPage: %lu, tier: %u, state: %d", pid, virtualPage, page, destPhysPage, tier + 1, state);
+		}
+	}
+}
+
+/*
+ * Moves a page one tier up once it has been accessed tierPromotionThreshold times. The policies are
+ * not involved because both tiers are PCM to them.
+ */
+bool HybridMemoryManager::promoteTier(PageMap::iterator it, addrint *destPhysicalPage){
+	uint64 timestamp = engine->getTimestamp();
+	if (it->second.isMigrating){
+		return false;
+	}
+	if (++tierAccessCounts[it->second.page] < tierPromotionThreshold){
+		return false;
+	}
+
+	auto pit = physicalPages.find(it->second.page);
+	myassert(pit != physicalPages.end());
+	int pid = pit->second.pid;
+	addrint virtualPage = pit->second.virtualPage;
+	int policy = partition->getNumPolicies() == 1 ? 0 : pid;
+
+	if (keepsHugePage(pid, virtualPage)){
+		hugePageKeptMigrations++;
+		return false;
+	}
+
+	if (migrationTableSize < maxMigrationTableSize && hasTokens(policy)){
+		unsigned tier = getTier(it->second.page);
+		if (!takeFreePage(&freePageLists[tier - 1], it->second.page, destPhysicalPage)){
+			return false;
+		}
+		takeTokens(policy);
+		splitHugePage(pid, virtualPage);
+		it->second.isMigrating = true;
+
+		bool ins = migrations.emplace(it->second.page, MigrationEntry(pid, virtualPage, *destPhysicalPage, PCM, COPY, timestamp)).second;
+		myassert(ins);
+
+		migrationTableSize++;
+
+		debug(": tier promotion: pid: %d, virtualPage: %lu, srcPhysPage: %lu, destPhysPage: %lu, tier: %u", pid, virtualPage, it->second.page, *destPhysicalPage, tier - 1);
+
+		migrationEntriesSum += migrations.size();
+		migrationEntriesCount++;
+
+		return true;
+	} else {
+		return false;
+	}
+}
+
 void HybridMemoryManager::updateMonitors(){
 	monitors.clear();
 	progress.clear();
@@ -666,24 +967,15 @@ void HybridMemoryManager::drainCompleted(addrint page){
 	}
 }
 
-void HybridMemoryManager::flushCompleted(addrint addr, bool dirty, IMemory *caller){
+void HybridMemoryManager::pageFlushCompleted(addrint page, const vector<addrint>& dirtyBlocks, unsigned flushedBlocks, IMemory *caller){
 	uint64 timestamp = engine->getTimestamp();
-	debug("(%lu, %s, %s)", addr, dirty?"dirty":"clean", caller->getName());
-	addrint pageAddr = getIndex(addr);
-	auto mig = migrations.find(pageAddr);
+	debug("(%lu, %lu, %u, %s)", page, dirtyBlocks.size(), flushedBlocks, caller->getName());
+	auto mig = migrations.find(page);
 	myassert(mig != migrations.end());
 	myassert(mig->second.state == FLUSH_BEFORE || mig->second.state == FLUSH_AFTER);
-	auto fit = flushQueue.begin();
-	while (fit != flushQueue.end() && fit->first != addr){
-		++fit;
-	}
-	myassert(fit != flushQueue.end());
-	myassert(fit->second);
-	flushQueue.erase(fit);
-	flushQueueSize--;
-	if (dirty){
-		if (!suppressFlushWritebacks){
-			addrint offset = getOffset(addr);
+	if (!suppressFlushWritebacks){
+		for (auto it = dirtyBlocks.begin(); it != dirtyBlocks.end(); ++it){
+			addrint offset = getOffset(*it);
 			addrint writebackAddr = 0;
 			if (mig->second.state == FLUSH_BEFORE){
 				writebackAddr = getAddress(mig->first, offset);
@@ -696,27 +988,16 @@ void HybridMemoryManager::flushCompleted(addrint addr, bool dirty, IMemory *call
 			MemoryRequest *req = new MemoryRequest(writebackAddr, blockSize, false, false, HIGH);
 			if (!stalledRequests.empty() || !memory->access(req, this)){
 				mig->second.stalledRequestsLeft++;
-				stalledRequests.emplace_back(req, pageAddr);
+				stalledRequests.emplace_back(req, page);
 			}
 		}
-		dirtyFlushedBlocks++;
-	} else {
-		cleanFlushedBlocks++;
 	}
+	dirtyFlushedBlocks += dirtyBlocks.size();
+	cleanFlushedBlocks += flushedBlocks - dirtyBlocks.size();
 	mig->second.flushRequestsLeft--;
 	if (mig->second.flushRequestsLeft == 0 && mig->second.stalledRequestsLeft == 0){
 		finishFlushing(mig->first);
 	}
-
-	auto it = flushQueue.begin();
-	while (it != flushQueue.end() && flushQueueSize < maxFlushQueueSize){
-		if (!it->second){
-			lastLevelCache->flush(it->first, blockSize, true, this);
-			it->second = true;
-			flushQueueSize++;
-		}
-		++it;
-	}
 }
 
 void HybridMemoryManager::remapCompleted(addrint pageAddr, IMemory *caller){
@@ -731,15 +1012,15 @@ void HybridMemoryManager::tagChangeCompleted(addrint addr){
 	addrint pageAddr = getIndex(addr);
 	auto mig = migrations.find(pageAddr);
 	myassert(mig != migrations.end() &&  mig->second.state == FLUSH_AFTER);
-	myassert(addr == tagChangeQueue.front().first);
-	tagChangeQueue.pop_front();
+	myassert(tagChangesInFlight > 0);
+	tagChangesInFlight--;
 	mig->second.tagChangeRequestsLeft--;
 	tagChanges++;
+	issueTagChanges();
 	if (mig->second.tagChangeRequestsLeft == 0){
-		finishFlushing(mig->first);
-	}
-	if (!tagChangeQueue.empty()){
-		lastLevelCache->changeTag(tagChangeQueue.front().first, tagChangeQueue.front().second, blockSize, this);
+		//blocks with misses or write backs in flight when their tag changed still have the old tag, so they are flushed
+		mig->second.flushRequestsLeft++;
+		lastLevelCache->flushPage(mig->first, this);
 	}
 }
 
@@ -770,8 +1051,10 @@ void HybridMemoryManager::finishFlushing(addrint srcPhysicalPage){
 		PhysicalPageMap::iterator ppit = physicalPages.find(mig->first);
 		myassert(ppit != physicalPages.end());
 		physicalPages.erase(ppit);
+		removeTierPage(mig->first);
 		bool ins = physicalPages.emplace(mig->second.destPhysicalPage, PhysicalPageEntry(mig->second.pid, mig->second.virtualPage)).second;
 		myassert(ins);
+		addTierPage(mig->second.destPhysicalPage);
 
 		unstallCpus(mig->second.pid, mig->second.virtualPage);
 
@@ -806,6 +1089,7 @@ void HybridMemoryManager::finishFlushing(addrint srcPhysicalPage){
 		//it->second.migrations.back().end = timestamp;
 		//it->second.migrations.emplace_back(PCM, timestamp);
 	} else {
+		bool tierMove = isTierMove(mig->first, mig->second.destPhysicalPage);
 		if (mig->second.state == FLUSH_BEFORE){
 			mig->second.state = COPY;
 			it->second.stallOnAccess = false;
@@ -814,7 +1098,9 @@ void HybridMemoryManager::finishFlushing(addrint srcPhysicalPage){
 			addEvent(0, COPY_PAGE);
 			unstallCpus(mig->second.pid, mig->second.virtualPage);
 
-			if(mig->second.dest == DRAM){
+			if (tierMove){
+				//moves between tiers below DRAM are not DRAM or PCM migrations
+			} else if(mig->second.dest == DRAM){
 				dramFlushBeforeTime += (timestamp - mig->second.startFlushTime);
 			} else if (mig->second.dest == PCM){
 				pcmFlushBeforeTime += (timestamp - mig->second.startFlushTime);
@@ -822,18 +1108,19 @@ void HybridMemoryManager::finishFlushing(addrint srcPhysicalPage){
 				myassert(false);
 			}
 		} else if (mig->second.state == FLUSH_AFTER){
-			if (mig->second.dest == PCM){
+			if (mig->second.dest == PCM && !tierMove){
 				demoting = false;
 				addEvent(1, DEMOTE);
 			}
 
 			it->second.page = mig->second.destPhysicalPage;
 			it->second.type = mig->second.dest;
-			if (it->second.type == DRAM) {
-				pcmFreePageList.emplace_back(mig->first);
+			freePageLists[getTier(mig->first)].add(mig->first);
+			if (tierMove) {
+				//the page is still in PCM for the policy and the process
+			} else if (it->second.type == DRAM) {
 				pcmMemorySizeUsedPerPid[mig->second.pid] -= pageSize;
 			} else if (it->second.type == PCM){
-				dramFreePageList.emplace_back(mig->first);
 				dramMemorySizeUsedPerPid[mig->second.pid] -= pageSize;
 			} else {
 				myassert(false);
@@ -847,16 +1134,22 @@ void HybridMemoryManager::finishFlushing(addrint srcPhysicalPage){
 			PhysicalPageMap::iterator ppit = physicalPages.find(mig->first);
 			myassert(ppit != physicalPages.end());
 			physicalPages.erase(ppit);
+			removeTierPage(mig->first);
 			bool ins = physicalPages.emplace(mig->second.destPhysicalPage, PhysicalPageEntry(mig->second.pid, mig->second.virtualPage)).second;
 			myassert(ins);
+			addTierPage(mig->second.destPhysicalPage);
 
 			unstallCpus(mig->second.pid, mig->second.virtualPage);
 
-			policies[mig->second.pid]->done(mig->second.pid, mig->second.virtualPage);
+			if (!tierMove){
+				policies[mig->second.pid]->done(mig->second.pid, mig->second.virtualPage);
+			}
 
 			memory->finishMigration(mig->first);
 
-			if (mig->second.dest == DRAM){
+			if (tierMove){
+				debug(": finished tier move: pid: %d, virtualPage: %lu", mig->second.pid, mig->second.virtualPage);
+			} else if (mig->second.dest == DRAM){
 				debug(": finished promotion: pid: %d, virtualPage: %lu", mig->second.pid, mig->second.virtualPage);
 			} else {
 				debug(": finished demotion: pid: %d, virtualPage: %lu", mig->second.pid, mig->second.virtualPage);
@@ -865,7 +1158,21 @@ void HybridMemoryManager::finishFlushing(addrint srcPhysicalPage){
 			uint64 migrationTime = timestamp - mig->second.startMigrationTime;
 			uint64 flushTime = timestamp - mig->second.startFlushTime;
 
-			if(mig->second.dest == DRAM){
+			unsigned srcTier = getTier(mig->first);
+			unsigned destTier = getTier(mig->second.destPhysicalPage);
+			if (destTier < srcTier){
+				tierPromotions[destTier]++;
+			} else {
+				tierDemotions[destTier]++;
+				if (tierMove){
+					myassert(tierDemotionsInFlight[srcTier] > 0);
+					tierDemotionsInFlight[srcTier]--;
+				}
+			}
+
+			if (tierMove){
+				//counted in the tier statistics only
+			} else if(mig->second.dest == DRAM){
 				dramFullMigrations++;
 				dramFullMigrationTime += migrationTime;
 				dramFlushAfterTime += flushTime;
@@ -899,7 +1206,7 @@ void HybridMemoryManager::copyCompleted(addrint srcPhysicalPage){
 	if (mig->second.rolledBack){
 		myassert(mig->second.dest == DRAM);
 		myassert(it->second.type == PCM);
-		dramFreePageList.emplace_back(mig->second.destPhysicalPage);
+		freePageLists[0].add(mig->second.destPhysicalPage);
 		dramMemorySizeUsedPerPid[mig->second.pid] -= pageSize;
 		it->second.isMigrating = false;
 		myassert(!it->second.stallOnAccess);
@@ -937,7 +1244,9 @@ void HybridMemoryManager::copyCompleted(addrint srcPhysicalPage){
 		mig->second.startFlushTime = timestamp;
 
 		uint64 cpTime = timestamp - mig->second.startCopyTime;
-		if(mig->second.dest == DRAM){
+		if (isTierMove(mig->first, mig->second.destPhysicalPage)){
+			//counted in the tier statistics only
+		} else if(mig->second.dest == DRAM){
 			dramCopyTime += cpTime;
 		} else if (mig->second.dest == PCM){
 			pcmCopyTime += cpTime;
@@ -952,31 +1261,231 @@ void HybridMemoryManager::flushPage(addrint page){
 	auto mig = migrations.find(page);
 	myassert(mig != migrations.end());
 	myassert(mig->second.state == FLUSH_BEFORE || mig->second.state == FLUSH_AFTER);
-	for (addrint offset = 0; offset < pageSize; offset += blockSize){
-		addrint addr = getAddress(page,offset);
-		flushQueue.emplace_back(addr, false);
-		mig->second.flushRequestsLeft++;
-	}
-	auto it = flushQueue.begin();
-	while (it != flushQueue.end() && flushQueueSize < maxFlushQueueSize){
-		if (!it->second){
-			lastLevelCache->flush(it->first, blockSize, true, this);
-			it->second = true;
-			flushQueueSize++;
-		}
-		++it;
-	}
+	mig->second.flushRequestsLeft++;
+	lastLevelCache->flushPage(page, this);
 	mig->second.startFlushTime = engine->getTimestamp();
 }
 
+/*
+ * Queues the tag changes of all the blocks of the page. Blocks of different pages share the queue,
+ * so several pages can be in flight, but at most maxFlushQueueSize blocks are sent to the cache at once.
+ */
 void HybridMemoryManager::changeTags(addrint oldPage, addrint newPage){
-	myassert(false);
-	//TODO: change tag change logic so that tag changes happen concurrently
-	//TODO: fix tag change logic so that finishFlushing is called for the correct page
+	auto mig = migrations.find(oldPage);
+	myassert(mig != migrations.end());
+	myassert(arePagesCompatible(oldPage, newPage));
 	for (addrint offset = 0; offset < pageSize; offset += blockSize){
 		tagChangeQueue.emplace_back(make_pair(getAddress(oldPage,offset), getAddress(newPage,offset)));
+		mig->second.tagChangeRequestsLeft++;
 	}
-	lastLevelCache->changeTag(tagChangeQueue.front().first, tagChangeQueue.front().second, blockSize, this);
+	issueTagChanges();
+}
+
+void HybridMemoryManager::issueTagChanges(){
+	while (!tagChangeQueue.empty() && tagChangesInFlight < maxFlushQueueSize){
+		pair<addrint, addrint> tagChange = tagChangeQueue.front();
+		tagChangeQueue.pop_front();
+		tagChangesInFlight++;
+		lastLevelCache->changeTag(tagChange.first, tagChange.second, blockSize, this);
+	}
+}
+
+/*
+ * Takes the first free page that is compatible with the source page of a migration
+ */
+bool HybridMemoryManager::takeFreePage(FreePageList *freePageList, addrint srcPage, addrint *freePage){
+	return freePageList->take([this, srcPage](addrint page){return arePagesCompatible(srcPage, page);}, freePage);
+}
+
+/*
+ * Returns the free page list new pages of the given type are allocated from: PCM pages are
+ * allocated in the fastest tier below DRAM that has free pages
+ */
+FreePageList *HybridMemoryManager::getFreePageList(PageType type){
+	if (type == DRAM){
+		return &freePageLists[0];
+	} else if (type == PCM){
+		unsigned tier = 1;
+		while (tier + 1 < numTiers && freePageLists[tier].empty()){
+			tier++;
+		}
+		return &freePageLists[tier];
+	} else {
+		myassert(false);
+		return 0;
+	}
+}
+
+unsigned HybridMemoryManager::getTier(addrint physicalPage) const {
+	unsigned tier = 0;
+	while (physicalPage >= firstTierPages[tier + 1]){
+		tier++;
+		myassert(tier < numTiers);
+	}
+	return tier;
+}
+
+/*
+ * Keeps track of the pages that are mapped to each tier: pages in tiers with a slower tier below them
+ * are candidates to be demoted and pages below the first PCM tier count accesses to be promoted
+ */
+void HybridMemoryManager::addTierPage(addrint physicalPage){
+	unsigned tier = getTier(physicalPage);
+	if (tier != 0 && tier + 1 < numTiers){
+		TierClock& clock = tierClocks[tier];
+		clock.pages.emplace_back(physicalPage);
+		bool ins = clock.entries.emplace(physicalPage, make_pair(prev(clock.pages.end()), false)).second;
+		myassert(ins);
+	}
+}
+
+void HybridMemoryManager::removeTierPage(addrint physicalPage){
+	unsigned tier = getTier(physicalPage);
+	if (tier != 0 && tier + 1 < numTiers){
+		TierClock& clock = tierClocks[tier];
+		auto cit = clock.entries.find(physicalPage);
+		myassert(cit != clock.entries.end());
+		clock.pages.erase(cit->second.first);
+		clock.entries.erase(cit);
+	}
+	if (tier > 1){
+		tierAccessCounts.erase(physicalPage);
+	}
+}
+
+uint64 HybridMemoryManager::getPcmMemorySizeUsed(){
+	uint64 freePages = 0;
+	for (unsigned i = 1; i < numTiers; i++){
+		freePages += freePageLists[i].size();
+	}
+	return (numPcmPages - freePages) * pageSize;
+}
+
+/*
+ * Returns the physical page for a newly accessed virtual page. With huge pages, the first page of a
+ * huge page to be accessed reserves a free frame in the memory chosen by the migration policy and the
+ * rest of the pages are mapped to the same frame as long as the policy chooses the same memory for them.
+ */
+addrint HybridMemoryManager::allocatePage(int pid, addrint virtualPage, PageType type){
+	if (hugePagePolicies[pid] == NO_HUGE_PAGES){
+		return takeSinglePage(type);
+	}
+	addrint hugePage = virtualPage / pagesPerHugePage;
+	auto hit = hugePages[pid].find(hugePage);
+	if (hit == hugePages[pid].end()){
+		addrint firstPage;
+		//frames are reserved in the fastest tier that has a free one
+		unsigned tier = type == DRAM ? 0 : 1;
+		unsigned lastTier = type == DRAM ? 0 : numTiers - 1;
+		bool reserved = freePageLists[tier].takeFrame(&firstPage);
+		while (!reserved && tier < lastTier){
+			tier++;
+			reserved = freePageLists[tier].takeFrame(&firstPage);
+		}
+		if (reserved){
+			hit = hugePages[pid].emplace(hugePage, HugePageEntry(firstPage, type, true)).first;
+			hugePageReservations++;
+		} else {
+			hit = hugePages[pid].emplace(hugePage, HugePageEntry(0, type, false)).first;
+			hugePageFallbacks++;
+		}
+	}
+	if (hit->second.reserved && hit->second.type != type){
+		releaseHugePage(pid, hit);
+	}
+	if (hit->second.reserved){
+		hit->second.mappedPages++;
+		if (hit->second.mappedPages == pagesPerHugePage){
+			hugePagesMapped++;
+		}
+		return hit->second.firstPage + virtualPage % pagesPerHugePage;
+	} else {
+		return takeSinglePage(type);
+	}
+}
+
+addrint HybridMemoryManager::takeSinglePage(PageType type){
+	FreePageList *freePageList = getFreePageList(type);
+	if (freePageList->empty()){
+		//give back the unmapped pages of a huge page reserved in this memory
+		for (unsigned pid = 0; pid < numProcesses && freePageList->empty(); pid++){
+			for (auto hit = hugePages[pid].begin(); hit != hugePages[pid].end() && freePageList->empty(); ++hit){
+				if (hit->second.reserved && hit->second.type == type && hit->second.mappedPages < pagesPerHugePage){
+					releaseHugePage(pid, hit);
+					freePageList = getFreePageList(type);
+				}
+			}
+		}
+	}
+	if (freePageList->empty()){
+		if (type == DRAM){
+			error("DRAM free page list is empty");
+		} else {
+			error("PCM free page list is empty");
+		}
+	}
+	return freePageList->take();
+}
+
+/*
+ * Returns whether an on demand migration of the page should not be attempted because the page belongs to
+ * a huge page that the huge page policy of the process keeps whole
+ */
+bool HybridMemoryManager::keepsHugePage(int pid, addrint virtualPage){
+	if (hugePagePolicies[pid] == NO_HUGE_PAGES || hugePagePolicies[pid] == SPLIT_HUGE_PAGES){
+		return false;
+	}
+	auto hit = hugePages[pid].find(virtualPage / pagesPerHugePage);
+	if (hit == hugePages[pid].end() || !hit->second.reserved){
+		return false;
+	}
+	if (hugePagePolicies[pid] == WHOLE_HUGE_PAGES){
+		return true;
+	} else if (hugePagePolicies[pid] == THP_HUGE_PAGES){
+		//sparsely mapped huge pages give little reach and are split
+		return hit->second.mappedPages >= thpMinMappedFraction * pagesPerHugePage;
+	} else {
+		myassert(false);
+		return false;
+	}
+}
+
+/*
+ * Splits the huge page of a page that is about to be migrated
+ */
+void HybridMemoryManager::splitHugePage(int pid, addrint virtualPage){
+	if (hugePagePolicies[pid] == NO_HUGE_PAGES){
+		return;
+	}
+	auto hit = hugePages[pid].find(virtualPage / pagesPerHugePage);
+	if (hit != hugePages[pid].end() && hit->second.reserved){
+		releaseHugePage(pid, hit);
+	}
+}
+
+/*
+ * Ends the reservation of a huge page: the pages that were mapped stay where they are and the rest
+ * of the frame is freed
+ */
+void HybridMemoryManager::releaseHugePage(int pid, HugePageMap::iterator hit){
+	myassert(hit->second.reserved);
+	FreePageList *freePageList = &freePageLists[getTier(hit->second.firstPage)];
+	addrint firstVirtualPage = hit->first * pagesPerHugePage;
+	for (unsigned i = 0; i < pagesPerHugePage; i++){
+		if (pages[pid].find(firstVirtualPage + i) == pages[pid].end()){
+			freePageList->add(hit->second.firstPage + i);
+		}
+	}
+	hit->second.reserved = false;
+	hugePageSplits++;
+}
+
+bool HybridMemoryManager::isMappedAsHugePage(int pid, addrint virtualPage){
+	if (hugePagePolicies[pid] == NO_HUGE_PAGES){
+		return false;
+	}
+	auto hit = hugePages[pid].find(virtualPage / pagesPerHugePage);
+	return hit != hugePages[pid].end() && hit->second.reserved && hit->second.mappedPages == pagesPerHugePage;
 }
 
 void HybridMemoryManager::unstallCpus(int pid, addrint virtualPage){
@@ -993,16 +1502,66 @@ void HybridMemoryManager::unstallCpus(int pid, addrint virtualPage){
 }
 
 bool HybridMemoryManager::arePagesCompatible(addrint page1, addrint page2) const {
-	if (flushPolicy == FLUSH_PCM_BEFORE || flushPolicy == FLUSH_ONLY_AFTER || REMAP){
+	if (flushPolicy == FLUSH_PCM_BEFORE || flushPolicy == FLUSH_ONLY_AFTER || flushPolicy == REMAP){
 		return true;
 	} else if (flushPolicy == CHANGE_TAG){
-		return lastLevelCache->isSameSet(getAddress(page1, 0), getAddress(page2, 0));
+		//every block of the page must stay in the same set of the last level cache
+		for (addrint offset = 0; offset < pageSize; offset += blockSize){
+			if (!lastLevelCache->isSameSet(getAddress(page1, offset), getAddress(page2, offset))){
+				return false;
+			}
+		}
+		return true;
 	} else {
 		myassert(false);
 		return false;
 	}
 }
 
+/*
+ * Returns whether the policy has enough tokens to migrate a page
+ */
+bool HybridMemoryManager::hasTokens(int policy){
+	if (migrationRate == 0){
+		return true;
+	}
+	updateTokens();
+	if (tokens[policy] < pageSize){
+		throttledMigrations++;
+		return false;
+	}
+	return true;
+}
+
+void HybridMemoryManager::takeTokens(int policy){
+	if (migrationRate != 0){
+		myassert(tokens[policy] >= pageSize);
+		tokens[policy] -= pageSize;
+	}
+}
+
+void HybridMemoryManager::updateTokens(){
+	uint64 timestamp = engine->getTimestamp();
+	if (adaptiveMigrationRate && timestamp - lastRateUpdate >= migrationRatePeriod){
+		//multiplicative decrease while the queue stall time keeps rising, additive increase otherwise
+		uint64 queueStallTime = memory->getQueueStallTime();
+		uint64 delta = queueStallTime - lastQueueStallTime;
+		if (delta > lastQueueStallDelta){
+			migrationRateFactor = max(migrationRateFactor / 2, 1.0 / 64);
+		} else {
+			migrationRateFactor = min(migrationRateFactor + 1.0 / 16, 1.0);
+		}
+		lastQueueStallTime = queueStallTime;
+		lastQueueStallDelta = delta;
+		lastRateUpdate = timestamp;
+	}
+	double capacity = static_cast<double>(migrationBurst) * pageSize;
+	for (unsigned i = 0; i < tokens.size(); i++){
+		tokens[i] = min(tokens[i] + (timestamp - lastTokenUpdate) * migrationRate * partition->getRate(i) * migrationRateFactor, capacity);
+	}
+	lastTokenUpdate = timestamp;
+}
+
 void HybridMemoryManager::processInterrupt(Counter* counter){
 	myassert(periodType == "instructions");
 	myassert(instrCounters[0] == counter);
@@ -1020,6 +1579,153 @@ void HybridMemoryManager::processInterrupt(Counter* counter){
 	}
 }
 
+/*
+ * Pages cannot be checkpointed while they are being migrated
+ */
+bool HybridMemoryManager::isQuiescent() const {
+	if (!migrations.empty() || !stalledRequests.empty() || !tagChangeQueue.empty() || tagChangesInFlight != 0){
+		return false;
+	}
+	for (unsigned pid = 0; pid < numProcesses; pid++){
+		if (!stalledCpus[pid].empty()){
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Whether an access could stall: a page is being flushed (only copies let accesses through) or something
+ * is waiting for a page
+ */
+bool HybridMemoryManager::isStallingAccesses() const {
+	for (auto it = migrations.begin(); it != migrations.end(); ++it){
+		if (it->second.state != COPY){
+			return true;
+		}
+	}
+	if (!stalledRequests.empty() || !tagChangeQueue.empty() || tagChangesInFlight != 0){
+		return true;
+	}
+	for (unsigned pid = 0; pid < numProcesses; pid++){
+		if (!stalledCpus[pid].empty()){
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * On-demand copies to DRAM only finish when their pages are accessed, so the rest of their blocks are read
+ */
+void HybridMemoryManager::quiesce(){
+	for (auto it = migrations.begin(); it != migrations.end(); ++it){
+		if (it->second.state == COPY && !it->second.needsCopying && !it->second.rolledBack && it->second.dest == DRAM){
+			memory->complete(it->first);
+		}
+	}
+}
+
+void HybridMemoryManager::saveCheckpoint(CheckpointWriter *writer){
+	writer->write(numProcesses);
+	for (unsigned pid = 0; pid < numProcesses; pid++){
+		writer->write(static_cast<uint64>(pages[pid].size()));
+		for (PageMap::const_iterator it = pages[pid].begin(); it != pages[pid].end(); ++it){
+			writer->write(it->first);
+			writer->write(it->second.page);
+			writer->write(it->second.type);
+		}
+	}
+	//huge page reservations are not saved: the unmapped pages of reserved frames are saved as free pages
+	vector<vector<addrint> > freePages(numTiers);
+	for (unsigned i = 0; i < numTiers; i++){
+		freePageLists[i].getPages(&freePages[i]);
+	}
+	for (unsigned pid = 0; pid < numProcesses; pid++){
+		for (auto hit = hugePages[pid].begin(); hit != hugePages[pid].end(); ++hit){
+			if (hit->second.reserved){
+				for (unsigned i = 0; i < pagesPerHugePage; i++){
+					if (pages[pid].find(hit->first * pagesPerHugePage + i) == pages[pid].end()){
+						freePages[getTier(hit->second.firstPage)].emplace_back(hit->second.firstPage + i);
+					}
+				}
+			}
+		}
+	}
+	writer->write(numTiers);
+	for (vector<addrint>& freeList : freePages){
+		writer->write(static_cast<uint64>(freeList.size()));
+		for (auto it = freeList.begin(); it != freeList.end(); ++it){
+			writer->write(*it);
+		}
+	}
+	writer->write(static_cast<unsigned>(policies.size()));
+	for (vector<IMigrationPolicy*>::iterator it = policies.begin(); it != policies.end(); ++it){
+		(*it)->saveCheckpoint(writer);
+	}
+}
+
+/*
+ * Replaces the initial allocation: the page tables, free lists and migration policies are
+ * restored as they were when the checkpoint was taken
+ */
+void HybridMemoryManager::restoreCheckpoint(CheckpointReader *reader){
+	if (reader->read<unsigned>() != numProcesses){
+		error("Checkpoint has a different number of processes");
+	}
+	physicalPages.clear();
+	tierClocks.clear();
+	tierClocks.resize(numTiers);
+	tierAccessCounts.clear();
+	for (unsigned pid = 0; pid < numProcesses; pid++){
+		pages[pid].clear();
+		hugePages[pid].clear();
+		dramMemorySizeUsedPerPid[pid] = 0;
+		pcmMemorySizeUsedPerPid[pid] = 0;
+		uint64 numPages = reader->read<uint64>();
+		for (uint64 i = 0; i < numPages; i++){
+			addrint virtualPage = reader->read<addrint>();
+			addrint page = reader->read<addrint>();
+			PageType type = reader->read<PageType>();
+			if (type == DRAM){
+				if (!isDramPage(page)){
+					error("Checkpoint maps page %lu, which is reserved for the line cache", page);
+				}
+				dramMemorySizeUsedPerPid[pid] += pageSize;
+			} else if (type == PCM){
+				myassert(isPcmPage(page));
+				pcmMemorySizeUsedPerPid[pid] += pageSize;
+			} else {
+				myassert(false);
+			}
+			pages[pid].emplace(virtualPage, PageEntry(page, type, engine->getTimestamp()));
+			bool ins = physicalPages.emplace(page, PhysicalPageEntry(pid, virtualPage)).second;
+			myassert(ins);
+			addTierPage(page);
+		}
+	}
+	if (reader->read<unsigned>() != numTiers){
+		error("Checkpoint has a different number of memory tiers");
+	}
+	for (FreePageList& freeList : freePageLists){
+		freeList.clear();
+		uint64 numPages = reader->read<uint64>();
+		for (uint64 i = 0; i < numPages; i++){
+			addrint page = reader->read<addrint>();
+			if (!isDramPage(page) && !isPcmPage(page)){
+				error("Checkpoint has free page %lu, which is reserved for the line cache", page);
+			}
+			freeList.add(page);
+		}
+	}
+	if (reader->read<unsigned>() != policies.size()){
+		error("Checkpoint has a different number of migration policies");
+	}
+	for (vector<IMigrationPolicy*>::iterator it = policies.begin(); it != policies.end(); ++it){
+		(*it)->restoreCheckpoint(reader);
+	}
+}
+
 int HybridMemoryManager::getPidOfAddress(addrint addr){
 	PhysicalPageMap::iterator it = physicalPages.find(getIndex(addr));
 	if (it == physicalPages.end()){
@@ -1046,6 +1752,7 @@ void HybridMemoryManager::addInstrCounter(Counter* counter, unsigned pid){
 
 HybridMemoryManager::~HybridMemoryManager(){
 	delete [] pages;
+	delete [] hugePages;
 	delete [] stalledCpus;
 }
 
@@ -2488,6 +3195,38 @@ ostream& operator<<(ostream& lhs, FlushPolicy rhs){
 	return lhs;
 }
 
+istream& operator>>(istream& lhs, HugePagePolicy& rhs){
+	string s;
+	lhs >> s;
+	if (s == "never"){
+		rhs = NO_HUGE_PAGES;
+	} else if (s == "whole"){
+		rhs = WHOLE_HUGE_PAGES;
+	} else if (s == "split"){
+		rhs = SPLIT_HUGE_PAGES;
+	} else if (s == "thp"){
+		rhs = THP_HUGE_PAGES;
+	} else {
+		error("Invalid huge page policy: %s", s.c_str());
+	}
+	return lhs;
+}
+
+ostream& operator<<(ostream& lhs, HugePagePolicy rhs){
+	if(rhs == NO_HUGE_PAGES){
+		lhs << "never";
+	} else if(rhs == WHOLE_HUGE_PAGES){
+		lhs << "whole";
+	} else if(rhs == SPLIT_HUGE_PAGES){
+		lhs << "split";
+	} else if(rhs == THP_HUGE_PAGES){
+		lhs << "thp";
+	} else {
+		error("Invalid huge page policy");
+	}
+	return lhs;
+}
+
 istream& operator>>(istream& lhs, MonitoringStrategy& rhs){
 	string s;
 	lhs >> s;
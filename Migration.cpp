@@ -146,6 +146,20 @@ void BaseMigrationPolicy::setNumDramPages(uint64 dramPagesNew) {
     maxFreeDramPages = dramPages * maxFreeDram;
 }
 
+void BaseMigrationPolicy::saveCheckpoint(CheckpointWriter *writer) {
+    writer->write(dramPages);
+    writer->write(dramPagesLeft);
+    writer->write(maxFreeDramPages);
+    writer->write(dramFull);
+}
+
+void BaseMigrationPolicy::restoreCheckpoint(CheckpointReader *reader) {
+    reader->read(&dramPages);
+    reader->read(&dramPagesLeft);
+    reader->read(&maxFreeDramPages);
+    reader->read(&dramFull);
+}
+
 NoMigrationPolicy::NoMigrationPolicy(
         const string& nameArg,
         Engine *engineArg,
@@ -477,6 +491,1097 @@ bool MultiQueueMigrationPolicy::selectDemotionPage(int *pid, addrint *addr) {
     }
 }
 
+void MultiQueueMigrationPolicy::setThresholds(unsigned thresholdQueueArg, uint64 lifetimeArg, uint64 filterThresholdArg) {
+    if (thresholdQueueArg == 0 || thresholdQueueArg >= numQueues) {
+        error("Threshold queue (%u) must be between 1 and the number of queues minus 1 (%u)", thresholdQueueArg, numQueues - 1);
+    }
+    thresholdQueue = thresholdQueueArg;
+    lifetime = lifetimeArg;
+    filterThreshold = filterThresholdArg;
+}
+
+void MultiQueueMigrationPolicy::saveCheckpoint(CheckpointWriter *writer) {
+    BaseMigrationPolicy::saveCheckpoint(writer);
+    writer->write(currentTime);
+    writer->write(tries);
+    for (unsigned type = 0; type < 2; type++) {
+        for (unsigned i = 0; i < numQueues; i++) {
+            saveQueue(writer, queues[type][i]);
+        }
+    }
+    saveQueue(writer, victims);
+    saveQueue(writer, history);
+    writer->write(static_cast<uint64>(pending.size()));
+    for (auto it = pending.begin(); it != pending.end(); ++it) {
+        writer->write(it->first);
+        writer->write(it->second);
+    }
+}
+
+/*
+ * The page map is not saved: every page has exactly one entry in one of the queues, so it is
+ * rebuilt while the queues are restored
+ */
+void MultiQueueMigrationPolicy::restoreCheckpoint(CheckpointReader *reader) {
+    BaseMigrationPolicy::restoreCheckpoint(reader);
+    reader->read(&currentTime);
+    reader->read(&tries);
+    for (unsigned i = 0; i < numPids; i++) {
+        pages[i].clear();
+    }
+    for (unsigned type = 0; type < 2; type++) {
+        for (unsigned i = 0; i < numQueues; i++) {
+            restoreQueue(reader, &queues[type][i], i);
+        }
+    }
+    restoreQueue(reader, &victims, -1);
+    restoreQueue(reader, &history, -2);
+    pending.clear();
+    uint64 numPending = reader->read<uint64>();
+    for (uint64 i = 0; i < numPending; i++) {
+        int pid = reader->read<int>();
+        addrint addr = reader->read<addrint>();
+        pending.emplace_back(pid, addr);
+    }
+}
+
+void MultiQueueMigrationPolicy::saveQueue(CheckpointWriter *writer, const AccessQueue& queue) {
+    writer->write(static_cast<uint64>(queue.size()));
+    for (auto it = queue.begin(); it != queue.end(); ++it) {
+        int index = numPids == 1 ? 0 : it->pid;
+        auto pit = pages[index].find(it->addr);
+        myassert(pit != pages[index].end());
+        writer->write(it->pid);
+        writer->write(it->addr);
+        writer->write(it->expirationTime);
+        writer->write(it->count);
+        writer->write(it->demoted);
+        writer->write(it->migrating);
+        writer->write(pit->second.type);
+    }
+}
+
+void MultiQueueMigrationPolicy::restoreQueue(CheckpointReader *reader, AccessQueue *queue, int queueIndex) {
+    queue->clear();
+    uint64 size = reader->read<uint64>();
+    for (uint64 i = 0; i < size; i++) {
+        int pid = reader->read<int>();
+        addrint addr = reader->read<addrint>();
+        uint64 expirationTime = reader->read<uint64>();
+        uint64 count = reader->read<uint64>();
+        bool demoted = reader->read<bool>();
+        bool migrating = reader->read<bool>();
+        PageType type = reader->read<PageType>();
+        int index = numPids == 1 ? 0 : pid;
+        auto ait = queue->emplace(queue->end(), AccessEntry(pid, addr, expirationTime, count, demoted, migrating));
+        bool ins = pages[index].emplace(addr, PageEntry(type, queueIndex, ait)).second;
+        myassert(ins);
+    }
+}
+
+
+//Count-Min Sketch
+
+SketchMigrationPolicy::SketchMigrationPolicy(
+        const string& nameArg,
+        Engine *engineArg,
+        uint64 debugStartArg,
+        uint64 dramPagesArg,
+        AllocationPolicy allocPolicyArg,
+        unsigned numPidsArg,
+        double maxFreeDramArg,
+        uint32 completeThresholdArg,
+        uint64 rollbackTimeoutArg,
+        unsigned widthArg,
+        unsigned depthArg,
+        uint64 resetPeriodArg,
+        uint32 promotionThresholdArg,
+        unsigned maxCandidatesArg) :
+BaseMigrationPolicy(nameArg, engineArg, debugStartArg, dramPagesArg, allocPolicyArg, numPidsArg, maxFreeDramArg, completeThresholdArg, rollbackTimeoutArg),
+width(widthArg),
+depth(depthArg),
+resetPeriod(resetPeriodArg),
+promotionThreshold(promotionThresholdArg),
+maxCandidates(maxCandidatesArg) {
+
+    if (width < 2 || (width & (width - 1)) != 0) {
+        error("Sketch width (%u) must be a power of 2 larger than 1", width);
+    }
+    if (depth == 0) {
+        error("Sketch depth must be larger than 0");
+    }
+    if (promotionThreshold == 0) {
+        error("Sketch promotion threshold must be larger than 0");
+    }
+
+    widthLog = 0;
+    while ((1U << widthLog) < width) {
+        widthLog++;
+    }
+
+    //fixed odd multipliers (splitmix64) so that runs are reproducible
+    uint64 state = 0x9E3779B97F4A7C15ULL;
+    for (unsigned i = 0; i < depth; i++) {
+        state += 0x9E3779B97F4A7C15ULL;
+        uint64 z = state;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        z = z ^ (z >> 31);
+        seeds.push_back(z | 1);
+    }
+    counters.resize(static_cast<uint64>(width) * depth, 0);
+    sampleCount = 0;
+
+    candidates = new CandidateMap[numPids];
+    numCandidates = 0;
+
+    dramPagesMap = new ClockMap[numPids];
+    hand = clock.end();
+}
+
+SketchMigrationPolicy::~SketchMigrationPolicy() {
+    delete[] candidates;
+    delete[] dramPagesMap;
+}
+
+PageType SketchMigrationPolicy::allocate(int pid, addrint addr, bool read, bool instr) {
+    PageType ret = BaseMigrationPolicy::allocate(pid, addr, read, instr);
+    if (ret == DRAM) {
+        addDramPage(pid, addr, false);
+    }
+    return ret;
+}
+
+bool SketchMigrationPolicy::migrate(int pid, addrint addr) {
+    if (dramPagesLeft > 0) {
+        int index = numPids == 1 ? 0 : pid;
+        auto it = candidates[index].find(addr);
+        if (it != candidates[index].end()) {
+            myassert(dramPagesMap[index].find(addr) == dramPagesMap[index].end());
+            candidates[index].erase(it);
+            numCandidates--;
+            addDramPage(pid, addr, true);
+            dramPagesLeft--;
+            return true;
+        }
+    }
+    return false;
+}
+
+void SketchMigrationPolicy::monitor(const vector<CountEntry>& counts, const vector<ProgressEntry>& progress) {
+    for (auto cit = counts.begin(); cit != counts.end(); ++cit) {
+        if (cit->reads == 0) {
+            continue;
+        }
+        int index = numPids == 1 ? 0 : cit->pid;
+        uint32 estimate = update(index, cit->page, cit->reads);
+        auto it = dramPagesMap[index].find(cit->page);
+        if (it != dramPagesMap[index].end()) {
+            it->second->referenced = true;
+        } else if (estimate >= promotionThreshold) {
+            addCandidate(index, cit->page, estimate);
+        }
+        sampleCount += cit->reads;
+        if (resetPeriod != 0 && sampleCount >= resetPeriod) {
+            halve();
+        }
+    }
+    BaseMigrationPolicy::monitor(counts, progress);
+}
+
+bool SketchMigrationPolicy::selectDemotionPage(int *pid, addrint *addr) {
+    if (dramPagesLeft > maxFreeDramPages) {
+        return false;
+    }
+
+    //second chance: the second sweep always finds a victim
+    uint64 steps = 2 * clock.size();
+    for (uint64 i = 0; i < steps; i++) {
+        if (hand == clock.end()) {
+            hand = clock.begin();
+        }
+        if (hand->referenced) {
+            hand->referenced = false;
+            ++hand;
+        } else {
+            int index = numPids == 1 ? 0 : hand->pid;
+            *pid = hand->pid;
+            *addr = hand->addr;
+            dramPagesMap[index].erase(hand->addr);
+            hand = clock.erase(hand);
+            dramPagesLeft++;
+            return true;
+        }
+    }
+    return false;
+}
+
+void SketchMigrationPolicy::saveCheckpoint(CheckpointWriter *writer) {
+    BaseMigrationPolicy::saveCheckpoint(writer);
+    writer->write(width);
+    writer->write(depth);
+    for (auto it = counters.begin(); it != counters.end(); ++it) {
+        writer->write(*it);
+    }
+    writer->write(sampleCount);
+    writer->write(static_cast<uint64>(clock.size()));
+    auto it = hand;
+    for (uint64 i = 0; i < clock.size(); i++) {
+        if (it == clock.end()) {
+            it = clock.begin();
+        }
+        writer->write(it->pid);
+        writer->write(it->addr);
+        writer->write(it->referenced);
+        ++it;
+    }
+    for (unsigned i = 0; i < numPids; i++) {
+        writer->write(static_cast<uint64>(candidates[i].size()));
+        for (auto cit = candidates[i].begin(); cit != candidates[i].end(); ++cit) {
+            writer->write(cit->first);
+            writer->write(cit->second);
+        }
+    }
+}
+
+/*
+ * The clock is saved starting at the hand, so the hand is at the beginning of the restored clock
+ */
+void SketchMigrationPolicy::restoreCheckpoint(CheckpointReader *reader) {
+    BaseMigrationPolicy::restoreCheckpoint(reader);
+    unsigned widthCheck = reader->read<unsigned>();
+    unsigned depthCheck = reader->read<unsigned>();
+    if (widthCheck != width || depthCheck != depth) {
+        error("Checkpoint sketch dimensions (%ux%u) do not match the configuration (%ux%u)", depthCheck, widthCheck, depth, width);
+    }
+    for (auto it = counters.begin(); it != counters.end(); ++it) {
+        reader->read(&*it);
+    }
+    reader->read(&sampleCount);
+    clock.clear();
+    for (unsigned i = 0; i < numPids; i++) {
+        dramPagesMap[i].clear();
+    }
+    hand = clock.end();
+    uint64 size = reader->read<uint64>();
+    for (uint64 i = 0; i < size; i++) {
+        int pid = reader->read<int>();
+        addrint addr = reader->read<addrint>();
+        bool referenced = reader->read<bool>();
+        addDramPage(pid, addr, referenced);
+    }
+    hand = clock.begin();
+    numCandidates = 0;
+    for (unsigned i = 0; i < numPids; i++) {
+        candidates[i].clear();
+        uint64 numEntries = reader->read<uint64>();
+        for (uint64 j = 0; j < numEntries; j++) {
+            addrint addr = reader->read<addrint>();
+            uint64 count = reader->read<uint64>();
+            candidates[i].emplace(addr, count);
+            numCandidates++;
+        }
+    }
+}
+
+unsigned SketchMigrationPolicy::getCounterIndex(unsigned row, int index, addrint addr) const {
+    uint64 key = (static_cast<uint64>(index) << 52) ^ addr;
+    return row * width + static_cast<unsigned>((key * seeds[row]) >> (64 - widthLog));
+}
+
+/*
+ * Conservative update: rows are only raised up to the new estimate, which reduces the
+ * overestimation caused by collisions
+ */
+uint32 SketchMigrationPolicy::update(int index, addrint addr, uint64 count) {
+    uint32 estimate = numeric_limits<uint32>::max();
+    for (unsigned row = 0; row < depth; row++) {
+        estimate = min(estimate, counters[getCounterIndex(row, index, addr)]);
+    }
+    uint64 sum = static_cast<uint64>(estimate) + count;
+    uint32 newEstimate = sum > numeric_limits<uint32>::max() ? numeric_limits<uint32>::max() : static_cast<uint32>(sum);
+    for (unsigned row = 0; row < depth; row++) {
+        uint32 *counter = &counters[getCounterIndex(row, index, addr)];
+        if (*counter < newEstimate) {
+            *counter = newEstimate;
+        }
+    }
+    return newEstimate;
+}
+
+void SketchMigrationPolicy::halve() {
+    for (auto it = counters.begin(); it != counters.end(); ++it) {
+        *it >>= 1;
+    }
+    for (unsigned i = 0; i < numPids; i++) {
+        for (auto it = candidates[i].begin(); it != candidates[i].end();) {
+            it->second /= 2;
+            if (it->second < promotionThreshold) {
+                it = candidates[i].erase(it);
+                numCandidates--;
+            } else {
+                ++it;
+            }
+        }
+    }
+    sampleCount = 0;
+}
+
+void SketchMigrationPolicy::addCandidate(int index, addrint addr, uint64 estimate) {
+    auto it = candidates[index].find(addr);
+    if (it != candidates[index].end()) {
+        it->second = estimate;
+        return;
+    }
+    if (maxCandidates == 0) {
+        return;
+    }
+    if (numCandidates == maxCandidates) {
+        //replace the coldest candidate, if it is colder than the new one
+        int minIndex = -1;
+        CandidateMap::iterator minIt;
+        for (unsigned i = 0; i < numPids; i++) {
+            for (auto cit = candidates[i].begin(); cit != candidates[i].end(); ++cit) {
+                if (minIndex == -1 || cit->second < minIt->second) {
+                    minIndex = i;
+                    minIt = cit;
+                }
+            }
+        }
+        myassert(minIndex != -1);
+        if (minIt->second >= estimate) {
+            return;
+        }
+        candidates[minIndex].erase(minIt);
+        numCandidates--;
+    }
+    candidates[index].emplace(addr, estimate);
+    numCandidates++;
+}
+
+void SketchMigrationPolicy::addDramPage(int pid, addrint addr, bool referenced) {
+    int index = numPids == 1 ? 0 : pid;
+    auto it = clock.emplace(hand, ClockEntry(pid, addr, referenced));
+    bool ins = dramPagesMap[index].emplace(addr, it).second;
+    myassert(ins);
+}
+
+//First Touch
+
+FirstTouchMigrationPolicy::FirstTouchMigrationPolicy(
+        const string& nameArg,
+        Engine *engineArg,
+        uint64 debugStartArg,
+        uint64 dramPagesArg,
+        AllocationPolicy allocPolicyArg,
+        unsigned numPidsArg,
+        double maxFreeDramArg,
+        uint32 completeThresholdArg,
+        uint64 rollbackTimeoutArg) :
+BaseMigrationPolicy(nameArg, engineArg, debugStartArg, dramPagesArg, allocPolicyArg, numPidsArg, maxFreeDramArg, completeThresholdArg, rollbackTimeoutArg) {
+
+    currentIt = queue.end();
+    pages = new PageMap[numPids];
+}
+
+FirstTouchMigrationPolicy::~FirstTouchMigrationPolicy() {
+    delete[] pages;
+}
+
+PageType FirstTouchMigrationPolicy::allocate(int pid, addrint addr, bool read, bool instr) {
+    PageType ret = BaseMigrationPolicy::allocate(pid, addr, read, instr);
+    if (ret == DRAM) {
+        addDramPage(pid, addr, false);
+    }
+    return ret;
+}
+
+bool FirstTouchMigrationPolicy::migrate(int pid, addrint addr) {
+    if (dramPagesLeft > 0) {
+        addDramPage(pid, addr, false);
+        dramPagesLeft--;
+        return true;
+    } else {
+        return false;
+    }
+}
+
+void FirstTouchMigrationPolicy::monitor(const vector<CountEntry>& counts, const vector<ProgressEntry>& progress) {
+    for (auto cit = counts.begin(); cit != counts.end(); ++cit) {
+        int index = numPids == 1 ? 0 : cit->pid;
+        PageMap::iterator it = pages[index].find(cit->page);
+        if (it != pages[index].end()) {
+            it->second->ref = true;
+        }
+    }
+    BaseMigrationPolicy::monitor(counts, progress);
+}
+
+bool FirstTouchMigrationPolicy::selectDemotionPage(int *pid, addrint *addr) {
+    if (dramPagesLeft > maxFreeDramPages) {
+        return false;
+    }
+    if (queue.empty()) {
+        return false;
+    }
+    if (currentIt == queue.end()) {
+        currentIt = queue.begin();
+    }
+    while (currentIt->ref) {
+        currentIt->ref = false;
+        ++currentIt;
+        if (currentIt == queue.end()) {
+            currentIt = queue.begin();
+        }
+    }
+    int index = numPids == 1 ? 0 : currentIt->pid;
+    *pid = currentIt->pid;
+    *addr = currentIt->addr;
+    PageMap::iterator it = pages[index].find(currentIt->addr);
+    myassert(it != pages[index].end());
+    myassert(it->second == currentIt);
+    pages[index].erase(it);
+    currentIt = queue.erase(currentIt);
+    dramPagesLeft++;
+    return true;
+}
+
+void FirstTouchMigrationPolicy::saveCheckpoint(CheckpointWriter *writer) {
+    BaseMigrationPolicy::saveCheckpoint(writer);
+    writer->write(static_cast<uint64>(queue.size()));
+    auto it = currentIt;
+    for (uint64 i = 0; i < queue.size(); i++) {
+        if (it == queue.end()) {
+            it = queue.begin();
+        }
+        writer->write(it->pid);
+        writer->write(it->addr);
+        writer->write(it->ref);
+        ++it;
+    }
+}
+
+/*
+ * The clock is saved starting at the hand, so the hand is at the beginning of the restored clock
+ */
+void FirstTouchMigrationPolicy::restoreCheckpoint(CheckpointReader *reader) {
+    BaseMigrationPolicy::restoreCheckpoint(reader);
+    queue.clear();
+    for (unsigned i = 0; i < numPids; i++) {
+        pages[i].clear();
+    }
+    currentIt = queue.end();
+    uint64 size = reader->read<uint64>();
+    for (uint64 i = 0; i < size; i++) {
+        int pid = reader->read<int>();
+        addrint addr = reader->read<addrint>();
+        bool ref = reader->read<bool>();
+        addDramPage(pid, addr, ref);
+    }
+    currentIt = queue.begin();
+}
+
+void FirstTouchMigrationPolicy::addDramPage(int pid, addrint addr, bool ref) {
+    int index = numPids == 1 ? 0 : pid;
+    auto accessIt = queue.emplace(currentIt, AccessEntry(pid, addr, ref));
+    bool ins = pages[index].emplace(addr, accessIt).second;
+    myassert(ins);
+}
+
+//Double Clock
+
+DoubleClockMigrationPolicy::DoubleClockMigrationPolicy(
+        const string& nameArg,
+        Engine *engineArg,
+        uint64 debugStartArg,
+        uint64 dramPagesArg,
+        AllocationPolicy allocPolicyArg,
+        unsigned numPidsArg,
+        double maxFreeDramArg,
+        uint32 completeThresholdArg,
+        uint64 rollbackTimeoutArg) :
+BaseMigrationPolicy(nameArg, engineArg, debugStartArg, dramPagesArg, allocPolicyArg, numPidsArg, maxFreeDramArg, completeThresholdArg, rollbackTimeoutArg) {
+
+    currentDramIt = dramQueue.end();
+    pages = new PageMap[numPids];
+}
+
+DoubleClockMigrationPolicy::~DoubleClockMigrationPolicy() {
+    delete[] pages;
+}
+
+PageType DoubleClockMigrationPolicy::allocate(int pid, addrint addr, bool read, bool instr) {
+    PageType ret = BaseMigrationPolicy::allocate(pid, addr, read, instr);
+    if (ret == DRAM) {
+        addDramPage(pid, addr, false);
+    }
+    return ret;
+}
+
+bool DoubleClockMigrationPolicy::migrate(int pid, addrint addr) {
+    if (dramPagesLeft > 0) {
+        int index = numPids == 1 ? 0 : pid;
+        PageMap::iterator it = pages[index].find(addr);
+        if (it != pages[index].end()) {
+            myassert(it->second.type == PCM_ACTIVE_LIST);
+            pcmActiveQueue.erase(it->second.accessIt);
+            pages[index].erase(it);
+            addDramPage(pid, addr, false);
+            dramPagesLeft--;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * The active list is swept once per monitoring period, before the new counts are applied: pages that were
+ * not accessed since the previous sweep become inactive again
+ */
+void DoubleClockMigrationPolicy::monitor(const vector<CountEntry>& counts, const vector<ProgressEntry>& progress) {
+    for (auto pcmIt = pcmActiveQueue.begin(); pcmIt != pcmActiveQueue.end();) {
+        if (pcmIt->ref) {
+            pcmIt->ref = false;
+            ++pcmIt;
+        } else {
+            int index = numPids == 1 ? 0 : pcmIt->pid;
+            pages[index].erase(pcmIt->addr);
+            pcmIt = pcmActiveQueue.erase(pcmIt);
+        }
+    }
+
+    for (auto cit = counts.begin(); cit != counts.end(); ++cit) {
+        if (cit->reads + cit->writes == 0) {
+            continue;
+        }
+        int index = numPids == 1 ? 0 : cit->pid;
+        PageMap::iterator it = pages[index].find(cit->page);
+        if (it != pages[index].end()) {
+            it->second.accessIt->ref = true;
+        } else {
+            auto accessIt = pcmActiveQueue.emplace(pcmActiveQueue.end(), AccessEntry(cit->pid, cit->page, true));
+            pages[index].emplace(cit->page, PageEntry(PCM_ACTIVE_LIST, accessIt));
+        }
+    }
+    BaseMigrationPolicy::monitor(counts, progress);
+}
+
+bool DoubleClockMigrationPolicy::selectDemotionPage(int *pid, addrint *addr) {
+    if (dramPagesLeft > maxFreeDramPages) {
+        return false;
+    }
+    if (dramQueue.empty()) {
+        return false;
+    }
+    if (currentDramIt == dramQueue.end()) {
+        currentDramIt = dramQueue.begin();
+    }
+    while (currentDramIt->ref) {
+        currentDramIt->ref = false;
+        ++currentDramIt;
+        if (currentDramIt == dramQueue.end()) {
+            currentDramIt = dramQueue.begin();
+        }
+    }
+    int index = numPids == 1 ? 0 : currentDramIt->pid;
+    *pid = currentDramIt->pid;
+    *addr = currentDramIt->addr;
+    PageMap::iterator it = pages[index].find(currentDramIt->addr);
+    myassert(it != pages[index].end());
+    myassert(it->second.accessIt == currentDramIt);
+    pages[index].erase(it);
+    currentDramIt = dramQueue.erase(currentDramIt);
+    dramPagesLeft++;
+    return true;
+}
+
+void DoubleClockMigrationPolicy::saveCheckpoint(CheckpointWriter *writer) {
+    BaseMigrationPolicy::saveCheckpoint(writer);
+    writer->write(static_cast<uint64>(dramQueue.size()));
+    auto it = currentDramIt;
+    for (uint64 i = 0; i < dramQueue.size(); i++) {
+        if (it == dramQueue.end()) {
+            it = dramQueue.begin();
+        }
+        writer->write(it->pid);
+        writer->write(it->addr);
+        writer->write(it->ref);
+        ++it;
+    }
+    writer->write(static_cast<uint64>(pcmActiveQueue.size()));
+    for (auto pcmIt = pcmActiveQueue.begin(); pcmIt != pcmActiveQueue.end(); ++pcmIt) {
+        writer->write(pcmIt->pid);
+        writer->write(pcmIt->addr);
+        writer->write(pcmIt->ref);
+    }
+}
+
+/*
+ * The DRAM clock is saved starting at the hand, so the hand is at the beginning of the restored clock
+ */
+void DoubleClockMigrationPolicy::restoreCheckpoint(CheckpointReader *reader) {
+    BaseMigrationPolicy::restoreCheckpoint(reader);
+    dramQueue.clear();
+    pcmActiveQueue.clear();
+    for (unsigned i = 0; i < numPids; i++) {
+        pages[i].clear();
+    }
+    currentDramIt = dramQueue.end();
+    uint64 size = reader->read<uint64>();
+    for (uint64 i = 0; i < size; i++) {
+        int pid = reader->read<int>();
+        addrint addr = reader->read<addrint>();
+        bool ref = reader->read<bool>();
+        addDramPage(pid, addr, ref);
+    }
+    currentDramIt = dramQueue.begin();
+    size = reader->read<uint64>();
+    for (uint64 i = 0; i < size; i++) {
+        int pid = reader->read<int>();
+        addrint addr = reader->read<addrint>();
+        bool ref = reader->read<bool>();
+        int index = numPids == 1 ? 0 : pid;
+        auto accessIt = pcmActiveQueue.emplace(pcmActiveQueue.end(), AccessEntry(pid, addr, ref));
+        bool ins = pages[index].emplace(addr, PageEntry(PCM_ACTIVE_LIST, accessIt)).second;
+        myassert(ins);
+    }
+}
+
+void DoubleClockMigrationPolicy::addDramPage(int pid, addrint addr, bool ref) {
+    int index = numPids == 1 ? 0 : pid;
+    auto accessIt = dramQueue.emplace(currentDramIt, AccessEntry(pid, addr, ref));
+    bool ins = pages[index].emplace(addr, PageEntry(DRAM_LIST, accessIt)).second;
+    myassert(ins);
+}
+
+//Two LRU
+
+TwoLRUMigrationPolicy::TwoLRUMigrationPolicy(
+        const string& nameArg,
+        Engine *engineArg,
+        uint64 debugStartArg,
+        uint64 dramPagesArg,
+        AllocationPolicy allocPolicyArg,
+        unsigned numPidsArg,
+        double maxFreeDramArg,
+        uint32 completeThresholdArg,
+        uint64 rollbackTimeoutArg,
+        uint64 promotionThresholdArg) :
+BaseMigrationPolicy(nameArg, engineArg, debugStartArg, dramPagesArg, allocPolicyArg, numPidsArg, maxFreeDramArg, completeThresholdArg, rollbackTimeoutArg),
+promotionThreshold(promotionThresholdArg) {
+
+    pages = new PageMap[numPids];
+}
+
+TwoLRUMigrationPolicy::~TwoLRUMigrationPolicy() {
+    delete[] pages;
+}
+
+PageType TwoLRUMigrationPolicy::allocate(int pid, addrint addr, bool read, bool instr) {
+    int index = numPids == 1 ? 0 : pid;
+    PageType ret = BaseMigrationPolicy::allocate(pid, addr, read, instr);
+    AccessQueue::iterator accessIt;
+    ListType list;
+    if (ret == DRAM) {
+        accessIt = dramQueue.emplace(dramQueue.begin(), AccessEntry(pid, addr));
+        list = DRAM_LIST;
+    } else {
+        accessIt = pcmQueue.emplace(pcmQueue.begin(), AccessEntry(pid, addr));
+        list = PCM_LIST;
+    }
+    bool ins = pages[index].emplace(addr, PageEntry(list, accessIt)).second;
+    myassert(ins);
+    return ret;
+}
+
+bool TwoLRUMigrationPolicy::migrate(int pid, addrint addr) {
+    if (dramPagesLeft > 0) {
+        int index = numPids == 1 ? 0 : pid;
+        PageMap::iterator it = pages[index].find(addr);
+        myassert(it != pages[index].end());
+        myassert(it->second.type == PCM_LIST);
+        if (it->second.accessIt->hitCount > promotionThreshold) {
+            dramQueue.splice(dramQueue.begin(), pcmQueue, it->second.accessIt);
+            it->second.accessIt->hitCount = 0;
+            it->second.type = DRAM_LIST;
+            dramPagesLeft--;
+            return true;
+        }
+    }
+    return false;
+}
+
+void TwoLRUMigrationPolicy::monitor(const vector<CountEntry>& counts, const vector<ProgressEntry>& progress) {
+    for (auto cit = counts.begin(); cit != counts.end(); ++cit) {
+        if (cit->reads + cit->writes == 0) {
+            continue;
+        }
+        int index = numPids == 1 ? 0 : cit->pid;
+        PageMap::iterator it = pages[index].find(cit->page);
+        myassert(it != pages[index].end());
+        it->second.accessIt->hitCount += cit->reads + cit->writes;
+        if (it->second.type == DRAM_LIST) {
+            dramQueue.splice(dramQueue.begin(), dramQueue, it->second.accessIt);
+        } else if (it->second.type == PCM_LIST) {
+            pcmQueue.splice(pcmQueue.begin(), pcmQueue, it->second.accessIt);
+        } else {
+            myassert(false);
+        }
+    }
+    BaseMigrationPolicy::monitor(counts, progress);
+}
+
+bool TwoLRUMigrationPolicy::selectDemotionPage(int *pid, addrint *addr) {
+    if (dramPagesLeft > maxFreeDramPages) {
+        return false;
+    }
+    if (dramQueue.empty()) {
+        return false;
+    }
+    AccessQueue::iterator dramIt = dramQueue.end();
+    --dramIt;
+    int index = numPids == 1 ? 0 : dramIt->pid;
+    *pid = dramIt->pid;
+    *addr = dramIt->addr;
+    PageMap::iterator it = pages[index].find(dramIt->addr);
+    myassert(it != pages[index].end());
+    myassert(it->second.accessIt == dramIt);
+    pcmQueue.splice(pcmQueue.begin(), dramQueue, dramIt);
+    it->second.accessIt->hitCount = 0;
+    it->second.type = PCM_LIST;
+    dramPagesLeft++;
+    return true;
+}
+
+void TwoLRUMigrationPolicy::saveCheckpoint(CheckpointWriter *writer) {
+    BaseMigrationPolicy::saveCheckpoint(writer);
+    saveQueue(writer, dramQueue);
+    saveQueue(writer, pcmQueue);
+}
+
+void TwoLRUMigrationPolicy::restoreCheckpoint(CheckpointReader *reader) {
+    BaseMigrationPolicy::restoreCheckpoint(reader);
+    for (unsigned i = 0; i < numPids; i++) {
+        pages[i].clear();
+    }
+    restoreQueue(reader, &dramQueue, DRAM_LIST);
+    restoreQueue(reader, &pcmQueue, PCM_LIST);
+}
+
+void TwoLRUMigrationPolicy::saveQueue(CheckpointWriter *writer, const AccessQueue& queue) {
+    writer->write(static_cast<uint64>(queue.size()));
+    for (auto it = queue.begin(); it != queue.end(); ++it) {
+        writer->write(it->pid);
+        writer->write(it->addr);
+        writer->write(it->hitCount);
+    }
+}
+
+void TwoLRUMigrationPolicy::restoreQueue(CheckpointReader *reader, AccessQueue *queue, ListType type) {
+    queue->clear();
+    uint64 size = reader->read<uint64>();
+    for (uint64 i = 0; i < size; i++) {
+        int pid = reader->read<int>();
+        addrint addr = reader->read<addrint>();
+        uint64 hitCount = reader->read<uint64>();
+        int index = numPids == 1 ? 0 : pid;
+        auto accessIt = queue->emplace(queue->end(), AccessEntry(pid, addr, hitCount));
+        bool ins = pages[index].emplace(addr, PageEntry(type, accessIt)).second;
+        myassert(ins);
+    }
+}
+
+//Offline
+
+OfflineMigrationPolicy::OfflineMigrationPolicy(
+        const string& nameArg,
+        Engine *engineArg,
+        uint64 debugStartArg,
+        uint64 dramPagesArg,
+        AllocationPolicy allocPolicyArg,
+        unsigned numPidsArg,
+        double maxFreeDramArg,
+        uint32 completeThresholdArg,
+        uint64 rollbackTimeoutArg,
+        int thisPidArg,
+        const string& filenameArg,
+        const string& metricTypeArg,
+        const string& accessTypeArg,
+        const string& weightTypeArg,
+        uint64 intervalCountArg,
+        uint64 metricThresholdArg) :
+BaseMigrationPolicy(nameArg, engineArg, debugStartArg, dramPagesArg, allocPolicyArg, numPidsArg, maxFreeDramArg, completeThresholdArg, rollbackTimeoutArg),
+thisPid(thisPidArg),
+intervalCount(intervalCountArg),
+metricThreshold(metricThresholdArg),
+previousInterval(0) {
+
+    if (metricTypeArg == "accessed") {
+        metricType = ACCESSED;
+    } else if (metricTypeArg == "access_count") {
+        metricType = ACCESS_COUNT;
+    } else if (metricTypeArg == "touch_count") {
+        metricType = TOUCH_COUNT;
+    } else {
+        error("Invalid metric type: %s", metricTypeArg.c_str());
+    }
+
+    if (accessTypeArg == "reads") {
+        accessType = READS;
+    } else if (accessTypeArg == "writes") {
+        accessType = WRITES;
+    } else if (accessTypeArg == "accesses") {
+        accessType = ACCESSES;
+    } else {
+        error("Invalid access type: %s", accessTypeArg.c_str());
+    }
+
+    if (weightTypeArg == "uniform") {
+        for (uint64 i = 0; i < intervalCount; i++) {
+            weights.emplace_back(1);
+        }
+    } else if (weightTypeArg == "linear") {
+        for (uint64 i = 0; i < intervalCount; i++) {
+            weights.emplace_back(intervalCount - i);
+        }
+    } else if (weightTypeArg == "exponential") {
+        for (uint64 i = 0; i < intervalCount; i++) {
+            weights.emplace_back(static_cast<uint64> (pow(2.0, static_cast<double> (intervalCount - i - 1))));
+        }
+    } else {
+        error("Invalid weight type: %s", weightTypeArg.c_str());
+    }
+
+    if (numPids != 1) {
+        error("Sharing offline policies is not yet implemented");
+    }
+
+    gzFile trace = gzopen(filenameArg.c_str(), "r");
+    if (trace == 0) {
+        error("Could not open file %s", filenameArg.c_str());
+    }
+
+    period = 0;
+
+    bool done = false;
+    while (!done) {
+        uint64 icount;
+        uint32 size;
+        int read = gzread(trace, &icount, sizeof (uint64));
+        if (read > 0) {
+            if (period == 0) {
+                period = icount;
+            }
+            gzread(trace, &size, sizeof (uint32));
+            for (uint32 i = 0; i < size; i++) {
+                addrint page;
+                uint32 reads;
+                uint32 writes;
+                uint8 readBlocks;
+                uint8 writtenBlocks;
+                uint8 accessedBlocks;
+                gzread(trace, &page, sizeof (addrint));
+                gzread(trace, &reads, sizeof (uint32));
+                gzread(trace, &writes, sizeof (uint32));
+                gzread(trace, &readBlocks, sizeof (uint8));
+                gzread(trace, &writtenBlocks, sizeof (uint8));
+                gzread(trace, &accessedBlocks, sizeof (uint8));
+
+                uint64 readCount = 0, writeCount = 0, accessCount = 0;
+                if (metricType == ACCESSED) {
+                    readCount = reads == 0 ? 0 : 1;
+                    writeCount = writes == 0 ? 0 : 1;
+                    accessCount = readCount || writeCount;
+                } else if (metricType == ACCESS_COUNT) {
+                    readCount = reads;
+                    writeCount = writes;
+                    accessCount = readCount + writeCount;
+                } else if (metricType == TOUCH_COUNT) {
+                    readCount = readBlocks;
+                    writeCount = writtenBlocks;
+                    accessCount = accessedBlocks;
+                } else {
+                    myassert(false);
+                }
+
+                uint64 count = 0;
+                if (accessType == READS) {
+                    count = readCount;
+                } else if (accessType == WRITES) {
+                    count = writeCount;
+                } else if (accessType == ACCESSES) {
+                    count = accessCount;
+                } else {
+                    myassert(false);
+                }
+
+                PageMap::iterator pit = pages.emplace(page, PageEntry(INVALID)).first;
+                pit->second.counters.emplace_back(icount / period, count);
+            }
+        } else {
+            if (gzeof(trace)) {
+                done = true;
+            } else {
+                error("Error reading file %s", filenameArg.c_str());
+            }
+        }
+    }
+
+    gzclose(trace);
+
+    if (period == 0) {
+        error("Counter trace %s is empty", filenameArg.c_str());
+    }
+}
+
+PageType OfflineMigrationPolicy::allocate(int pid, addrint addr, bool read, bool instr) {
+    myassert(pid == thisPid);
+    PageType ret = BaseMigrationPolicy::allocate(pid, addr, read, instr);
+    PageMap::iterator pit = pages.find(addr);
+    if (pit == pages.end()) {
+        pit = pages.emplace(addr, PageEntry(INVALID)).first;
+    }
+    myassert(pit->second.type == INVALID);
+    pit->second.cur = 0;
+    pit->second.type = ret;
+    rankPage(pit, previousInterval);
+    return ret;
+}
+
+bool OfflineMigrationPolicy::migrate(int pid, addrint addr) {
+    uint64 timestamp = engine->getTimestamp();
+    if (dramPagesLeft <= 0) {
+        return false;
+    }
+    updateMetrics();
+    PageMap::iterator pit = pages.find(addr);
+    myassert(pit != pages.end());
+    myassert(pit->second.type == PCM);
+    uint64 metric = pit->second.pcmIt->first;
+    if (metric == 0) {
+        return false;
+    }
+    if (!dramMetricMap.empty() && metric <= dramMetricMap.begin()->first * metricThreshold) {
+        return false;
+    }
+    debug(": instruction: %lu; PCM(%lu, %lu) to DRAM", instrCounter->getTotalValue(), metric, addr);
+    pcmMetricMap.erase(pit->second.pcmIt);
+    pit->second.dramIt = dramMetricMap.emplace(metric, addr);
+    pit->second.type = DRAM;
+    dramPagesLeft--;
+    return true;
+}
+
+bool OfflineMigrationPolicy::selectDemotionPage(int *pid, addrint *addr) {
+    uint64 timestamp = engine->getTimestamp();
+    if (dramPagesLeft > maxFreeDramPages) {
+        return false;
+    }
+    updateMetrics();
+
+    //demote only if the hottest PCM page would replace the coldest DRAM page
+    PcmMetricMap::iterator addrOfMaxPcmIt = pcmMetricMap.begin();
+    if (addrOfMaxPcmIt == pcmMetricMap.end() || addrOfMaxPcmIt->first == 0) {
+        return false;
+    }
+    DramMetricMap::iterator addrOfMinDramIt = dramMetricMap.begin();
+    if (addrOfMinDramIt == dramMetricMap.end()) {
+        debug(": instruction: %lu. No DRAM pages ranked", instrCounter->getTotalValue());
+        return false;
+    }
+    if (addrOfMaxPcmIt->first > addrOfMinDramIt->first * metricThreshold) {
+        debug(": instruction: %lu; DRAM(%lu, %lu) to PCM", instrCounter->getTotalValue(), addrOfMinDramIt->first, addrOfMinDramIt->second);
+        PageMap::iterator minDramIt = pages.find(addrOfMinDramIt->second);
+        myassert(minDramIt != pages.end());
+        myassert(minDramIt->second.type == DRAM);
+        minDramIt->second.pcmIt = pcmMetricMap.emplace(addrOfMinDramIt->first, addrOfMinDramIt->second);
+        dramMetricMap.erase(addrOfMinDramIt);
+        minDramIt->second.type = PCM;
+        *pid = thisPid;
+        *addr = minDramIt->first;
+        dramPagesLeft++;
+        return true;
+    } else {
+        debug(": instruction: %lu. Below threshold", instrCounter->getTotalValue());
+        return false;
+    }
+}
+
+/*
+ * The rankings are not saved: they are rebuilt from the counter trace, the type of every page and its
+ * position in the trace
+ */
+void OfflineMigrationPolicy::saveCheckpoint(CheckpointWriter *writer) {
+    BaseMigrationPolicy::saveCheckpoint(writer);
+    writer->write(previousInterval);
+    uint64 numPages = dramMetricMap.size() + pcmMetricMap.size();
+    writer->write(numPages);
+    for (auto it = pages.begin(); it != pages.end(); ++it) {
+        if (it->second.type != INVALID) {
+            writer->write(it->first);
+            writer->write(it->second.type);
+            writer->write(it->second.cur);
+        }
+    }
+}
+
+void OfflineMigrationPolicy::restoreCheckpoint(CheckpointReader *reader) {
+    BaseMigrationPolicy::restoreCheckpoint(reader);
+    reader->read(&previousInterval);
+    for (auto it = pages.begin(); it != pages.end(); ++it) {
+        it->second.type = INVALID;
+        it->second.cur = 0;
+    }
+    dramMetricMap.clear();
+    pcmMetricMap.clear();
+    uint64 numPages = reader->read<uint64>();
+    for (uint64 i = 0; i < numPages; i++) {
+        addrint addr = reader->read<addrint>();
+        PageType type = reader->read<PageType>();
+        uint64 cur = reader->read<uint64>();
+        PageMap::iterator pit = pages.emplace(addr, PageEntry(INVALID)).first;
+        pit->second.type = type;
+        pit->second.cur = cur;
+        rankPage(pit, previousInterval);
+    }
+}
+
+void OfflineMigrationPolicy::updateMetrics() {
+    uint64 currentInterval = instrCounter->getTotalValue() / period + 1;
+    if (previousInterval != currentInterval) {
+        previousInterval = currentInterval;
+        dramMetricMap.clear();
+        pcmMetricMap.clear();
+        for (PageMap::iterator it = pages.begin(); it != pages.end(); ++it) {
+            if (it->second.type != INVALID) {
+                rankPage(it, currentInterval);
+            }
+        }
+    }
+}
+
+//Ranks a page by its weighted accesses in the intervalCount intervals starting at interval
+void OfflineMigrationPolicy::rankPage(PageMap::iterator pit, uint64 interval) {
+    while (pit->second.cur < pit->second.counters.size() && pit->second.counters[pit->second.cur].interval < interval) {
+        ++pit->second.cur;
+    }
+    uint64 sum = 0;
+    uint64 i = pit->second.cur;
+    uint64 lastInterval = interval + intervalCount;
+    while (i < pit->second.counters.size() && pit->second.counters[i].interval < lastInterval) {
+        uint64 windex = pit->second.counters[i].interval - interval;
+        sum += pit->second.counters[i].count * weights.at(windex);
+        ++i;
+    }
+
+    if (pit->second.type == DRAM) {
+        pit->second.dramIt = dramMetricMap.emplace(sum, pit->first);
+    } else if (pit->second.type == PCM) {
+        pit->second.pcmIt = pcmMetricMap.emplace(sum, pit->first);
+    } else {
+        myassert(false);
+    }
+}
 
 
 
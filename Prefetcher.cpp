@@ -0,0 +1,290 @@
+/*
+ * Copyright (c) 2015 Santiago Bock
+ *
+ * See the file LICENSE.txt for copying permission.
+ */
+
+#include "Prefetcher.H"
+
+BasePrefetcher::BasePrefetcher(const string& nameArg, const string& descArg, StatContainer *statCont, unsigned blockSizeArg, unsigned maxDegreeArg, bool throttlingArg) :
+	name(nameArg),
+	blockSize(blockSizeArg),
+	maxDegree(maxDegreeArg),
+	throttling(throttlingArg),
+	degree(maxDegreeArg),
+	epochAccesses(0),
+	epochIssued(0),
+	epochUsed(0),
+	issued(statCont, nameArg + "_issued", "Number of prefetches issued by the " + descArg, 0),
+	dropped(statCont, nameArg + "_dropped", "Number of prefetch candidates dropped by the " + descArg, 0),
+	useful(statCont, nameArg + "_useful", "Number of prefetches by the " + descArg + " that completed before their first use", 0),
+	late(statCont, nameArg + "_late", "Number of prefetches by the " + descArg + " that were still in flight at their first use", 0),
+	evicted(statCont, nameArg + "_evicted", "Number of prefetches by the " + descArg + " evicted without being used", 0),
+	demandMisses(statCont, nameArg + "_demand_misses", "Number of demand read misses not covered by the " + descArg, 0),
+	degreeIncreases(statCont, nameArg + "_degree_increases", "Number of times the " + descArg + " increased its degree", 0),
+	degreeDecreases(statCont, nameArg + "_degree_decreases", "Number of times the " + descArg + " decreased its degree", 0),
+	used(statCont, nameArg + "_used", "Number of prefetches by the " + descArg + " that were used", 0, &useful, &late),
+	demandMissesWithoutPrefetching(statCont, nameArg + "_demand_misses_without_prefetching", "Number of demand read misses there would have been without the " + descArg, 0, &used, &demandMisses),
+	accuracy(statCont, nameArg + "_accuracy", "Fraction of the prefetches by the " + descArg + " that were used", &used, &issued),
+	coverage(statCont, nameArg + "_coverage", "Fraction of demand read misses eliminated by the " + descArg, &used, &demandMissesWithoutPrefetching),
+	timeliness(statCont, nameArg + "_timeliness", "Fraction of the used prefetches by the " + descArg + " that completed before their first use", &useful, &used) {
+
+	if (maxDegree == 0){
+		error("Prefetch degree must be larger than 0");
+	}
+}
+
+void BasePrefetcher::train(addrint blockAddr, bool miss, bool prefetchHit, vector<addrint> *candidates){
+	if (miss && !prefetchHit){
+		demandMisses++;
+	}
+	if (degree > 0){
+		unsigned size = candidates->size();
+		trainPrivate(blockAddr, miss, prefetchHit, candidates);
+		if (candidates->size() > size + degree){
+			candidates->resize(size + degree);
+		}
+	}
+	epochAccesses++;
+	if (epochAccesses == EPOCH_LENGTH){
+		throttle();
+	}
+}
+
+void BasePrefetcher::prefetchIssued(){
+	issued++;
+	epochIssued++;
+}
+
+void BasePrefetcher::prefetchUsed(bool lateArg){
+	if (lateArg){
+		late++;
+	} else {
+		useful++;
+	}
+	epochUsed++;
+}
+
+void BasePrefetcher::throttle(){
+	if (throttling){
+		if (epochIssued == 0){
+			//turned off during the last epoch: probe again with the smallest degree
+			if (degree == 0){
+				degree = 1;
+				degreeIncreases++;
+			}
+		} else {
+			double epochAccuracy = static_cast<double>(epochUsed) / static_cast<double>(epochIssued);
+			if (epochAccuracy >= HIGH_ACCURACY && degree < maxDegree){
+				degree++;
+				degreeIncreases++;
+			} else if (epochAccuracy < LOW_ACCURACY && degree > 0){
+				degree--;
+				degreeDecreases++;
+			}
+		}
+	}
+	epochAccesses = 0;
+	epochIssued = 0;
+	epochUsed = 0;
+}
+
+NextLinePrefetcher::NextLinePrefetcher(const string& nameArg, const string& descArg, StatContainer *statCont, unsigned blockSizeArg, unsigned maxDegreeArg, bool throttlingArg) :
+	BasePrefetcher(nameArg, descArg, statCont, blockSizeArg, maxDegreeArg, throttlingArg) {}
+
+void NextLinePrefetcher::trainPrivate(addrint blockAddr, bool miss, bool prefetchHit, vector<addrint> *candidates){
+	if (miss || prefetchHit){
+		for (unsigned i = 1; i <= degree; i++){
+			candidates->emplace_back(blockAddr + i * blockSize);
+		}
+	}
+}
+
+StridePrefetcher::StridePrefetcher(const string& nameArg, const string& descArg, StatContainer *statCont, unsigned blockSizeArg, unsigned maxDegreeArg, bool throttlingArg, unsigned regionSizeArg, unsigned tableSizeArg) :
+	BasePrefetcher(nameArg, descArg, statCont, blockSizeArg, maxDegreeArg, throttlingArg),
+	regionSize(regionSizeArg),
+	tableSize(tableSizeArg) {
+
+	if (tableSize == 0){
+		error("Stride prefetcher table size must be larger than 0");
+	}
+}
+
+void StridePrefetcher::trainPrivate(addrint blockAddr, bool miss, bool prefetchHit, vector<addrint> *candidates){
+	addrint region = blockAddr / regionSize;
+	auto it = table.find(region);
+	if (it == table.end()){
+		if (table.size() == tableSize){
+			table.erase(lru.back());
+			lru.pop_back();
+		}
+		lru.emplace_front(region);
+		table.emplace(region, StrideEntry(blockAddr, lru.begin()));
+		return;
+	}
+	lru.splice(lru.begin(), lru, it->second.lruIt);
+
+	int64 stride = static_cast<int64>(blockAddr) - static_cast<int64>(it->second.lastAddr);
+	if (stride == 0){
+		return;
+	}
+	if (stride == it->second.stride){
+		if (it->second.confidence < CONFIDENCE_THRESHOLD){
+			it->second.confidence++;
+		}
+	} else {
+		it->second.stride = stride;
+		it->second.confidence = 0;
+	}
+	it->second.lastAddr = blockAddr;
+	if (it->second.confidence >= CONFIDENCE_THRESHOLD){
+		for (unsigned i = 1; i <= degree; i++){
+			candidates->emplace_back(blockAddr + i * stride);
+		}
+	}
+}
+
+StreamPrefetcher::StreamPrefetcher(const string& nameArg, const string& descArg, StatContainer *statCont, unsigned blockSizeArg, unsigned maxDegreeArg, bool throttlingArg, unsigned numStreamsArg) :
+	BasePrefetcher(nameArg, descArg, statCont, blockSizeArg, maxDegreeArg, throttlingArg),
+	streams(numStreamsArg),
+	accesses(0) {
+
+	if (streams.empty()){
+		error("Stream prefetcher must have at least one stream");
+	}
+}
+
+void StreamPrefetcher::trainPrivate(addrint blockAddr, bool miss, bool prefetchHit, vector<addrint> *candidates){
+	accesses++;
+	int64 window = WINDOW * blockSize;
+	Stream *stream = 0;
+	for (auto it = streams.begin(); it != streams.end(); ++it){
+		if (it->valid){
+			int64 distance = static_cast<int64>(blockAddr) - static_cast<int64>(it->lastAddr);
+			if (-window <= distance && distance <= window){
+				stream = &*it;
+				break;
+			}
+		}
+	}
+
+	if (stream == 0){
+		if (miss){
+			Stream *victim = &streams[0];
+			for (auto it = streams.begin(); it != streams.end(); ++it){
+				if (!it->valid){
+					victim = &*it;
+					break;
+				}
+				if (it->lastUse < victim->lastUse){
+					victim = &*it;
+				}
+			}
+			victim->valid = true;
+			victim->lastAddr = blockAddr;
+			victim->direction = 0;
+			victim->lastUse = accesses;
+		}
+		return;
+	}
+
+	stream->lastUse = accesses;
+	if (blockAddr == stream->lastAddr){
+		return;
+	}
+	int direction = blockAddr > stream->lastAddr ? 1 : -1;
+	if (stream->direction != direction){
+		//first confirmation, or the stream turned around
+		stream->direction = direction;
+		stream->nextPrefetch = blockAddr;
+	}
+	stream->lastAddr = blockAddr;
+
+	int64 step = direction * static_cast<int64>(blockSize);
+	int64 ahead = (static_cast<int64>(stream->nextPrefetch) - static_cast<int64>(blockAddr)) * direction;
+	if (ahead <= 0){
+		stream->nextPrefetch = blockAddr;
+		ahead = 0;
+	}
+	for (unsigned i = 0; i < degree && ahead < window; i++){
+		stream->nextPrefetch += step;
+		ahead += blockSize;
+		candidates->emplace_back(stream->nextPrefetch);
+	}
+}
+
+RegionPrefetcher::RegionPrefetcher(const string& nameArg, const string& descArg, StatContainer *statCont, unsigned blockSizeArg, unsigned maxDegreeArg, bool throttlingArg, unsigned regionSizeArg, unsigned tableSizeArg) :
+	BasePrefetcher(nameArg, descArg, statCont, blockSizeArg, maxDegreeArg, throttlingArg),
+	regionSize(regionSizeArg),
+	blocksPerRegion(regionSizeArg / blockSizeArg),
+	tableSize(tableSizeArg) {
+
+	if (tableSize == 0){
+		error("Region prefetcher table size must be larger than 0");
+	}
+}
+
+void RegionPrefetcher::trainPrivate(addrint blockAddr, bool miss, bool prefetchHit, vector<addrint> *candidates){
+	addrint region = blockAddr / regionSize;
+	unsigned block = (blockAddr % regionSize) / blockSize;
+	auto it = active.find(region);
+	if (it != active.end()){
+		activeLru.splice(activeLru.begin(), activeLru, it->second.lruIt);
+		it->second.footprint[block] = true;
+		return;
+	}
+	if (!miss){
+		return;
+	}
+
+	//retire the least recently used active region to the history
+	if (active.size() == tableSize){
+		addrint victim = activeLru.back();
+		activeLru.pop_back();
+		auto vit = active.find(victim);
+		auto hit = history.find(victim);
+		if (hit == history.end()){
+			if (history.size() == tableSize){
+				history.erase(historyLru.back());
+				historyLru.pop_back();
+			}
+			historyLru.emplace_front(victim);
+			history.emplace(victim, vit->second.footprint);
+		} else {
+			hit->second = vit->second.footprint;
+		}
+		active.erase(vit);
+	}
+	activeLru.emplace_front(region);
+	auto p = active.emplace(region, RegionEntry(blocksPerRegion, activeLru.begin()));
+	p.first->second.footprint[block] = true;
+
+	auto hit = history.find(region);
+	if (hit != history.end()){
+		addrint regionAddr = region * regionSize;
+		unsigned count = 0;
+		for (unsigned i = 0; i < blocksPerRegion && count < degree; i++){
+			if (i != block && hit->second[i]){
+				candidates->emplace_back(regionAddr + i * blockSize);
+				count++;
+			}
+		}
+	}
+}
+
+IPrefetcher *createPrefetcher(const string& type, const string& nameArg, const string& descArg, StatContainer *statCont, unsigned blockSize, unsigned pageSize, unsigned degree, bool throttling, unsigned tableSize){
+	if (type == "none"){
+		return 0;
+	} else if (type == "next_line"){
+		return new NextLinePrefetcher(nameArg, descArg, statCont, blockSize, degree, throttling);
+	} else if (type == "stride"){
+		return new StridePrefetcher(nameArg, descArg, statCont, blockSize, degree, throttling, pageSize, tableSize);
+	} else if (type == "stream"){
+		return new StreamPrefetcher(nameArg, descArg, statCont, blockSize, degree, throttling, tableSize);
+	} else if (type == "region"){
+		return new RegionPrefetcher(nameArg, descArg, statCont, blockSize, degree, throttling, pageSize, tableSize);
+	} else {
+		error("Invalid prefetcher type: %s", type.c_str());
+		return 0;
+	}
+}
@@ -0,0 +1,191 @@
+/*
+ * Copyright (c) 2015 Santiago Bock
+ *
+ * See the file LICENSE.txt for copying permission.
+ */
+
+#include "Sampling.H"
+
+#include <cmath>
+#include <sstream>
+
+double Sampler::Estimate::getError(uint64 n) const {
+	if (n < 2){
+		return 0;
+	}
+	double mean = sum / n;
+	double variance = (sumSquares - n * mean * mean) / (n - 1);
+	return variance <= 0 ? 0 : Z * sqrt(variance / n);
+}
+
+Sampler::Sampler(Engine *engineArg, StatContainer *statsArg, HybridMemoryManager *managerArg, uint64 fastForwardInstrArg, uint64 warmupInstrArg, uint64 windowInstrArg, double targetErrorArg, uint64 minWindowsArg, const string& statNamesArg) :
+	engine(engineArg),
+	stats(statsArg),
+	manager(managerArg),
+	fastForwardInstr(fastForwardInstrArg),
+	warmupInstr(warmupInstrArg),
+	windowInstr(windowInstrArg),
+	targetError(targetErrorArg),
+	minWindows(minWindowsArg),
+	statNames(statNamesArg),
+	phase(DONE),
+	phaseStartInstr(0),
+	windowStartTimestamp(0),
+	numWindows(0),
+	windows(statsArg, "sampling_windows", "Number of measurement windows of the sampled simulation", 0),
+	instrFastForwarded(statsArg, "sampling_instructions_fast_forwarded", "Number of instructions executed without timing by the sampled simulation", 0),
+	ipcMean(statsArg, "sampling_ipc_mean", "Mean IPC (all CPUs) of the measurement windows", 0),
+	ipcError(statsArg, "sampling_ipc_error", "Half width of the 95% confidence interval of the mean IPC", 0) {
+
+	if (windowInstr == 0){
+		error("Sampling window must be larger than 0 instructions");
+	}
+	if (targetError > 0 && minWindows < 2){
+		error("Sampling with a target error needs at least 2 windows");
+	}
+}
+
+void Sampler::start(){
+	if (cpus.empty()){
+		error("Sampling needs at least one CPU");
+	}
+	estimates.emplace_back("ipc", static_cast<StatBase *>(0));
+	istringstream iss(statNames);
+	string pattern;
+	while (getline(iss, pattern, ',')){
+		if (pattern.empty()){
+			continue;
+		}
+		vector<StatBase *> selected = stats->findAll(pattern);
+		if (selected.empty()){
+			error("Sampling statistic '%s' does not exist", pattern.c_str());
+		}
+		for (auto it = selected.begin(); it != selected.end(); ++it){
+			estimates.emplace_back((*it)->getName(), *it);
+		}
+	}
+	for (auto it = cpus.begin(); it != cpus.end(); ++it){
+		(*it)->stopFetching();
+	}
+	phase = DRAINING;
+	engine->addEvent(0, this);
+}
+
+void Sampler::process(const Event *event){
+	uint64 timestamp = engine->getTimestamp();
+	if (isFinished()){
+		phase = DONE;
+		cout << timestamp << ": end of the traces after " << numWindows << " sampling windows" << endl;
+		printReport(cout);
+		return;
+	}
+	if (phase == DRAINING){
+		if (isIdle()){
+			for (auto it = cpus.begin(); it != cpus.end(); ++it){
+				instrFastForwarded += (*it)->fastForward(fastForwardInstr);
+			}
+			for (auto it = cpus.begin(); it != cpus.end(); ++it){
+				(*it)->startFetching();
+			}
+			phase = WARMUP;
+			phaseStartInstr = getInstructions();
+		}
+	} else if (phase == WARMUP){
+		if (getInstructions() - phaseStartInstr >= warmupInstr * cpus.size()){
+			stats->startInterval();
+			phase = MEASUREMENT;
+			phaseStartInstr = getInstructions();
+			windowStartTimestamp = timestamp;
+		}
+	} else if (phase == MEASUREMENT){
+		if (getInstructions() - phaseStartInstr >= windowInstr * cpus.size()){
+			endWindow();
+			if (targetError > 0 && numWindows >= minWindows && estimates[0].getError(numWindows) <= targetError * estimates[0].getMean(numWindows)){
+				phase = DONE;
+				cout << timestamp << ": target error reached after " << numWindows << " sampling windows" << endl;
+				printReport(cout);
+				engine->quit();
+				return;
+			}
+			for (auto it = cpus.begin(); it != cpus.end(); ++it){
+				(*it)->stopFetching();
+			}
+			phase = DRAINING;
+		}
+	} else {
+		myassert(false);
+	}
+	engine->addEvent(CHECK_PERIOD, this);
+}
+
+void Sampler::endWindow(){
+	uint64 timestamp = engine->getTimestamp();
+	uint64 cycles = timestamp - windowStartTimestamp;
+	double ipc = cycles == 0 ? 0 : static_cast<double>(getInstructions() - phaseStartInstr) / cycles;
+	estimates[0].add(ipc);
+	for (auto it = estimates.begin() + 1; it != estimates.end(); ++it){
+		it->add(it->stat->getIntervalValueAsDouble());
+	}
+	numWindows++;
+	windows = numWindows;
+	ipcMean = estimates[0].getMean(numWindows);
+	ipcError = estimates[0].getError(numWindows);
+	cout << timestamp << ": sampling window " << numWindows << ": ipc " << ipc << " (mean " << ipcMean.getValue() << " +/- " << ipcError.getValue() << ")" << endl;
+}
+
+void Sampler::printReport(ostream& os) const {
+	os << "Sampled simulation: " << numWindows << " windows of " << windowInstr << " instructions per CPU, ";
+	os << warmupInstr << " warm-up and " << fastForwardInstr << " fast-forwarded instructions per CPU between windows" << endl;
+	os << "Estimates with 95% confidence intervals:" << endl;
+	for (auto it = estimates.begin(); it != estimates.end(); ++it){
+		double mean = it->getMean(numWindows);
+		double err = it->getError(numWindows);
+		os << "  " << it->name << ": " << mean << " +/- " << err;
+		if (mean != 0){
+			os << " (" << 100 * err / mean << "%)";
+		}
+		os << endl;
+	}
+	if (targetError > 0 && numWindows >= 2){
+		double mean = estimates[0].getMean(numWindows);
+		double err = estimates[0].getError(numWindows);
+		if (mean != 0){
+			//the half width shrinks with the square root of the number of windows
+			double needed = ceil(numWindows * (err / (targetError * mean)) * (err / (targetError * mean)));
+			os << "  windows needed for a " << 100 * targetError << "% error in the ipc: " << static_cast<uint64>(needed) << endl;
+		}
+	}
+}
+
+uint64 Sampler::getInstructions() const {
+	uint64 instr = 0;
+	for (auto it = cpus.begin(); it != cpus.end(); ++it){
+		instr += (*it)->getNumInstr();
+	}
+	return instr;
+}
+
+//whether the CPUs can fast-forward: the pipelines and the caches are empty and no access would stall on a
+//page being flushed. On-demand copies to DRAM only advance with accesses, so they stay in flight.
+bool Sampler::isIdle() const {
+	for (auto it = cpus.begin(); it != cpus.end(); ++it){
+		if (!(*it)->isDrained()){
+			return false;
+		}
+	}
+	for (auto it = caches.begin(); it != caches.end(); ++it){
+		if (!(*it)->isIdle()){
+			return false;
+		}
+	}
+	return manager == 0 || !manager->isStallingAccesses();
+}
+
+bool Sampler::isFinished() const {
+	for (auto it = cpus.begin(); it != cpus.end(); ++it){
+		if (!(*it)->isFinished()){
+			return false;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,306 @@
+/*
+ * Copyright (c) 2015 Santiago Bock
+ *
+ * See the file LICENSE.txt for copying permission.
+ */
+
+#include "Server.H"
+
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+SimulationServer::SimulationServer(const string& socketPathArg, unsigned maxWorkersArg, uint64 cpuLimitArg, uint64 memoryLimitArg, SimulationFunction simulateArg) :
+	socketPath(socketPathArg),
+	maxWorkers(maxWorkersArg),
+	cpuLimit(cpuLimitArg),
+	memoryLimit(memoryLimitArg),
+	simulate(simulateArg),
+	nextId(0),
+	completed(0),
+	failed(0) {
+
+	if (maxWorkers == 0){
+		error("Number of workers must be larger than 0");
+	}
+	sockaddr_un addr;
+	if (socketPath.size() >= sizeof(addr.sun_path)){
+		error("Socket path '%s' is too long", socketPath.c_str());
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socketPath.c_str());
+
+	listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listenFd < 0){
+		error("Could not create socket");
+	}
+	//remove the socket left behind by a previous server
+	unlink(socketPath.c_str());
+	if (bind(listenFd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0){
+		error("Could not bind socket '%s'", socketPath.c_str());
+	}
+	if (listen(listenFd, SOMAXCONN) < 0){
+		error("Could not listen on socket '%s'", socketPath.c_str());
+	}
+	//a client that disconnects must not kill the server
+	signal(SIGPIPE, SIG_IGN);
+}
+
+SimulationServer::~SimulationServer(){
+	close(listenFd);
+	unlink(socketPath.c_str());
+}
+
+void SimulationServer::run(){
+	cout << "listening on '" << socketPath << "' with " << maxWorkers << " workers" << endl;
+	while (true){
+		vector<pollfd> fds;
+		pollfd pfd;
+		pfd.fd = listenFd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		fds.emplace_back(pfd);
+		for (auto it = receiving.begin(); it != receiving.end(); ++it){
+			pfd.fd = it->first;
+			fds.emplace_back(pfd);
+		}
+		if (poll(fds.data(), fds.size(), POLL_PERIOD) < 0){
+			if (errno != EINTR){
+				error("Could not poll socket '%s'", socketPath.c_str());
+			}
+			errno = 0;
+		}
+		for (auto it = fds.begin(); it != fds.end(); ++it){
+			if (it->revents == 0){
+				continue;
+			}
+			if (it->fd == listenFd){
+				acceptConnection();
+			} else {
+				receive(receiving[it->fd]);
+			}
+		}
+		reapJobs();
+		startJobs();
+	}
+}
+
+void SimulationServer::acceptConnection(){
+	int fd = accept(listenFd, 0, 0);
+	if (fd < 0){
+		warn("Could not accept connection");
+		errno = 0;
+		return;
+	}
+	receiving.emplace(fd, new Job(nextId++, fd));
+}
+
+void SimulationServer::receive(Job *job){
+	char buf[4096];
+	ssize_t count = read(job->fd, buf, sizeof(buf));
+	if (count < 0){
+		if (errno == EINTR || errno == EAGAIN){
+			errno = 0;
+			return;
+		}
+		errno = 0;
+		receiving.erase(job->fd);
+		close(job->fd);
+		delete job;
+		return;
+	}
+	bool done = false;
+	if (count == 0){
+		//the client closed its side of the connection: whatever was sent is the whole job
+		if (!job->buffer.empty()){
+			parseLine(job, job->buffer);
+			job->buffer.clear();
+		}
+		done = true;
+	} else {
+		job->buffer.append(buf, count);
+		size_t pos;
+		while (!done && (pos = job->buffer.find('\n')) != string::npos){
+			string line = job->buffer.substr(0, pos);
+			job->buffer.erase(0, pos + 1);
+			done = parseLine(job, line);
+		}
+	}
+	if (done){
+		receiving.erase(job->fd);
+		if (job->traces.empty()){
+			reply(job->fd, "error: job does not contain any trace\n");
+			close(job->fd);
+			delete job;
+		} else {
+			enqueue(job);
+		}
+	}
+}
+
+bool SimulationServer::parseLine(Job *job, const string& lineArg){
+	string line(lineArg);
+	line.erase(0, line.find_first_not_of(" \t"));
+	line.erase(line.find_last_not_of(" \t\r") + 1);
+	if (line == "."){
+		return true;
+	}
+	if (line.empty() || line[0] == '#'){
+		return false;
+	}
+	if (line[0] == '-'){
+		job->config += line + "\n";
+	} else {
+		job->traces.emplace_back(line);
+	}
+	return false;
+}
+
+void SimulationServer::enqueue(Job *job){
+	char filename[] = "/tmp/hmmsim_job_XXXXXX";
+	int fd = mkstemp(filename);
+	if (fd < 0 || write(fd, job->config.data(), job->config.size()) != static_cast<ssize_t>(job->config.size())){
+		warn("Could not write configuration of job %u", job->id);
+		errno = 0;
+		if (fd >= 0){
+			close(fd);
+			unlink(filename);
+		}
+		reply(job->fd, "error: could not write job configuration\n");
+		close(job->fd);
+		delete job;
+		return;
+	}
+	close(fd);
+	job->configFilename = filename;
+	queue.emplace_back(job);
+	ostringstream oss;
+	oss << "queued " << job->id << " (" << queue.size() << " waiting, " << running.size() << " running)\n";
+	reply(job->fd, oss.str());
+	cout << "job " << job->id << " queued with " << job->traces.size() << " traces" << endl;
+}
+
+void SimulationServer::startJobs(){
+	while (running.size() < maxWorkers && !queue.empty()){
+		Job *job = queue.front();
+		queue.pop_front();
+		ostringstream oss;
+		oss << "started " << job->id << "\n";
+		reply(job->fd, oss.str());
+		cout.flush();
+		cerr.flush();
+		fflush(stdout);
+		fflush(stderr);
+		pid_t pid = fork();
+		if (pid < 0){
+			warn("Could not fork job %u", job->id);
+			errno = 0;
+			finishJob(job, "error: could not start job\n");
+		} else if (pid == 0){
+			runJob(job);
+		} else {
+			job->pid = pid;
+			running.emplace(pid, job);
+			cout << "job " << job->id << " started (pid " << pid << ")" << endl;
+		}
+	}
+}
+
+void SimulationServer::runJob(Job *job){
+	//the worker only keeps the connection of its own job
+	close(listenFd);
+	for (auto it = receiving.begin(); it != receiving.end(); ++it){
+		close(it->first);
+	}
+	for (auto it = queue.begin(); it != queue.end(); ++it){
+		close((*it)->fd);
+	}
+	for (auto it = running.begin(); it != running.end(); ++it){
+		close(it->second->fd);
+	}
+	//a client that disconnects cancels its job
+	signal(SIGPIPE, SIG_DFL);
+
+	rlimit limit;
+	if (cpuLimit != 0){
+		limit.rlim_cur = cpuLimit;
+		limit.rlim_max = cpuLimit + 1;
+		if (setrlimit(RLIMIT_CPU, &limit) < 0){
+			error("Could not set CPU time limit of job %u", job->id);
+		}
+	}
+	if (memoryLimit != 0){
+		limit.rlim_cur = limit.rlim_max = memoryLimit * 1024 * 1024;
+		if (setrlimit(RLIMIT_AS, &limit) < 0){
+			error("Could not set memory limit of job %u", job->id);
+		}
+	}
+
+	if (dup2(job->fd, STDOUT_FILENO) < 0 || dup2(job->fd, STDERR_FILENO) < 0){
+		error("Could not redirect output of job %u", job->id);
+	}
+	close(job->fd);
+
+	vector<char *> argv;
+	argv.emplace_back(const_cast<char *>("sim"));
+	argv.emplace_back(const_cast<char *>(job->configFilename.c_str()));
+	for (auto it = job->traces.begin(); it != job->traces.end(); ++it){
+		argv.emplace_back(const_cast<char *>(it->c_str()));
+	}
+	argv.emplace_back(static_cast<char *>(0));
+	exit(simulate(argv.size() - 1, argv.data()));
+}
+
+void SimulationServer::reapJobs(){
+	int status;
+	pid_t pid;
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0){
+		auto it = running.find(pid);
+		if (it == running.end()){
+			continue;
+		}
+		Job *job = it->second;
+		running.erase(it);
+		ostringstream oss;
+		if (WIFEXITED(status)){
+			oss << "exit " << WEXITSTATUS(status) << "\n";
+			if (WEXITSTATUS(status) != 0){
+				failed++;
+			}
+		} else {
+			oss << "killed " << WTERMSIG(status) << " (" << strsignal(WTERMSIG(status)) << ")\n";
+			failed++;
+		}
+		completed++;
+		cout << "job " << job->id << " finished: " << oss.str();
+		cout << completed << " jobs completed (" << failed << " failed), " << running.size() << " running, " << queue.size() << " waiting" << endl;
+		finishJob(job, oss.str());
+	}
+	errno = 0;
+}
+
+void SimulationServer::finishJob(Job *job, const string& message){
+	reply(job->fd, message);
+	close(job->fd);
+	unlink(job->configFilename.c_str());
+	delete job;
+}
+
+void SimulationServer::reply(int fd, const string& message){
+	//the client might be gone already; the job goes on (or is discarded) regardless
+	if (write(fd, message.data(), message.size()) < 0){
+		errno = 0;
+	}
+}
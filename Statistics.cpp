@@ -7,6 +7,8 @@
 #include "Statistics.H"
 #include "Error.H"
 
+#include <fnmatch.h>
+
 #include <cassert>
 
 void StatContainer::insert(StatBase *stat){
@@ -14,10 +16,8 @@ void StatContainer::insert(StatBase *stat){
 	if (stat->getName().find_first_of(" \t\n\r") != string::npos){
 		error("Statistic %s contains a whitespace in its name", stat->getName().c_str());
 	}
-	for (list<StatBase*>::iterator it = stats.begin(); it != stats.end(); ++it){
-		if ((*it)->getName() == stat->getName()){
-			error("Statistic %s has already been defined", stat->getName().c_str());
-		}
+	if (!index.emplace(stat->getName(), stat).second){
+		error("Statistic %s has already been defined", stat->getName().c_str());
 	}
 	stats.emplace_back(stat);
 }
@@ -30,11 +30,8 @@ StatListIter StatContainer::insertAfter(StatBase *stat, StatListIter parent){
 	if (stat->getName().find_first_of(" \t\n\r") != string::npos){
 		error("Statistic %s contains a whitespace in its name", stat->getName().c_str());
 	}
-	for (list<StatBase*>::iterator it = stats.begin(); it != stats.end(); ++it){
-		//cout << "insertAfter: " << (*it)->getName() << endl;
-		if ((*it)->getName() == stat->getName()){
-			error("Statistic %s has already been defined", stat->getName().c_str());
-		}
+	if (!index.emplace(stat->getName(), stat).second){
+		error("Statistic %s has already been defined", stat->getName().c_str());
 	}
 
 	assert(parent != stats.end());
@@ -44,45 +41,143 @@ StatListIter StatContainer::insertAfter(StatBase *stat, StatListIter parent){
 }
 
 StatListIter StatContainer::erase(StatListIter iter){
+	index.erase((*iter)->getName());
 	return stats.erase(iter);
 }
 
 void StatContainer::reset(){
-	for (list<StatBase*>::iterator it = stats.begin(); it != stats.end(); ++it){
+	for (StatList::iterator it = stats.begin(); it != stats.end(); ++it){
 		(*it)->reset();
 	}
 }
 
 void StatContainer::startInterval(){
-	for (list<StatBase*>::iterator it = stats.begin(); it != stats.end(); ++it){
+	for (StatList::iterator it = stats.begin(); it != stats.end(); ++it){
 		(*it)->startInterval();
 	}
 }
 
+StatBase* StatContainer::find(const string& name) const {
+	unordered_map<string, StatBase*>::const_iterator it = index.find(name);
+	return it == index.end() ? 0 : it->second;
+}
+
+vector<StatBase*> StatContainer::findAll(const string& patterns) const {
+	vector<string> globs;
+	istringstream iss(patterns);
+	string pattern;
+	while (getline(iss, pattern, ',')){
+		if (!pattern.empty()){
+			globs.emplace_back(pattern);
+		}
+	}
+	vector<StatBase*> ret;
+	for (StatList::const_iterator it = stats.begin(); it != stats.end(); ++it){
+		for (vector<string>::const_iterator git = globs.begin(); git != globs.end(); ++git){
+			if (fnmatch(git->c_str(), (*it)->getName().c_str(), 0) == 0){
+				ret.emplace_back(*it);
+				break;
+			}
+		}
+	}
+	return ret;
+}
+
 void StatContainer::genListStats(){
-	for (list<StatBase*>::iterator it = stats.begin(); it != stats.end(); ++it){
+	for (StatList::iterator it = stats.begin(); it != stats.end(); ++it){
 		it = (*it)->generate(it);
 	}
 }
 
 void StatContainer::print(ostream& os) {
-	for (list<StatBase*>::const_iterator it = stats.begin(); it != stats.end(); ++it){
+	for (StatList::const_iterator it = stats.begin(); it != stats.end(); ++it){
+		os << "#" << (*it)->getDesc() << endl;
+		os << (*it)->getName() << " " << (*it)->getValueAsString() << endl << endl;
+	}
+}
+
+void StatContainer::print(ostream& os, const string& patterns) {
+	vector<StatBase*> selected = findAll(patterns);
+	for (vector<StatBase*>::const_iterator it = selected.begin(); it != selected.end(); ++it){
 		os << "#" << (*it)->getDesc() << endl;
 		os << (*it)->getName() << " " << (*it)->getValueAsString() << endl << endl;
 	}
 }
 
 void StatContainer::printNames(ostream& os) {
-	for (list<StatBase*>::const_iterator it = stats.begin(); it != stats.end(); ++it){
-		os << (*it)->getName() << '\t' << flush;
+	for (StatList::const_iterator it = stats.begin(); it != stats.end(); ++it){
+		os << (*it)->getName() << '\t';
+	}
+}
+
+void StatContainer::printNames(IntervalStatsWriter *writer) {
+	for (StatList::const_iterator it = stats.begin(); it != stats.end(); ++it){
+		writer->addColumn((*it)->getName(), (*it)->getColumnType());
 	}
 }
 
 void StatContainer::printInterval(ostream& os) {
-	for (list<StatBase*>::const_iterator it = stats.begin(); it != stats.end(); ++it){
+	for (StatList::const_iterator it = stats.begin(); it != stats.end(); ++it){
 		//os << (*it)->getName() << " " << (*it)->getIntervalValueAsString() << endl;
 		(*it)->printIntervalValue(os);
-		os << '\t' << flush;
+		os << '\t';
 	}
 }
 
+void StatContainer::printInterval(IntervalStatsWriter *writer) {
+	for (StatList::const_iterator it = stats.begin(); it != stats.end(); ++it){
+		writer->add((*it)->getIntervalValueAsBits());
+	}
+	writer->endRow();
+}
+
+
+/*
+ * Writes the values of all the statistics that hold state, each one tagged with its name and size so
+ * that a checkpoint can be restored into a simulator that defines a different set of statistics
+ */
+void StatContainer::saveCheckpoint(ostream& os) {
+	uint64 count = 0;
+	for (StatList::const_iterator it = stats.begin(); it != stats.end(); ++it){
+		if ((*it)->hasState()){
+			count++;
+		}
+	}
+	os.write(reinterpret_cast<const char *>(&count), sizeof(count));
+	for (StatList::const_iterator it = stats.begin(); it != stats.end(); ++it){
+		if ((*it)->hasState()){
+			ostringstream oss;
+			(*it)->saveState(oss);
+			uint32 nameSize = (*it)->getName().size();
+			uint32 stateSize = oss.str().size();
+			os.write(reinterpret_cast<const char *>(&nameSize), sizeof(nameSize));
+			os.write((*it)->getName().data(), nameSize);
+			os.write(reinterpret_cast<const char *>(&stateSize), sizeof(stateSize));
+			os.write(oss.str().data(), stateSize);
+		}
+	}
+}
+
+void StatContainer::restoreCheckpoint(istream& is) {
+	uint64 count = 0;
+	is.read(reinterpret_cast<char *>(&count), sizeof(count));
+	for (uint64 i = 0; i < count && is; i++){
+		uint32 nameSize = 0, stateSize = 0;
+		is.read(reinterpret_cast<char *>(&nameSize), sizeof(nameSize));
+		string name(nameSize, '\0');
+		is.read(&name[0], nameSize);
+		is.read(reinterpret_cast<char *>(&stateSize), sizeof(stateSize));
+		string state(stateSize, '\0');
+		is.read(&state[0], stateSize);
+		StatBase *stat = find(name);
+		if (stat == 0 || !stat->hasState()){
+			warn("Statistic %s in checkpoint is not defined", name.c_str());
+		} else {
+			istringstream iss(state);
+			stat->restoreState(iss);
+		}
+	}
+	if (!is){
+		error("Checkpoint statistics are truncated");
+	}
+}
@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2015 Santiago Bock
+ *
+ * See the file LICENSE.txt for copying permission.
+ */
+
+#include "Sweep.H"
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <fstream>
+
+Sweeper::Sweeper(Engine *engineArg, Checkpointer *checkpointerArg, const SweepCallback& callbackArg, const string& filename, unsigned maxJobsArg) :
+	engine(engineArg),
+	checkpointer(checkpointerArg),
+	callback(callbackArg),
+	maxJobs(maxJobsArg),
+	scheduledTimestamp(0),
+	attempts(0),
+	failed(0),
+	parent(false) {
+
+	if (maxJobs == 0){
+		error("Number of sweep jobs must be larger than 0");
+	}
+	readFile(filename);
+}
+
+void Sweeper::readFile(const string& filename){
+	ifstream ifs(filename.c_str());
+	if (!ifs.good()){
+		error("Could not read sweep file '%s'", filename.c_str());
+	}
+	set<string> names;
+	string line;
+	unsigned lineNumber = 0;
+	while (getline(ifs, line)){
+		lineNumber++;
+		line.erase(0, line.find_first_not_of(" \t"));
+		line.erase(line.find_last_not_of(" \t\r") + 1);
+		if (line.empty() || line[0] == '#'){
+			continue;
+		}
+		if (line[0] == '['){
+			if (line[line.size() - 1] != ']' || line.size() == 2){
+				error("Wrong configuration header in sweep file '%s', line %u", filename.c_str(), lineNumber);
+			}
+			string name = line.substr(1, line.size() - 2);
+			if (!names.insert(name).second){
+				error("Configuration '%s' appears twice in sweep file '%s'", name.c_str(), filename.c_str());
+			}
+			configs.emplace_back(name);
+		} else if (line[0] == '-'){
+			if (configs.empty()){
+				error("Option before the first configuration header in sweep file '%s', line %u", filename.c_str(), lineNumber);
+			}
+			size_t end = line.find_first_of(" \t");
+			if (end == string::npos){
+				error("Option without value in sweep file '%s', line %u", filename.c_str(), lineNumber);
+			}
+			string opt = line.substr(1, end - 1);
+			string value = line.substr(line.find_first_not_of(" \t", end));
+			configs.back().overrides.emplace_back(opt, value);
+		} else {
+			error("Wrong format in sweep file '%s', line %u", filename.c_str(), lineNumber);
+		}
+	}
+	if (configs.empty()){
+		error("Sweep file '%s' does not contain any configuration", filename.c_str());
+	}
+}
+
+void Sweeper::schedule(uint64 timestamp){
+	if (timestamp < engine->getTimestamp()){
+		error("Sweep timestamp (%lu) is earlier than the current timestamp (%lu)", timestamp, engine->getTimestamp());
+	}
+	scheduledTimestamp = timestamp;
+	engine->addEvent(timestamp - engine->getTimestamp(), this);
+}
+
+void Sweeper::process(const Event *event){
+	//overrides are only safe to apply when no page is in the middle of a migration
+	if (!checkpointer->isQuiescent()){
+		if (++attempts >= MAX_ATTEMPTS){
+			error("Could not fork the sweep configurations: the memory hierarchy was not quiescent within %lu cycles of %lu", MAX_ATTEMPTS * RETRY_PERIOD, scheduledTimestamp);
+		}
+		checkpointer->quiesce();
+		engine->addEvent(RETRY_PERIOD, this);
+		return;
+	}
+	uint64 timestamp = engine->getTimestamp();
+	cout << timestamp << ": forking " << configs.size() << " sweep configurations" << endl;
+	//anything left in the buffers would be written again by every child
+	cout.flush();
+	cerr.flush();
+	fflush(stdout);
+	fflush(stderr);
+
+	for (auto it = configs.begin(); it != configs.end(); ++it){
+		while (children.size() >= maxJobs){
+			waitChild();
+		}
+		pid_t pid = fork();
+		if (pid < 0){
+			error("Could not fork sweep configuration '%s'", it->name.c_str());
+		} else if (pid == 0){
+			configName = it->name;
+			callback(*it);
+			checkpointer->endQuiesce();
+			return;
+		}
+		children.emplace(pid, it->name);
+	}
+	while (!children.empty()){
+		waitChild();
+	}
+	cout << "finished " << configs.size() << " sweep configurations (" << failed << " failed)" << endl;
+	parent = true;
+	engine->quit();
+}
+
+void Sweeper::waitChild(){
+	int status;
+	pid_t pid = wait(&status);
+	if (pid < 0){
+		error("Could not wait for sweep configurations");
+	}
+	auto it = children.find(pid);
+	if (it != children.end()){
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0){
+			cerr << "Sweep configuration '" << it->second << "' failed" << endl;
+			failed++;
+		}
+		children.erase(it);
+	}
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2015 Santiago Bock
+ *
+ * See the file LICENSE.txt for copying permission.
+ */
+
+#include "ThreadedTraceReader.H"
+#include "Error.H"
+
+ThreadedTraceReader::ThreadedTraceReader(TraceReaderBase *readerArg, unsigned maxChunksArg) : reader(readerArg), maxChunks(maxChunksArg), finished(false), stop(false), currentEntry(0) {
+	if (maxChunks == 0){
+		error("Threaded trace reader needs at least one chunk");
+	}
+	worker = thread(&ThreadedTraceReader::decode, this);
+}
+
+ThreadedTraceReader::~ThreadedTraceReader(){
+	{
+		lock_guard<mutex> lock(queueMutex);
+		stop = true;
+	}
+	notFull.notify_one();
+	worker.join();
+	delete reader;
+}
+
+bool ThreadedTraceReader::readEntry(TraceEntry *entry){
+	if (currentEntry == current.size()){
+		unique_lock<mutex> lock(queueMutex);
+		notEmpty.wait(lock, [this]{return !chunks.empty() || finished;});
+		if (chunks.empty()){
+			return false;
+		}
+		current.swap(chunks.front());
+		chunks.pop_front();
+		lock.unlock();
+		notFull.notify_one();
+		currentEntry = 0;
+	}
+	*entry = current[currentEntry++];
+	if (entry->instr){
+		numInstr++;
+	} else if (entry->read){
+		numReads++;
+	} else {
+		numWrites++;
+	}
+	return true;
+}
+
+void ThreadedTraceReader::decode(){
+	bool more = true;
+	while (more){
+		vector<TraceEntry> chunk;
+		chunk.reserve(CHUNK_SIZE);
+		TraceEntry entry;
+		while (chunk.size() < CHUNK_SIZE && (more = reader->readEntry(&entry))){
+			chunk.emplace_back(entry);
+		}
+		unique_lock<mutex> lock(queueMutex);
+		notFull.wait(lock, [this]{return chunks.size() < maxChunks || stop;});
+		if (stop){
+			return;
+		}
+		if (!chunk.empty()){
+			chunks.emplace_back();
+			chunks.back().swap(chunk);
+		}
+		if (!more){
+			finished = true;
+		}
+		lock.unlock();
+		notEmpty.notify_one();
+	}
+}
@@ -0,0 +1,250 @@
+/*
+ * Copyright (c) 2015 Santiago Bock
+ *
+ * See the file LICENSE.txt for copying permission.
+ */
+
+#include "TraceCache.H"
+#include "Error.H"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <sstream>
+#include <vector>
+
+static const size_t HEADER_SIZE = 4096; //entries start at a page boundary
+static const char CACHE_MAGIC[8] = {'H', 'M', 'M', 'T', 'R', 'C', '1', '\0'};
+
+struct CacheHeader {
+	char magic[8];
+	uint64 numEntries;
+	uint64 sourceSize; //total size of the compressed files the entries were decoded from
+	uint64 sourceTime; //latest modification time of those files
+	char source[HEADER_SIZE - 32]; //path of the first compressed file
+};
+
+static_assert(sizeof(CacheHeader) == HEADER_SIZE, "wrong trace cache header size");
+
+TraceCache::TraceCache(const string& dirArg, uint64 budgetArg) : dir(dirArg), budget(budgetArg) {
+	if (mkdir(dir.c_str(), 0777) < 0 && errno != EEXIST){
+		error("Could not create trace cache directory '%s'", dir.c_str());
+	}
+	errno = 0;
+}
+
+int TraceCache::open(const string& prefix, CompressionType compression){
+	string ext(compression == GZIP ? ".gz" : ".bz2");
+	const char *kinds[] = {"-instr", "-read", "-write"};
+	const char *streams[] = {"-time", "-addr", "-size"};
+	uint64 sourceSize = 0;
+	uint64 sourceTime = 0;
+	for (unsigned i = 0; i < 3; i++){
+		for (unsigned j = 0; j < 3; j++){
+			string filename = prefix + kinds[i] + streams[j] + ext;
+			struct stat st;
+			if (stat(filename.c_str(), &st) < 0){
+				error("Could not open file '%s'", filename.c_str());
+			}
+			sourceSize += st.st_size;
+			sourceTime = max(sourceTime, static_cast<uint64>(st.st_mtime));
+		}
+	}
+	char path[PATH_MAX];
+	string first = prefix + kinds[0] + streams[0] + ext;
+	if (realpath(first.c_str(), path) == 0){
+		error("Could not resolve path of file '%s'", first.c_str());
+	}
+	string source(path);
+	if (source.size() >= sizeof(CacheHeader::source)){
+		error("Path of trace '%s' is too long for the trace cache", source.c_str());
+	}
+
+	ostringstream oss;
+	oss << dir << "/" << hex << hash<string>()(source);
+	string filename = oss.str() + ".trace";
+
+	int fd = openValid(filename, source, sourceSize, sourceTime);
+	if (fd < 0){
+		//serialize decoding so that simulations that start at the same time decode the trace only once
+		string lockname = oss.str() + ".lock";
+		int lockFd = ::open(lockname.c_str(), O_RDWR | O_CREAT, 0666);
+		if (lockFd < 0 || flock(lockFd, LOCK_EX) < 0){
+			error("Could not lock trace cache file '%s'", lockname.c_str());
+		}
+		fd = openValid(filename, source, sourceSize, sourceTime);
+		if (fd < 0){
+			fd = decode(prefix, compression, filename, source, sourceSize, sourceTime);
+		}
+		close(lockFd);
+		evict(filename);
+	}
+	//the modification time orders the files for eviction
+	futimens(fd, 0);
+	errno = 0;
+	return fd;
+}
+
+int TraceCache::openValid(const string& filename, const string& source, uint64 sourceSize, uint64 sourceTime){
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0){
+		errno = 0;
+		return -1;
+	}
+	if (flock(fd, LOCK_SH) < 0){
+		error("Could not lock trace cache file '%s'", filename.c_str());
+	}
+	//the file could have been removed before it was locked; the mapping would still be valid
+	CacheHeader header;
+	struct stat st;
+	if (fstat(fd, &st) < 0 || pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+			memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+			header.sourceSize != sourceSize || header.sourceTime != sourceTime || source != header.source ||
+			static_cast<uint64>(st.st_size) != HEADER_SIZE + header.numEntries * sizeof(TraceEntry)){
+		close(fd);
+		errno = 0;
+		return -1;
+	}
+	return fd;
+}
+
+int TraceCache::decode(const string& prefix, CompressionType compression, const string& filename, const string& source, uint64 sourceSize, uint64 sourceTime){
+	ostringstream oss;
+	oss << filename << ".tmp." << getpid();
+	string tmpname = oss.str();
+	FILE *file = fopen(tmpname.c_str(), "w");
+	if (file == 0){
+		error("Could not open trace cache file '%s'", tmpname.c_str());
+	}
+	CacheHeader header;
+	memset(&header, 0, sizeof(header));
+	if (fwrite(&header, sizeof(header), 1, file) != 1){
+		error("Could not write trace cache file '%s'", tmpname.c_str());
+	}
+
+	CompressedTraceReader reader(prefix, compression);
+	vector<TraceEntry> chunk;
+	TraceEntry entry;
+	bool more = true;
+	while (more){
+		chunk.clear();
+		while (chunk.size() < 4096 && (more = reader.readEntry(&entry))){
+			chunk.emplace_back(entry);
+		}
+		if (!chunk.empty() && fwrite(chunk.data(), sizeof(TraceEntry), chunk.size(), file) != chunk.size()){
+			error("Could not write trace cache file '%s'", tmpname.c_str());
+		}
+		header.numEntries += chunk.size();
+	}
+
+	memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+	header.sourceSize = sourceSize;
+	header.sourceTime = sourceTime;
+	strcpy(header.source, source.c_str());
+	if (fseek(file, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, file) != 1 || fclose(file) != 0){
+		error("Could not write trace cache file '%s'", tmpname.c_str());
+	}
+	//lock the file before it becomes visible, so that it cannot be evicted before it is mapped
+	int fd = ::open(tmpname.c_str(), O_RDONLY);
+	if (fd < 0 || flock(fd, LOCK_SH) < 0){
+		error("Could not open trace cache file '%s'", tmpname.c_str());
+	}
+	//replacing a stale file does not affect the simulations that still have it mapped
+	if (rename(tmpname.c_str(), filename.c_str()) < 0){
+		error("Could not rename trace cache file '%s'", tmpname.c_str());
+	}
+	cout << "decoded trace '" << prefix << "' into the trace cache (" << header.numEntries << " entries)" << endl;
+	return fd;
+}
+
+void TraceCache::evict(const string& keep){
+	string lockname = dir + "/cache.lock";
+	int lockFd = ::open(lockname.c_str(), O_RDWR | O_CREAT, 0666);
+	if (lockFd < 0 || flock(lockFd, LOCK_EX) < 0){
+		error("Could not lock trace cache file '%s'", lockname.c_str());
+	}
+	DIR *d = opendir(dir.c_str());
+	if (d == 0){
+		error("Could not read trace cache directory '%s'", dir.c_str());
+	}
+	vector<pair<uint64, string> > files; //modification time and name
+	uint64 total = 0;
+	dirent *ent;
+	while ((ent = readdir(d)) != 0){
+		string name(ent->d_name);
+		if (name.size() < 6 || name.compare(name.size() - 6, 6, ".trace") != 0){
+			continue;
+		}
+		string filename = dir + "/" + name;
+		struct stat st;
+		if (stat(filename.c_str(), &st) == 0){
+			total += st.st_size;
+			if (filename != keep){
+				files.emplace_back(st.st_mtime, filename);
+			}
+		}
+	}
+	closedir(d);
+	sort(files.begin(), files.end());
+	for (auto it = files.begin(); it != files.end() && total > budget; ++it){
+		int fd = ::open(it->second.c_str(), O_RDONLY);
+		if (fd < 0){
+			continue;
+		}
+		//files that some simulation has mapped cannot be locked exclusively
+		struct stat st;
+		if (flock(fd, LOCK_EX | LOCK_NB) == 0 && fstat(fd, &st) == 0 && unlink(it->second.c_str()) == 0){
+			total -= st.st_size;
+		}
+		close(fd);
+	}
+	close(lockFd);
+	errno = 0;
+}
+
+CachedTraceReader::CachedTraceReader(TraceCache *cache, const string& prefix, CompressionType compression) : TraceReaderBase(), currentEntry(0) {
+	fd = cache->open(prefix, compression);
+	struct stat st;
+	if (fstat(fd, &st) < 0){
+		error("Could not read trace cache file of trace '%s'", prefix.c_str());
+	}
+	dataSize = st.st_size;
+	data = mmap(0, dataSize, PROT_READ, MAP_SHARED, fd, 0);
+	if (data == MAP_FAILED){
+		error("Could not map trace cache file of trace '%s'", prefix.c_str());
+	}
+	madvise(data, dataSize, MADV_SEQUENTIAL);
+	numEntries = static_cast<const CacheHeader *>(data)->numEntries;
+	entries = reinterpret_cast<const TraceEntry *>(static_cast<const char *>(data) + HEADER_SIZE);
+}
+
+CachedTraceReader::~CachedTraceReader(){
+	munmap(data, dataSize);
+	close(fd);
+}
+
+bool CachedTraceReader::readEntry(TraceEntry *entry){
+	if (currentEntry == numEntries){
+		return false;
+	}
+	*entry = entries[currentEntry++];
+	if (entry->instr){
+		numInstr++;
+	} else if (entry->read){
+		numReads++;
+	} else {
+		numWrites++;
+	}
+	return true;
+}
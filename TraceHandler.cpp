@@ -7,6 +7,7 @@
 #include "Error.H"
 #include "TraceHandler.H"
 
+#include <algorithm>
 #include <iomanip>
 
 #include <cassert>
@@ -18,13 +19,14 @@ TraceReaderBase::TraceReaderBase(){
 	numWrites = 0;
 }
 
-TraceReader::TraceReader(const string& filename) : TraceReaderBase(){
+TraceReader::TraceReader(const string& filenameArg) : TraceReaderBase(), filename(filenameArg){
 	trace = fopen(filename.c_str(), "r");
 	if (trace == 0){
 		error("Could not open file '%s'", filename.c_str());
 	}
 	currentEntry = BUFFER_SIZE;
 	lastEntry = -1;
+	entriesRead = 0;
 }
 
 TraceReader::~TraceReader(){
@@ -34,6 +36,7 @@ TraceReader::~TraceReader(){
 bool TraceReader::readEntry(TraceEntry *entry){
 	if (currentEntry == BUFFER_SIZE){
 		size_t r = fread(&entries, sizeof(struct TraceEntry), BUFFER_SIZE, trace);
+		entriesRead += r;
 		if (r == BUFFER_SIZE){
 			currentEntry = 0;
 		} else {
@@ -63,9 +66,68 @@ bool TraceReader::readEntry(TraceEntry *entry){
 	return true;
 }
 
+void TraceReader::reopen(){
+	fclose(trace);
+	trace = fopen(filename.c_str(), "r");
+	if (trace == 0){
+		error("Could not open file '%s'", filename.c_str());
+	}
+	if (fseeko(trace, entriesRead * sizeof(struct TraceEntry), SEEK_SET) != 0){
+		error("Could not seek in file '%s'", filename.c_str());
+	}
+}
 
-CompressedTraceReader::TraceMerger::TraceMerger(const string& prefix, CompressionType compressionArg){
-	compression = compressionArg;
+
+//bzip2 files cannot seek, so the bytes up to the position are decompressed again and dropped
+static void skipCompressed(BZFILE *trace, uint64 bytes){
+	char buffer[4096];
+	while (bytes > 0){
+		int bzerror;
+		int toRead = min<uint64>(bytes, sizeof(buffer));
+		int r = BZ2_bzRead(&bzerror, trace, buffer, toRead);
+		if ((bzerror != BZ_OK && bzerror != BZ_STREAM_END) || r != toRead){
+			error("Error skipping the entries already read from a trace file");
+		}
+		bytes -= r;
+	}
+}
+
+CompressedTraceReader::TraceMerger::TraceMerger(const string& prefixArg, CompressionType compressionArg) : prefix(prefixArg), compression(compressionArg){
+	open();
+	timestampEntries = new uint64[BUFFER_SIZE];
+	addressEntries = new addrint[BUFFER_SIZE];
+	sizeEntries = new uint8[BUFFER_SIZE];
+	currentEntry = BUFFER_SIZE;
+	lastEntry = -1;
+	currentTimestamp = 0;
+	entriesRead = 0;
+}
+
+CompressedTraceReader::TraceMerger::~TraceMerger(){
+	close();
+	delete [] timestampEntries;
+	delete [] addressEntries;
+	delete [] sizeEntries;
+}
+
+/*
+ * The entries already read are in the buffers, so the files continue right after them
+ */
+void CompressedTraceReader::TraceMerger::reopen(){
+	close();
+	open();
+	if (compression == GZIP){
+		if (gzseek(gzTimestampFile, entriesRead * sizeof(uint64), SEEK_SET) == -1 || gzseek(gzAddressFile, entriesRead * sizeof(addrint), SEEK_SET) == -1 || gzseek(gzSizeFile, entriesRead * sizeof(uint8), SEEK_SET) == -1){
+			error("Could not seek in the trace files of '%s'", prefix.c_str());
+		}
+	} else if (compression == BZIP2){
+		skipCompressed(timestampTrace, entriesRead * sizeof(uint64));
+		skipCompressed(addressTrace, entriesRead * sizeof(addrint));
+		skipCompressed(sizeTrace, entriesRead * sizeof(uint8));
+	}
+}
+
+void CompressedTraceReader::TraceMerger::open(){
 	if (compression == GZIP){
 		string filename = prefix+"-time.gz";
 		if((gzTimestampFile = gzopen(filename.c_str(), "r")) == 0){
@@ -103,15 +165,9 @@ CompressedTraceReader::TraceMerger::TraceMerger(const string& prefix, Compressio
 			error("Could not prepare for reading compressed file '%s': %d", filename.c_str(), bzerror);
 		}
 	}
-	timestampEntries = new uint64[BUFFER_SIZE];
-	addressEntries = new addrint[BUFFER_SIZE];
-	sizeEntries = new uint8[BUFFER_SIZE];
-	currentEntry = BUFFER_SIZE;
-	lastEntry = -1;
-	currentTimestamp = 0;
 }
 
-CompressedTraceReader::TraceMerger::~TraceMerger(){
+void CompressedTraceReader::TraceMerger::close(){
 	if (compression == GZIP){
 		gzclose(gzTimestampFile);
 		gzclose(gzAddressFile);
@@ -128,9 +184,6 @@ CompressedTraceReader::TraceMerger::~TraceMerger(){
 		fclose(addressFile);
 		fclose(sizeFile);
 	}
-	delete [] timestampEntries;
-	delete [] addressEntries;
-	delete [] sizeEntries;
 }
 
 bool CompressedTraceReader::TraceMerger::readEntry(uint64 *timestamp, addrint *addr, uint8 *size){
@@ -149,7 +202,9 @@ bool CompressedTraceReader::TraceMerger::readEntry(uint64 *timestamp, addrint *a
 
 			if (timestampRead == -1){
 				error("Error reading trace file");
-			} else if (timestampRead == BUFFER_SIZE){
+			}
+			entriesRead += timestampRead;
+			if (timestampRead == BUFFER_SIZE){
 				currentEntry = 0;
 			} else {
 				currentEntry = 0;
@@ -170,6 +225,7 @@ bool CompressedTraceReader::TraceMerger::readEntry(uint64 *timestamp, addrint *a
 				error("Bytes read from all three files are not the same (timestamp: %d, address: %d and size: %d)", timestampRead, addressRead, sizeRead);
 			}
 
+			entriesRead += timestampRead;
 			if (timestampError == BZ_OK){
 				assert(timestampRead == BUFFER_SIZE);
 				currentEntry = 0;
@@ -240,6 +296,12 @@ CompressedTraceReader::CompressedTraceReader(const string& prefix, CompressionTy
 	writeValid = writeMerger.readEntry(&writeTimestamp, &writeAddress, &writeSize);
 }
 
+void CompressedTraceReader::reopen(){
+	instrMerger.reopen();
+	readMerger.reopen();
+	writeMerger.reopen();
+}
+
 bool CompressedTraceReader::readEntry(TraceEntry *entry){
 	//static int i;
 	//i++;
@@ -191,7 +191,7 @@ int main(int argc, char * argv[]){
 			}
 
 			addrint evictedAddr;
-			CacheModel::Result res = cache.access(firstAddr, entry.read, entry.instr, &evictedAddr, 0);
+			CacheModel::Result res = cache.access(firstAddr, entry.read, entry.instr, false, &evictedAddr, 0);
 			if (res == CacheModel::HIT){
 
 			} else if (res == CacheModel::MISS_WITHOUT_EVICTION || res == CacheModel::MISS_WITH_EVICTION){
@@ -213,7 +213,7 @@ int main(int argc, char * argv[]){
 			}
 
 			if (firstAddr != secondAddr){
-				res = cache.access(secondAddr, entry.read, entry.instr, &evictedAddr, 0);
+				res = cache.access(secondAddr, entry.read, entry.instr, false, &evictedAddr, 0);
 				if (res == CacheModel::HIT){
 
 				} else if (res == CacheModel::MISS_WITHOUT_EVICTION || res == CacheModel::MISS_WITH_EVICTION){
@@ -462,10 +462,10 @@ int main(int argc, char * argv[]){
 					addrint firstByteBlockAddress = entry.address & ~offsetMask[b];
 					addrint lastByteBlockAddress = (entry.address + entry.size - 1) & ~offsetMask[b];
 					if (firstByteBlockAddress == lastByteBlockAddress){
-						caches[s][b]->access(firstByteBlockAddress, entry.read, entry.instr, &evictedAddr, &internalAddr);
+						caches[s][b]->access(firstByteBlockAddress, entry.read, entry.instr, false, &evictedAddr, &internalAddr);
 					} else if (firstByteBlockAddress + b == lastByteBlockAddress){
-						caches[s][b]->access(firstByteBlockAddress, entry.read, entry.instr, &evictedAddr, &internalAddr);
-						caches[s][b]->access(lastByteBlockAddress, entry.read, entry.instr, &evictedAddr, &internalAddr);
+						caches[s][b]->access(firstByteBlockAddress, entry.read, entry.instr, false, &evictedAddr, &internalAddr);
+						caches[s][b]->access(lastByteBlockAddress, entry.read, entry.instr, false, &evictedAddr, &internalAddr);
 					} else {
 						error("Access covers more than one cache block");
 					}
@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2015 Santiago Bock
+ *
+ * See the file LICENSE.txt for copying permission.
+ */
+
+#include "Arguments.H"
+#include "DebugTrace.H"
+
+#include <limits>
+
+
+int main(int argc, char * argv[]){
+
+	ArgumentContainer args("debugtext", false);
+	PositionalArgument<string> inputFile(&args, "input_file", "debug trace file written by the simulator", "");
+	OptionalArgument<string> component(&args, "component", "name of the only component whose records are printed (empty for all components)", "");
+	OptionalArgument<uint64> start(&args, "start", "timestamp of the first record printed", 0);
+	OptionalArgument<uint64> end(&args, "end", "timestamp after which records are not printed", numeric_limits<uint64>::max());
+
+	if (args.parse(argc, argv)){
+		args.usage(cerr);
+		return -1;
+	}
+
+	DebugTraceReader reader(inputFile.getValue());
+
+	DebugRecord record;
+	while (reader.readRecord(&record)){
+		if (record.timestamp < start.getValue() || record.timestamp > end.getValue()){
+			continue;
+		}
+		const string& name = reader.getComponent(record);
+		if (!component.getValue().empty() && name != component.getValue()){
+			continue;
+		}
+		cout << record.timestamp << ": " << name << "." << reader.format(record) << "\n";
+	}
+
+	return 0;
+}
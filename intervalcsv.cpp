@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2015 Santiago Bock
+ *
+ * See the file LICENSE.txt for copying permission.
+ */
+
+#include "Arguments.H"
+#include "IntervalStats.H"
+
+
+int main(int argc, char * argv[]){
+
+	ArgumentContainer args("intervalcsv", false);
+	PositionalArgument<string> inputFile(&args, "input_file", "binary interval statistics file written by the simulator", "");
+	OptionalArgument<string> separator(&args, "separator", "column separator", ",");
+
+	if (args.parse(argc, argv)){
+		args.usage(cerr);
+		return -1;
+	}
+
+	IntervalStatsReader reader(inputFile.getValue());
+
+	for (unsigned i = 0; i < reader.getNumColumns(); i++){
+		if (i != 0){
+			cout << separator.getValue();
+		}
+		cout << reader.getName(i);
+	}
+	cout << "\n";
+
+	vector<uint64> row;
+	while (reader.readRow(&row)){
+		for (unsigned i = 0; i < reader.getNumColumns(); i++){
+			if (i != 0){
+				cout << separator.getValue();
+			}
+			cout << reader.format(i, row[i]);
+		}
+		cout << "\n";
+	}
+
+	return 0;
+}
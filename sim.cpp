@@ -7,7 +7,9 @@
 #include "Arguments.H"
 #include "Bank.H"
 #include "Cache.H"
+#include "Checkpoint.H"
 #include "CPU.H"
+#include "DebugTrace.H"
 #include "Engine.H"
 #include "Error.H"
 #include "HybridMemory.H"
@@ -16,13 +18,43 @@
 #include "MemoryManager.H"
 #include "Migration.H"
 #include "Partition.H"
+#include "Prefetcher.H"
+#include "Sampling.H"
+#include "Server.H"
 #include "Statistics.H"
+#include "Sweep.H"
+#include "ThreadedTraceReader.H"
+#include "TraceCache.H"
 #include "TraceHandler.H"
 #include "Types.H"
 
 #include <cassert>
+#include <sstream>
 
-int main(int argc, char * argv[]){
+/*
+ * Parses a string of values separated by "_" with one value per far memory tier, or a single value for all of them
+ */
+template <class T> static vector<T> parseTierValues(const string& values, unsigned numTiers, const string& name){
+	vector<T> ret;
+	size_t current;
+	size_t next = -1;
+	do {
+		current = next + 1;
+		next = values.find_first_of("_", current);
+		istringstream iss(values.substr(current, next - current));
+		T value;
+		iss >> value;
+		ret.emplace_back(value);
+	} while (next != string::npos);
+	if (ret.size() == 1){
+		ret.resize(numTiers, ret[0]);
+	} else if (ret.size() != numTiers){
+		error("%s has %lu values but must have 1 or %u", name.c_str(), ret.size(), numTiers);
+	}
+	return ret;
+}
+
+static int simulate(int argc, char * argv[]){
 
 //	enum A {
 //		B,
@@ -53,25 +85,54 @@ int main(int argc, char * argv[]){
 	OptionalArgument<string> confPrefix(&args, "conf_prefix", "prefix of per-trace configuration file (name of trace will be appended)", "");
 
 	OptionalArgument<string> statsFile(&args, "stats", "name of statistics file", "", false);
+	OptionalArgument<string> statsSelect(&args, "stats_select", "comma-separated shell wildcard patterns of the statistics written to the statistics file (empty for all)", "");
 	OptionalArgument<string> countersPrefix(&args, "counters", "prefix of file where the counter trace is written to", "", false);
 
 	OptionalArgument<uint64> intervalStatsPeriod(&args, "interval_stats_period", "period use by the engine to print interval statistics (0 for no interval statistics)", 0);
 	OptionalArgument<string> intervalStatsFile(&args, "interval_stats_file", "name of interval statistics file (empty for no interval statistics", "");
+	OptionalArgument<IntervalStatsFormat> intervalStatsFormat(&args, "interval_stats_format", "format of the interval statistics file (text|binary|gzip); binary files are converted with intervalcsv", TEXT_INTERVAL_STATS);
 
 	OptionalArgument<string> tracePrefix(&args, "trace_prefix", "prefix of trace files", "");
+	OptionalArgument<bool> threadedTraceReaders(&args, "threaded_trace_readers", "whether each trace is decoded on its own thread, ahead of the simulation", false);
+	OptionalArgument<string> traceCacheDir(&args, "trace_cache_dir", "directory where decoded traces are shared with other simulations, preferably on a tmpfs such as /dev/shm (empty for no trace cache)", "");
+	OptionalArgument<uint64> traceCacheBudget(&args, "trace_cache_budget", "size in MB above which unused traces are evicted from the trace cache", 4096);
+	OptionalArgument<unsigned> traceBufferChunks(&args, "trace_buffer_chunks", "number of decoded chunks of 4096 entries buffered per threaded trace reader", 16);
 	OptionalArgument<string> counterTracePrefix(&args, "counter_trace_prefix", "prefix of the file where the counter trace is read from", "");
 	OptionalArgument<string> counterTraceInfix(&args, "counter_trace_infix", "infix (after prefix and after conf but before name of trace) of the file where the counter trace is read from", "");
 
 	OptionalArgument<uint64> stop(&args, "stop", "timestamp to stop execution of the simulator (0 means don't stop)", 0);
 
+	OptionalArgument<string> checkpointSave(&args, "checkpoint_save", "name of the checkpoint file to write (empty for no checkpoint)", "");
+	OptionalArgument<uint64> checkpointAt(&args, "checkpoint_at", "timestamp at which the checkpoint is written (or as soon as possible after it, once no page is being migrated)", 0);
+	OptionalArgument<bool> checkpointExit(&args, "checkpoint_exit", "whether to stop the simulation after writing the checkpoint", false);
+	OptionalArgument<string> checkpointRestore(&args, "checkpoint_restore", "name of the checkpoint file to start the simulation from (empty to start from the beginning)", "");
+	OptionalArgument<bool> checkpointRestoreStats(&args, "checkpoint_restore_stats", "whether the statistics are restored from the checkpoint (otherwise they start from zero)", true);
+
+	OptionalArgument<string> sweepFile(&args, "sweep_file", "name of the file with the configurations simulated after the warm-up, each in its own process (empty for no sweep)", "");
+	OptionalArgument<uint64> sweepAt(&args, "sweep_at", "timestamp at which the sweep configurations are forked (or as soon as possible after it, once no page is being migrated)", 0);
+	OptionalArgument<bool> sampling(&args, "sampling", "whether to simulate only sampled windows of the traces in detail (SMARTS)", false);
+	OptionalArgument<uint64> samplingFastForward(&args, "sampling_fast_forward", "number of instructions per CPU executed without timing between sampling windows", 1000000);
+	OptionalArgument<uint64> samplingWarmup(&args, "sampling_warmup", "number of instructions per CPU simulated in detail before each sampling window", 20000);
+	OptionalArgument<uint64> samplingWindow(&args, "sampling_window", "number of instructions per CPU measured in each sampling window", 10000);
+	OptionalArgument<double> samplingTargetError(&args, "sampling_target_error", "relative half width of the 95% confidence interval of the IPC at which sampling stops (0 to sample until the end of the traces)", 0);
+	OptionalArgument<uint64> samplingMinWindows(&args, "sampling_min_windows", "minimum number of sampling windows before the target error is checked", 30);
+	OptionalArgument<string> samplingStats(&args, "sampling_stats", "comma-separated names (or shell wildcard patterns) of the statistics estimated from the sampling windows (in addition to the IPC)", "");
+
+	OptionalArgument<unsigned> sweepJobs(&args, "sweep_jobs", "maximum number of sweep configurations simulated at the same time", 1);
+
 	OptionalArgument<uint64> debugStart(&args, "debug", "timestamp to start debugging output ", numeric_limits<uint64>::max());
 	OptionalArgument<uint64> debugCpuStart(&args, "debug_cpu", "timestamp to start debugging output for the CPUs", numeric_limits<uint64>::max());
 	OptionalArgument<uint64> debugCachesStart(&args, "debug_caches", "timestamp to start debugging output for the caches", numeric_limits<uint64>::max());
 	OptionalArgument<uint64> debugHybridMemoryStart(&args, "debug_hybrid_memory", "timestamp to start debugging output for the hybrid memory", numeric_limits<uint64>::max());
 	OptionalArgument<uint64> debugHybridMemoryManagerStart(&args, "debug_hybrid_memory_manager", "timestamp to start debugging output for the hybrid memory manager", numeric_limits<uint64>::max());
 	OptionalArgument<uint64> debugCachesHybridStart(&args, "debug_caches_hybrid", "timestamp to start debugging output for the caches, hybrid memory and hybrid memory manager", numeric_limits<uint64>::max());
+	OptionalArgument<string> debugTraceFile(&args, "debug_trace_file", "name of the file where the debugging output is dumped (print it with debugtext)", "debug.trace");
+	OptionalArgument<uint64> debugTraceSize(&args, "debug_trace_size", "number of most recent debugging records kept per component", 65536);
 
 	OptionalArgument<uint64> progressPeriod(&args, "progress_period", "period use by the engine to print progress information (0 for no information)", 10000000);
+	OptionalArgument<bool> eventProfile(&args, "event_profile", "whether to print the events and host time of each component (needs a simulator compiled with PROFILE_EVENTS)", false);
+	OptionalArgument<string> eventProfileFile(&args, "event_profile_file", "name of the file where the event profile is written (empty for the standard output)", "");
+	OptionalArgument<bool> eventProfileIntervals(&args, "event_profile_intervals", "whether the event profile is also printed for each interval of the interval statistics", false);
 
 	OptionalArgument<unsigned> blockSize(&args, "block_size", "block size", 64);
 	OptionalArgument<unsigned> pageSize(&args, "page_size", "page size", 4096);
@@ -96,6 +157,13 @@ int main(int argc, char * argv[]){
 	OptionalArgument<uint64> sharedL2Penalty(&args, "L2_penalty", "shared L2 penalty", 32); //8 ns @ 4GHz
 	OptionalArgument<uint64> sharedL2QueueSize(&args, "L2_queue_size", "shared L2 queue size", 16);
 
+	OptionalArgument<string> instrL1Prefetcher(&args, "instr_L1_prefetcher", "instruction L1 prefetcher (none|next_line|stride|stream|region)", "none");
+	OptionalArgument<string> dataL1Prefetcher(&args, "data_L1_prefetcher", "data L1 prefetcher (none|next_line|stride|stream|region)", "none");
+	OptionalArgument<string> sharedL2Prefetcher(&args, "L2_prefetcher", "shared L2 prefetcher (none|next_line|stride|stream|region)", "none");
+	OptionalArgument<unsigned> prefetchDegree(&args, "prefetch_degree", "maximum number of prefetches issued per access", 4);
+	OptionalArgument<bool> prefetchThrottling(&args, "prefetch_throttling", "whether prefetchers adjust their degree based on their accuracy", true);
+	OptionalArgument<unsigned> prefetchTableSize(&args, "prefetch_table_size", "number of regions tracked by the stride and region prefetchers and number of streams of the stream prefetcher", 16);
+
 	OptionalArgument<bool> realCacheRemap(&args, "real_cache_remap", "whether the caches use real cache remap (remap latency == penalty, flush previous levels) or not (remap latency == 0, remap previous levels)", true);
 
 	OptionalArgument<bool> privateL2(&args, "private_L2", "whether the L2 is private", false);
@@ -108,12 +176,21 @@ int main(int argc, char * argv[]){
 
 	//Arguments for Hybrid Memory Manager
 	OptionalArgument<FlushPolicy> flushPolicy(&args, "flush_policy", "flush policy (flush_pcm_before|flush_only_after|remap|change_tag)", FLUSH_PCM_BEFORE);
-	OptionalArgument<unsigned> flushQueueSize(&args, "flush_queue_size", "number of concurrent flushes due to migrations", 8);
+	OptionalArgument<unsigned> flushQueueSize(&args, "flush_queue_size", "number of concurrent block flushes (old hybrid memory manager) or tag changes (change_tag flush policy) due to migrations", 8);
 	OptionalArgument<bool> supressFlushWritebacks(&args, "suppress_flush_writebacks", "whether to suppress writebacks due to L2 flushing", false);
 	OptionalArgument<uint64> demoteTimout(&args, "demote_timeout", "number of clock cycles after no demotion was started to try again", 10000);
 	OptionalArgument<uint64> partitionPeriod(&args, "partition_period", "size in clock cycles or number of instructions of the partition recalculation period", 1000000);
 	OptionalArgument<string> periodType(&args, "period_type", "type of the partition recalculation period (cycles|instructions)", "cycles");
 	OptionalArgument<unsigned> migrationTableSize(&args, "migration_table_size", "maximum size of the migration table", numeric_limits<unsigned>::max());
+	OptionalArgument<double> migrationRate(&args, "migration_rate", "maximum number of bytes migrated per cycle, divided among processes by the partition rates (0 means unlimited)", 0);
+	OptionalArgument<unsigned> migrationBurst(&args, "migration_burst", "number of pages that can be migrated back to back without exceeding the migration rate", 4);
+	OptionalArgument<bool> adaptiveMigrationRate(&args, "adaptive_migration_rate", "whether to lower the migration rate while the DRAM and PCM queue stall time rises", false);
+	OptionalArgument<uint64> migrationRatePeriod(&args, "migration_rate_period", "number of cycles between adjustments of the adaptive migration rate", 100000);
+	OptionalArgument<unsigned> hugePageSize(&args, "huge_page_size", "huge page size", 2097152);
+	OptionalArgument<string> hugePagePolicies(&args, "huge_page_policies", "string representing the huge page policy of each process (never|whole|split|thp), or of all processes if there is only one", "never");
+	OptionalArgument<double> thpMinMapped(&args, "thp_min_mapped", "minimum fraction of the pages of a huge page that must be mapped for the thp huge page policy to keep it whole", 0.5);
+	OptionalArgument<unsigned> tierPromotionThreshold(&args, "tier_promotion_threshold", "number of accesses after which a page in a far memory tier is moved one tier up", 8);
+	OptionalArgument<unsigned> tierFreePages(&args, "tier_free_pages", "number of free pages kept in each tier below DRAM that has a far memory tier below it", 64);
 
 
 	//Arguments for migration policies
@@ -138,7 +215,7 @@ int main(int argc, char * argv[]){
 
 
 	//Migration, allocation and partition
-	OptionalArgument<string> migrationPolicy(&args, "migration_policy", "migration policy (no_migration|multi_queue|first_touch|double_clock|frequency|offline|two_lru)", "multi_queue");
+	OptionalArgument<string> migrationPolicy(&args, "migration_policy", "migration policy (no_migration|multi_queue|sketch|first_touch|double_clock|frequency|offline|two_lru)", "multi_queue");
 	OptionalArgument<AllocationPolicy> allocationPolicy(&args, "allocation_policy", "allocation policy (dram_first|pcm_only|custom)", DRAM_FIRST);
 	OptionalArgument<string> customAllocator(&args, "custom_allocator", "custom allocator (offline_frequency)", "offline_frequency");
 	OptionalArgument<string> partitionPolicy(&args, "partition_policy", "partition policy (none|static|offline)", "none");
@@ -166,6 +243,18 @@ int main(int argc, char * argv[]){
 	OptionalArgument<unsigned> demotionAttempts(&args, "demotion_attempts", "number of times the policy is consulted before it allows for a demotion", 0);
 
 
+	//Arguments for the two LRU migration policy
+	OptionalArgument<uint64> twoLRUThreshold(&args, "two_lru_threshold", "number of accesses for a PCM page to be promoted by the two LRU policy", 1000);
+
+
+	//Arguments for the Count-Min sketch migration policy
+	OptionalArgument<unsigned> sketchWidth(&args, "sketch_width", "number of counters per row of the sketch (power of 2)", 65536);
+	OptionalArgument<unsigned> sketchDepth(&args, "sketch_depth", "number of rows of the sketch", 4);
+	OptionalArgument<uint64> sketchResetPeriod(&args, "sketch_reset_period", "number of reads counted between halvings of the sketch (0 means never)", 655360);
+	OptionalArgument<uint32> sketchPromotionThreshold(&args, "sketch_promotion_threshold", "estimated read count for a PCM page to become a promotion candidate", 16);
+	OptionalArgument<unsigned> sketchCandidates(&args, "sketch_candidates", "maximum number of promotion candidates tracked exactly", 1024);
+
+
 	//Arguments for static partition policy
 	OptionalArgument<string> dramFractions(&args, "dram_fractions", "string representing the fraction of dram space allocated to each process", "0.0078125"); //32MB for a 4GB system
 	OptionalArgument<string> rateFractions(&args, "rate_fractions", "string representing the fraction of migration rate allocated to each process", "1");
@@ -197,6 +286,14 @@ int main(int argc, char * argv[]){
 	OptionalArgument<bool> elideCleanDramBlocks(&args, "elide_clean_dram_blocks", "whether to elide copying of clean DRAM block for page migrations from DRAM to PCM", false);
 	OptionalArgument<bool> fixedPcmMigrationCost(&args, "fixed_pcm_migration_cost", "whether the hybrid memory uses a fixed migration cost for page migrations from DRAM to PCM", false);
 	OptionalArgument<uint64> pcmMigrationCost(&args, "pcm_migration_cost", "PCM migration cost", 1);
+	OptionalArgument<bool> copyEngine(&args, "copy_engine", "whether the hybrid memory copies the blocks of several migrations at once in row buffer order instead of using the migration read and write delays", false);
+	OptionalArgument<unsigned> copyWindow(&args, "copy_window", "maximum number of copy reads in flight in the copy engine", 16);
+	OptionalArgument<unsigned> copyBatchSize(&args, "copy_batch_size", "number of migrations whose blocks the copy engine issues together", 4);
+	OptionalArgument<uint64> lineCacheSize(&args, "line_cache_size", "size of the DRAM used by the hybrid memory to cache single blocks of the pages below DRAM (0 disables the line cache)", 0);
+	OptionalArgument<unsigned> lineCacheAssoc(&args, "line_cache_assoc", "associativity of the line cache (1 is direct mapped)", 1);
+	OptionalArgument<unsigned> lineCacheMigrationBlocks(&args, "line_cache_migration_blocks", "minimum number of accessed blocks for a page below DRAM to be seen by the migration policies (0 shows them all)", 0);
+	OptionalArgument<bool> criticalBlockFirst(&args, "critical_block_first", "whether on-demand migrations to DRAM read the blocks that the page read before ahead of the rest of the page", false);
+	OptionalArgument<uint64> idleCopyPeriod(&args, "idle_copy_period", "period for reading the remaining blocks of on-demand migrations to DRAM while their bank is idle (0 reads them only on demand or on completion)", 0);
 
 	//Arguments for Old hHybrid memory
 	OptionalArgument<bool> burstMigration(&args, "burst_migration", "whether the hybrid memory issues requests for page migration in a burst", true);
@@ -223,6 +320,8 @@ int main(int argc, char * argv[]){
 	OptionalArgument<uint64> dramOpenLatency(&args, "dram_open_latency", "DRAM open latency", 50); //12.5ns @4GHz
 	OptionalArgument<uint64> dramCloseLatency(&args, "dram_close_latency", "DRAM close latency", 50);
 	OptionalArgument<uint64> dramAccessLatency(&args, "dram_access_latency", "DRAM access_latency", 50);
+	OptionalArgument<unsigned> dramWriteHighWatermark(&args, "dram_write_high_watermark", "number of queued DRAM writes per bank that starts a write drain (0 disables the separate write queue)", 0);
+	OptionalArgument<unsigned> dramWriteLowWatermark(&args, "dram_write_low_watermark", "number of queued DRAM writes per bank that ends a write drain", 0);
 	OptionalArgument<uint64> dramBusLatency(&args, "dram_bus_latency", "DRAM bus latency", 16); //4ns @4GHz; 4ns == 4 transfers @ 1000MHz (DDR-2000)
 	//Total size: 8GB
 
@@ -239,8 +338,27 @@ int main(int argc, char * argv[]){
 	OptionalArgument<uint64> pcmCloseLatency(&args, "pcm_close_latency", "PCM close latency", 60); //12 slower array writes //old: 5600); //350ns for 128 bit write
 	OptionalArgument<uint64> pcmAccessLatency(&args, "pcm_access_latency", "PCM access_latency", 5);
 	OptionalArgument<bool> pcmLongLatency(&args,  "pcm_long_latency", "whether PCM uses long latency for close operation (close latency * number of dirty columns)", true);
+	OptionalArgument<unsigned> pcmWriteHighWatermark(&args, "pcm_write_high_watermark", "number of queued PCM writes per bank that starts a write drain (0 disables the separate write queue)", 0);
+	OptionalArgument<unsigned> pcmWriteLowWatermark(&args, "pcm_write_low_watermark", "number of queued PCM writes per bank that ends a write drain", 0);
+	OptionalArgument<bool> pcmWritePausing(&args, "pcm_write_pausing", "whether PCM write backs can be paused at column boundaries to serve high priority reads", false);
+	OptionalArgument<bool> pcmWriteCancellation(&args, "pcm_write_cancellation", "whether PCM write backs can be cancelled to serve high priority reads", false);
+	OptionalArgument<unsigned> pcmWriteCancelThreshold(&args, "pcm_write_cancel_threshold", "percentage of a PCM write back after which it can no longer be cancelled", 75);
 	OptionalArgument<uint64> pcmBusLatency(&args, "pcm_bus_latency", "PCM bus latency", 4); //10ns @4GHz; 10ns == 4 transfer @ 400MHz (DDR-800)
 
+	//Far memory parameters (tiers below PCM in the hybrid memory; the values separated by "_" are per tier)
+	OptionalArgument<unsigned> farTiers(&args, "far_tiers", "number of far memory tiers below PCM", 0);
+	OptionalArgument<RowBufferPolicy> farRowBufferPolicy(&args, "far_row_buffer_policy", "far memory row buffer policy (open_page|closed_page)", OPEN_PAGE);
+	OptionalArgument<MappingType> farMappingType(&args, "far_mapping_type", "far memory mapping type (row_rank_bank_col|row_col_rank_bank|rank_bank_row_col)", ROW_RANK_BANK_COL);
+	OptionalArgument<string> farQueueSize(&args, "far_queue_size", "far memory queue size", "128");
+	OptionalArgument<string> farRanks(&args, "far_ranks", "number of far memory ranks", "8");
+	OptionalArgument<string> farBanksPerRank(&args, "far_banks_per_rank", "number of far memory banks per rank", "8");
+	OptionalArgument<string> farRowsPerBank(&args, "far_rows_per_bank", "number of far memory rows per bank", "65536");
+	OptionalArgument<string> farBlocksPerRow(&args, "far_blocks_per_row", "number of far memory blocks per row", "64");
+	OptionalArgument<string> farOpenLatency(&args, "far_open_latency", "far memory open latency", "50");
+	OptionalArgument<string> farCloseLatency(&args, "far_close_latency", "far memory close latency", "50");
+	OptionalArgument<string> farAccessLatency(&args, "far_access_latency", "far memory access latency", "330"); //DRAM plus 70ns @4GHz for the link
+	OptionalArgument<string> farBusLatency(&args, "far_bus_latency", "far memory bus latency", "16");
+
 //	args.print(cout);
 //	return -1;
 
@@ -266,6 +384,8 @@ int main(int argc, char * argv[]){
 		debugHybridMemoryManagerStart.setValue(debugStart.getValue());
 	}
 
+	DebugTrace::init(debugTraceFile.getValue(), debugTraceSize.getValue());
+
 	unsigned numCores;
 	unsigned numProcesses;
 	vector<string> traceNames;
@@ -297,9 +417,16 @@ int main(int argc, char * argv[]){
 
 
 	StatContainer stats;
-	Engine engine(&stats, intervalStatsPeriod.getValue(), intervalStatsFile.getValue(), progressPeriod.getValue());
+	Engine engine(&stats, intervalStatsPeriod.getValue(), intervalStatsFile.getValue(), intervalStatsFormat.getValue(), progressPeriod.getValue());
+	if (eventProfile.getValue()){
+		if (eventProfileIntervals.getValue() && (intervalStatsPeriod.getValue() == 0 || intervalStatsFile.getValue().empty())){
+			error("Event profile intervals need interval statistics (-interval_stats_period and -interval_stats_file)");
+		}
+		engine.enableProfiling(eventProfileFile.getValue(), eventProfileIntervals.getValue());
+	}
 	Memory *dramMemory = 0;
 	Memory *pcmMemory = 0;
+	vector<Memory *> farMemories;
 	IMemory *memory = 0;
 	CacheMemory *cacheMemory = 0;
 	HybridMemory *hybridMemory = 0;
@@ -313,27 +440,47 @@ int main(int argc, char * argv[]){
 	OldHybridMemoryManager *ohmm = 0;
 
 	if (memoryOrganization.getValue() == "dram"){
-		dramMemory = new Memory("dram", "DRAM", &engine, &stats, debugStart.getValue(), DRAM_QUEUE, DRAM_OPEN, DRAM_ACCESS, DRAM_CLOSE, DRAM_BUS_QUEUE, DRAM_BUS, dramRowBufferPolicy.getValue(), DESTRUCTIVE_READS, dramMappingType.getValue(), dramGlobalQueue.getValue(), dramQueueSize.getValue(), dramRanks.getValue(), dramBanksPerRank.getValue(), dramRowsPerBank.getValue(), dramBlocksPerRow.getValue(), blockSize.getValue(), dramOpenLatency.getValue(), dramCloseLatency.getValue(), dramAccessLatency.getValue(), false, dramBusLatency.getValue(), 0);
+		dramMemory = new Memory("dram", "DRAM", &engine, &stats, debugStart.getValue(), DRAM_QUEUE, DRAM_OPEN, DRAM_ACCESS, DRAM_CLOSE, DRAM_BUS_QUEUE, DRAM_BUS, dramRowBufferPolicy.getValue(), DESTRUCTIVE_READS, dramMappingType.getValue(), dramGlobalQueue.getValue(), dramQueueSize.getValue(), dramRanks.getValue(), dramBanksPerRank.getValue(), dramRowsPerBank.getValue(), dramBlocksPerRow.getValue(), blockSize.getValue(), dramOpenLatency.getValue(), dramCloseLatency.getValue(), dramAccessLatency.getValue(), false, dramWriteHighWatermark.getValue(), dramWriteLowWatermark.getValue(), false, false, 0, dramBusLatency.getValue(), 0);
 		manager = new SimpleMemoryManager(&stats, dramMemory, numProcesses, pageSize.getValue());
 		memory = dramMemory;
 	} else if (memoryOrganization.getValue() == "pcm"){
-		pcmMemory = new Memory("pcm", "PCM", &engine, &stats, debugStart.getValue(), PCM_QUEUE, PCM_OPEN, PCM_ACCESS, PCM_CLOSE, PCM_BUS_QUEUE, PCM_BUS, pcmRowBufferPolicy.getValue(), NON_DESTRUCTIVE_READS, pcmMappingType.getValue(), pcmGlobalQueue.getValue(), pcmQueueSize.getValue(), pcmRanks.getValue(), pcmBanksPerRank.getValue(), pcmRowsPerBank.getValue(), pcmBlocksPerRow.getValue(), blockSize.getValue(), pcmOpenLatency.getValue(), pcmCloseLatency.getValue(), pcmAccessLatency.getValue(), pcmLongLatency.getValue(), pcmBusLatency.getValue(),0);
+		pcmMemory = new Memory("pcm", "PCM", &engine, &stats, debugStart.getValue(), PCM_QUEUE, PCM_OPEN, PCM_ACCESS, PCM_CLOSE, PCM_BUS_QUEUE, PCM_BUS, pcmRowBufferPolicy.getValue(), NON_DESTRUCTIVE_READS, pcmMappingType.getValue(), pcmGlobalQueue.getValue(), pcmQueueSize.getValue(), pcmRanks.getValue(), pcmBanksPerRank.getValue(), pcmRowsPerBank.getValue(), pcmBlocksPerRow.getValue(), blockSize.getValue(), pcmOpenLatency.getValue(), pcmCloseLatency.getValue(), pcmAccessLatency.getValue(), pcmLongLatency.getValue(), pcmWriteHighWatermark.getValue(), pcmWriteLowWatermark.getValue(), pcmWritePausing.getValue(), pcmWriteCancellation.getValue(), pcmWriteCancelThreshold.getValue(), pcmBusLatency.getValue(),0);
 		manager = new SimpleMemoryManager(&stats, pcmMemory, numProcesses, pageSize.getValue());
 		memory = pcmMemory;
 	} else if (memoryOrganization.getValue() == "cache"){
-		dramMemory = new Memory("dram", "DRAM", &engine, &stats, debugStart.getValue(), DRAM_QUEUE, DRAM_OPEN, DRAM_ACCESS, DRAM_CLOSE, DRAM_BUS_QUEUE, DRAM_BUS,  dramRowBufferPolicy.getValue(), DESTRUCTIVE_READS, dramMappingType.getValue(), dramGlobalQueue.getValue(), dramQueueSize.getValue(), dramRanks.getValue(), dramBanksPerRank.getValue(), dramRowsPerBank.getValue(), dramBlocksPerRow.getValue(), blockSize.getValue(), dramOpenLatency.getValue(), dramCloseLatency.getValue(), dramAccessLatency.getValue(), false, dramBusLatency.getValue(),0);
-		pcmMemory = new Memory("pcm", "PCM", &engine, &stats, debugStart.getValue(), PCM_QUEUE, PCM_OPEN, PCM_ACCESS, PCM_CLOSE, PCM_BUS_QUEUE, PCM_BUS, pcmRowBufferPolicy.getValue(), NON_DESTRUCTIVE_READS, pcmMappingType.getValue(), pcmGlobalQueue.getValue(), pcmQueueSize.getValue(), pcmRanks.getValue(), pcmBanksPerRank.getValue(), pcmRowsPerBank.getValue(), pcmBlocksPerRow.getValue(), blockSize.getValue(), pcmOpenLatency.getValue(), pcmCloseLatency.getValue(), pcmAccessLatency.getValue(), pcmLongLatency.getValue(), pcmBusLatency.getValue(),0);
+		dramMemory = new Memory("dram", "DRAM", &engine, &stats, debugStart.getValue(), DRAM_QUEUE, DRAM_OPEN, DRAM_ACCESS, DRAM_CLOSE, DRAM_BUS_QUEUE, DRAM_BUS,  dramRowBufferPolicy.getValue(), DESTRUCTIVE_READS, dramMappingType.getValue(), dramGlobalQueue.getValue(), dramQueueSize.getValue(), dramRanks.getValue(), dramBanksPerRank.getValue(), dramRowsPerBank.getValue(), dramBlocksPerRow.getValue(), blockSize.getValue(), dramOpenLatency.getValue(), dramCloseLatency.getValue(), dramAccessLatency.getValue(), false, dramWriteHighWatermark.getValue(), dramWriteLowWatermark.getValue(), false, false, 0, dramBusLatency.getValue(),0);
+		pcmMemory = new Memory("pcm", "PCM", &engine, &stats, debugStart.getValue(), PCM_QUEUE, PCM_OPEN, PCM_ACCESS, PCM_CLOSE, PCM_BUS_QUEUE, PCM_BUS, pcmRowBufferPolicy.getValue(), NON_DESTRUCTIVE_READS, pcmMappingType.getValue(), pcmGlobalQueue.getValue(), pcmQueueSize.getValue(), pcmRanks.getValue(), pcmBanksPerRank.getValue(), pcmRowsPerBank.getValue(), pcmBlocksPerRow.getValue(), blockSize.getValue(), pcmOpenLatency.getValue(), pcmCloseLatency.getValue(), pcmAccessLatency.getValue(), pcmLongLatency.getValue(), pcmWriteHighWatermark.getValue(), pcmWriteLowWatermark.getValue(), pcmWritePausing.getValue(), pcmWriteCancellation.getValue(), pcmWriteCancelThreshold.getValue(), pcmBusLatency.getValue(),0);
 		cacheMemory = new CacheMemory("cache_memory", "Cache Memory", &engine, &stats, debugStart.getValue(), dramMemory, pcmMemory, dramCacheblockSize.getValue(), dramCacheAssoc.getValue(), CACHE_LRU, pageSize.getValue(), dramCacheTagPenalty.getValue(), dramCacheQueueSize.getValue());
 		manager = new SimpleMemoryManager(&stats, pcmMemory, numProcesses, pageSize.getValue());
 		memory = cacheMemory;
 	} else if (memoryOrganization.getValue() == "hybrid"){
-		dramMemory = new Memory("dram", "DRAM", &engine, &stats, debugStart.getValue(), DRAM_QUEUE, DRAM_OPEN, DRAM_ACCESS, DRAM_CLOSE, DRAM_BUS_QUEUE, DRAM_BUS, dramRowBufferPolicy.getValue(), DESTRUCTIVE_READS, dramMappingType.getValue(), dramGlobalQueue.getValue(), dramQueueSize.getValue(), dramRanks.getValue(), dramBanksPerRank.getValue(), dramRowsPerBank.getValue(), dramBlocksPerRow.getValue(), blockSize.getValue(), dramOpenLatency.getValue(), dramCloseLatency.getValue(), dramAccessLatency.getValue(), false, dramBusLatency.getValue(),0);
-		pcmMemory = new Memory("pcm", "PCM", &engine, &stats, debugStart.getValue(), PCM_QUEUE, PCM_OPEN, PCM_ACCESS, PCM_CLOSE, PCM_BUS_QUEUE, PCM_BUS, pcmRowBufferPolicy.getValue(), NON_DESTRUCTIVE_READS, pcmMappingType.getValue(), pcmGlobalQueue.getValue(), pcmQueueSize.getValue(), pcmRanks.getValue(), pcmBanksPerRank.getValue(), pcmRowsPerBank.getValue(), pcmBlocksPerRow.getValue(), blockSize.getValue(), pcmOpenLatency.getValue(), pcmCloseLatency.getValue(), pcmAccessLatency.getValue(), pcmLongLatency.getValue(), pcmBusLatency.getValue(), dramMemory->getSize());
-		hybridMemory = new HybridMemory("hybrid_memory", "Hybrid Memory", &engine, &stats, debugHybridMemoryStart.getValue(), numProcesses, dramMemory, pcmMemory, blockSize.getValue(), pageSize.getValue(), dramMigrationReadDelay.getValue(), dramMigrationWriteDelay.getValue(), pcmMigrationReadDelay.getValue(), pcmMigrationWriteDelay.getValue(), completionThreshold.getValue(), elideCleanDramBlocks.getValue(), fixedPcmMigrationCost.getValue(), pcmMigrationCost.getValue());
+		dramMemory = new Memory("dram", "DRAM", &engine, &stats, debugStart.getValue(), DRAM_QUEUE, DRAM_OPEN, DRAM_ACCESS, DRAM_CLOSE, DRAM_BUS_QUEUE, DRAM_BUS, dramRowBufferPolicy.getValue(), DESTRUCTIVE_READS, dramMappingType.getValue(), dramGlobalQueue.getValue(), dramQueueSize.getValue(), dramRanks.getValue(), dramBanksPerRank.getValue(), dramRowsPerBank.getValue(), dramBlocksPerRow.getValue(), blockSize.getValue(), dramOpenLatency.getValue(), dramCloseLatency.getValue(), dramAccessLatency.getValue(), false, dramWriteHighWatermark.getValue(), dramWriteLowWatermark.getValue(), false, false, 0, dramBusLatency.getValue(),0);
+		pcmMemory = new Memory("pcm", "PCM", &engine, &stats, debugStart.getValue(), PCM_QUEUE, PCM_OPEN, PCM_ACCESS, PCM_CLOSE, PCM_BUS_QUEUE, PCM_BUS, pcmRowBufferPolicy.getValue(), NON_DESTRUCTIVE_READS, pcmMappingType.getValue(), pcmGlobalQueue.getValue(), pcmQueueSize.getValue(), pcmRanks.getValue(), pcmBanksPerRank.getValue(), pcmRowsPerBank.getValue(), pcmBlocksPerRow.getValue(), blockSize.getValue(), pcmOpenLatency.getValue(), pcmCloseLatency.getValue(), pcmAccessLatency.getValue(), pcmLongLatency.getValue(), pcmWriteHighWatermark.getValue(), pcmWriteLowWatermark.getValue(), pcmWritePausing.getValue(), pcmWriteCancellation.getValue(), pcmWriteCancelThreshold.getValue(), pcmBusLatency.getValue(), dramMemory->getSize());
+		if (farTiers.getValue() != 0){
+			vector<unsigned> queueSizes = parseTierValues<unsigned>(farQueueSize.getValue(), farTiers.getValue(), "far_queue_size");
+			vector<unsigned> ranks = parseTierValues<unsigned>(farRanks.getValue(), farTiers.getValue(), "far_ranks");
+			vector<unsigned> banksPerRank = parseTierValues<unsigned>(farBanksPerRank.getValue(), farTiers.getValue(), "far_banks_per_rank");
+			vector<unsigned> rowsPerBank = parseTierValues<unsigned>(farRowsPerBank.getValue(), farTiers.getValue(), "far_rows_per_bank");
+			vector<unsigned> blocksPerRow = parseTierValues<unsigned>(farBlocksPerRow.getValue(), farTiers.getValue(), "far_blocks_per_row");
+			vector<uint64> openLatencies = parseTierValues<uint64>(farOpenLatency.getValue(), farTiers.getValue(), "far_open_latency");
+			vector<uint64> closeLatencies = parseTierValues<uint64>(farCloseLatency.getValue(), farTiers.getValue(), "far_close_latency");
+			vector<uint64> accessLatencies = parseTierValues<uint64>(farAccessLatency.getValue(), farTiers.getValue(), "far_access_latency");
+			vector<uint64> busLatencies = parseTierValues<uint64>(farBusLatency.getValue(), farTiers.getValue(), "far_bus_latency");
+			uint64 offset = dramMemory->getSize() + pcmMemory->getSize();
+			for (unsigned i = 0; i < farTiers.getValue(); i++){
+				ostringstream name, desc;
+				name << "far" << i;
+				desc << "Far Memory " << i;
+				//far memories use the PCM counters of the requests
+				farMemories.emplace_back(new Memory(name.str(), desc.str(), &engine, &stats, debugStart.getValue(), PCM_QUEUE, PCM_OPEN, PCM_ACCESS, PCM_CLOSE, PCM_BUS_QUEUE, PCM_BUS, farRowBufferPolicy.getValue(), DESTRUCTIVE_READS, farMappingType.getValue(), false, queueSizes[i], ranks[i], banksPerRank[i], rowsPerBank[i], blocksPerRow[i], blockSize.getValue(), openLatencies[i], closeLatencies[i], accessLatencies[i], false, 0, 0, false, false, 0, busLatencies[i], offset));
+				offset += farMemories.back()->getSize();
+			}
+		}
+		hybridMemory = new HybridMemory("hybrid_memory", "Hybrid Memory", &engine, &stats, debugHybridMemoryStart.getValue(), numProcesses, dramMemory, pcmMemory, blockSize.getValue(), pageSize.getValue(), dramMigrationReadDelay.getValue(), dramMigrationWriteDelay.getValue(), pcmMigrationReadDelay.getValue(), pcmMigrationWriteDelay.getValue(), completionThreshold.getValue(), elideCleanDramBlocks.getValue(), fixedPcmMigrationCost.getValue(), pcmMigrationCost.getValue(), copyEngine.getValue(), copyWindow.getValue(), copyBatchSize.getValue(), farMemories, lineCacheSize.getValue(), lineCacheAssoc.getValue(), lineCacheMigrationBlocks.getValue(), criticalBlockFirst.getValue(), idleCopyPeriod.getValue());
 		memory = hybridMemory;
 	} else if (memoryOrganization.getValue() == "old_hybrid"){
-		dramMemory = new Memory("dram", "DRAM", &engine, &stats, debugStart.getValue(), DRAM_QUEUE, DRAM_OPEN, DRAM_ACCESS, DRAM_CLOSE, DRAM_BUS_QUEUE, DRAM_BUS, dramRowBufferPolicy.getValue(), DESTRUCTIVE_READS, dramMappingType.getValue(), dramGlobalQueue.getValue(), dramQueueSize.getValue(), dramRanks.getValue(), dramBanksPerRank.getValue(), dramRowsPerBank.getValue(), dramBlocksPerRow.getValue(), blockSize.getValue(), dramOpenLatency.getValue(), dramCloseLatency.getValue(), dramAccessLatency.getValue(), false, dramBusLatency.getValue(),0);
-		pcmMemory = new Memory("pcm", "PCM", &engine, &stats, debugStart.getValue(), PCM_QUEUE, PCM_OPEN, PCM_ACCESS, PCM_CLOSE, PCM_BUS_QUEUE, PCM_BUS, pcmRowBufferPolicy.getValue(), NON_DESTRUCTIVE_READS, pcmMappingType.getValue(), pcmGlobalQueue.getValue(), pcmQueueSize.getValue(), pcmRanks.getValue(), pcmBanksPerRank.getValue(), pcmRowsPerBank.getValue(), pcmBlocksPerRow.getValue(), blockSize.getValue(), pcmOpenLatency.getValue(), pcmCloseLatency.getValue(), pcmAccessLatency.getValue(), pcmLongLatency.getValue(), pcmBusLatency.getValue(), dramMemory->getSize());
+		dramMemory = new Memory("dram", "DRAM", &engine, &stats, debugStart.getValue(), DRAM_QUEUE, DRAM_OPEN, DRAM_ACCESS, DRAM_CLOSE, DRAM_BUS_QUEUE, DRAM_BUS, dramRowBufferPolicy.getValue(), DESTRUCTIVE_READS, dramMappingType.getValue(), dramGlobalQueue.getValue(), dramQueueSize.getValue(), dramRanks.getValue(), dramBanksPerRank.getValue(), dramRowsPerBank.getValue(), dramBlocksPerRow.getValue(), blockSize.getValue(), dramOpenLatency.getValue(), dramCloseLatency.getValue(), dramAccessLatency.getValue(), false, dramWriteHighWatermark.getValue(), dramWriteLowWatermark.getValue(), false, false, 0, dramBusLatency.getValue(),0);
+		pcmMemory = new Memory("pcm", "PCM", &engine, &stats, debugStart.getValue(), PCM_QUEUE, PCM_OPEN, PCM_ACCESS, PCM_CLOSE, PCM_BUS_QUEUE, PCM_BUS, pcmRowBufferPolicy.getValue(), NON_DESTRUCTIVE_READS, pcmMappingType.getValue(), pcmGlobalQueue.getValue(), pcmQueueSize.getValue(), pcmRanks.getValue(), pcmBanksPerRank.getValue(), pcmRowsPerBank.getValue(), pcmBlocksPerRow.getValue(), blockSize.getValue(), pcmOpenLatency.getValue(), pcmCloseLatency.getValue(), pcmAccessLatency.getValue(), pcmLongLatency.getValue(), pcmWriteHighWatermark.getValue(), pcmWriteLowWatermark.getValue(), pcmWritePausing.getValue(), pcmWriteCancellation.getValue(), pcmWriteCancelThreshold.getValue(), pcmBusLatency.getValue(), dramMemory->getSize());
 		oldHybridMemory = new OldHybridMemory("hybrid_memory", "Hybrid Memory", &engine, &stats, debugHybridMemoryStart.getValue(), numProcesses, dramMemory, pcmMemory, blockSize.getValue(), pageSize.getValue(), burstMigration.getValue(), fixedDramMigrationCost.getValue(), fixedPcmMigrationCost.getValue(), dramMigrationCost.getValue(), pcmMigrationCost.getValue(), migrationMechanism.getValue() == REDIRECT);
 		memory = oldHybridMemory;
 	} else {
@@ -343,6 +490,7 @@ int main(int argc, char * argv[]){
 
 	if (useCaches.getValue()){
 		sharedL2 = new Cache("L2", "Shared L2 Cache" , &engine, &stats, debugCachesStart.getValue(), L2_WAIT, L2_TAG, L2_STALL, memory, 1024*sharedL2CacheSize.getValue(), blockSize.getValue(), sharedL2Assoc.getValue(), CACHE_LRU, pageSize.getValue(), sharedL2Penalty.getValue(), sharedL2QueueSize.getValue(), realCacheRemap.getValue());
+		sharedL2->setPrefetcher(createPrefetcher(sharedL2Prefetcher.getValue(), "L2_prefetcher", "Shared L2 Cache prefetcher", &stats, blockSize.getValue(), pageSize.getValue(), prefetchDegree.getValue(), prefetchThrottling.getValue(), prefetchTableSize.getValue()));
 	}
 
 	if (memoryOrganization.getValue() == "hybrid"){
@@ -375,21 +523,25 @@ int main(int argc, char * argv[]){
 				policies.emplace_back(new NoMigrationPolicy(ossName.str(), &engine, debugStart.getValue(), partition->getDramPages(i), allocationPolicy.getValue(), pidsPerPolicy));
 			} else if (migrationPolicy.getValue() == "multi_queue"){
 				policies.emplace_back(new MultiQueueMigrationPolicy(ossName.str(), &engine, debugStart.getValue(), partition->getDramPages(i), allocationPolicy.getValue(), pidsPerPolicy, maxFreeDram.getValue(), completeThreshold.getValue(), rollbackTimeout.getValue(), numQueues.getValue(), thresholdQueue.getValue(), lifetime.getValue(), logicalTime.getValue(), filterThreshold.getValue(), secondDemotionEviction.getValue(), aging.getValue(), history.getValue(), pendingList.getValue(), rollback.getValue(), promotionFilter.getValue(), demotionAttempts.getValue()));
+			} else if (migrationPolicy.getValue() == "sketch"){
+				policies.emplace_back(new SketchMigrationPolicy(ossName.str(), &engine, debugStart.getValue(), partition->getDramPages(i), allocationPolicy.getValue(), pidsPerPolicy, maxFreeDram.getValue(), completeThreshold.getValue(), rollbackTimeout.getValue(), sketchWidth.getValue(), sketchDepth.getValue(), sketchResetPeriod.getValue(), sketchPromotionThreshold.getValue(), sketchCandidates.getValue()));
 			} else  if (migrationPolicy.getValue() == "first_touch"){
-//				policies.emplace_back(new FirstTouchMigrationPolicy(ossName.str(), &engine, debugStart.getValue(), partition->getDramPages(i), allocationPolicy.getValue(), allocator, pidsPerPolicy));
+				policies.emplace_back(new FirstTouchMigrationPolicy(ossName.str(), &engine, debugStart.getValue(), partition->getDramPages(i), allocationPolicy.getValue(), pidsPerPolicy, maxFreeDram.getValue(), completeThreshold.getValue(), rollbackTimeout.getValue()));
 			} else  if (migrationPolicy.getValue() == "double_clock"){
-//				policies.emplace_back(new DoubleClockMigrationPolicy(ossName.str(), &engine, debugStart.getValue(), partition->getDramPages(i), allocationPolicy.getValue(), allocator, pidsPerPolicy));
+				policies.emplace_back(new DoubleClockMigrationPolicy(ossName.str(), &engine, debugStart.getValue(), partition->getDramPages(i), allocationPolicy.getValue(), pidsPerPolicy, maxFreeDram.getValue(), completeThreshold.getValue(), rollbackTimeout.getValue()));
+			} else  if (migrationPolicy.getValue() == "two_lru"){
+				policies.emplace_back(new TwoLRUMigrationPolicy(ossName.str(), &engine, debugStart.getValue(), partition->getDramPages(i), allocationPolicy.getValue(), pidsPerPolicy, maxFreeDram.getValue(), completeThreshold.getValue(), rollbackTimeout.getValue(), twoLRUThreshold.getValue()));
 			} else if (migrationPolicy.getValue() == "frequency"){
 				//monitoringStrategy.getValue(), monitorApp.getValue(), promotionPolicy.getValue(), demotionPolicy.getValue(), candidateListEvictionPolicy.getValue(), flushPolicy.getValue(), candidateListSize.getValue(), migrationQueueSize.getValue(), agingPeriod.getValue(), counterReadPeriod.getValue(), accessBitPeriod.getValue(),
 			} else if (migrationPolicy.getValue() == "offline"){
-//				string filename = counterTracePrefix.getValue() + traceNames[i] + ".gz";
-//				policies.emplace_back(new OfflineMigrationPolicy(ossName.str(), &engine, debugStart.getValue(), partition->getDramPages(i), allocationPolicy.getValue(), allocator, pidsPerPolicy, i, filename, metricType.getValue(), accessType.getValue(), weightType.getValue(), intervalCount.getValue(), metricThreshold.getValue()));
+				string filename = counterTracePrefix.getValue() + traceNames[i] + ".gz";
+				policies.emplace_back(new OfflineMigrationPolicy(ossName.str(), &engine, debugStart.getValue(), partition->getDramPages(i), allocationPolicy.getValue(), pidsPerPolicy, maxFreeDram.getValue(), completeThreshold.getValue(), rollbackTimeout.getValue(), i, filename, metricType.getValue(), accessType.getValue(), weightType.getValue(), intervalCount.getValue(), metricThreshold.getValue()));
 			} else {
 				args.usage(cerr);
 				return -1;
 			}
 		}
-		hmm = new HybridMemoryManager(&engine, &stats, debugHybridMemoryManagerStart.getValue(), numCores, numProcesses, sharedL2, hybridMemory, policies, partition, blockSize.getValue(), pageSize.getValue(), flushPolicy.getValue(), flushQueueSize.getValue(), supressFlushWritebacks.getValue(), demoteTimout.getValue(), partitionPeriod.getValue(), periodType.getValue(), migrationTableSize.getValue(), perPageStats.getValue(), perPageStatsFilename.getValue());
+		hmm = new HybridMemoryManager(&engine, &stats, debugHybridMemoryManagerStart.getValue(), numCores, numProcesses, sharedL2, hybridMemory, policies, partition, blockSize.getValue(), pageSize.getValue(), flushPolicy.getValue(), flushQueueSize.getValue(), supressFlushWritebacks.getValue(), demoteTimout.getValue(), partitionPeriod.getValue(), periodType.getValue(), migrationTableSize.getValue(), migrationRate.getValue(), migrationBurst.getValue(), adaptiveMigrationRate.getValue(), migrationRatePeriod.getValue(), hugePageSize.getValue(), hugePagePolicies.getValue(), thpMinMapped.getValue(), tierPromotionThreshold.getValue(), tierFreePages.getValue(), perPageStats.getValue(), perPageStatsFilename.getValue());
 		manager = hmm;
 	}
 
@@ -460,20 +612,34 @@ int main(int argc, char * argv[]){
 	map<unsigned, TraceReaderBase*> readers;
 	map<unsigned, CPU*> cpus;
 
+	TraceCache *traceCache = 0;
+	if (!traceCacheDir.getValue().empty()){
+		traceCache = new TraceCache(traceCacheDir.getValue(), traceCacheBudget.getValue() * 1024 * 1024);
+	}
+
 	for (unsigned i = 0; i < numCores; i++){
 		if (useCaches.getValue()){
 			ostringstream ossName, ossDesc;
 			ossName << "instr_L1_" << i;
 			ossDesc << "Instruction L1 Cache " << i;
 			instrL1s[i] = new Cache(ossName.str(), ossDesc.str(), &engine, &stats, debugCachesStart.getValue(), L1_WAIT, L1_TAG, L1_STALL, sharedL2, 1024*instrL1CacheSize.getValue(), blockSize.getValue(), instrL1Assoc.getValue(), CACHE_LRU, pageSize.getValue(), instrL1Penalty.getValue(), instrL1QueueSize.getValue(), realCacheRemap.getValue());
+			instrL1s[i]->setPrefetcher(createPrefetcher(instrL1Prefetcher.getValue(), ossName.str() + "_prefetcher", ossDesc.str() + " prefetcher", &stats, blockSize.getValue(), pageSize.getValue(), prefetchDegree.getValue(), prefetchThrottling.getValue(), prefetchTableSize.getValue()));
 			ostringstream ossName2, ossDesc2;
 			ossName2 << "data_L1_" << i;
 			ossDesc2 << "Data L1 Cache " << i;
 			dataL1s[i] = new Cache(ossName2.str(), ossDesc2.str(), &engine, &stats, debugCachesStart.getValue(), L1_WAIT, L1_TAG, L1_STALL, sharedL2, 1024*dataL1CacheSize.getValue(), blockSize.getValue(), dataL1Assoc.getValue(), CACHE_LRU, pageSize.getValue(), dataL1Penalty.getValue(), dataL1QueueSize.getValue(), realCacheRemap.getValue());
+			dataL1s[i]->setPrefetcher(createPrefetcher(dataL1Prefetcher.getValue(), ossName2.str() + "_prefetcher", ossDesc2.str() + " prefetcher", &stats, blockSize.getValue(), pageSize.getValue(), prefetchDegree.getValue(), prefetchThrottling.getValue(), prefetchTableSize.getValue()));
 			sharedL2->addPrevLevel(instrL1s[i]);
 			sharedL2->addPrevLevel(dataL1s[i]);
 		}
-		readers[i] = new CompressedTraceReader(tracePrefix.getValue() + traceNames[i], GZIP);
+		if (traceCache != 0){
+			readers[i] = new CachedTraceReader(traceCache, tracePrefix.getValue() + traceNames[i], GZIP);
+		} else {
+			readers[i] = new CompressedTraceReader(tracePrefix.getValue() + traceNames[i], GZIP);
+		}
+		if (threadedTraceReaders.getValue()){
+			readers[i] = new ThreadedTraceReader(readers[i], traceBufferChunks.getValue());
+		}
 		ostringstream ossName3, ossDesc3;
 		ossName3 << "cpu_" << i;
 		ossDesc3 << "CPU " << i;
@@ -485,7 +651,6 @@ int main(int argc, char * argv[]){
 		} else {
 			cpus[i] = new OOOCPU(&engine, ossName3.str(), ossDesc3.str(), debugCpuStart.getValue(), &stats, i, pid, manager, memory, memory, readers[i], blockSize.getValue(), instrLimit.getValue(), robSize.getValue(), issueWidth.getValue());
 		}
-		cpus[i]->start();
 	}
 
 	//Add counters to hybrid memory manager
@@ -515,9 +680,113 @@ int main(int argc, char * argv[]){
 		}
 	}
 
-	for(auto it = allocationNames.begin(); it != allocationNames.end(); ++it)
-		cout << *it;
-	manager->allocate(allocationNames);
+	Checkpointer checkpointer(&engine, &stats);
+	if (!checkpointSave.getValue().empty() || !checkpointRestore.getValue().empty() || !sweepFile.getValue().empty()){
+		if (hmm == 0){
+			error("Checkpoints and sweeps are only supported with the hybrid memory organization");
+		}
+		if (useCaches.getValue()){
+			for (unsigned i = 0; i < numCores; i++){
+				checkpointer.add(instrL1s[i]->getName(), instrL1s[i]);
+				checkpointer.add(dataL1s[i]->getName(), dataL1s[i]);
+			}
+			checkpointer.add(sharedL2->getName(), sharedL2);
+		}
+		checkpointer.add(dramMemory->getName(), dramMemory);
+		checkpointer.add(pcmMemory->getName(), pcmMemory);
+		for (unsigned i = 0; i < farMemories.size(); i++){
+			checkpointer.add(farMemories[i]->getName(), farMemories[i]);
+		}
+		checkpointer.add(hmm->getName(), hmm);
+		for (unsigned i = 0; i < numCores; i++){
+			checkpointer.add(cpus[i]->getName(), cpus[i]);
+		}
+	}
+
+	if (checkpointRestore.getValue().empty()){
+		for(auto it = allocationNames.begin(); it != allocationNames.end(); ++it)
+			cout << *it;
+		manager->allocate(allocationNames);
+	} else {
+		checkpointer.restore(checkpointRestore.getValue(), checkpointRestoreStats.getValue());
+		cout << engine.getTimestamp() << ": restored checkpoint from '" << checkpointRestore.getValue() << "'" << endl;
+	}
+
+	for (unsigned i = 0; i < numCores; i++){
+		cpus[i]->start();
+	}
+
+	Sampler *sampler = 0;
+	if (sampling.getValue()){
+		if (ohmm != 0){
+			error("Sampling is not supported with the old hybrid memory organization");
+		}
+		if (intervalStatsPeriod.getValue() != 0){
+			error("Sampling uses the interval statistics and cannot be combined with -interval_stats_period");
+		}
+		sampler = new Sampler(&engine, &stats, hmm, samplingFastForward.getValue(), samplingWarmup.getValue(), samplingWindow.getValue(), samplingTargetError.getValue(), samplingMinWindows.getValue(), samplingStats.getValue());
+		for (unsigned i = 0; i < numCores; i++){
+			sampler->addCpu(cpus[i]);
+		}
+		if (useCaches.getValue()){
+			for (unsigned i = 0; i < numCores; i++){
+				sampler->addCache(instrL1s[i]);
+				sampler->addCache(dataL1s[i]);
+			}
+			sampler->addCache(sharedL2);
+		}
+		sampler->start();
+	}
+
+	if (!checkpointSave.getValue().empty()){
+		checkpointer.schedule(checkpointAt.getValue(), checkpointSave.getValue(), checkpointExit.getValue());
+	}
+
+	//only options that can change in the middle of a simulation are accepted in a sweep file
+	auto applySweepConfig = [&](const SweepConfig& config){
+		//the child would otherwise share the offsets of the trace files with the parent and the other children
+		for (auto it = readers.begin(); it != readers.end(); ++it){
+			it->second->reopen();
+		}
+		for (auto it = config.overrides.begin(); it != config.overrides.end(); ++it){
+			if (args.override(it->first, it->second)){
+				error("Sweep configuration '%s' overrides an invalid option", config.name.c_str());
+			}
+			if (it->first == "flush_policy"){
+				hmm->setFlushPolicy(flushPolicy.getValue());
+			} else if (it->first == "dram_open_latency" || it->first == "dram_close_latency" || it->first == "dram_access_latency"){
+				dramMemory->setLatencies(dramOpenLatency.getValue(), dramCloseLatency.getValue(), dramAccessLatency.getValue());
+			} else if (it->first == "pcm_open_latency" || it->first == "pcm_close_latency" || it->first == "pcm_access_latency"){
+				pcmMemory->setLatencies(pcmOpenLatency.getValue(), pcmCloseLatency.getValue(), pcmAccessLatency.getValue());
+			} else if (it->first == "threshold_queue" || it->first == "lifetime" || it->first == "filter_threshold"){
+				for (auto pit = policies.begin(); pit != policies.end(); ++pit){
+					MultiQueueMigrationPolicy *mq = dynamic_cast<MultiQueueMigrationPolicy *>(*pit);
+					if (mq == 0){
+						error("Option '%s' in sweep configuration '%s' requires the multi-queue migration policy", it->first.c_str(), config.name.c_str());
+					}
+					mq->setThresholds(thresholdQueue.getValue(), lifetime.getValue(), filterThreshold.getValue());
+				}
+			} else {
+				error("Option '%s' in sweep configuration '%s' cannot be changed after the warm-up", it->first.c_str(), config.name.c_str());
+			}
+		}
+		cout << engine.getTimestamp() << ": simulating sweep configuration '" << config.name << "'" << endl;
+	};
+
+	Sweeper *sweeper = 0;
+	if (!sweepFile.getValue().empty()){
+		if (statsFile.getValue().empty()){
+			error("Sweeps require a statistics file (each configuration writes its own copy)");
+		}
+		if (!intervalStatsFile.getValue().empty()){
+			error("Sweeps do not support interval statistics");
+		}
+		if (threadedTraceReaders.getValue()){
+			error("Sweeps do not support threaded trace readers (the reader threads do not survive a fork)");
+		}
+		sweeper = new Sweeper(&engine, &checkpointer, applySweepConfig, sweepFile.getValue(), sweepJobs.getValue());
+		sweeper->schedule(sweepAt.getValue());
+	}
 
 
 	class Exit : public IEventHandler{
@@ -528,20 +797,63 @@ int main(int argc, char * argv[]){
 	};
 
 	if(stop.getValue() != 0){
-		engine.addEvent(stop.getValue(), new Exit(), 0);
+		if (stop.getValue() <= engine.getTimestamp()){
+			error("Stop timestamp (%lu) is not after the timestamp of the checkpoint (%lu)", stop.getValue(), engine.getTimestamp());
+		}
+		engine.addEvent(stop.getValue() - engine.getTimestamp(), new Exit(), 0);
 	}
 
 	engine.run();
 
-	if (statsFile.getValue().empty()){
-		stats.print(cout);
-	} else {
-		ofstream out(statsFile.getValue().c_str());
-		stats.print(out);
-		out.close();
+	//the parent of a sweep only waited for the configurations, which write their own statistics
+	bool sweepParent = sweeper != 0 && sweeper->isParent();
+	int status = sweepParent && sweeper->getNumFailed() != 0 ? 1 : 0;
+
+	if (!sweepParent){
+		ofstream out;
+		if (!statsFile.getValue().empty()){
+			string filename = statsFile.getValue();
+			if (sweeper != 0 && !sweeper->getConfigName().empty()){
+				filename += "." + sweeper->getConfigName();
+			}
+			out.open(filename.c_str());
+		}
+		ostream& statsOut = statsFile.getValue().empty() ? cout : out;
+		if (statsSelect.getValue().empty()){
+			stats.print(statsOut);
+		} else {
+			stats.print(statsOut, statsSelect.getValue());
+		}
+		if (out.is_open()){
+			out.close();
+		}
 	}
 
+	delete sampler;
+	delete sweeper;
 	delete manager;
 
-	return 0;
+	return status;
+}
+
+/*
+ * "sim -server SOCKET [OPTIONS]" keeps the simulator running and simulates the jobs it receives on
+ * the socket (see Server.H); otherwise a single simulation is run with the given arguments
+ */
+int main(int argc, char * argv[]){
+	if (argc > 1 && string(argv[1]) == "-server"){
+		ArgumentContainer args("sim -server", false);
+		PositionalArgument<string> socketPath(&args, "SOCKET", "path of the Unix domain socket the server listens on", "");
+		OptionalArgument<unsigned> workers(&args, "workers", "maximum number of jobs simulated at the same time", 1);
+		OptionalArgument<uint64> jobCpuLimit(&args, "job_cpu_limit", "seconds of CPU time after which a job is killed (0 for no limit)", 0);
+		OptionalArgument<uint64> jobMemoryLimit(&args, "job_memory_limit", "megabytes of address space available to each job (0 for no limit)", 0);
+		if (args.parse(argc - 1, argv + 1)){
+			args.usage(cerr);
+			return -1;
+		}
+		SimulationServer server(socketPath.getValue(), workers.getValue(), jobCpuLimit.getValue(), jobMemoryLimit.getValue(), simulate);
+		server.run();
+		return 0;
+	}
+	return simulate(argc, argv);
 }